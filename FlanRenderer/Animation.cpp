@@ -0,0 +1,487 @@
+#include "Animation.h"
+#include "CpuFeatures.h"
+#include "GltfAccessors.h"
+#include "JobSystem.h"
+#include "Resources.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <tinygltf/tiny_gltf.h>
+
+namespace Flan {
+    enum struct Interpolation {
+        Step,
+        Linear,
+        CubicSpline,
+    };
+
+    // A glTF channel with its keys, before resampling
+    struct SourceTrack {
+        int node;
+        AnimationPath path;
+        int n_components;
+        Interpolation interpolation;
+        std::vector<float> times;
+        std::vector<float> values; // Cubic splines store in-tangent, value and out-tangent per key
+    };
+
+    // The key index found by the last lookup. Resampling walks forward through time, so the next lookup almost
+    // always finds its key at or right after the cached one
+    struct CurveCursor {
+        size_t key = 0;
+    };
+
+    static u32 pad_to_lanes(u32 count)
+    {
+        return (count + animation_lane_width - 1) / animation_lane_width * animation_lane_width;
+    }
+
+    static void evaluate_curve(const SourceTrack& track, float time, CurveCursor& cursor, float* out)
+    {
+        const size_t n_keys = track.times.size();
+        const int n = track.n_components;
+        const bool cubic = track.interpolation == Interpolation::CubicSpline;
+        auto value = [&](size_t key) { return &track.values[(cubic ? key * 3 + 1 : key) * n]; };
+
+        if (cursor.key >= n_keys || time < track.times[cursor.key]) {
+            cursor.key = 0;
+        }
+        while (cursor.key + 1 < n_keys && track.times[cursor.key + 1] <= time) {
+            cursor.key++;
+        }
+
+        //Hold the first and last values outside of the key range
+        const size_t key = cursor.key;
+        if (n_keys == 1 || time <= track.times[0] || key + 1 >= n_keys || track.interpolation == Interpolation::Step) {
+            std::copy(value(key), value(key) + n, out);
+            return;
+        }
+
+        const float delta = track.times[key + 1] - track.times[key];
+        const float s = delta > 0.0f ? (time - track.times[key]) / delta : 0.0f;
+        const float* a = value(key);
+        const float* b = value(key + 1);
+
+        if (cubic) {
+            //Hermite spline, tangents are scaled by the key interval
+            const float* out_tangent = &track.values[(key * 3 + 2) * n];
+            const float* in_tangent = &track.values[((key + 1) * 3) * n];
+            const float s2 = s * s;
+            const float s3 = s2 * s;
+            for (int c = 0; c < n; ++c) {
+                out[c] = (2 * s3 - 3 * s2 + 1) * a[c] + (s3 - 2 * s2 + s) * delta * out_tangent[c] + (-2 * s3 + 3 * s2) * b[c] + (s3 - s2) * delta * in_tangent[c];
+            }
+        }
+        else if (track.path == AnimationPath::Rotation) {
+            const glm::quat q = glm::slerp(glm::quat(a[3], a[0], a[1], a[2]), glm::quat(b[3], b[0], b[1], b[2]), s);
+            out[0] = q.x; out[1] = q.y; out[2] = q.z; out[3] = q.w;
+            return;
+        }
+        else {
+            for (int c = 0; c < n; ++c) {
+                out[c] = a[c] + (b[c] - a[c]) * s;
+            }
+        }
+
+        if (track.path == AnimationPath::Rotation) {
+            const float length = sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2] + out[3] * out[3]);
+            for (int c = 0; c < 4 && length > 0.0f; ++c) out[c] /= length;
+        }
+    }
+
+    bool import_animation(const tinygltf::Animation& animation, const tinygltf::Model& model, float sample_rate, AnimationClip& clip_out, std::vector<float>* samples_out)
+    {
+        //Read every channel we can animate
+        std::vector<SourceTrack> source_tracks;
+        float duration = 0.0f;
+        for (auto& channel : animation.channels)
+        {
+            SourceTrack track;
+            if (channel.target_path == "translation") { track.path = AnimationPath::Translation; track.n_components = 3; }
+            else if (channel.target_path == "rotation") { track.path = AnimationPath::Rotation; track.n_components = 4; }
+            else if (channel.target_path == "scale") { track.path = AnimationPath::Scale; track.n_components = 3; }
+            else continue;
+            if (channel.target_node < 0 || channel.sampler < 0 || channel.sampler >= static_cast<int>(animation.samplers.size())) continue;
+
+            auto& sampler = animation.samplers[channel.sampler];
+            track.node = channel.target_node;
+            track.interpolation = sampler.interpolation == "STEP" ? Interpolation::Step : sampler.interpolation == "CUBICSPLINE" ? Interpolation::CubicSpline : Interpolation::Linear;
+
+            int n_time_components, n_value_components;
+            if (!read_accessor_floats(model, sampler.input, track.times, n_time_components) ||
+                !read_accessor_floats(model, sampler.output, track.values, n_value_components) ||
+                track.times.empty() || n_value_components != track.n_components ||
+                track.values.size() != track.times.size() * track.n_components * (track.interpolation == Interpolation::CubicSpline ? 3 : 1))
+            {
+                printf("[ERROR] Skipping invalid %s channel of animation '%s'\n", channel.target_path.c_str(), animation.name.c_str());
+                continue;
+            }
+            duration = std::max(duration, track.times.back());
+            source_tracks.push_back(std::move(track));
+        }
+        if (source_tracks.empty()) {
+            return false;
+        }
+
+        //Rotations first, so they can be normalized as one block
+        std::stable_sort(source_tracks.begin(), source_tracks.end(), [](const SourceTrack& a, const SourceTrack& b) {
+            return a.path == AnimationPath::Rotation && b.path != AnimationPath::Rotation;
+        });
+        u32 n_path_tracks[3] = { 0, 0, 0 };
+        for (auto& track : source_tracks) n_path_tracks[static_cast<u32>(track.path)]++;
+        const u32 rotation_stride = pad_to_lanes(n_path_tracks[static_cast<u32>(AnimationPath::Rotation)]);
+        const u32 translation_stride = pad_to_lanes(n_path_tracks[static_cast<u32>(AnimationPath::Translation)]);
+        const u32 scale_stride = pad_to_lanes(n_path_tracks[static_cast<u32>(AnimationPath::Scale)]);
+        const u32 translation_base = rotation_stride * 4;
+        const u32 scale_base = translation_base + translation_stride * 3;
+        const u32 n_channels = scale_base + scale_stride * 3;
+
+        std::vector<AnimationTrack> tracks;
+        u32 path_index[3] = { 0, 0, 0 };
+        for (auto& source : source_tracks)
+        {
+            const u32 path = static_cast<u32>(source.path);
+            const u32 base = source.path == AnimationPath::Rotation ? 0 : source.path == AnimationPath::Translation ? translation_base : scale_base;
+            const u32 stride = source.path == AnimationPath::Rotation ? rotation_stride : source.path == AnimationPath::Translation ? translation_stride : scale_stride;
+            tracks.push_back({ static_cast<u32>(source.node), source.path, base + path_index[path]++, stride });
+        }
+
+        //Resample at a rate that lands the last frame exactly on the end of the clip
+        const u32 n_frames = duration > 0.0f ? static_cast<u32>(ceilf(duration * sample_rate)) + 1 : 1;
+        const float frame_rate = n_frames > 1 ? static_cast<float>(n_frames - 1) / duration : 0.0f;
+        std::vector<float> samples(static_cast<size_t>(n_frames) * n_channels, 0.0f);
+
+        //Padding lanes of the rotation block are identity quaternions, so normalizing them stays finite
+        for (u32 frame = 0; frame < n_frames; ++frame) {
+            for (u32 i = n_path_tracks[static_cast<u32>(AnimationPath::Rotation)]; i < rotation_stride; ++i) {
+                samples[static_cast<size_t>(frame) * n_channels + 3 * rotation_stride + i] = 1.0f;
+            }
+        }
+
+        for (size_t t = 0; t < tracks.size(); ++t)
+        {
+            const SourceTrack& source = source_tracks[t];
+            const AnimationTrack& track = tracks[t];
+            CurveCursor cursor;
+            float value[4];
+            float previous[4] = { 0, 0, 0, 0 };
+            for (u32 frame = 0; frame < n_frames; ++frame)
+            {
+                const float time = n_frames > 1 ? std::min(static_cast<float>(frame) / frame_rate, duration) : 0.0f;
+                evaluate_curve(source, time, cursor, value);
+
+                //Keep consecutive quaternions in the same hemisphere, so interpolating between frames takes the short way
+                if (track.path == AnimationPath::Rotation) {
+                    const float dot = value[0] * previous[0] + value[1] * previous[1] + value[2] * previous[2] + value[3] * previous[3];
+                    if (frame > 0 && dot < 0.0f) {
+                        for (int c = 0; c < 4; ++c) value[c] = -value[c];
+                    }
+                    std::copy(value, value + 4, previous);
+                }
+                for (int c = 0; c < source.n_components; ++c) {
+                    samples[static_cast<size_t>(frame) * n_channels + track.first_channel + c * track.component_stride] = value[c];
+                }
+            }
+        }
+
+        //Quantize every channel to 16 bits within its own range
+        std::vector<float> offsets(n_channels);
+        std::vector<float> scales(n_channels);
+        std::vector<u16> keys(samples.size());
+        for (u32 channel = 0; channel < n_channels; ++channel)
+        {
+            float min_value = FLT_MAX;
+            float max_value = -FLT_MAX;
+            for (u32 frame = 0; frame < n_frames; ++frame) {
+                const float v = samples[static_cast<size_t>(frame) * n_channels + channel];
+                min_value = std::min(min_value, v);
+                max_value = std::max(max_value, v);
+            }
+            offsets[channel] = min_value;
+            scales[channel] = (max_value - min_value) / 65535.0f;
+            for (u32 frame = 0; frame < n_frames; ++frame) {
+                const size_t index = static_cast<size_t>(frame) * n_channels + channel;
+                keys[index] = scales[channel] > 0.0f ? static_cast<u16>(std::clamp(lroundf((samples[index] - min_value) / scales[channel]), 0L, 65535L)) : 0;
+            }
+        }
+
+        //Copy the result into the allocator
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Animation - " + animation.name;
+        clip_out.name = static_cast<char*>(dynamic_allocate(animation.name.size() + 1));
+        memcpy(clip_out.name, animation.name.c_str(), animation.name.size() + 1);
+        clip_out.tracks = static_cast<AnimationTrack*>(dynamic_allocate(sizeof(AnimationTrack) * tracks.size()));
+        clip_out.keys = static_cast<u16*>(dynamic_allocate(sizeof(u16) * keys.size(), 16));
+        clip_out.channel_offsets = static_cast<float*>(dynamic_allocate(sizeof(float) * n_channels, 32));
+        clip_out.channel_scales = static_cast<float*>(dynamic_allocate(sizeof(float) * n_channels, 32));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        memcpy(clip_out.tracks, tracks.data(), sizeof(AnimationTrack) * tracks.size());
+        memcpy(clip_out.keys, keys.data(), sizeof(u16) * keys.size());
+        memcpy(clip_out.channel_offsets, offsets.data(), sizeof(float) * n_channels);
+        memcpy(clip_out.channel_scales, scales.data(), sizeof(float) * n_channels);
+        clip_out.duration = duration;
+        clip_out.sample_rate = frame_rate;
+        clip_out.n_frames = n_frames;
+        clip_out.n_channels = n_channels;
+        clip_out.n_tracks = static_cast<u32>(tracks.size());
+        clip_out.rotation_stride = rotation_stride;
+        clip_out.track_keys = nullptr;
+        clip_out.key_frames = nullptr;
+        clip_out.key_data = nullptr;
+        if (samples_out != nullptr) *samples_out = std::move(samples);
+        return true;
+    }
+
+    // Interpolate between two quantized rows and dequantize: out = (a + (b - a) * t) * scale + offset
+    typedef void (*SampleRowFn)(const u16* row_a, const u16* row_b, float t, const float* offsets, const float* scales, float* out, u32 n_channels);
+
+    // Normalize the rotation block of a pose
+    typedef void (*NormalizeRotationsFn)(float* pose, u32 rotation_stride);
+
+    static void sample_row_scalar(const u16* row_a, const u16* row_b, float t, const float* offsets, const float* scales, float* out, u32 n_channels)
+    {
+        for (u32 i = 0; i < n_channels; ++i) {
+            const float a = static_cast<float>(row_a[i]);
+            const float b = static_cast<float>(row_b[i]);
+            out[i] = (a + (b - a) * t) * scales[i] + offsets[i];
+        }
+    }
+
+    FLAN_TARGET_SSE41 static void sample_row_sse41(const u16* row_a, const u16* row_b, float t, const float* offsets, const float* scales, float* out, u32 n_channels)
+    {
+        const __m128 factor = _mm_set1_ps(t);
+        for (u32 i = 0; i < n_channels; i += 4) {
+            const __m128 a = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_a + i))));
+            const __m128 b = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row_b + i))));
+            const __m128 value = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), factor));
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(value, _mm_loadu_ps(scales + i)), _mm_loadu_ps(offsets + i)));
+        }
+    }
+
+    FLAN_TARGET_AVX2 static void sample_row_avx2(const u16* row_a, const u16* row_b, float t, const float* offsets, const float* scales, float* out, u32 n_channels)
+    {
+        const __m256 factor = _mm256_set1_ps(t);
+        for (u32 i = 0; i < n_channels; i += 8) {
+            const __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row_a + i))));
+            const __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row_b + i))));
+            const __m256 value = _mm256_fmadd_ps(_mm256_sub_ps(b, a), factor, a);
+            _mm256_storeu_ps(out + i, _mm256_fmadd_ps(value, _mm256_loadu_ps(scales + i), _mm256_loadu_ps(offsets + i)));
+        }
+    }
+
+    static void normalize_rotations_scalar(float* pose, u32 rotation_stride)
+    {
+        for (u32 i = 0; i < rotation_stride; ++i) {
+            float* x = pose + i;
+            const float length = sqrtf(x[0] * x[0] + x[rotation_stride] * x[rotation_stride] + x[rotation_stride * 2] * x[rotation_stride * 2] + x[rotation_stride * 3] * x[rotation_stride * 3]);
+            const float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+            for (u32 c = 0; c < 4; ++c) x[c * rotation_stride] *= inverse;
+        }
+    }
+
+    FLAN_TARGET_AVX static void normalize_rotations_avx(float* pose, u32 rotation_stride)
+    {
+        for (u32 i = 0; i < rotation_stride; i += 8) {
+            const __m256 x = _mm256_loadu_ps(pose + i);
+            const __m256 y = _mm256_loadu_ps(pose + rotation_stride + i);
+            const __m256 z = _mm256_loadu_ps(pose + rotation_stride * 2 + i);
+            const __m256 w = _mm256_loadu_ps(pose + rotation_stride * 3 + i);
+            __m256 length_squared = _mm256_mul_ps(x, x);
+            length_squared = _mm256_add_ps(length_squared, _mm256_mul_ps(y, y));
+            length_squared = _mm256_add_ps(length_squared, _mm256_mul_ps(z, z));
+            length_squared = _mm256_add_ps(length_squared, _mm256_mul_ps(w, w));
+            const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(length_squared));
+            _mm256_storeu_ps(pose + i, _mm256_mul_ps(x, inverse));
+            _mm256_storeu_ps(pose + rotation_stride + i, _mm256_mul_ps(y, inverse));
+            _mm256_storeu_ps(pose + rotation_stride * 2 + i, _mm256_mul_ps(z, inverse));
+            _mm256_storeu_ps(pose + rotation_stride * 3 + i, _mm256_mul_ps(w, inverse));
+        }
+    }
+
+    // Interpolate two poses, negating rotations of b that lie in the other hemisphere from a
+    typedef void (*BlendPosesFn)(const float* pose_a, const float* pose_b, float t, float* out, u32 rotation_stride, u32 n_channels);
+
+    static void blend_poses_scalar(const float* pose_a, const float* pose_b, float t, float* out, u32 rotation_stride, u32 n_channels)
+    {
+        for (u32 i = 0; i < rotation_stride; ++i) {
+            float dot = 0.0f;
+            for (u32 c = 0; c < 4; ++c) dot += pose_a[c * rotation_stride + i] * pose_b[c * rotation_stride + i];
+            const float sign = dot < 0.0f ? -1.0f : 1.0f;
+            for (u32 c = 0; c < 4; ++c) {
+                const float a = pose_a[c * rotation_stride + i];
+                out[c * rotation_stride + i] = a + (pose_b[c * rotation_stride + i] * sign - a) * t;
+            }
+        }
+        for (u32 i = rotation_stride * 4; i < n_channels; ++i) {
+            out[i] = pose_a[i] + (pose_b[i] - pose_a[i]) * t;
+        }
+    }
+
+    FLAN_TARGET_AVX static void blend_poses_avx(const float* pose_a, const float* pose_b, float t, float* out, u32 rotation_stride, u32 n_channels)
+    {
+        const __m256 factor = _mm256_set1_ps(t);
+        const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+        for (u32 i = 0; i < rotation_stride; i += 8) {
+            __m256 a[4], b[4];
+            __m256 dot = _mm256_setzero_ps();
+            for (u32 c = 0; c < 4; ++c) {
+                a[c] = _mm256_loadu_ps(pose_a + c * rotation_stride + i);
+                b[c] = _mm256_loadu_ps(pose_b + c * rotation_stride + i);
+                dot = _mm256_add_ps(dot, _mm256_mul_ps(a[c], b[c]));
+            }
+            const __m256 flip = _mm256_and_ps(dot, sign_bit);
+            for (u32 c = 0; c < 4; ++c) {
+                const __m256 b_near = _mm256_xor_ps(b[c], flip);
+                _mm256_storeu_ps(out + c * rotation_stride + i, _mm256_add_ps(a[c], _mm256_mul_ps(_mm256_sub_ps(b_near, a[c]), factor)));
+            }
+        }
+        for (u32 i = rotation_stride * 4; i < n_channels; i += 8) {
+            const __m256 a = _mm256_loadu_ps(pose_a + i);
+            _mm256_storeu_ps(out + i, _mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(pose_b + i), a), factor)));
+        }
+    }
+
+    static SampleRowFn select_sample_row()
+    {
+        const CpuFeatures& features = CpuFeatures::get();
+        return features.avx2 && features.fma ? sample_row_avx2 : features.sse41 ? sample_row_sse41 : sample_row_scalar;
+    }
+
+    static NormalizeRotationsFn select_normalize_rotations()
+    {
+        return CpuFeatures::get().avx ? normalize_rotations_avx : normalize_rotations_scalar;
+    }
+
+    static BlendPosesFn select_blend_poses()
+    {
+        return CpuFeatures::get().avx ? blend_poses_avx : blend_poses_scalar;
+    }
+
+    // Index of the last key at or before a frame. Playback mostly moves forward by less than a key, so it walks a few
+    // keys on from the cached one, then gallops ahead in growing steps for callers that skip frames, before falling
+    // back to a binary search
+    static u32 find_key(const u16* key_frames, u32 n_keys, float frame, u32 cursor)
+    {
+        const auto is_after = [](float f, u16 key_frame) { return f < static_cast<float>(key_frame); };
+        u32 first = 0;
+        u32 last = n_keys;
+        if (cursor < n_keys && key_frames[cursor] <= frame) {
+            for (int step = 0; step < 4; ++step) {
+                if (cursor + 1 >= n_keys || key_frames[cursor + 1] > frame) {
+                    return cursor;
+                }
+                cursor++;
+            }
+            u32 step = 2;
+            first = cursor;
+            while (cursor + step < n_keys && key_frames[cursor + step] <= frame) {
+                first = cursor + step;
+                step *= 2;
+            }
+            last = std::min(cursor + step, n_keys);
+        }
+        const u16* next = std::upper_bound(key_frames + first, key_frames + last, frame, is_after);
+        return next == key_frames ? 0 : static_cast<u32>(next - key_frames) - 1;
+    }
+
+    static float read_key(const u8* data, u32 key_size, size_t index)
+    {
+        if (key_size == 1) {
+            return static_cast<float>(data[index]);
+        }
+        u16 value;
+        memcpy(&value, data + index * 2, sizeof(value));
+        return static_cast<float>(value);
+    }
+
+    static void sample_compressed(const AnimationClip& clip, float frame, u16* cursors, float* pose)
+    {
+        //Channels without a track keep the values an empty row would have, identity for the rotation padding
+        std::fill(pose, pose + clip.n_channels, 0.0f);
+        std::fill(pose + clip.rotation_stride * 3, pose + clip.rotation_stride * 4, 1.0f);
+
+        for (u32 t = 0; t < clip.n_tracks; ++t) {
+            const AnimationTrack& track = clip.tracks[t];
+            const AnimationTrackKeys& keys = clip.track_keys[t];
+            const u16* key_frames = clip.key_frames + keys.first_key;
+            const u32 key_a = find_key(key_frames, keys.n_keys, frame, cursors != nullptr ? cursors[t] : 0);
+            const u32 key_b = std::min(key_a + 1, keys.n_keys - 1);
+            if (cursors != nullptr) cursors[t] = static_cast<u16>(key_a);
+
+            const float span = static_cast<float>(key_frames[key_b]) - static_cast<float>(key_frames[key_a]);
+            const float factor = span > 0.0f ? std::clamp((frame - static_cast<float>(key_frames[key_a])) / span, 0.0f, 1.0f) : 0.0f;
+            const u32 n_components = track.path == AnimationPath::Rotation ? 4 : 3;
+            const u8* data = clip.key_data + keys.key_data_offset;
+            for (u32 c = 0; c < n_components; ++c) {
+                const float a = read_key(data, keys.key_size, static_cast<size_t>(key_a) * n_components + c);
+                const float b = read_key(data, keys.key_size, static_cast<size_t>(key_b) * n_components + c);
+                const u32 channel = track.first_channel + c * track.component_stride;
+                pose[channel] = (a + (b - a) * factor) * keys.scales[c] + keys.offsets[c];
+            }
+        }
+    }
+
+    static void sample_instances(const AnimationClip& clip, const float* times, size_t first, size_t count, float* poses_out, bool looping, u16* cursors)
+    {
+        static const SampleRowFn sample_row = select_sample_row();
+        static const NormalizeRotationsFn normalize_rotations = select_normalize_rotations();
+
+        for (size_t i = first; i < first + count; ++i) {
+            //Find the two frames around this time
+            float time = times[i];
+            if (looping && clip.duration > 0.0f) {
+                time = fmodf(time, clip.duration);
+                if (time < 0.0f) time += clip.duration;
+            }
+            const float frame = std::clamp(time * clip.sample_rate, 0.0f, static_cast<float>(clip.n_frames - 1));
+            const u32 frame_a = std::min(static_cast<u32>(frame), clip.n_frames - 1);
+            const u32 frame_b = std::min(frame_a + 1, clip.n_frames - 1);
+            const float t = frame - static_cast<float>(frame_a);
+
+            float* pose = poses_out + i * clip.n_channels;
+            if (clip.track_keys != nullptr) {
+                sample_compressed(clip, frame, cursors != nullptr ? cursors + i * clip.n_tracks : nullptr, pose);
+                normalize_rotations(pose, clip.rotation_stride);
+                continue;
+            }
+            sample_row(&clip.keys[static_cast<size_t>(frame_a) * clip.n_channels], &clip.keys[static_cast<size_t>(frame_b) * clip.n_channels],
+                       t, clip.channel_offsets, clip.channel_scales, pose, clip.n_channels);
+            normalize_rotations(pose, clip.rotation_stride);
+        }
+    }
+
+    void sample_animation(const AnimationClip& clip, const float* times, size_t n_instances, float* poses_out, bool looping, u16* cursors)
+    {
+        // Small batches aren't worth handing out to other threads
+        constexpr size_t instances_per_job = 64;
+        if (n_instances <= instances_per_job) {
+            sample_instances(clip, times, 0, n_instances, poses_out, looping, cursors);
+            return;
+        }
+        const size_t n_jobs = (n_instances + instances_per_job - 1) / instances_per_job;
+        JobSystem::get_instance()->parallel_for(n_jobs, [&](size_t job) {
+            const size_t first = job * instances_per_job;
+            sample_instances(clip, times, first, std::min(instances_per_job, n_instances - first), poses_out, looping, cursors);
+        });
+    }
+
+    void blend_poses(const AnimationClip& clip, const float* pose_a, const float* pose_b, float t, float* pose_out)
+    {
+        static const BlendPosesFn blend = select_blend_poses();
+        static const NormalizeRotationsFn normalize_rotations = select_normalize_rotations();
+        blend(pose_a, pose_b, t, pose_out, clip.rotation_stride, clip.n_channels);
+        normalize_rotations(pose_out, clip.rotation_stride);
+    }
+
+    glm::vec3 get_pose_vec3(const float* pose, const AnimationTrack& track)
+    {
+        const float* x = pose + track.first_channel;
+        return { x[0], x[track.component_stride], x[track.component_stride * 2] };
+    }
+
+    glm::quat get_pose_quat(const float* pose, const AnimationTrack& track)
+    {
+        const float* x = pose + track.first_channel;
+        return glm::quat(x[track.component_stride * 3], x[0], x[track.component_stride], x[track.component_stride * 2]);
+    }
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include "FlanTypes.h"
+
+namespace tinygltf {
+    class Model;
+    struct Animation;
+}
+
+// Runtime animation clips. glTF channels are resampled at a fixed rate on import, so sampling never has to search
+// for keys, and every value is quantized to 16 bits within the range of its channel.
+//
+// Every track component is a channel, and one frame of the clip is a row of channels. Rows are laid out in SoA form:
+// the x of every rotation track, then the y of every rotation track, and so on, followed by the translation and scale
+// blocks in the same way. Each block is padded to animation_lane_width channels, so the sampler can interpolate a
+// whole row with SIMD and normalize 8 rotations at a time, without scalar tails. A sampled pose uses the same layout.
+//
+// Compressed clips (see AnimationCompression.h) drop the rows, and keep only the keys each track needs instead.
+// Sampling them looks up keys per track, which cursors make cheap for clips that play forward.
+
+namespace Flan {
+    static constexpr float animation_default_sample_rate = 30.0f;
+    static constexpr u32 animation_lane_width = 8;
+
+    enum struct AnimationPath : u32 {
+        Translation = 0,
+        Rotation,
+        Scale,
+    };
+
+    // One animated property of one glTF node. Component c lives in channel first_channel + c * component_stride
+    struct AnimationTrack {
+        u32 target_node;
+        AnimationPath path;
+        u32 first_channel;
+        u32 component_stride;
+    };
+
+    // Keys of one track of a compressed clip. The track keeps n_keys of the clip's frames, listed in
+    // AnimationClip::key_frames from first_key on. Every key holds all components of the track, each one key_size
+    // bytes wide, starting at key_data_offset in AnimationClip::key_data
+    struct AnimationTrackKeys {
+        u32 first_key;
+        u32 n_keys;
+        u32 key_data_offset;
+        u32 key_size; // 1 or 2
+        float offsets[4]; // value = key * scales[component] + offsets[component]
+        float scales[4];
+    };
+
+    struct AnimationClip {
+        char* name;
+        float duration;
+        float sample_rate;
+        u32 n_frames;
+        u32 n_channels; // Width of a row, always a multiple of animation_lane_width
+        u32 n_tracks;
+        u32 rotation_stride; // Rotation channels come first, as 4 blocks of this many channels
+        AnimationTrack* tracks;
+        u16* keys; // n_frames rows of n_channels, null once the clip is compressed
+        float* channel_offsets; // value = key * channel_scales[channel] + channel_offsets[channel], null once compressed
+        float* channel_scales;
+        AnimationTrackKeys* track_keys; // One per track in compressed clips, null otherwise
+        u16* key_frames;
+        u8* key_data;
+    };
+
+    // Resample a glTF animation into a clip. Morph target weight channels are skipped. samples_out gets the resampled
+    // frames before quantization, n_frames rows of n_channels floats
+    bool import_animation(const tinygltf::Animation& animation, const tinygltf::Model& model, float sample_rate, AnimationClip& clip_out,
+                          std::vector<float>* samples_out = nullptr);
+
+    // Sample one clip for many instances at once. times holds one time per instance, poses_out gets n_channels floats
+    // per instance. Large batches are split across the job system. cursors is optional, with n_tracks per instance
+    // that are kept between calls, it saves searching for keys in compressed clips
+    void sample_animation(const AnimationClip& clip, const float* times, size_t n_instances, float* poses_out, bool looping = true, u16* cursors = nullptr);
+
+    // Blend two poses of the same clip, out = a + (b - a) * t, with rotations normalized again. Rotations take the
+    // shorter way around, and out may alias a or b
+    void blend_poses(const AnimationClip& clip, const float* pose_a, const float* pose_b, float t, float* pose_out);
+
+    // Read one track back out of a sampled pose
+    glm::vec3 get_pose_vec3(const float* pose, const AnimationTrack& track);
+    glm::quat get_pose_quat(const float* pose, const AnimationTrack& track);
+}
@@ -0,0 +1,287 @@
+#include "AnimationCompression.h"
+#include "Resources.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace Flan {
+    // Longest run of frames one interpolated segment may cover, this keeps key reduction linear in the clip length
+    static constexpr u32 max_segment_frames = 256;
+
+    static u32 get_component_count(AnimationPath path)
+    {
+        return path == AnimationPath::Rotation ? 4 : 3;
+    }
+
+    static float get_tolerance(const AnimationCompressionSettings& settings, AnimationPath path)
+    {
+        switch (path) {
+        case AnimationPath::Translation: return settings.translation_tolerance;
+        case AnimationPath::Rotation: return settings.rotation_tolerance;
+        default: return settings.scale_tolerance;
+        }
+    }
+
+    // The value of every component of a track on every frame, from the float samples when there are any and decoded
+    // from the 16 bit rows otherwise
+    static void decode_track(const AnimationClip& clip, const AnimationTrack& track, const float* samples, std::vector<float>& values_out)
+    {
+        const u32 n_components = get_component_count(track.path);
+        values_out.resize(static_cast<size_t>(clip.n_frames) * n_components);
+        for (u32 frame = 0; frame < clip.n_frames; ++frame) {
+            for (u32 c = 0; c < n_components; ++c) {
+                const u32 channel = track.first_channel + c * track.component_stride;
+                if (samples != nullptr) {
+                    values_out[static_cast<size_t>(frame) * n_components + c] = samples[static_cast<size_t>(frame) * clip.n_channels + channel];
+                    continue;
+                }
+                const float key = static_cast<float>(clip.keys[static_cast<size_t>(frame) * clip.n_channels + channel]);
+                values_out[static_cast<size_t>(frame) * n_components + c] = key * clip.channel_scales[channel] + clip.channel_offsets[channel];
+            }
+        }
+    }
+
+    static bool is_constant(const std::vector<float>& values, u32 n_frames, u32 n_components, float tolerance)
+    {
+        for (u32 frame = 1; frame < n_frames; ++frame) {
+            for (u32 c = 0; c < n_components; ++c) {
+                if (fabsf(values[static_cast<size_t>(frame) * n_components + c] - values[c]) > tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static bool is_rest_pose(const float* value, const AnimationTrack& track, const ModelNode* nodes, size_t n_nodes, float tolerance)
+    {
+        if (nodes == nullptr || track.target_node >= n_nodes) {
+            return false;
+        }
+        const ModelNode& node = nodes[track.target_node];
+        auto matches = [&](const float* rest, u32 n_components, float sign) {
+            for (u32 c = 0; c < n_components; ++c) {
+                if (fabsf(value[c] - rest[c] * sign) > tolerance) return false;
+            }
+            return true;
+        };
+        switch (track.path) {
+        case AnimationPath::Translation: return matches(&node.translation.x, 3, 1.0f);
+        case AnimationPath::Scale: return matches(&node.scale.x, 3, 1.0f);
+        default: {
+            //q and -q are the same rotation
+            const float rest[4] = { node.rotation.x, node.rotation.y, node.rotation.z, node.rotation.w };
+            return matches(rest, 4, 1.0f) || matches(rest, 4, -1.0f);
+        }
+        }
+    }
+
+    // Whether interpolating between frames start and end reproduces every frame in between
+    static bool segment_fits(const std::vector<float>& values, u32 n_components, u32 start, u32 end, float tolerance)
+    {
+        const float* a = &values[static_cast<size_t>(start) * n_components];
+        const float* b = &values[static_cast<size_t>(end) * n_components];
+        for (u32 frame = start + 1; frame < end; ++frame) {
+            const float t = static_cast<float>(frame - start) / static_cast<float>(end - start);
+            const float* v = &values[static_cast<size_t>(frame) * n_components];
+            for (u32 c = 0; c < n_components; ++c) {
+                if (fabsf(a[c] + (b[c] - a[c]) * t - v[c]) > tolerance) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Greedily grow each segment for as long as interpolating over it stays within tolerance. The first and last
+    // frames are always kept
+    static void reduce_keys(const std::vector<float>& values, u32 n_frames, u32 n_components, float tolerance, std::vector<u16>& frames_out)
+    {
+        frames_out.push_back(0);
+        u32 start = 0;
+        while (start + 1 < n_frames) {
+            u32 end = start + 1;
+            while (end + 1 < n_frames && end + 1 - start <= max_segment_frames && segment_fits(values, n_components, start, end + 1, tolerance)) {
+                end++;
+            }
+            frames_out.push_back(static_cast<u16>(end));
+            start = end;
+        }
+    }
+
+    void AnimationCompressionReport::add(const AnimationCompressionReport& other)
+    {
+        uncompressed_bytes += other.uncompressed_bytes;
+        quantized_bytes += other.quantized_bytes;
+        compressed_bytes += other.compressed_bytes;
+        n_tracks += other.n_tracks;
+        n_constant_tracks += other.n_constant_tracks;
+        n_removed_tracks += other.n_removed_tracks;
+        n_frames_in += other.n_frames_in;
+        n_keys_out += other.n_keys_out;
+        for (int i = 0; i < 3; ++i) max_error[i] = std::max(max_error[i], other.max_error[i]);
+    }
+
+    void AnimationCompressionReport::print(const char* name) const
+    {
+        printf("Animation '%s': %zu bytes as floats, %zu bytes as 16 bit rows, %zu bytes compressed (%.1f%%)\n", name, uncompressed_bytes, quantized_bytes, compressed_bytes,
+               quantized_bytes > 0 ? 100.0 * static_cast<double>(compressed_bytes) / static_cast<double>(quantized_bytes) : 0.0);
+        printf("    %zu of %zu keys kept, %u constant and %u removed of %u tracks, max error translation %g rotation %g scale %g\n", n_keys_out, n_frames_in,
+               n_constant_tracks, n_removed_tracks, n_tracks, max_error[static_cast<u32>(AnimationPath::Translation)], max_error[static_cast<u32>(AnimationPath::Rotation)],
+               max_error[static_cast<u32>(AnimationPath::Scale)]);
+    }
+
+    bool compress_animation(AnimationClip& clip, const ModelNode* nodes, size_t n_nodes, const AnimationCompressionSettings& settings, AnimationCompressionReport* report_out,
+                            const std::vector<float>* samples)
+    {
+        if (clip.track_keys != nullptr || clip.keys == nullptr) {
+            return true;
+        }
+        if (clip.n_frames > 65536) {
+            printf("[ERROR] Animation '%s' has too many frames to compress\n", clip.name);
+            return false;
+        }
+        if (samples != nullptr && samples->size() != static_cast<size_t>(clip.n_frames) * clip.n_channels) {
+            printf("[ERROR] Samples of animation '%s' don't match the clip\n", clip.name);
+            return false;
+        }
+
+        AnimationCompressionReport report;
+        report.n_tracks = clip.n_tracks;
+        report.quantized_bytes = sizeof(AnimationTrack) * clip.n_tracks + sizeof(u16) * clip.n_frames * clip.n_channels + sizeof(float) * 2 * clip.n_channels;
+
+        std::vector<AnimationTrack> kept_tracks;
+        std::vector<AnimationTrackKeys> track_keys;
+        std::vector<u16> key_frames;
+        std::vector<u8> key_data;
+        std::vector<float> values;
+        std::vector<u16> frames;
+        for (u32 t = 0; t < clip.n_tracks; ++t)
+        {
+            const AnimationTrack& track = clip.tracks[t];
+            const u32 n_components = get_component_count(track.path);
+            const float tolerance = get_tolerance(settings, track.path);
+            decode_track(clip, track, samples != nullptr ? samples->data() : nullptr, values);
+            report.uncompressed_bytes += sizeof(float) * values.size();
+            report.n_frames_in += clip.n_frames;
+
+            //Drop tracks that never leave the rest pose, and keep one key for other constant tracks
+            frames.clear();
+            if (is_constant(values, clip.n_frames, n_components, tolerance * 0.5f))
+            {
+                if (is_rest_pose(values.data(), track, nodes, n_nodes, tolerance * 0.5f))
+                {
+                    report.n_removed_tracks++;
+                    continue;
+                }
+                report.n_constant_tracks++;
+                frames.push_back(0);
+            }
+            else
+            {
+                reduce_keys(values, clip.n_frames, n_components, tolerance * 0.5f, frames);
+            }
+
+            //Quantize within the range of the kept keys, 8 bits only if half a step stays within the other half of the tolerance
+            float offsets[4];
+            float ranges[4];
+            u32 key_size = 1;
+            for (u32 c = 0; c < n_components; ++c)
+            {
+                float min_value = FLT_MAX;
+                float max_value = -FLT_MAX;
+                for (u16 frame : frames)
+                {
+                    const float v = values[static_cast<size_t>(frame) * n_components + c];
+                    min_value = std::min(min_value, v);
+                    max_value = std::max(max_value, v);
+                }
+                offsets[c] = min_value;
+                ranges[c] = max_value - min_value;
+                if (ranges[c] / 255.0f * 0.5f > tolerance * 0.5f) key_size = 2;
+            }
+            const float max_key = key_size == 1 ? 255.0f : 65535.0f;
+
+            AnimationTrackKeys keys{};
+            keys.first_key = static_cast<u32>(key_frames.size());
+            keys.n_keys = static_cast<u32>(frames.size());
+            keys.key_data_offset = static_cast<u32>((key_data.size() + 1) & ~static_cast<size_t>(1));
+            keys.key_size = key_size;
+            key_data.resize(keys.key_data_offset + static_cast<size_t>(keys.n_keys) * n_components * key_size, 0);
+            for (u32 c = 0; c < n_components; ++c)
+            {
+                keys.offsets[c] = offsets[c];
+                keys.scales[c] = ranges[c] / max_key;
+            }
+            for (u32 k = 0; k < keys.n_keys; ++k)
+            {
+                for (u32 c = 0; c < n_components; ++c)
+                {
+                    const float v = values[static_cast<size_t>(frames[k]) * n_components + c];
+                    const long key = ranges[c] > 0.0f ? std::clamp(lroundf((v - offsets[c]) / ranges[c] * max_key), 0L, static_cast<long>(max_key)) : 0;
+                    u8* destination = &key_data[keys.key_data_offset + (static_cast<size_t>(k) * n_components + c) * key_size];
+                    if (key_size == 1) {
+                        *destination = static_cast<u8>(key);
+                    }
+                    else {
+                        const u16 key16 = static_cast<u16>(key);
+                        memcpy(destination, &key16, sizeof(key16));
+                    }
+                }
+            }
+
+            //Measure the error of the result on every frame, decoding it the way the sampler does
+            float& max_error = report.max_error[static_cast<u32>(track.path)];
+            u32 segment = 0;
+            for (u32 frame = 0; frame < clip.n_frames; ++frame)
+            {
+                while (segment + 1 < keys.n_keys && frames[segment + 1] <= frame) segment++;
+                const u32 next = std::min(segment + 1, keys.n_keys - 1);
+                const float span = static_cast<float>(frames[next]) - static_cast<float>(frames[segment]);
+                const float factor = span > 0.0f ? static_cast<float>(frame - frames[segment]) / span : 0.0f;
+                for (u32 c = 0; c < n_components; ++c)
+                {
+                    auto decode = [&](u32 k) {
+                        const u8* source = &key_data[keys.key_data_offset + (static_cast<size_t>(k) * n_components + c) * key_size];
+                        u16 key16 = *source;
+                        if (key_size == 2) memcpy(&key16, source, sizeof(key16));
+                        return static_cast<float>(key16) * keys.scales[c] + keys.offsets[c];
+                    };
+                    const float a = decode(segment);
+                    const float decoded = a + (decode(next) - a) * factor;
+                    max_error = std::max(max_error, fabsf(decoded - values[static_cast<size_t>(frame) * n_components + c]));
+                }
+            }
+
+            key_frames.insert(key_frames.end(), frames.begin(), frames.end());
+            kept_tracks.push_back(track);
+            track_keys.push_back(keys);
+        }
+
+        //Replace the rows with the keys. The kept tracks fit in the old track array
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = std::string("MdlRes - Animation - ") + clip.name;
+        clip.track_keys = static_cast<AnimationTrackKeys*>(dynamic_allocate(static_cast<u32>(sizeof(AnimationTrackKeys) * std::max<size_t>(track_keys.size(), 1))));
+        clip.key_frames = static_cast<u16*>(dynamic_allocate(static_cast<u32>(sizeof(u16) * std::max<size_t>(key_frames.size(), 1))));
+        clip.key_data = static_cast<u8*>(dynamic_allocate(static_cast<u32>(std::max<size_t>(key_data.size(), 1))));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        std::copy(kept_tracks.begin(), kept_tracks.end(), clip.tracks);
+        std::copy(track_keys.begin(), track_keys.end(), clip.track_keys);
+        std::copy(key_frames.begin(), key_frames.end(), clip.key_frames);
+        std::copy(key_data.begin(), key_data.end(), clip.key_data);
+        clip.n_tracks = static_cast<u32>(kept_tracks.size());
+        dynamic_free(clip.keys);
+        dynamic_free(clip.channel_offsets);
+        dynamic_free(clip.channel_scales);
+        clip.keys = nullptr;
+        clip.channel_offsets = nullptr;
+        clip.channel_scales = nullptr;
+
+        report.n_keys_out = key_frames.size();
+        report.compressed_bytes = (sizeof(AnimationTrack) + sizeof(AnimationTrackKeys)) * kept_tracks.size() + sizeof(u16) * key_frames.size() + key_data.size();
+        if (report_out != nullptr) *report_out = report;
+        return true;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "Animation.h"
+#include "Skinning.h"
+
+#include <vector>
+
+// Compresses resampled clips for memory. Every track is reduced on its own:
+// - Tracks that hold the rest pose of their node for the whole clip are removed, posing leaves the node as it is
+// - Tracks that hold any other constant value keep a single key
+// - Other tracks drop every frame that linear interpolation between the remaining keys reproduces within tolerance
+// - The keys that are left are quantized within the range of their track, to 8 bits where that stays within
+//   tolerance and 16 bits otherwise
+//
+// Half of each tolerance goes to dropping keys and half to quantization, so the error of a compressed channel stays
+// within its tolerance. The report measures it on every frame of the clip. Given the float samples import_animation
+// resampled the clip from, keys are built from and measured against those, otherwise against the 16 bit rows, which
+// leaves the error of that first quantization out of the report.
+
+namespace Flan {
+    struct AnimationCompressionSettings {
+        float translation_tolerance = 0.0005f; // Model space units
+        float rotation_tolerance = 0.0005f; // Per quaternion component, about 0.06 degrees
+        float scale_tolerance = 0.0005f;
+    };
+
+    struct AnimationCompressionReport {
+        size_t uncompressed_bytes = 0; // The resampled clip as 32 bit floats
+        size_t quantized_bytes = 0; // The resampled clip with 16 bit rows, as import_animation creates it
+        size_t compressed_bytes = 0;
+        u32 n_tracks = 0;
+        u32 n_constant_tracks = 0;
+        u32 n_removed_tracks = 0;
+        size_t n_frames_in = 0; // Frames of all tracks together
+        size_t n_keys_out = 0;
+        float max_error[3] = { 0, 0, 0 }; // Largest error of any component over all frames, per AnimationPath
+
+        void add(const AnimationCompressionReport& other);
+        void print(const char* name) const;
+    };
+
+    // Compress an imported clip in place. nodes are used to find tracks that hold the rest pose, they can be null.
+    // Clips too long for 16 bit key frames are left as they are, and false is returned
+    bool compress_animation(AnimationClip& clip, const ModelNode* nodes, size_t n_nodes, const AnimationCompressionSettings& settings = AnimationCompressionSettings{},
+                            AnimationCompressionReport* report_out = nullptr, const std::vector<float>* samples = nullptr);
+}
@@ -0,0 +1,256 @@
+#include "AnimationScheduler.h"
+#include "Animation.h"
+#include "JobSystem.h"
+#include "LodSelection.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+
+namespace Flan {
+    // Instances are handed to the job system in batches of this many
+    static constexpr size_t instances_per_job = 256;
+
+    void AnimationScheduler::init(const AnimationSchedulerSettings& settings)
+    {
+        release();
+        m_settings = settings;
+        m_settings.max_interval = std::bit_floor(std::clamp<u32>(settings.max_interval, 1, 1u << (max_animation_update_levels - 1)));
+    }
+
+    void AnimationScheduler::release()
+    {
+        m_frame = 0;
+        m_instances.clear();
+        m_poses.clear();
+        m_cursors.clear();
+        m_due.clear();
+        m_sampled.clear();
+        m_stats.reset();
+    }
+
+    u32 AnimationScheduler::add_instance(const AnimationClip* clip, float importance, bool looping)
+    {
+        ScheduledInstance instance{};
+        instance.speed = 1.0f;
+        instance.importance = importance;
+        instance.interval = 1;
+
+        //Multiplicative hash of the index, so instances added together don't all land on the same frames
+        const u32 index = static_cast<u32>(m_instances.size());
+        instance.phase = index * 0x9E3779B1u;
+        m_instances.push_back(instance);
+        set_clip(index, clip, 0.0f, looping);
+        return index;
+    }
+
+    void AnimationScheduler::set_clip(u32 instance, const AnimationClip* clip, float time, bool looping)
+    {
+        ScheduledInstance& scheduled = m_instances[instance];
+        scheduled.clip = clip;
+        scheduled.time = time;
+        scheduled.looping = looping;
+        scheduled.resample = true;
+        if (clip != nullptr) {
+            allocate_poses(scheduled);
+            std::fill_n(&m_cursors[scheduled.cursor_offset], clip->n_tracks, static_cast<u16>(0));
+        }
+    }
+
+    void AnimationScheduler::set_time(u32 instance, float time)
+    {
+        m_instances[instance].time = time;
+        m_instances[instance].resample = true;
+    }
+
+    void AnimationScheduler::set_bounds(u32 instance, glm::vec3 center, float radius)
+    {
+        m_instances[instance].center = center;
+        m_instances[instance].radius = radius;
+    }
+
+    void AnimationScheduler::set_importance(u32 instance, float importance)
+    {
+        m_instances[instance].importance = importance;
+    }
+
+    void AnimationScheduler::set_speed(u32 instance, float speed)
+    {
+        m_instances[instance].speed = speed;
+    }
+
+    void AnimationScheduler::allocate_poses(ScheduledInstance& instance)
+    {
+        //Keep the old space if the new clip fits, otherwise take new space at the end
+        if (instance.clip->n_channels > instance.pose_capacity) {
+            instance.pose_offset = m_poses.size();
+            instance.pose_capacity = instance.clip->n_channels;
+            m_poses.resize(m_poses.size() + instance.pose_capacity * 2, 0.0f);
+        }
+        if (instance.clip->n_tracks > instance.cursor_capacity) {
+            instance.cursor_offset = m_cursors.size();
+            instance.cursor_capacity = instance.clip->n_tracks;
+            m_cursors.resize(m_cursors.size() + instance.cursor_capacity, 0);
+        }
+    }
+
+    u32 AnimationScheduler::get_update_interval(const ScheduledInstance& instance, glm::vec3 camera_position, float projection_scale) const
+    {
+        //The camera is inside the bounds
+        const float distance = glm::length(instance.center - camera_position);
+        if (distance <= instance.radius) {
+            return 1;
+        }
+
+        //Every halving of the screen size below the full rate radius doubles the interval
+        const float radius = project_error(instance.radius, distance, projection_scale) * instance.importance;
+        if (radius >= m_settings.full_rate_radius) {
+            return 1;
+        }
+        const float ratio = m_settings.full_rate_radius / std::max(radius, 1e-6f);
+        if (ratio >= static_cast<float>(m_settings.max_interval)) {
+            return m_settings.max_interval;
+        }
+        return std::bit_ceil(static_cast<u32>(ceilf(ratio)));
+    }
+
+    u64 AnimationScheduler::get_frames_to_loop(const ScheduledInstance& instance, float step) const
+    {
+        //Blending across the end of a loop would pass through every pose in between, so predictions stop at the
+        //last frame before it. Only a single frame step crosses it, and that shows no blend
+        const float duration = instance.clip->duration;
+        if (!instance.looping || duration <= 0.0f || step == 0.0f) {
+            return UINT64_MAX;
+        }
+        const float loop = floorf(instance.time / duration);
+        const float boundary = (step > 0.0f ? loop + 1.0f : loop) * duration;
+        return std::max<u64>(1, static_cast<u64>(floorf((boundary - instance.time) / step)));
+    }
+
+    bool AnimationScheduler::crossed_loop(const ScheduledInstance& instance) const
+    {
+        const float duration = instance.clip->duration;
+        if (!instance.looping || duration <= 0.0f || !instance.predicted) {
+            return false;
+        }
+        return floorf(instance.time / duration) != floorf(instance.to_time / duration);
+    }
+
+    void AnimationScheduler::update(float delta_time, glm::vec3 camera_position, float projection_scale)
+    {
+        m_frame++;
+        m_due.resize(m_instances.size());
+        JobSystem* job_system = JobSystem::get_instance();
+
+        //Advance every instance, pick its interval, and find how far the ones that aren't due are through their blend
+        const size_t n_jobs = (m_instances.size() + instances_per_job - 1) / instances_per_job;
+        job_system->parallel_for(n_jobs, [&](size_t job) {
+            const size_t end = std::min(m_instances.size(), (job + 1) * instances_per_job);
+            for (size_t i = job * instances_per_job; i < end; ++i) {
+                ScheduledInstance& instance = m_instances[i];
+                m_due[i] = 0;
+                if (instance.clip == nullptr) {
+                    continue;
+                }
+                const float step = delta_time * instance.speed;
+                instance.time += step;
+                const u32 interval = get_update_interval(instance, camera_position, projection_scale);
+
+                //Instances that need a faster rate than they were sampled at don't wait for the end of their blend
+                const u64 blend_frames = instance.to_frame - instance.from_frame;
+                const bool speed_up = interval < blend_frames && (m_frame + instance.phase) % interval == 0;
+                const bool due = instance.resample || m_frame >= instance.to_frame || speed_up;
+
+                //Frame times that vary can take an instance past the end of its loop before its prediction, the pose
+                //it blended towards is from the other end of the clip then
+                if (due && crossed_loop(instance)) {
+                    instance.resample = true;
+                }
+
+                const float blend = instance.predicted ? std::min(static_cast<float>(m_frame - instance.from_frame) / static_cast<float>(blend_frames), 1.0f) : 1.0f;
+                if (!due) {
+                    instance.blend = blend;
+                    continue;
+                }
+
+                //The pose on screen this frame is where the next blend starts
+                if (m_settings.interpolate && !instance.resample) {
+                    float* from = &m_poses[instance.pose_offset];
+                    blend_poses(*instance.clip, from, from + instance.pose_capacity, blend, from);
+                }
+                instance.interval = interval;
+                instance.from_frame = m_frame;
+                m_due[i] = 1;
+
+                //Full rate instances, and instances that hold their pose between samples, are sampled at the current time
+                u64 frames_ahead = interval - (m_frame + instance.phase) % interval;
+                instance.predicted = interval > 1 && m_settings.interpolate;
+                if (!instance.predicted) {
+                    instance.to_frame = m_frame + frames_ahead;
+                    instance.to_time = instance.time;
+                    continue;
+                }
+                frames_ahead = std::min<u64>(frames_ahead, get_frames_to_loop(instance, step));
+                instance.to_frame = m_frame + frames_ahead;
+                instance.to_time = instance.time + static_cast<float>(frames_ahead) * step;
+            }
+        });
+
+        //Gather the instances to sample, and count
+        m_sampled.clear();
+        m_stats.reset();
+        for (size_t i = 0; i < m_instances.size(); ++i) {
+            const ScheduledInstance& instance = m_instances[i];
+            if (instance.clip == nullptr) {
+                continue;
+            }
+            const u32 level = std::countr_zero(instance.interval);
+            m_stats.n_instances++;
+            m_stats.instances_per_level[level]++;
+            if (m_due[i]) {
+                m_sampled.push_back(static_cast<u32>(i));
+                m_stats.n_sampled++;
+                m_stats.sampled_per_level[level]++;
+            }
+            else if (instance.blend < 1.0f) {
+                m_stats.n_interpolated++;
+            }
+        }
+
+        //Sample the due instances at the time of their next update, or now if skipped frames hold the pose
+        const size_t n_sample_jobs = (m_sampled.size() + instances_per_job - 1) / instances_per_job;
+        job_system->parallel_for(n_sample_jobs, [&](size_t job) {
+            const size_t end = std::min(m_sampled.size(), (job + 1) * instances_per_job);
+            for (size_t s = job * instances_per_job; s < end; ++s) {
+                ScheduledInstance& instance = m_instances[m_sampled[s]];
+                float* from = &m_poses[instance.pose_offset];
+                u16* cursors = &m_cursors[instance.cursor_offset];
+                if (instance.resample && instance.predicted) {
+                    sample_animation(*instance.clip, &instance.time, 1, from, instance.looping, cursors);
+                }
+                sample_animation(*instance.clip, &instance.to_time, 1, from + instance.pose_capacity, instance.looping, cursors);
+                instance.blend = instance.predicted ? 0.0f : 1.0f;
+                instance.resample = false;
+            }
+        });
+    }
+
+    bool AnimationScheduler::get_pose(u32 instance, float* pose_out) const
+    {
+        const ScheduledInstance& scheduled = m_instances[instance];
+        if (scheduled.clip == nullptr || scheduled.pose_capacity == 0) {
+            return false;
+        }
+        const float* from = &m_poses[scheduled.pose_offset];
+        const float* to = from + scheduled.pose_capacity;
+        if (scheduled.blend <= 0.0f || scheduled.blend >= 1.0f) {
+            const float* pose = scheduled.blend <= 0.0f ? from : to;
+            std::copy(pose, pose + scheduled.clip->n_channels, pose_out);
+        }
+        else {
+            blend_poses(*scheduled.clip, from, to, scheduled.blend, pose_out);
+        }
+        return true;
+    }
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include "FlanTypes.h"
+
+// Update rate LOD for animated instances. Every instance gets an update interval of 1, 2, 4 or more frames from the
+// size of its bounding sphere on screen times its importance, so small and unimportant instances sample their clip
+// less often.
+//
+// Instances are spread over the frames of their interval by a fixed phase, so about 1 / interval of the instances of
+// each rate are sampled every frame and the per-frame cost stays flat. When an instance is sampled, its clip is
+// evaluated at the time of its next update, and the frames in between blend towards that pose from the one shown on
+// the update frame. The pose is never behind the clip time, and playback doesn't step at low rates. Instances at the
+// full rate are sampled at the current time instead.
+//
+// The blend itself happens when a pose is read, into the caller's buffer, so poses nobody reads cost nothing and the
+// ones that are read go straight from the blend to posing the node tree.
+
+namespace Flan {
+    struct AnimationClip;
+
+    static constexpr u32 max_animation_update_levels = 8; // Intervals 1, 2, 4, ... 128 frames
+
+    struct AnimationSchedulerSettings {
+        // Projected radius in pixels an instance of importance 1 needs to be sampled every frame. Every halving of the
+        // radius doubles the interval
+        float full_rate_radius = 100.0f;
+
+        // Longest interval in frames, rounded down to a power of 2
+        u32 max_interval = 8;
+
+        // Blend skipped frames between samples, otherwise they hold the last pose
+        bool interpolate = true;
+    };
+
+    // Counts for one update of the scheduler
+    struct AnimationSchedulerStats {
+        u32 n_instances = 0;
+        u32 n_sampled = 0; // Instances whose clip was evaluated
+        u32 n_interpolated = 0; // Instances blended between two samples
+        u32 instances_per_level[max_animation_update_levels]{}; // Instances running at interval 1 << level
+        u32 sampled_per_level[max_animation_update_levels]{};
+        void reset() { *this = AnimationSchedulerStats{}; }
+    };
+
+    class AnimationScheduler {
+    public:
+        void init(const AnimationSchedulerSettings& settings = AnimationSchedulerSettings{});
+        void release();
+
+        // Add an instance playing a clip from time 0, returns its index
+        u32 add_instance(const AnimationClip* clip, float importance = 1.0f, bool looping = true);
+
+        // Switch the clip, or jump to a time. Either one samples the instance on the next update
+        void set_clip(u32 instance, const AnimationClip* clip, float time = 0.0f, bool looping = true);
+        void set_time(u32 instance, float time);
+
+        // World space bounding sphere, used for the screen size
+        void set_bounds(u32 instance, glm::vec3 center, float radius);
+
+        // Scales the screen size, e.g. 2 for the player's character, or 0 for instances nobody looks at
+        void set_importance(u32 instance, float importance);
+        void set_speed(u32 instance, float speed);
+
+        // Advance every instance by delta_time and sample the ones that are due. projection_scale comes from
+        // get_projection_scale
+        void update(float delta_time, glm::vec3 camera_position, float projection_scale);
+
+        // Pose of an instance after the last update, in the layout of its clip. pose_out needs n_channels floats of
+        // the instance's clip. Returns false if the instance has no clip. Safe to call from several threads at once
+        bool get_pose(u32 instance, float* pose_out) const;
+        const AnimationClip* get_clip(u32 instance) const { return m_instances[instance].clip; }
+        float get_time(u32 instance) const { return m_instances[instance].time; }
+        u32 get_interval(u32 instance) const { return m_instances[instance].interval; }
+        size_t get_instance_count() const { return m_instances.size(); }
+        const AnimationSchedulerStats& get_stats() const { return m_stats; }
+
+    private:
+        struct ScheduledInstance {
+            const AnimationClip* clip;
+            float time;
+            float speed;
+            float importance;
+            glm::vec3 center;
+            float radius;
+            bool looping;
+            bool resample; // The clip or time changed, the blend source is stale
+            u32 phase; // Offset of this instance's update frames
+            u32 interval; // Frames between samples, a power of 2
+            u64 from_frame; // Frame the blend starts at
+            u64 to_frame; // Frame of the next sample
+            float to_time; // Time the target pose was sampled at
+            bool predicted; // The target pose is for to_frame, otherwise it's for from_frame and is held until to_frame
+            float blend; // Of the current frame, from the source to the target pose
+            size_t pose_offset; // 2 poses: blend source and blend target
+            size_t pose_capacity; // Channels available per pose
+            size_t cursor_offset;
+            size_t cursor_capacity;
+        };
+
+        void allocate_poses(ScheduledInstance& instance);
+        u32 get_update_interval(const ScheduledInstance& instance, glm::vec3 camera_position, float projection_scale) const;
+        u64 get_frames_to_loop(const ScheduledInstance& instance, float step) const;
+        bool crossed_loop(const ScheduledInstance& instance) const;
+
+        AnimationSchedulerSettings m_settings;
+        u64 m_frame = 0;
+        std::vector<ScheduledInstance> m_instances;
+        std::vector<float> m_poses;
+        std::vector<u16> m_cursors; // Key cursors of every instance, see sample_animation
+        std::vector<u8> m_due; // Per instance, set when it's sampled this update
+        std::vector<u32> m_sampled;
+        AnimationSchedulerStats m_stats;
+    };
+}
@@ -0,0 +1,262 @@
+#include "AssetPipeline.h"
+#include "CookedModel.h"
+#include "Hash.h"
+#include "JobSystem.h"
+#include "ModelResource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace Flan {
+    // Hash of the file contents, or 0 if it can't be read
+    static u64 hash_file(const std::string& path)
+    {
+        std::ifstream file_stream(path, std::ios::binary);
+        if (file_stream.is_open() == false) {
+            return 0;
+        }
+        std::vector<char> buffer(1 MB);
+        u64 hash = fnv_offset_basis;
+        while (file_stream) {
+            file_stream.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            hash = hash_bytes(buffer.data(), static_cast<size_t>(file_stream.gcount()), hash);
+        }
+        if (file_stream.bad()) {
+            return 0;
+        }
+        return hash == 0 ? 1 : hash;
+    }
+
+    AssetPipeline::AssetPipeline(ResourceManager* resource_manager, const AssetBuildSettings& settings)
+        : m_resource_manager(resource_manager), m_settings(settings)
+    {
+    }
+
+    void AssetPipeline::add_model(const std::string& source_path, const std::string& output_path)
+    {
+        m_jobs.push_back({ source_path, output_path, {}, {}, true, 0, false, false });
+    }
+
+    std::string AssetPipeline::get_cache_path(u64 key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+        return m_settings.cache_directory + "/" + name + cooked_model_extension;
+    }
+
+    u64 AssetPipeline::get_settings_hash() const
+    {
+        const LodSettings& lod = m_settings.lod_settings;
+        u64 hash = hash_bytes(&cooked_model_version, sizeof(cooked_model_version));
+        hash = hash_bytes(lod.target_ratios.data(), sizeof(float) * lod.target_ratios.size(), hash);
+        hash = hash_bytes(&lod.max_relative_error, sizeof(lod.max_relative_error), hash);
+        hash = hash_bytes(&lod.min_reduction, sizeof(lod.min_reduction), hash);
+
+        //Cooked models store the atlas textures built on import, and which textures they name depends on these too.
+        //Fields are hashed one by one, so padding bytes don't end up in the key
+        const TextureImportSettings& textures = m_resource_manager->get_texture_import_settings();
+        hash = hash_bytes(&textures.compress, sizeof(textures.compress), hash);
+        hash = hash_bytes(&textures.quality, sizeof(textures.quality), hash);
+        hash = hash_bytes(&textures.color_format, sizeof(textures.color_format), hash);
+        hash = hash_bytes(&textures.pack_orm, sizeof(textures.pack_orm), hash);
+        hash = hash_string(textures.cache_directory, hash);
+        hash = hash_bytes(&textures.atlas.enabled, sizeof(textures.atlas.enabled), hash);
+        hash = hash_bytes(&textures.atlas.max_texture_size, sizeof(textures.atlas.max_texture_size), hash);
+        hash = hash_bytes(&textures.atlas.page_size, sizeof(textures.atlas.page_size), hash);
+        hash = hash_bytes(&textures.atlas.n_levels, sizeof(textures.atlas.n_levels), hash);
+        hash = hash_bytes(&textures.atlas.padding, sizeof(textures.atlas.padding), hash);
+        return hash;
+    }
+
+    AssetBuildReport AssetPipeline::build()
+    {
+        const auto start_time = std::chrono::steady_clock::now();
+        AssetBuildReport report;
+        report.n_jobs = m_jobs.size();
+
+        std::error_code error;
+        std::filesystem::create_directories(m_settings.cache_directory, error);
+        load_manifest();
+
+        //Find what every job reads
+        JobSystem::get_instance()->parallel_for(m_jobs.size(), [&](size_t i) {
+            BuildJob& job = m_jobs[i];
+            job.dependencies = { job.source_path };
+            job.optional_dependencies.clear();
+            job.found_dependencies = ModelResource::find_dependencies(job.source_path, job.dependencies, job.optional_dependencies);
+        });
+
+        //Hash every file once, even when several jobs share it. Files whose size and modification time match the
+        //manifest keep their old hash
+        std::vector<std::string> files;
+        for (auto& job : m_jobs) {
+            files.insert(files.end(), job.dependencies.begin(), job.dependencies.end());
+            files.insert(files.end(), job.optional_dependencies.begin(), job.optional_dependencies.end());
+        }
+        std::sort(files.begin(), files.end());
+        files.erase(std::unique(files.begin(), files.end()), files.end());
+
+        std::vector<FileRecord> records(files.size());
+        std::vector<bool> rehashed(files.size(), false);
+        std::vector<FileStatus> statuses(files.size(), FileStatus::Found);
+        JobSystem::get_instance()->parallel_for(files.size(), [&](size_t i) {
+            std::error_code file_error;
+            FileRecord record{ 0, 0, 0 };
+            records[i] = record;
+            if (!std::filesystem::exists(files[i], file_error)) {
+                statuses[i] = file_error ? FileStatus::Unreadable : FileStatus::Missing;
+                return;
+            }
+            record.size = std::filesystem::file_size(files[i], file_error);
+            if (!file_error) {
+                record.write_time = static_cast<i64>(std::filesystem::last_write_time(files[i], file_error).time_since_epoch().count());
+            }
+            if (file_error) {
+                statuses[i] = FileStatus::Unreadable;
+                return;
+            }
+            auto cached = m_file_records.find(files[i]);
+            if (cached != m_file_records.end() && cached->second.size == record.size && cached->second.write_time == record.write_time && cached->second.hash != 0) {
+                record.hash = cached->second.hash;
+            }
+            else {
+                record.hash = hash_file(files[i]);
+                rehashed[i] = true;
+                if (record.hash == 0) {
+                    statuses[i] = FileStatus::Unreadable;
+                }
+            }
+            records[i] = record;
+        });
+        std::unordered_map<std::string, FileStatus> file_statuses;
+        for (size_t i = 0; i < files.size(); ++i) {
+            m_file_records[files[i]] = records[i];
+            file_statuses[files[i]] = statuses[i];
+            report.n_files_hashed += rehashed[i] ? 1 : 0;
+        }
+
+        //Combine the input hashes into the job key. Paths are part of it, so the same file used as a different map
+        //still changes the key. A job that can't read a file it needs fails instead of building from what's left, and
+        //optional files that don't exist go into the key as missing, so adding one later rebuilds the job
+        const u64 settings_hash = get_settings_hash();
+        std::vector<size_t> stale_jobs;
+        for (size_t i = 0; i < m_jobs.size(); ++i) {
+            BuildJob& job = m_jobs[i];
+            u64 key = settings_hash;
+            bool readable = job.found_dependencies;
+            if (!job.found_dependencies) {
+                printf("[ERROR] Failed to build '%s', its dependencies couldn't be found!\n", job.source_path.c_str());
+            }
+            for (auto& dependency : job.dependencies) {
+                const FileStatus status = file_statuses[dependency];
+                if (status != FileStatus::Found && readable) {
+                    printf("[ERROR] Failed to build '%s', it depends on '%s', which %s!\n", job.source_path.c_str(), dependency.c_str(),
+                           status == FileStatus::Missing ? "doesn't exist" : "can't be read");
+                }
+                readable = readable && status == FileStatus::Found;
+                key = hash_string(dependency, key);
+                key = hash_bytes(&m_file_records[dependency].hash, sizeof(u64), key);
+            }
+            for (auto& dependency : job.optional_dependencies) {
+                const FileStatus status = file_statuses[dependency];
+                if (status == FileStatus::Unreadable && readable) {
+                    printf("[ERROR] Failed to build '%s', it depends on '%s', which can't be read!\n", job.source_path.c_str(), dependency.c_str());
+                }
+                readable = readable && status != FileStatus::Unreadable;
+                const bool exists = status == FileStatus::Found;
+                key = hash_string(dependency, key);
+                key = hash_bytes(&exists, sizeof(exists), key);
+                if (exists) {
+                    key = hash_bytes(&m_file_records[dependency].hash, sizeof(u64), key);
+                }
+            }
+            job.key = key;
+            if (!readable) {
+                job.stale = false;
+                job.succeeded = false;
+                continue;
+            }
+            job.stale = !std::filesystem::exists(get_cache_path(key), error);
+            job.succeeded = !job.stale;
+            if (job.stale) {
+                stale_jobs.push_back(i);
+            }
+        }
+
+        //Run the stale jobs
+        JobSystem::get_instance()->parallel_for(stale_jobs.size(), [&](size_t i) {
+            BuildJob& job = m_jobs[stale_jobs[i]];
+            job.succeeded = cook_model(job.source_path, get_cache_path(job.key), m_resource_manager, m_settings.lod_settings);
+        });
+
+        //Copy the results out of the cache, skipping outputs that are already up to date
+        for (auto& job : m_jobs) {
+            if (!job.succeeded) {
+                report.n_failed++;
+                continue;
+            }
+            report.n_built += job.stale ? 1 : 0;
+            report.n_cached += job.stale ? 0 : 1;
+
+            const std::string cache_path = get_cache_path(job.key);
+            std::error_code copy_error;
+            const bool up_to_date = std::filesystem::exists(job.output_path, copy_error) &&
+                std::filesystem::file_size(job.output_path, copy_error) == std::filesystem::file_size(cache_path, copy_error) &&
+                std::filesystem::last_write_time(job.output_path, copy_error) >= std::filesystem::last_write_time(cache_path, copy_error);
+            if (!up_to_date) {
+                std::filesystem::copy_file(cache_path, job.output_path, std::filesystem::copy_options::overwrite_existing, copy_error);
+                if (copy_error) {
+                    printf("[ERROR] Failed to copy '%s' to '%s': %s\n", cache_path.c_str(), job.output_path.c_str(), copy_error.message().c_str());
+                    report.n_built -= job.stale ? 1 : 0;
+                    report.n_cached -= job.stale ? 0 : 1;
+                    report.n_failed++;
+                }
+            }
+        }
+
+        save_manifest();
+        m_jobs.clear();
+
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        printf("Asset build: %zu jobs, %zu built, %zu cached, %zu failed, %zu files hashed, %.2f s\n",
+               report.n_jobs, report.n_built, report.n_cached, report.n_failed, report.n_files_hashed, report.seconds);
+        return report;
+    }
+
+    //One line per file: hash, size, write time, path
+    void AssetPipeline::load_manifest()
+    {
+        std::ifstream file_stream(m_settings.cache_directory + "/manifest.txt");
+        if (file_stream.is_open() == false) {
+            return;
+        }
+        std::string line;
+        while (std::getline(file_stream, line)) {
+            unsigned long long hash, size;
+            long long write_time;
+            int path_start = 0;
+            if (sscanf(line.c_str(), "%llx %llu %lld %n", &hash, &size, &write_time, &path_start) == 3 && path_start > 0) {
+                m_file_records[line.substr(path_start)] = { static_cast<u64>(size), static_cast<i64>(write_time), static_cast<u64>(hash) };
+            }
+        }
+    }
+
+    void AssetPipeline::save_manifest() const
+    {
+        const std::string path = m_settings.cache_directory + "/manifest.txt";
+        std::ofstream file_stream(path, std::ios::trunc);
+        if (file_stream.is_open() == false) {
+            printf("[ERROR] Failed to open file '%s' for writing!\n", path.c_str());
+            return;
+        }
+        char prefix[80];
+        for (auto& [file, record] : m_file_records) {
+            if (record.hash == 0) continue;
+            snprintf(prefix, sizeof(prefix), "%016llx %llu %lld ", static_cast<unsigned long long>(record.hash),
+                     static_cast<unsigned long long>(record.size), static_cast<long long>(record.write_time));
+            file_stream << prefix << file << "\n";
+        }
+    }
+}
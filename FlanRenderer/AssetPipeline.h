@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Resources.h"
+#include "MeshSimplifier.h"
+
+// Incremental asset builds. Every cooked model is a job whose key is the hash of the contents of its source glTF,
+// everything the glTF pulls in (buffers and textures), the import settings and the cooked format version. Outputs
+// are stored in a cache directory under that key, so a job only runs when one of its inputs actually changed, and
+// switching back to an earlier version of an asset is a cache hit. Stale jobs run in parallel on the job system.
+//
+// File hashes are remembered in a manifest in the cache directory, together with the file size and modification
+// time, so unchanged files aren't read again on the next build. A job fails when a file it needs is missing or can't be
+// read, its key never stands in for contents it couldn't see.
+
+namespace Flan {
+    struct AssetBuildSettings {
+        std::string cache_directory = "Assets/Cache";
+        LodSettings lod_settings;
+    };
+
+    struct AssetBuildReport {
+        size_t n_jobs = 0;
+        size_t n_built = 0;
+        size_t n_cached = 0;
+        size_t n_failed = 0;
+        size_t n_files_hashed = 0; // Files that had to be read, the rest came from the manifest
+        double seconds = 0.0;
+    };
+
+    class AssetPipeline {
+    public:
+        AssetPipeline(ResourceManager* resource_manager, const AssetBuildSettings& settings = AssetBuildSettings{});
+        void add_model(const std::string& source_path, const std::string& output_path);
+        AssetBuildReport build();
+
+    private:
+        struct FileRecord {
+            u64 size;
+            i64 write_time;
+            u64 hash; // 0 when the file doesn't exist or can't be read
+        };
+
+        enum class FileStatus {
+            Found,
+            Missing,
+            Unreadable,
+        };
+
+        struct BuildJob {
+            std::string source_path;
+            std::string output_path;
+            std::vector<std::string> dependencies; // Includes the source itself
+            std::vector<std::string> optional_dependencies; // Files the job reads if they exist
+            bool found_dependencies; // False when the source couldn't be parsed for them
+            u64 key;
+            bool stale;
+            bool succeeded;
+        };
+
+        std::string get_cache_path(u64 key) const;
+        u64 get_settings_hash() const;
+        void load_manifest();
+        void save_manifest() const;
+
+        ResourceManager* m_resource_manager;
+        AssetBuildSettings m_settings;
+        std::vector<BuildJob> m_jobs;
+        std::unordered_map<std::string, FileRecord> m_file_records;
+    };
+}
@@ -0,0 +1,176 @@
+#include "Bounds.h"
+#include "Resources.h"
+
+#include <algorithm>
+
+namespace Flan {
+    AABB merge_aabb(const AABB& a, const AABB& b)
+    {
+        return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+    }
+
+    AABB transform_aabb(const AABB& aabb, const glm::mat4& matrix)
+    {
+        if (!aabb.is_valid()) {
+            return aabb;
+        }
+
+        // Transform the center, then project the extents onto the new axes (Arvo's method)
+        const glm::vec3 center = matrix * glm::vec4(aabb.get_center(), 1.0f);
+        const glm::vec3 extents = aabb.get_extents();
+        const glm::mat3 abs_matrix = glm::mat3(glm::abs(glm::vec3(matrix[0])), glm::abs(glm::vec3(matrix[1])), glm::abs(glm::vec3(matrix[2])));
+        const glm::vec3 new_extents = abs_matrix * extents;
+        return { center - new_extents, center + new_extents };
+    }
+
+    template <typename GetPosition>
+    static AABB aabb_from(GetPosition position, size_t count)
+    {
+        AABB aabb;
+        for (size_t i = 0; i < count; ++i) {
+            aabb.min = glm::min(aabb.min, position(i));
+            aabb.max = glm::max(aabb.max, position(i));
+        }
+        return aabb;
+    }
+
+    // Ritter's algorithm: start from the most distant pair among the points extremal on each axis, then grow the sphere to fit any point outside it
+    template <typename GetPosition>
+    static BoundingSphere sphere_from(GetPosition position, size_t count)
+    {
+        if (count == 0) {
+            return {};
+        }
+
+        size_t min_index[3] = { 0, 0, 0 };
+        size_t max_index[3] = { 0, 0, 0 };
+        for (size_t i = 0; i < count; ++i) {
+            const glm::vec3 p = position(i);
+            for (int axis = 0; axis < 3; ++axis) {
+                if (p[axis] < position(min_index[axis])[axis]) min_index[axis] = i;
+                if (p[axis] > position(max_index[axis])[axis]) max_index[axis] = i;
+            }
+        }
+
+        int best_axis = 0;
+        float best_distance = -1.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            const glm::vec3 d = position(max_index[axis]) - position(min_index[axis]);
+            const float distance = glm::dot(d, d);
+            if (distance > best_distance) {
+                best_distance = distance;
+                best_axis = axis;
+            }
+        }
+
+        BoundingSphere sphere;
+        sphere.center = (position(min_index[best_axis]) + position(max_index[best_axis])) * 0.5f;
+        sphere.radius = sqrtf(best_distance) * 0.5f;
+
+        for (size_t i = 0; i < count; ++i) {
+            const glm::vec3 d = position(i) - sphere.center;
+            const float distance_squared = glm::dot(d, d);
+            if (distance_squared > sphere.radius * sphere.radius) {
+                const float distance = sqrtf(distance_squared);
+                const float new_radius = (sphere.radius + distance) * 0.5f;
+                sphere.center += d * ((new_radius - sphere.radius) / distance);
+                sphere.radius = new_radius;
+            }
+        }
+
+        // Ritter can end up noticeably loose, so also try the sphere around the AABB center and keep whichever is smaller
+        const AABB aabb = aabb_from(position, count);
+        BoundingSphere box_sphere{ aabb.get_center(), 0.0f };
+        for (size_t i = 0; i < count; ++i) {
+            box_sphere.radius = std::max(box_sphere.radius, glm::length(position(i) - box_sphere.center));
+        }
+
+        return box_sphere.radius < sphere.radius ? box_sphere : sphere;
+    }
+
+    AABB compute_aabb(const Vertex* vertices, size_t n_verts)
+    {
+        return aabb_from([vertices](size_t i) { return vertices[i].position; }, n_verts);
+    }
+
+    BoundingSphere compute_bounding_sphere(const Vertex* vertices, size_t n_verts)
+    {
+        return sphere_from([vertices](size_t i) { return vertices[i].position; }, n_verts);
+    }
+
+    AABB compute_aabb(const Vertex* vertices, const u32* indices, size_t n_indices)
+    {
+        return aabb_from([vertices, indices](size_t i) { return vertices[indices[i]].position; }, n_indices);
+    }
+
+    BoundingSphere compute_bounding_sphere(const Vertex* vertices, const u32* indices, size_t n_indices)
+    {
+        return sphere_from([vertices, indices](size_t i) { return vertices[indices[i]].position; }, n_indices);
+    }
+
+    NormalCone compute_normal_cone(const Vertex* vertices, const u32* indices, size_t n_indices, const BoundingSphere& sphere)
+    {
+        NormalCone cone;
+        cone.apex = sphere.center;
+
+        // Average the face normals to get the axis. Using the unnormalized cross product weighs them by area
+        glm::vec3 normal_sum{ 0, 0, 0 };
+        for (size_t i = 0; i + 2 < n_indices; i += 3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].position;
+            normal_sum += glm::cross(p1 - p0, p2 - p0);
+        }
+        if (glm::dot(normal_sum, normal_sum) < 1e-20f) {
+            return cone;
+        }
+        cone.axis = glm::normalize(normal_sum);
+
+        // Find the widest angle between the axis and any face normal
+        float min_dot = 1.0f;
+        for (size_t i = 0; i + 2 < n_indices; i += 3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].position;
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float length = glm::length(normal);
+            if (length > 0.0f) {
+                min_dot = std::min(min_dot, glm::dot(normal / length, cone.axis));
+            }
+        }
+
+        // A cone wider than ~84 degrees can barely cull anything, so don't bother
+        if (min_dot <= 0.1f) {
+            return cone;
+        }
+
+        // Move the apex back along the axis until every triangle plane is in front of it
+        float max_t = 0.0f;
+        for (size_t i = 0; i + 2 < n_indices; i += 3) {
+            const glm::vec3& p0 = vertices[indices[i + 0]].position;
+            const glm::vec3& p1 = vertices[indices[i + 1]].position;
+            const glm::vec3& p2 = vertices[indices[i + 2]].position;
+            const glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const float length = glm::length(normal);
+            if (length <= 0.0f) {
+                continue;
+            }
+            const float dn = glm::dot(normal / length, cone.axis);
+            const float dc = glm::dot(sphere.center - p0, normal / length);
+            max_t = std::max(max_t, dc / dn);
+        }
+
+        cone.apex = sphere.center - cone.axis * max_t;
+        cone.cutoff = sqrtf(1.0f - min_dot * min_dot);
+        return cone;
+    }
+
+    MeshBounds compute_mesh_bounds(const Vertex* vertices, const u32* indices, size_t n_indices)
+    {
+        MeshBounds bounds;
+        bounds.aabb = compute_aabb(vertices, indices, n_indices);
+        bounds.sphere = compute_bounding_sphere(vertices, indices, n_indices);
+        bounds.cone = compute_normal_cone(vertices, indices, n_indices, bounds.sphere);
+        return bounds;
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cfloat>
+#include <glm/glm.hpp>
+#include "FlanTypes.h"
+
+namespace Flan {
+    struct Vertex;
+
+    struct AABB {
+        glm::vec3 min{ FLT_MAX, FLT_MAX, FLT_MAX };
+        glm::vec3 max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        bool is_valid() const { return min.x <= max.x; }
+        glm::vec3 get_center() const { return (min + max) * 0.5f; }
+        glm::vec3 get_extents() const { return (max - min) * 0.5f; }
+    };
+
+    struct BoundingSphere {
+        glm::vec3 center{ 0, 0, 0 };
+        float radius = 0.0f;
+    };
+
+    // All triangle normals lie within this cone. Seen from a point p, every triangle faces away when
+    // dot(normalize(apex - p), axis) >= cutoff. A cutoff of 1 or more means the cone is too wide to ever cull.
+    struct NormalCone {
+        glm::vec3 apex{ 0, 0, 0 };
+        glm::vec3 axis{ 0, 0, 1 };
+        float cutoff = 1.0f;
+        bool is_backfacing(glm::vec3 view_position) const { return cutoff < 1.0f && glm::dot(glm::normalize(apex - view_position), axis) >= cutoff; }
+    };
+
+    struct MeshBounds {
+        AABB aabb;
+        BoundingSphere sphere;
+        NormalCone cone;
+    };
+
+    AABB merge_aabb(const AABB& a, const AABB& b);
+    AABB transform_aabb(const AABB& aabb, const glm::mat4& matrix);
+
+    // Bounds of a contiguous range of vertices
+    AABB compute_aabb(const Vertex* vertices, size_t n_verts);
+    BoundingSphere compute_bounding_sphere(const Vertex* vertices, size_t n_verts);
+
+    // Bounds of the vertices referenced by an index list, duplicates are allowed
+    AABB compute_aabb(const Vertex* vertices, const u32* indices, size_t n_indices);
+    BoundingSphere compute_bounding_sphere(const Vertex* vertices, const u32* indices, size_t n_indices);
+
+    // Normal cone of a triangle list, using the face normals. The sphere is used to place the apex
+    NormalCone compute_normal_cone(const Vertex* vertices, const u32* indices, size_t n_indices, const BoundingSphere& sphere);
+
+    // AABB, Ritter bounding sphere and normal cone for a triangle list
+    MeshBounds compute_mesh_bounds(const Vertex* vertices, const u32* indices, size_t n_indices);
+}
@@ -0,0 +1,632 @@
+#include "Checks.h"
+#include "AnimationScheduler.h"
+#include "LodSelection.h"
+#include "ModelResource.h"
+#include "Skinning.h"
+#include "TextureCompression.h"
+#include "TextureResource.h"
+#include "TextureStreaming.h"
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <glm/gtc/matrix_transform.hpp>
+#include <stb/stb_image_write.h>
+
+namespace Flan {
+    //Print an expectation that didn't hold, and pass on whether it did
+    static bool expect(bool condition, const char* what)
+    {
+        if (!condition)
+            printf("[FAILED] %s\n", what);
+        return condition;
+    }
+
+    static float get_check_projection_scale()
+    {
+        return get_projection_scale(glm::perspectiveRH_ZO(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 1000.0f), 1080.0f);
+    }
+
+    std::string write_check_fixture()
+    {
+        constexpr u32 texture_sizes[] = { 64, 128, 64, 1024 };
+        const std::filesystem::path directory = std::filesystem::temp_directory_path() / "flan_check_fixture";
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        if (error) {
+            printf("[ERROR] Failed to create '%s': %s\n", directory.string().c_str(), error.message().c_str());
+            return "";
+        }
+
+        tinygltf::Model model;
+        model.asset.version = "2.0";
+        model.buffers.resize(1);
+        model.buffers[0].uri = "fixture.bin";
+        model.scenes.resize(1);
+        const auto add_accessor = [&model](const void* bytes, size_t size, int component_type, int type, size_t count, int target) {
+            std::vector<unsigned char>& data = model.buffers[0].data;
+            tinygltf::BufferView view;
+            view.buffer = 0;
+            view.byteOffset = data.size();
+            view.byteLength = size;
+            view.target = target;
+            data.insert(data.end(), static_cast<const unsigned char*>(bytes), static_cast<const unsigned char*>(bytes) + size);
+            model.bufferViews.push_back(view);
+            tinygltf::Accessor accessor;
+            accessor.bufferView = static_cast<int>(model.bufferViews.size() - 1);
+            accessor.componentType = component_type;
+            accessor.type = type;
+            accessor.count = count;
+            model.accessors.push_back(accessor);
+            return static_cast<int>(model.accessors.size() - 1);
+        };
+
+        for (u32 i = 0; i < std::size(texture_sizes); ++i) {
+            //A unit quad per texture, side by side, with UVs that cover the texture once
+            const float x = static_cast<float>(i) * 1.5f;
+            const float positions[] = { x, 0, 0, x + 1, 0, 0, x + 1, 1, 0, x, 1, 0 };
+            const float uvs[] = { 0, 1, 1, 1, 1, 0, 0, 0 };
+            const u16 indices[] = { 0, 1, 2, 0, 2, 3 };
+            tinygltf::Primitive primitive;
+            primitive.attributes["POSITION"] = add_accessor(positions, sizeof(positions), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC3, 4, TINYGLTF_TARGET_ARRAY_BUFFER);
+            model.accessors.back().minValues = { x, 0, 0 };
+            model.accessors.back().maxValues = { x + 1, 1, 0 };
+            primitive.attributes["TEXCOORD_0"] = add_accessor(uvs, sizeof(uvs), TINYGLTF_COMPONENT_TYPE_FLOAT, TINYGLTF_TYPE_VEC2, 4, TINYGLTF_TARGET_ARRAY_BUFFER);
+            primitive.indices = add_accessor(indices, sizeof(indices), TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT, TINYGLTF_TYPE_SCALAR, 6, TINYGLTF_TARGET_ELEMENT_ARRAY_BUFFER);
+            primitive.material = static_cast<int>(i);
+            primitive.mode = TINYGLTF_MODE_TRIANGLES;
+
+            //Gradients under a checkerboard, so every level is different. Named like the other colour maps, see
+            //get_material_texture_root in ModelResource.cpp
+            const u32 size = texture_sizes[i];
+            std::vector<Pixel32> pixels(static_cast<size_t>(size) * size);
+            for (u32 y = 0; y < size; ++y) {
+                for (u32 texel_x = 0; texel_x < size; ++texel_x) {
+                    pixels[static_cast<size_t>(y) * size + texel_x] = { static_cast<u8>(texel_x * 255 / (size - 1)), static_cast<u8>(y * 255 / (size - 1)),
+                                                                       static_cast<u8>(((texel_x / 8 + y / 8) & 1) * 160 + i * 30), 255 };
+                }
+            }
+            tinygltf::Image image;
+            image.uri = "fixture_" + std::to_string(i) + "_alb.png";
+            const std::string image_path = (directory / image.uri).string();
+            if (!stbi_write_png(image_path.c_str(), static_cast<int>(size), static_cast<int>(size), 4, pixels.data(), static_cast<int>(size * sizeof(Pixel32)))) {
+                printf("[ERROR] Failed to write the check fixture texture '%s'!\n", image_path.c_str());
+                return "";
+            }
+            model.images.push_back(image);
+            tinygltf::Texture texture;
+            texture.source = static_cast<int>(i);
+            model.textures.push_back(texture);
+            tinygltf::Material material;
+            material.name = "fixture_" + std::to_string(i);
+            material.pbrMetallicRoughness.baseColorTexture.index = static_cast<int>(i);
+            model.materials.push_back(material);
+
+            tinygltf::Mesh mesh;
+            mesh.name = material.name;
+            mesh.primitives.push_back(primitive);
+            model.meshes.push_back(mesh);
+            tinygltf::Node node;
+            node.mesh = static_cast<int>(i);
+            model.nodes.push_back(node);
+            model.scenes[0].nodes.push_back(static_cast<int>(i));
+        }
+
+        const std::string path = (directory / "fixture.gltf").string();
+        tinygltf::TinyGLTF writer;
+        if (!writer.WriteGltfSceneToFile(&model, path, false, false, true, false)) {
+            printf("[ERROR] Failed to write the check fixture to '%s'!\n", path.c_str());
+            return "";
+        }
+        return path;
+    }
+
+    bool check_skinning(ResourceManager& resources, const char* path, int n_frames)
+    {
+        ModelResource* model = resources.get_resource<ModelResource>(resources.load_mesh(path));
+        if (model == nullptr || model->resource_type != ResourceType::Model) {
+            printf("[ERROR] Failed to load model '%s'!\n", path);
+            return false;
+        }
+
+        SkinnedModelInstance skinned_model;
+        if (!skinned_model.init(model)) {
+            return false;
+        }
+        const AnimationClip* clip = model->n_animations > 0 ? &model->animations[0] : nullptr;
+        constexpr float frame_time = 1.0f / 60.0f;
+
+        size_t n_invalid = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < n_frames; ++frame) {
+            skinned_model.update(clip, static_cast<float>(frame) * frame_time);
+            for (size_t i = 0; i < model->n_instances; ++i) {
+                const Vertex* vertices = skinned_model.get_vertices(i);
+                const size_t n_verts = vertices != nullptr ? model->meshes_cpu[model->instances[i].mesh_index].n_verts : 0;
+                for (size_t v = 0; v < n_verts; ++v) {
+                    const glm::vec3& position = vertices[v].position;
+                    if (!std::isfinite(position.x) || !std::isfinite(position.y) || !std::isfinite(position.z)) ++n_invalid;
+                }
+            }
+        }
+        const std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - start;
+
+        printf("Skinned %zu vertices for %i frames of '%s' in %.2f ms (%.3f ms per frame), %zu invalid vertices\n",
+               skinned_model.get_vertex_count(), n_frames, clip != nullptr ? clip->name : "rest pose", duration.count(),
+               n_frames > 0 ? duration.count() / static_cast<float>(n_frames) : 0.0f, n_invalid);
+        bool passed = expect(skinned_model.get_vertex_count() > 0, "The model has no skinned vertices");
+        passed &= expect(n_invalid == 0, "Skinning produced vertices that aren't finite");
+        skinned_model.release();
+        return passed;
+    }
+
+    bool check_crowd(ResourceManager& resources, const char* path, int n_instances)
+    {
+        ModelResource* model = resources.get_resource<ModelResource>(resources.load_mesh(path));
+        if (model == nullptr || model->resource_type != ResourceType::Model || model->n_animations == 0) {
+            printf("[ERROR] Failed to load an animated model from '%s'!\n", path);
+            return false;
+        }
+
+        //Rows of instances going away from the camera
+        const AnimationClip* clip = &model->animations[0];
+        AnimationScheduler scheduler;
+        scheduler.init();
+        constexpr int instances_per_row = 32;
+        for (int i = 0; i < n_instances; ++i) {
+            const u32 instance = scheduler.add_instance(clip);
+            scheduler.set_time(instance, static_cast<float>(i) * 0.37f);
+            scheduler.set_bounds(instance, { static_cast<float>(i % instances_per_row - instances_per_row / 2) * 2.0f, 0.0f, 4.0f + static_cast<float>(i / instances_per_row) * 2.0f }, 1.0f);
+        }
+        const float projection_scale = get_check_projection_scale();
+
+        //Every pose read back has to be finite, with unit length rotations
+        constexpr int n_frames = 120;
+        constexpr float frame_time = 1.0f / 60.0f;
+        std::vector<float> pose(clip->n_channels);
+        AnimationSchedulerStats totals;
+        size_t n_invalid = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < n_frames; ++frame) {
+            scheduler.update(frame_time, glm::vec3(0.0f), projection_scale);
+            for (int i = 0; i < n_instances; ++i) {
+                bool valid = scheduler.get_pose(static_cast<u32>(i), pose.data());
+                for (u32 t = 0; valid && t < clip->n_tracks; ++t) {
+                    const AnimationTrack& track = clip->tracks[t];
+                    if (track.path == AnimationPath::Rotation) {
+                        const glm::quat rotation = get_pose_quat(pose.data(), track);
+                        valid = std::isfinite(rotation.w) && std::abs(glm::length(rotation) - 1.0f) < 1e-3f;
+                    }
+                    else {
+                        const glm::vec3 value = get_pose_vec3(pose.data(), track);
+                        valid = std::isfinite(value.x) && std::isfinite(value.y) && std::isfinite(value.z);
+                    }
+                }
+                n_invalid += valid ? 0 : 1;
+            }
+            const AnimationSchedulerStats& stats = scheduler.get_stats();
+            totals.n_sampled += stats.n_sampled;
+            totals.n_interpolated += stats.n_interpolated;
+            for (u32 level = 0; level < max_animation_update_levels; ++level) {
+                totals.sampled_per_level[level] += stats.sampled_per_level[level];
+            }
+        }
+        const std::chrono::duration<float, std::milli> duration = std::chrono::steady_clock::now() - start;
+
+        printf("Animated %i instances of '%s' for %i frames in %.2f ms (%.3f ms per frame)\n", n_instances, clip->name, n_frames,
+               duration.count(), duration.count() / static_cast<float>(n_frames));
+        printf("    Per frame: %u sampled, %u interpolated\n", totals.n_sampled / n_frames, totals.n_interpolated / n_frames);
+        const AnimationSchedulerStats& stats = scheduler.get_stats();
+        for (u32 level = 0; level < max_animation_update_levels; ++level) {
+            if (stats.instances_per_level[level] > 0) {
+                printf("    Every %u frames: %u instances, %u sampled per frame\n", 1u << level, stats.instances_per_level[level], totals.sampled_per_level[level] / n_frames);
+            }
+        }
+        bool passed = expect(n_invalid == 0, "The scheduler returned invalid poses");
+        if (stats.instances_per_level[0] < static_cast<u32>(n_instances)) {
+            passed &= expect(totals.n_sampled < static_cast<u32>(n_instances * n_frames), "Instances at lower update rates were sampled every frame");
+        }
+        scheduler.release();
+        return passed;
+    }
+
+    bool check_streaming(ResourceManager& resources, const char* path, size_t budget_mb)
+    {
+        ModelResource* model = resources.get_resource<ModelResource>(resources.load_mesh(path));
+        if (model == nullptr || model->resource_type != ResourceType::Model || !model->bounds.is_valid()) {
+            printf("[ERROR] Failed to load model '%s'!\n", path);
+            return false;
+        }
+
+        TextureStreamingSettings settings;
+        settings.memory_budget = budget_mb MB;
+        TextureStreamer streamer;
+        streamer.init(settings);
+
+        //Stream every texture of every material, the same way the renderer does
+        std::vector<std::array<u32, 6>> material_textures(model->n_materials);
+        for (size_t i = 0; i < model->n_materials; ++i) {
+            const MaterialResource& material = model->materials_cpu[i];
+            const ResourceHandle handles[] = { material.tex_col, material.tex_nrm, material.tex_rgh, material.tex_mtl, material.tex_occ, material.tex_orm };
+            for (size_t j = 0; j < 6; ++j) {
+                const TextureResource* texture = resources.get_resource<TextureResource>(handles[j]);
+                material_textures[i][j] = texture != nullptr ? streamer.add_texture(texture) : no_streamed_texture;
+            }
+        }
+        if (!expect(streamer.get_texture_count() > 0, "The model has no textures, there's nothing to stream")) {
+            streamer.release();
+            return false;
+        }
+        std::vector<float> uv_densities(model->n_meshes);
+        for (size_t i = 0; i < model->n_meshes; ++i) {
+            const MeshCPU& mesh = model->meshes_cpu[i];
+            uv_densities[i] = compute_uv_density(mesh.vertices, mesh.indices, mesh.n_lods > 0 ? mesh.lods[0].n_indices : mesh.n_indices);
+        }
+
+        //Fly in from far away to right in front of the model, and back out. Then stay there until the levels that were
+        //needed on the way out have been dropped
+        const float projection_scale = get_check_projection_scale();
+        const glm::vec3 center = model->bounds.get_center();
+        const float radius = glm::length(model->bounds.get_extents());
+        constexpr int n_frames = 480;
+        size_t first_resident_bytes = 0;
+        size_t peak_resident_bytes = 0;
+        size_t n_frames_over_budget = 0;
+        TextureStreamingStats stats;
+        printf("Streaming %zu textures of '%s' with a %zu MB budget\n", streamer.get_texture_count(), path, budget_mb);
+        const int n_frames_total = n_frames + static_cast<int>(settings.drop_delay) + 1;
+        for (int frame = 0; frame < n_frames_total; ++frame) {
+            const float t = std::max(1.0f - std::abs(static_cast<float>(frame) / static_cast<float>(n_frames / 2) - 1.0f), 0.0f);
+            const float distance = radius * std::exp2(glm::mix(6.0f, -0.5f, t));
+            const glm::vec3 camera_position = center + glm::vec3(0.0f, 0.0f, distance);
+            for (size_t i = 0; i < model->n_instances; ++i) {
+                const MeshInstance& instance = model->instances[i];
+                if (instance.mesh_index >= model->n_materials) {
+                    continue;
+                }
+                const BoundingSphere& sphere = model->meshes_cpu[instance.mesh_index].bounds.sphere;
+                const float scale = std::max({ glm::length(glm::vec3(instance.transform[0])), glm::length(glm::vec3(instance.transform[1])), glm::length(glm::vec3(instance.transform[2])) });
+                const glm::vec3 sphere_center = instance.transform * glm::vec4(sphere.center, 1.0f);
+                for (const u32 texture : material_textures[instance.mesh_index]) {
+                    streamer.request_footprint(texture, sphere_center, sphere.radius * scale, uv_densities[instance.mesh_index] * scale, camera_position, projection_scale);
+                }
+            }
+            streamer.update();
+
+            //Frames here take no time, so give the loads a frame's worth of time to finish
+            streamer.wait_for_loads();
+            stats = streamer.get_stats();
+            if (frame == 0) {
+                first_resident_bytes = stats.resident_bytes;
+            }
+            peak_resident_bytes = std::max(peak_resident_bytes, stats.resident_bytes);
+
+            //Levels that are always resident are kept even when they don't fit
+            n_frames_over_budget += stats.resident_bytes > std::max(settings.memory_budget, first_resident_bytes) ? 1 : 0;
+            if (frame % 40 == 0 || frame == n_frames_total - 1) {
+                printf("    Frame %3i, %7.2f away: %6.2f MB resident, %6.2f MB wanted of %6.2f MB, %u loading, %u over budget\n", frame, distance,
+                       static_cast<float>(stats.resident_bytes) / (1024.0f * 1024.0f), static_cast<float>(stats.wanted_bytes) / (1024.0f * 1024.0f),
+                       static_cast<float>(stats.full_bytes) / (1024.0f * 1024.0f), stats.n_loads_in_flight, stats.n_over_budget);
+            }
+        }
+        bool passed = expect(n_frames_over_budget == 0, "Resident levels went over the budget");
+        passed &= expect(stats.full_bytes > first_resident_bytes, "Every level of the textures is always resident, there's nothing to stream");
+        if (stats.full_bytes > first_resident_bytes && settings.memory_budget > first_resident_bytes) {
+            passed &= expect(peak_resident_bytes > first_resident_bytes, "No levels streamed in as the camera got closer");
+        }
+        passed &= expect(stats.resident_bytes <= stats.wanted_bytes, "Levels nobody needs any more weren't dropped");
+        streamer.release();
+        return passed;
+    }
+
+    bool check_virtual_texture(int cache_tiles)
+    {
+        //Tiles are generated instead of decoded
+        constexpr u32 texture_size = 65536;
+        constexpr float terrain_size = 8192.0f;
+        VirtualTextureSettings settings;
+        settings.cache_tiles_x = static_cast<u32>(cache_tiles);
+        settings.cache_tiles_y = static_cast<u32>(cache_tiles);
+        VirtualTexture virtual_texture;
+        const u32 tile_row_bytes = get_texture_row_bytes(TextureFormat::RGBA8, settings.tile_size + 2 * settings.border);
+        const auto generate_tile = [tile_row_bytes](u32 level, u32 tile_x, u32 tile_y, u8* tile_out) {
+            for (u32 row = 0; row < tile_row_bytes / 4; ++row) {
+                memset(tile_out + row * tile_row_bytes, static_cast<int>((level * 37 + tile_x * 11 + tile_y * 5 + row) & 0xFF), tile_row_bytes);
+            }
+        };
+        if (!virtual_texture.init(texture_size, texture_size, TextureFormat::RGBA8, generate_tile, settings)) {
+            return false;
+        }
+
+        //The feedback pass, traced on the CPU at 1/12th of 1080p against the ground plane. Mips come from the pixel's
+        //footprint at 1080p, the shorter axis of it with anisotropic filtering up to 16x
+        constexpr int feedback_width = 160;
+        constexpr int feedback_height = 90;
+        const float projection_scale = get_check_projection_scale();
+        const float texels_per_unit = static_cast<float>(texture_size) / terrain_size;
+        std::vector<u32> feedback(feedback_width * feedback_height);
+
+        constexpr int n_frames = 1200;
+        u64 n_samples = 0;
+        u64 n_hits = 0;
+        u32 n_decodes = 0;
+        u32 n_evictions = 0;
+        printf("Virtual texture of %ux%u texels, %u levels, cache of %ix%i tiles (%.1f MB instead of %.1f GB)\n", texture_size, texture_size,
+               virtual_texture.get_level_count(), cache_tiles, cache_tiles, static_cast<double>(virtual_texture.get_tile_bytes()) * cache_tiles * cache_tiles / (1024.0 * 1024.0),
+               static_cast<double>(texture_size) * texture_size * 4.0 * 4.0 / 3.0 / (1024.0 * 1024.0 * 1024.0));
+        for (int frame = 0; frame < n_frames; ++frame) {
+            //A winding path over the terrain, looking ahead and down
+            const float time = static_cast<float>(frame) / 60.0f;
+            const glm::vec3 camera_position(terrain_size * 0.5f + std::sin(time * 0.3f) * 150.0f, 30.0f, 500.0f + time * 20.0f);
+            const float yaw = std::cos(time * 0.3f) * 0.45f;
+            const glm::vec3 forward = glm::normalize(glm::vec3(std::sin(yaw), -0.35f, std::cos(yaw)));
+            const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+            const glm::vec3 up = glm::cross(right, forward);
+
+            for (int y = 0; y < feedback_height; ++y) {
+                for (int x = 0; x < feedback_width; ++x) {
+                    const float screen_x = ((static_cast<float>(x) + 0.5f) / feedback_width * 2.0f - 1.0f) * 16.0f / 9.0f;
+                    const float screen_y = 1.0f - (static_cast<float>(y) + 0.5f) / feedback_height * 2.0f;
+                    const glm::vec3 ray = glm::normalize(forward + right * screen_x + up * screen_y);
+                    u32& entry = feedback[y * feedback_width + x];
+                    entry = no_virtual_page;
+                    if (ray.y >= -1e-3f) {
+                        continue;
+                    }
+                    const float distance = camera_position.y / -ray.y;
+                    const glm::vec3 hit = camera_position + ray * distance;
+                    const float u = hit.x / terrain_size;
+                    const float v = hit.z / terrain_size;
+                    if (u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f) {
+                        continue;
+                    }
+                    const float footprint = distance / projection_scale * texels_per_unit;
+                    const float stretched = footprint / -ray.y;
+                    const float mip = std::log2(std::max(footprint, stretched / 16.0f));
+                    const u32 level = static_cast<u32>(std::clamp(mip, 0.0f, static_cast<float>(virtual_texture.get_level_count() - 1)));
+                    entry = pack_virtual_page(level, static_cast<u32>(u * virtual_texture.get_page_count_x(level)), static_cast<u32>(v * virtual_texture.get_page_count_y(level)));
+                }
+            }
+            virtual_texture.add_feedback(feedback.data(), feedback.size());
+            virtual_texture.update();
+
+            //Frames here take no time, so give the decodes a frame's worth of time to finish
+            virtual_texture.wait_for_decodes();
+            const VirtualTextureStats& stats = virtual_texture.get_stats();
+            n_samples += stats.n_samples;
+            n_hits += stats.n_hits;
+            n_decodes += stats.n_decodes_started;
+            n_evictions += stats.n_evictions;
+            if (frame % 120 == 0 || frame == n_frames - 1) {
+                printf("    Frame %4i: %5.1f%% hit, %4u pages (%4u resident), %4u resident tiles, %3u requested, %2u decoding, %3u evicted\n", frame,
+                       stats.get_hit_rate() * 100.0f, stats.n_pages, stats.n_page_hits, stats.n_resident, stats.n_requested, stats.n_decodes_in_flight, stats.n_evictions);
+            }
+        }
+        const double hit_rate = n_samples > 0 ? static_cast<double>(n_hits) / static_cast<double>(n_samples) : 1.0;
+        printf("    Overall: %.1f%% of %llu samples hit, %u tiles decoded, %u evicted\n", 100.0 * hit_rate, static_cast<unsigned long long>(n_samples), n_decodes, n_evictions);
+        bool passed = expect(n_samples > 0, "The feedback asked for no pages");
+        passed &= expect(hit_rate >= 0.95, "Fewer than 95% of the samples found their page resident");
+        virtual_texture.release();
+        return passed;
+    }
+
+    bool check_texture_dedup(ResourceManager& resources, int n_paths, char** paths)
+    {
+        bool passed = true;
+        const TextureResource* original = nullptr;
+        for (int i = 0; i < n_paths; ++i) {
+            const ModelResource* model = resources.get_resource<ModelResource>(resources.load_mesh(paths[i]));
+            if (model == nullptr || model->resource_type != ResourceType::Model) {
+                printf("[ERROR] Failed to load model '%s'!\n", paths[i]);
+                passed = false;
+                continue;
+            }
+
+            //The first colour texture that came from an image file gets copied
+            for (size_t j = 0; j < model->n_materials && original == nullptr; ++j) {
+                const TextureResource* texture = model->materials_cpu[j].tex_col != 0 ? resources.get_resource<TextureResource>(model->materials_cpu[j].tex_col) : nullptr;
+                if (texture != nullptr && texture->resource_type == ResourceType::Texture && std::filesystem::is_regular_file(texture->name)) {
+                    original = texture;
+                }
+            }
+        }
+
+        const TextureDedupReport report = resources.get_texture_dedup_report();
+        printf("Loaded %zu textures from %i models, %zu unique\n", report.n_textures, n_paths, report.n_unique);
+        printf("    %.2f MB loaded, %.2f MB saved by sharing copies (%.1f%%)\n", static_cast<double>(report.bytes_loaded) / (1024.0 * 1024.0),
+               static_cast<double>(report.bytes_saved) / (1024.0 * 1024.0), report.bytes_loaded > 0 ? 100.0 * static_cast<double>(report.bytes_saved) / static_cast<double>(report.bytes_loaded) : 0.0);
+        passed &= expect(report.n_unique <= report.n_textures && report.bytes_saved <= report.bytes_loaded, "The deduplication report doesn't add up");
+        if (!expect(original != nullptr, "None of the models has a colour texture from an image file, there's nothing to copy")) {
+            return false;
+        }
+
+        //Load a copy of that file under another name, its handle has to resolve to the texture already loaded
+        const std::filesystem::path original_path = original->name;
+        const std::filesystem::path copy_path = std::filesystem::temp_directory_path() / ("flan_dedup_copy" + original_path.extension().string());
+        std::error_code error;
+        std::filesystem::copy_file(original_path, copy_path, std::filesystem::copy_options::overwrite_existing, error);
+        if (error) {
+            printf("[ERROR] Failed to copy '%s' to '%s': %s\n", original_path.string().c_str(), copy_path.string().c_str(), error.message().c_str());
+            return false;
+        }
+        const TextureResource* copy = resources.get_resource<TextureResource>(resources.load_texture(copy_path.string(), original->usage));
+        const TextureDedupReport copy_report = resources.get_texture_dedup_report();
+        std::filesystem::remove(copy_path, error);
+        printf("    A copy of '%s' %s the texture already loaded\n", original->name, copy == original ? "shares" : "doesn't share");
+        passed &= expect(copy == original, "A byte identical copy of a texture was loaded again");
+        passed &= expect(copy_report.n_unique == report.n_unique && copy_report.bytes_saved > report.bytes_saved, "The copy wasn't counted as shared");
+        return passed;
+    }
+
+    // The alpha of every pixel of a BC7 block, for the modes the encoder writes. False for any other mode
+    static bool decode_bc7_alpha(const u8* block, u8* alpha_out)
+    {
+        const auto read_bits = [block](u32 first, u32 count) {
+            u32 value = 0;
+            for (u32 i = 0; i < count; ++i) {
+                value |= ((block[(first + i) / 8] >> ((first + i) % 8)) & 1u) << i;
+            }
+            return value;
+        };
+        const u32 mode = std::countr_zero(block[0]);
+        if (mode == 1) {
+            std::fill(alpha_out, alpha_out + 16, static_cast<u8>(255));
+            return true;
+        }
+        if (mode != 6) {
+            return false;
+        }
+
+        //Mode 6 stores 7 bit alpha endpoints after the colour ones, then a p-bit per endpoint and 4 bit indices
+        static constexpr u32 weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+        const u32 alpha0 = (read_bits(49, 7) << 1) | read_bits(63, 1);
+        const u32 alpha1 = (read_bits(56, 7) << 1) | read_bits(64, 1);
+        for (u32 p = 0; p < 16; ++p) {
+            const u32 weight = weights[p == 0 ? read_bits(65, 3) : read_bits(64 + 4 * p, 4)];
+            alpha_out[p] = static_cast<u8>(((64 - weight) * alpha0 + weight * alpha1 + 32) >> 6);
+        }
+        return true;
+    }
+
+    bool check_texture_compression()
+    {
+        constexpr u32 size = 64;
+        std::vector<Pixel32> images[3];
+        for (auto& image : images) {
+            image.resize(size * size);
+        }
+        u32 seed = 12345;
+        const auto next_random = [&seed]() {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<u8>(seed >> 24);
+        };
+        for (u32 y = 0; y < size; ++y) {
+            for (u32 x = 0; x < size; ++x) {
+                images[0][y * size + x] = { static_cast<u8>(x * 4), static_cast<u8>(y * 4), static_cast<u8>(255 - (x + y) * 2), 255 };
+                images[1][y * size + x] = { next_random(), next_random(), next_random(), 255 };
+            }
+        }
+        //Flat blocks encode without error, which skips everything but the first mode 6 fit
+        for (u32 block = 0; block < (size / 4) * (size / 4); ++block) {
+            const Pixel32 colour = { next_random(), next_random(), next_random(), 255 };
+            const u32 block_x = block % (size / 4) * 4;
+            const u32 block_y = block / (size / 4) * 4;
+            for (u32 p = 0; p < 16; ++p) {
+                images[2][(block_y + p / 4) * size + block_x + p % 4] = colour;
+            }
+        }
+
+        bool passed = true;
+        const char* image_names[] = { "gradient", "noise", "flat" };
+        const char* quality_names[] = { "fast", "normal", "high" };
+        std::vector<u8> compressed(get_texture_level_bytes(TextureFormat::BC7, size, size));
+        for (u32 image = 0; image < 3; ++image) {
+            for (u32 quality = 0; quality < 3; ++quality) {
+                compress_texture(images[image].data(), size, size, TextureFormat::BC7, static_cast<TextureCompressionQuality>(quality), compressed.data());
+                size_t n_blocks = 0;
+                size_t n_translucent = 0;
+                size_t n_unknown = 0;
+                for (size_t offset = 0; offset < compressed.size(); offset += 16) {
+                    u8 alpha[16];
+                    n_blocks++;
+                    if (!decode_bc7_alpha(compressed.data() + offset, alpha)) {
+                        n_unknown++;
+                        continue;
+                    }
+                    n_translucent += std::any_of(alpha, alpha + 16, [](u8 a) { return a != 255; }) ? 1 : 0;
+                }
+                printf("BC7 %s %s: %zu of %zu blocks decode with alpha below 255\n", quality_names[quality], image_names[image], n_translucent, n_blocks);
+                passed &= expect(n_unknown == 0, "The encoder wrote a BC7 mode other than 1 and 6");
+                passed &= expect(n_translucent == 0, "An opaque image decodes with alpha below 255");
+            }
+        }
+        return passed;
+    }
+
+    // The bytes of the texel, or of the block for compressed formats, a UV lands on in a level
+    static const u8* get_texel_at(const TextureResource& texture, u32 level, glm::vec2 uv)
+    {
+        const u32 unit = is_block_compressed(texture.format) ? 4 : 1;
+        const u32 unit_bytes = get_texture_row_bytes(texture.format, unit);
+        const int x = std::clamp(static_cast<int>(std::floor(uv.x * static_cast<float>(texture.get_mip_width(level)))), 0, static_cast<int>(texture.get_mip_width(level)) - 1);
+        const int y = std::clamp(static_cast<int>(std::floor(uv.y * static_cast<float>(texture.get_mip_height(level)))), 0, static_cast<int>(texture.get_mip_height(level)) - 1);
+        return texture.get_mip_data(level) + static_cast<size_t>(y / unit) * texture.get_mip_row_pitch(level) + static_cast<size_t>(x / unit) * unit_bytes;
+    }
+
+    bool check_atlas(const char* path)
+    {
+        ResourceManager plain_resources;
+        TextureImportSettings settings = plain_resources.get_texture_import_settings();
+        settings.atlas.enabled = true;
+        ResourceManager atlas_resources;
+        atlas_resources.set_texture_import_settings(settings);
+        const ModelResource* plain = plain_resources.get_resource<ModelResource>(plain_resources.load_mesh(path));
+        const ModelResource* packed = atlas_resources.get_resource<ModelResource>(atlas_resources.load_mesh(path));
+        if (plain == nullptr || packed == nullptr || plain->resource_type != ResourceType::Model || packed->resource_type != ResourceType::Model || plain->n_meshes != packed->n_meshes) {
+            printf("[ERROR] Failed to load model '%s'!\n", path);
+            return false;
+        }
+
+        const ResourceHandle MaterialResource::* slots[] = { &MaterialResource::tex_col, &MaterialResource::tex_nrm, &MaterialResource::tex_rgh, &MaterialResource::tex_mtl,
+                                                             &MaterialResource::tex_emm, &MaterialResource::tex_occ, &MaterialResource::tex_orm };
+        std::vector<const TextureResource*> plain_textures;
+        std::vector<const TextureResource*> packed_textures;
+        size_t n_moved = 0;
+        size_t n_samples = 0;
+        size_t n_different = 0;
+        for (size_t mesh_index = 0; mesh_index < plain->n_meshes; ++mesh_index) {
+            const MeshCPU& plain_mesh = plain->meshes_cpu[mesh_index];
+            const MeshCPU& packed_mesh = packed->meshes_cpu[mesh_index];
+            bool moved = false;
+            for (const auto slot : slots) {
+                const TextureResource* plain_texture = plain->materials_cpu[mesh_index].*slot != 0 ? plain_resources.get_resource<TextureResource>(plain->materials_cpu[mesh_index].*slot) : nullptr;
+                const TextureResource* packed_texture = packed->materials_cpu[mesh_index].*slot != 0 ? atlas_resources.get_resource<TextureResource>(packed->materials_cpu[mesh_index].*slot) : nullptr;
+                if (plain_texture == nullptr || packed_texture == nullptr || plain_texture->resource_type != ResourceType::Texture || packed_texture->resource_type != ResourceType::Texture) {
+                    continue;
+                }
+                plain_textures.push_back(plain_texture);
+                packed_textures.push_back(packed_texture);
+                if (plain->materials_cpu[mesh_index].*slot == packed->materials_cpu[mesh_index].*slot) {
+                    continue;
+                }
+                moved = true;
+                const u32 last_level = packed_texture->n_mips - 1;
+                const u32 unit_bytes = get_texture_row_bytes(packed_texture->format, is_block_compressed(packed_texture->format) ? 4 : 1);
+                for (size_t i = 0; i + 2 < plain_mesh.n_indices; i += 3) {
+                    const u32* triangle = plain_mesh.indices + i;
+                    const glm::vec2 plain_uv = (plain_mesh.vertices[triangle[0]].texcoord0 + plain_mesh.vertices[triangle[1]].texcoord0 + plain_mesh.vertices[triangle[2]].texcoord0) / 3.0f;
+                    const glm::vec2 packed_uv = (packed_mesh.vertices[triangle[0]].texcoord0 + packed_mesh.vertices[triangle[1]].texcoord0 + packed_mesh.vertices[triangle[2]].texcoord0) / 3.0f;
+                    for (const u32 level : { 0u, last_level }) {
+                        //Right on the edge of a texel, rounding decides which side it lands on
+                        const glm::vec2 texel = plain_uv * glm::vec2(static_cast<float>(plain_texture->get_mip_width(level)), static_cast<float>(plain_texture->get_mip_height(level)));
+                        const glm::vec2 distance_to_edge = glm::abs(texel - glm::round(texel));
+                        if (distance_to_edge.x < 1e-3f || distance_to_edge.y < 1e-3f) {
+                            continue;
+                        }
+                        n_samples++;
+                        n_different += memcmp(get_texel_at(*plain_texture, level, plain_uv), get_texel_at(*packed_texture, level, packed_uv), unit_bytes) != 0 ? 1 : 0;
+                    }
+                }
+            }
+            n_moved += moved ? 1 : 0;
+        }
+
+        const auto count_unique = [](std::vector<const TextureResource*>& textures) {
+            std::sort(textures.begin(), textures.end());
+            return static_cast<size_t>(std::unique(textures.begin(), textures.end()) - textures.begin());
+        };
+        printf("Model '%s': %zu of %zu meshes moved into atlases, their materials use %zu textures instead of %zu\n", path, n_moved, plain->n_meshes, count_unique(packed_textures),
+               count_unique(plain_textures));
+        printf("    %zu of %zu samples differ from the original textures\n", n_different, n_samples);
+        if (!expect(n_moved > 0, "No meshes moved into atlases, there's nothing to compare")) {
+            return false;
+        }
+        bool passed = expect(n_samples > 0, "None of the moved meshes could be sampled");
+        passed &= expect(n_different == 0, "Atlases sample other texels than the textures they replaced");
+        return passed;
+    }
+}
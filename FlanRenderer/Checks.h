@@ -0,0 +1,38 @@
+#pragma once
+#include "Resources.h"
+
+// Checks of the systems that run without a window or GPU, so build machines can run them on real assets, see
+// FlanTools.cpp. Each one prints what it measured, and returns false when a result isn't what it should be.
+
+namespace Flan {
+    // Writes a model for the checks to the temporary directory, and returns its path or an empty string if it couldn't be
+    // written. It's four quads with a colour texture each: three small enough to be packed into atlases and one of
+    // 1024x1024 texels that has levels to stream. Each run writes it again
+    std::string write_check_fixture();
+
+    // Plays a model's first animation with CPU skinning. Every skinned vertex has to stay finite
+    bool check_skinning(ResourceManager& resources, const char* path, int n_frames);
+
+    // Plays a model's first animation on a crowd spread out in front of the camera through the animation scheduler.
+    // Every pose has to be valid, and the far instances have to be sampled less often than every frame
+    bool check_crowd(ResourceManager& resources, const char* path, int n_instances);
+
+    // Streams a model's textures while the camera flies towards it and back. Resident levels have to stay within the
+    // budget, stream in on the way in and get dropped again on the way out. Fails if the model has no levels to stream
+    bool check_streaming(ResourceManager& resources, const char* path, size_t budget_mb);
+
+    // Flies a camera low over a terrain with a virtual texture of 65536x65536 texels. Pages the feedback asks for have
+    // to be resident at least 95% of the time
+    bool check_virtual_texture(int cache_tiles);
+
+    // Loads models, then a copy of one of their textures under another path. The copy has to share the texture that's
+    // already loaded. Fails if none of the models has a colour texture from an image file to copy
+    bool check_texture_dedup(ResourceManager& resources, int n_paths, char** paths);
+
+    // Compresses opaque gradients, noise and flat colours to BC7 at every quality. Every pixel has to decode with alpha 255
+    bool check_texture_compression();
+
+    // Loads a model with and without texture atlases. The middle of every triangle of the meshes that moved has to
+    // sample the same texels as before, at the first and the last level of the atlases. Fails if no mesh moved
+    bool check_atlas(const char* path);
+}
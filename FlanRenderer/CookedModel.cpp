@@ -0,0 +1,313 @@
+#include "CookedModel.h"
+#include "AnimationCompression.h"
+#include "ModelResource.h"
+#include "TextureResource.h"
+#include "TextureAtlas.h"
+#include "TextureContainer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <type_traits>
+
+namespace Flan {
+    // These are stored in the file as they are in memory
+    static_assert(sizeof(Vertex) == 64 && sizeof(VertexSkin) == 24 && sizeof(SubMesh) == 92 && sizeof(MeshLod) == 12 && sizeof(Meshlet) == 60 &&
+                  sizeof(MeshInstance) == 72 && sizeof(ModelNode) == 44 && sizeof(AnimationTrack) == 16 && sizeof(AnimationTrackKeys) == 48,
+                  "Cooked model layout changed, bump cooked_model_version and update these sizes");
+    static_assert(std::is_trivially_copyable_v<Vertex> && std::is_trivially_copyable_v<VertexSkin> && std::is_trivially_copyable_v<SubMesh> &&
+                  std::is_trivially_copyable_v<Meshlet> && std::is_trivially_copyable_v<MeshInstance> && std::is_trivially_copyable_v<ModelNode> &&
+                  std::is_trivially_copyable_v<AnimationTrack> && std::is_trivially_copyable_v<AnimationTrackKeys>);
+
+    // Append a block at the next aligned offset, and return that offset
+    static u64 append_block(std::vector<u8>& blob, const void* data, size_t size)
+    {
+        if (size == 0) {
+            return 0;
+        }
+        const u64 offset = (blob.size() + cooked_model_alignment - 1) & ~(cooked_model_alignment - 1);
+        blob.resize(offset + size);
+        memcpy(&blob[offset], data, size);
+        return offset;
+    }
+
+    static const TextureResource* get_loaded_texture(ResourceHandle handle, ResourceManager* resource_manager)
+    {
+        if (handle == 0) {
+            return nullptr;
+        }
+        const TextureResource* texture = resource_manager->get_resource<TextureResource>(handle);
+        if (texture == nullptr || texture->resource_type != ResourceType::Texture || texture->name == nullptr) {
+            return nullptr;
+        }
+        return texture;
+    }
+
+    //A texture stored with the model, and the offset of its name
+    struct EmbeddedImage {
+        u64 name_offset;
+        const TextureResource* atlas; // Atlas textures are stored as they were built, embedded images as they were encoded
+    };
+
+    //Embedded images and atlas textures have no file to load from that's sure to stay around, their names are collected
+    //so the images can be stored with the model
+    static u64 append_texture_path(std::vector<u8>& blob, ResourceHandle handle, ResourceManager* resource_manager, std::map<std::string, EmbeddedImage>& embedded_images)
+    {
+        const TextureResource* texture = get_loaded_texture(handle, resource_manager);
+        if (texture == nullptr) {
+            return 0;
+        }
+        const u64 offset = append_block(blob, texture->name, strlen(texture->name) + 1);
+        std::string model_path;
+        int image_index;
+        if (split_embedded_image_name(texture->name, model_path, image_index)) {
+            embedded_images.emplace(texture->name, EmbeddedImage{ offset, nullptr });
+        }
+        else if (is_texture_atlas_name(texture->name)) {
+            embedded_images.emplace(texture->name, EmbeddedImage{ offset, texture });
+        }
+        return offset;
+    }
+
+    //Store the embedded images the materials use, reading each source glTF once
+    static bool append_embedded_images(std::vector<u8>& blob, const std::map<std::string, EmbeddedImage>& embedded_images, std::vector<CookedImage>& cooked_images_out)
+    {
+        std::map<std::string, std::vector<std::vector<u8>>> images_by_model;
+        std::vector<u8> atlas_bytes;
+        for (const auto& [name, embedded_image] : embedded_images)
+        {
+            const u64 name_offset = embedded_image.name_offset;
+            if (embedded_image.atlas != nullptr)
+            {
+                write_dds(*embedded_image.atlas, atlas_bytes);
+                cooked_images_out.push_back({ name_offset, append_block(blob, atlas_bytes.data(), atlas_bytes.size()), atlas_bytes.size() });
+                continue;
+            }
+
+            std::string model_path;
+            int image_index;
+            split_embedded_image_name(name, model_path, image_index);
+            auto model_images = images_by_model.find(model_path);
+            if (model_images == images_by_model.end())
+            {
+                model_images = images_by_model.emplace(model_path, std::vector<std::vector<u8>>{}).first;
+                ModelResource::read_embedded_images(model_path, model_images->second);
+            }
+            if (image_index < 0 || image_index >= static_cast<int>(model_images->second.size()) || model_images->second[image_index].empty())
+            {
+                printf("[ERROR] Failed to read embedded image '%s' from its model!\n", name.c_str());
+                return false;
+            }
+            const std::vector<u8>& bytes = model_images->second[image_index];
+            cooked_images_out.push_back({ name_offset, append_block(blob, bytes.data(), bytes.size()), bytes.size() });
+        }
+        return true;
+    }
+
+    bool write_cooked_model(const ModelResource& model, ResourceManager* resource_manager, const std::string& output_path)
+    {
+        //Reserve space for the header and both tables, they get filled in once the data offsets are known
+        std::vector<u8> blob;
+        CookedModelHeader header{};
+        memcpy(header.magic, cooked_model_magic, sizeof(header.magic));
+        header.version = cooked_model_version;
+        header.n_meshes = model.n_meshes;
+        header.n_materials = model.n_materials;
+        header.n_instances = model.n_instances;
+        header.n_nodes = model.n_nodes;
+        header.n_skins = model.n_skins;
+        header.n_animations = model.n_animations;
+        header.bounds = model.bounds;
+        append_block(blob, &header, sizeof(header));
+
+        std::vector<CookedMesh> cooked_meshes(model.n_meshes);
+        std::vector<CookedMaterial> cooked_materials(model.n_materials);
+        std::vector<CookedSkin> cooked_skins(model.n_skins);
+        std::vector<CookedAnimation> cooked_animations(model.n_animations);
+        std::map<std::string, EmbeddedImage> embedded_images;
+        std::vector<CookedImage> cooked_images;
+        header.meshes_offset = append_block(blob, cooked_meshes.data(), sizeof(CookedMesh) * cooked_meshes.size());
+        header.materials_offset = append_block(blob, cooked_materials.data(), sizeof(CookedMaterial) * cooked_materials.size());
+        header.skins_offset = append_block(blob, cooked_skins.data(), sizeof(CookedSkin) * cooked_skins.size());
+        header.animations_offset = append_block(blob, cooked_animations.data(), sizeof(CookedAnimation) * cooked_animations.size());
+        header.instances_offset = append_block(blob, model.instances, sizeof(MeshInstance) * model.n_instances);
+        header.nodes_offset = append_block(blob, model.nodes, sizeof(ModelNode) * model.n_nodes);
+
+        //Mesh data
+        for (size_t i = 0; i < model.n_meshes; ++i)
+        {
+            const MeshCPU& mesh = model.meshes_cpu[i];
+            CookedMesh& cooked = cooked_meshes[i];
+            cooked.vertices_offset = append_block(blob, mesh.vertices, sizeof(Vertex) * mesh.n_verts);
+            cooked.skin_offset = mesh.skin != nullptr ? append_block(blob, mesh.skin, sizeof(VertexSkin) * mesh.n_verts) : 0;
+            cooked.indices_offset = append_block(blob, mesh.indices, sizeof(u32) * mesh.n_indices);
+            cooked.lods_offset = append_block(blob, mesh.lods, sizeof(MeshLod) * mesh.n_lods);
+            cooked.sub_meshes_offset = append_block(blob, mesh.sub_meshes, sizeof(SubMesh) * mesh.n_sub_meshes);
+            cooked.meshlets_offset = append_block(blob, mesh.meshlets, sizeof(Meshlet) * mesh.n_meshlets);
+            cooked.meshlet_vertices_offset = append_block(blob, mesh.meshlet_vertices, sizeof(u32) * mesh.n_meshlet_vertices);
+            cooked.meshlet_triangles_offset = append_block(blob, mesh.meshlet_triangles, sizeof(u8) * 3 * mesh.n_meshlet_triangles);
+            cooked.n_verts = mesh.n_verts;
+            cooked.n_indices = mesh.n_indices;
+            cooked.n_lods = mesh.n_lods;
+            cooked.n_sub_meshes = mesh.n_sub_meshes;
+            cooked.n_meshlets = mesh.n_meshlets;
+            cooked.n_meshlet_vertices = mesh.n_meshlet_vertices;
+            cooked.n_meshlet_triangles = mesh.n_meshlet_triangles;
+            cooked.first_instance = mesh.first_instance;
+            cooked.n_instances = mesh.n_instances;
+            cooked.bounds = mesh.bounds;
+        }
+
+        //Materials
+        for (size_t i = 0; i < model.n_materials; ++i)
+        {
+            const MaterialResource& material = model.materials_cpu[i];
+            CookedMaterial& cooked = cooked_materials[i];
+            cooked.tex_col_path_offset = append_texture_path(blob, material.tex_col, resource_manager, embedded_images);
+            cooked.tex_nrm_path_offset = append_texture_path(blob, material.tex_nrm, resource_manager, embedded_images);
+            cooked.tex_rgh_path_offset = append_texture_path(blob, material.tex_rgh, resource_manager, embedded_images);
+            cooked.tex_mtl_path_offset = append_texture_path(blob, material.tex_mtl, resource_manager, embedded_images);
+            cooked.tex_emm_path_offset = append_texture_path(blob, material.tex_emm, resource_manager, embedded_images);
+            cooked.tex_occ_path_offset = append_texture_path(blob, material.tex_occ, resource_manager, embedded_images);
+
+            //A texture packed at load time is stored as the images it was packed from, the loader packs them again if
+            //it's set to
+            const TextureResource* orm = get_loaded_texture(material.tex_orm, resource_manager);
+            if (orm != nullptr && strchr(orm->name, '|') == nullptr)
+            {
+                cooked.tex_orm_path_offset = append_texture_path(blob, material.tex_orm, resource_manager, embedded_images);
+            }
+            else if (orm != nullptr)
+            {
+                std::string source_paths[3];
+                split_packed_texture_name(orm->name, source_paths);
+                u64* source_offsets[3] = { &cooked.tex_occ_path_offset, &cooked.tex_rgh_path_offset, &cooked.tex_mtl_path_offset };
+                for (u32 channel = 0; channel < 3; ++channel) {
+                    std::string model_path;
+                    int image_index;
+                    if (split_embedded_image_name(source_paths[channel], model_path, image_index)) {
+                        printf("[ERROR] Failed to cook texture '%s', packed textures can only be cooked from image files!\n", orm->name);
+                        return false;
+                    }
+                    *source_offsets[channel] = source_paths[channel].empty() ? 0 : append_block(blob, source_paths[channel].c_str(), source_paths[channel].size() + 1);
+                }
+            }
+            cooked.mul_col = material.mul_col;
+            cooked.mul_emm = material.mul_emm;
+            cooked.mul_tex = material.mul_tex;
+            cooked.mul_nrm = material.mul_nrm;
+            cooked.mul_rgh = material.mul_rgh;
+            cooked.mul_mtl = material.mul_mtl;
+        }
+
+        //Skins
+        for (size_t i = 0; i < model.n_skins; ++i)
+        {
+            const Skin& skin = model.skins[i];
+            CookedSkin& cooked = cooked_skins[i];
+            cooked.joints_offset = append_block(blob, skin.joints, sizeof(u32) * skin.n_joints);
+            cooked.inverse_bind_matrices_offset = append_block(blob, skin.inverse_bind_matrices, sizeof(glm::mat4) * skin.n_joints);
+            cooked.n_joints = skin.n_joints;
+        }
+
+        //Embedded images and atlas textures, the table goes at the end since its size is only known now
+        if (!append_embedded_images(blob, embedded_images, cooked_images))
+        {
+            return false;
+        }
+        header.n_images = cooked_images.size();
+        header.images_offset = append_block(blob, cooked_images.data(), sizeof(CookedImage) * cooked_images.size());
+
+        //Animations, each in the form it's sampled in
+        for (size_t i = 0; i < model.n_animations; ++i)
+        {
+            const AnimationClip& clip = model.animations[i];
+            CookedAnimation& cooked = cooked_animations[i];
+            cooked.name_offset = append_block(blob, clip.name, strlen(clip.name) + 1);
+            cooked.tracks_offset = append_block(blob, clip.tracks, sizeof(AnimationTrack) * clip.n_tracks);
+            if (clip.track_keys != nullptr)
+            {
+                //The key ranges of the tracks tell how many key frames and key bytes there are
+                for (u32 t = 0; t < clip.n_tracks; ++t)
+                {
+                    const AnimationTrackKeys& keys = clip.track_keys[t];
+                    const u64 n_components = clip.tracks[t].path == AnimationPath::Rotation ? 4 : 3;
+                    cooked.n_key_frames = std::max<u64>(cooked.n_key_frames, static_cast<u64>(keys.first_key) + keys.n_keys);
+                    cooked.n_key_data_bytes = std::max<u64>(cooked.n_key_data_bytes, keys.key_data_offset + keys.n_keys * n_components * keys.key_size);
+                }
+                cooked.track_keys_offset = append_block(blob, clip.track_keys, sizeof(AnimationTrackKeys) * clip.n_tracks);
+                cooked.key_frames_offset = append_block(blob, clip.key_frames, sizeof(u16) * cooked.n_key_frames);
+                cooked.key_data_offset = append_block(blob, clip.key_data, static_cast<size_t>(cooked.n_key_data_bytes));
+            }
+            else
+            {
+                cooked.keys_offset = append_block(blob, clip.keys, sizeof(u16) * clip.n_frames * clip.n_channels);
+                cooked.channel_offsets_offset = append_block(blob, clip.channel_offsets, sizeof(float) * clip.n_channels);
+                cooked.channel_scales_offset = append_block(blob, clip.channel_scales, sizeof(float) * clip.n_channels);
+            }
+            cooked.duration = clip.duration;
+            cooked.sample_rate = clip.sample_rate;
+            cooked.n_frames = clip.n_frames;
+            cooked.n_channels = clip.n_channels;
+            cooked.n_tracks = clip.n_tracks;
+            cooked.rotation_stride = clip.rotation_stride;
+            cooked.is_compressed = clip.track_keys != nullptr;
+        }
+
+        //Fill in the tables
+        header.file_size = blob.size();
+        memcpy(&blob[0], &header, sizeof(header));
+        if (!cooked_meshes.empty()) memcpy(&blob[header.meshes_offset], cooked_meshes.data(), sizeof(CookedMesh) * cooked_meshes.size());
+        if (!cooked_materials.empty()) memcpy(&blob[header.materials_offset], cooked_materials.data(), sizeof(CookedMaterial) * cooked_materials.size());
+        if (!cooked_skins.empty()) memcpy(&blob[header.skins_offset], cooked_skins.data(), sizeof(CookedSkin) * cooked_skins.size());
+        if (!cooked_animations.empty()) memcpy(&blob[header.animations_offset], cooked_animations.data(), sizeof(CookedAnimation) * cooked_animations.size());
+
+        //Write to a temporary file first, so a failed write never leaves a truncated model behind
+        const std::string temp_path = output_path + ".tmp";
+        {
+            std::ofstream file_stream(temp_path, std::ios::binary | std::ios::trunc);
+            if (file_stream.is_open() == false)
+            {
+                printf("[ERROR] Failed to open file '%s' for writing!\n", temp_path.c_str());
+                return false;
+            }
+            file_stream.write(reinterpret_cast<const char*>(blob.data()), static_cast<std::streamsize>(blob.size()));
+            if (!file_stream)
+            {
+                printf("[ERROR] Failed to write file '%s'!\n", temp_path.c_str());
+                return false;
+            }
+        }
+        std::error_code error;
+        std::filesystem::rename(temp_path, output_path, error);
+        if (error)
+        {
+            printf("[ERROR] Failed to move '%s' to '%s': %s\n", temp_path.c_str(), output_path.c_str(), error.message().c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool cook_model(const std::string& source_path, const std::string& output_path, ResourceManager* resource_manager, const LodSettings& lod_settings)
+    {
+        //The model is only needed until it's written, so a batch of cooks doesn't fill the allocator
+        ModelResource* model = static_cast<ModelResource*>(dynamic_allocate(sizeof(ModelResource)));
+        AnimationCompressionReport animation_report;
+        if (!model->load(source_path, resource_manager, lod_settings, &animation_report))
+        {
+            printf("[ERROR] Failed to cook model '%s', it could not be loaded!\n", source_path.c_str());
+            model->unload();
+            return false;
+        }
+        if (model->n_animations > 0) animation_report.print(source_path.c_str());
+        const bool written = write_cooked_model(*model, resource_manager, output_path);
+        model->unload();
+        if (!written)
+        {
+            return false;
+        }
+        printf("Cooked model '%s' to '%s'\n", source_path.c_str(), output_path.c_str());
+        return true;
+    }
+}
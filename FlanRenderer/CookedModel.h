@@ -0,0 +1,125 @@
+#pragma once
+#include <string>
+#include "Resources.h"
+#include "MeshSimplifier.h"
+
+// Cooked models are written offline, in the same layout the loader keeps them in memory. Loading one is a single
+// file mapping plus a pointer fix-up per mesh, there is no parsing and no per-vertex work.
+//
+// Layout: the header, the mesh, material and skin tables, followed by the data blocks. Every block starts on a
+// 16 byte boundary, and everything is referenced by its offset from the start of the file. An offset of 0 means
+// the block is empty. Any change to the layout of the structs below, or of the vertex, skin weight, sub-mesh, LOD,
+// meshlet, instance, node or animation track structs, needs a version bump.
+
+namespace Flan {
+    struct ModelResource;
+
+    static constexpr char cooked_model_magic[4] = { 'F', 'M', 'D', 'L' };
+    static constexpr u32 cooked_model_version = 10;
+    static constexpr u64 cooked_model_alignment = 16;
+    static constexpr const char* cooked_model_extension = ".fmdl";
+
+    struct CookedModelHeader {
+        char magic[4];
+        u32 version;
+        u64 file_size;
+        u64 meshes_offset;
+        u64 n_meshes;
+        u64 materials_offset;
+        u64 n_materials;
+        u64 instances_offset;
+        u64 n_instances;
+        u64 nodes_offset;
+        u64 n_nodes;
+        u64 skins_offset;
+        u64 n_skins;
+        u64 animations_offset;
+        u64 n_animations;
+        u64 images_offset;
+        u64 n_images;
+        AABB bounds;
+    };
+
+    struct CookedMesh {
+        u64 vertices_offset;
+        u64 skin_offset; // n_verts skin weights, or 0 if the mesh isn't skinned
+        u64 indices_offset;
+        u64 lods_offset;
+        u64 sub_meshes_offset;
+        u64 meshlets_offset;
+        u64 meshlet_vertices_offset;
+        u64 meshlet_triangles_offset;
+        u64 n_verts;
+        u64 n_indices;
+        u64 n_lods;
+        u64 n_sub_meshes;
+        u64 n_meshlets;
+        u64 n_meshlet_vertices;
+        u64 n_meshlet_triangles;
+        u64 first_instance;
+        u64 n_instances;
+        MeshBounds bounds;
+    };
+
+    struct CookedSkin {
+        u64 joints_offset;
+        u64 inverse_bind_matrices_offset;
+        u64 n_joints;
+    };
+
+    // An animation clip, see Animation.h. Compressed clips store their keys, clips too long to compress their rows
+    struct CookedAnimation {
+        u64 name_offset;
+        u64 tracks_offset;
+        u64 track_keys_offset; // Compressed clips only
+        u64 key_frames_offset;
+        u64 key_data_offset;
+        u64 keys_offset; // Clips that aren't compressed only
+        u64 channel_offsets_offset;
+        u64 channel_scales_offset;
+        u64 n_key_frames;
+        u64 n_key_data_bytes;
+        float duration;
+        float sample_rate;
+        u32 n_frames;
+        u32 n_channels;
+        u32 n_tracks;
+        u32 rotation_stride;
+        u32 is_compressed;
+        u32 padding;
+    };
+
+    // An image embedded in the source glTF, stored as it was encoded there. Materials name it like the glTF loader
+    // does, see get_embedded_image_name, and the loader decodes it from here instead of from a file. Atlas textures
+    // built on import are stored here too, as DDS files, so cooked models don't depend on the texture cache
+    struct CookedImage {
+        u64 name_offset;
+        u64 data_offset;
+        u64 n_bytes;
+    };
+
+    // Textures are stored as null-terminated paths, so they go through the resource manager like any other texture.
+    // Occlusion, roughness and metalness keep their own paths even when they were packed at load time
+    struct CookedMaterial {
+        u64 tex_col_path_offset;
+        u64 tex_nrm_path_offset;
+        u64 tex_rgh_path_offset;
+        u64 tex_mtl_path_offset;
+        u64 tex_emm_path_offset;
+        u64 tex_occ_path_offset;
+        u64 tex_orm_path_offset; // An image that already holds all three, like glTF's metallic-roughness maps
+        glm::vec4 mul_col;
+        glm::vec3 mul_emm;
+        glm::vec2 mul_tex;
+        float mul_nrm;
+        float mul_rgh;
+        float mul_mtl;
+    };
+
+    // Write a loaded model to disk. Texture paths are looked up through the resource manager, and embedded images are
+    // read from the source glTF again
+    bool write_cooked_model(const ModelResource& model, ResourceManager* resource_manager, const std::string& output_path);
+
+    // Load a glTF file and write it out as a cooked model
+    bool cook_model(const std::string& source_path, const std::string& output_path, ResourceManager* resource_manager, const LodSettings& lod_settings = LodSettings{});
+}
@@ -0,0 +1,62 @@
+#include "CpuFeatures.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace Flan {
+    static void cpuid(int out[4], int leaf, int subleaf)
+    {
+#if defined(_MSC_VER)
+        __cpuidex(out, leaf, subleaf);
+#else
+        unsigned int a, b, c, d;
+        __cpuid_count(leaf, subleaf, a, b, c, d);
+        out[0] = (int)a; out[1] = (int)b; out[2] = (int)c; out[3] = (int)d;
+#endif
+    }
+
+    static unsigned long long xgetbv0()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((unsigned long long)hi << 32) | lo;
+#endif
+    }
+
+    static CpuFeatures detect_cpu_features()
+    {
+        CpuFeatures features;
+        int regs[4];
+
+        cpuid(regs, 0, 0);
+        const int max_leaf = regs[0];
+
+        cpuid(regs, 1, 0);
+        features.sse41 = (regs[2] & (1 << 19)) != 0;
+        features.fma = (regs[2] & (1 << 12)) != 0;
+
+        // AVX needs the OS to save the YMM registers on context switch, which is what OSXSAVE + XCR0 tell us
+        const bool os_saves_ymm = (regs[2] & (1 << 27)) && ((xgetbv0() & 0x6) == 0x6);
+        features.avx = os_saves_ymm && (regs[2] & (1 << 28));
+        features.fma = features.fma && features.avx;
+
+        if (max_leaf >= 7) {
+            cpuid(regs, 7, 0);
+            features.avx2 = features.avx && (regs[1] & (1 << 5));
+        }
+
+        return features;
+    }
+
+    const CpuFeatures& CpuFeatures::get()
+    {
+        static const CpuFeatures features = detect_cpu_features();
+        return features;
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// MSVC lets any function use any intrinsic, GCC and Clang need to be told per function
+#if defined(_MSC_VER) && !defined(__clang__)
+#define FLAN_TARGET_SSE41
+#define FLAN_TARGET_AVX
+#define FLAN_TARGET_AVX2
+#else
+#define FLAN_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define FLAN_TARGET_AVX __attribute__((target("avx")))
+#define FLAN_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace Flan {
+    // Instruction set extensions supported by both the CPU and the OS, queried once at startup
+    struct CpuFeatures {
+        bool sse41 = false;
+        bool avx = false;
+        bool avx2 = false;
+        bool fma = false;
+
+        static const CpuFeatures& get();
+    };
+}
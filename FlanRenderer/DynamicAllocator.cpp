@@ -55,6 +55,7 @@ namespace Flan {
 
     void* DynamicAllocator::allocate(u32 size, u32 align)
     {
+        std::lock_guard<std::recursive_mutex> lock(allocation_mutex);
 #ifdef NORMAL_ALLOC
         (void)align;
         return malloc(size);
@@ -171,6 +172,7 @@ namespace Flan {
 
     void DynamicAllocator::release(void* pointer)
     {
+        std::lock_guard<std::recursive_mutex> lock(allocation_mutex);
 #ifdef NORMAL_ALLOC
         return free(pointer);
 #else
@@ -235,6 +237,7 @@ namespace Flan {
 
     void* DynamicAllocator::reallocate(void* pointer, u32 size, u32 align)
     {
+        std::lock_guard<std::recursive_mutex> lock(allocation_mutex);
 #ifdef NORMAL_ALLOC
         (void)align;
         return realloc(pointer, size);
@@ -271,6 +274,7 @@ namespace Flan {
 
     void DynamicAllocator::debug_memory()
     {
+        std::lock_guard<std::recursive_mutex> lock(allocation_mutex);
 #ifdef DEBUG
         printf("------MEMORY-DEBUG------\n");
         MemoryManagerHeader* header = static_cast<MemoryManagerHeader*>(block_start);
@@ -296,6 +300,7 @@ namespace Flan {
 
     std::vector<MemoryChunk> DynamicAllocator::get_memory_chunk_list()
     {
+        std::lock_guard<std::recursive_mutex> lock(allocation_mutex);
         std::vector<MemoryChunk> memory_chunks;
         for (auto a : memory_labels)
         {
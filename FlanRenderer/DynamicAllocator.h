@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include "FlanTypes.h"
@@ -34,12 +35,16 @@ namespace Flan {
         void debug_memory();
         std::vector<MemoryChunk> get_memory_chunk_list();
 
-        std::string curr_memory_chunk_label = "unknown";
+        // Per thread, so loaders running on worker threads label their own allocations
+        inline static thread_local std::string curr_memory_chunk_label = "unknown";
         std::unordered_map<void*, std::string> memory_labels;
 
     private:
         void* block_start = nullptr;
         u32 block_size = 0;
         std::unordered_map<void*, std::string> chunk_names;
+
+        // Recursive, since reallocate calls allocate and release
+        std::recursive_mutex allocation_mutex;
     };
 }
\ No newline at end of file
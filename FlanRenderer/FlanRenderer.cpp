@@ -97,8 +97,8 @@ int main()
         input.update(static_cast<GLFWwindow*>(renderer.get_window()));
         update_camera(renderer, input, move_speed, delta_time, mouse_sensitivity, camera_transform);
         renderer.set_camera_transform(camera_transform);
-        renderer.draw_model({ quad_handle, quad_transform });
-        renderer.draw_model({ quad_handle, quad_transform2 });
+        renderer.draw_model({ quad_handle, quad_transform, 1 });
+        renderer.draw_model({ quad_handle, quad_transform2, 2 });
         quad_transform.rotation *= glm::quat(glm::vec3{ 0, 2.0f * delta_time, 0 });
         quad_transform2.rotation *= glm::quat(glm::vec3{ 0, -2.0f * delta_time, 0 });
         renderer.end_frame();
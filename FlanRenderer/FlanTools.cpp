@@ -0,0 +1,89 @@
+#include <cstring>
+#include <iostream>
+
+#include "Resources.h"
+#include "AssetPipeline.h"
+#include "Checks.h"
+#include "CookedModel.h"
+#include "TextureContainer.h"
+
+// Offline tools and checks, without a window or GPU. Every command exits with 1 when it fails, so build machines can
+// run them on real assets
+
+static void print_usage()
+{
+    puts("Usage:");
+    puts("    FlanTools --cook <input.gltf> <output.fmdl>");
+    puts("    FlanTools --build <input.gltf> <output.fmdl> [<input.gltf> <output.fmdl> ...]");
+    puts("    FlanTools --texture <input.png> <output.dds> [color|normal|linear|packed]");
+    puts("    FlanTools --skin <model.gltf> [frames]");
+    puts("    FlanTools --crowd <model.gltf> [instances]");
+    puts("    FlanTools --stream [<model.gltf> [budget in MB]]");
+    puts("    FlanTools --virtual-texture [cache tiles per side]");
+    puts("    FlanTools --texture-dedup [<model.gltf> ...]");
+    puts("    FlanTools --atlas [<model.gltf>]");
+    puts("    FlanTools --texture-compression");
+    puts("Checks without a model run on one they generate, see write_check_fixture in Checks.h");
+}
+
+int main(int argc, char** argv)
+{
+    // Initialize resource manager
+    Flan::ResourceManager resources;
+
+    // Offline cooking
+    if (argc == 4 && strcmp(argv[1], "--cook") == 0) {
+        return Flan::cook_model(argv[2], argv[3], &resources) ? 0 : 1;
+    }
+
+    // Incremental build
+    if (argc >= 4 && argc % 2 == 0 && strcmp(argv[1], "--build") == 0) {
+        Flan::AssetPipeline pipeline(&resources);
+        for (int i = 2; i < argc; i += 2) {
+            pipeline.add_model(argv[i], argv[i + 1]);
+        }
+        return pipeline.build().n_failed == 0 ? 0 : 1;
+    }
+
+    // Offline texture conversion, packed textures take "<red.png>|<green.png>|<blue.png>" as their input
+    if ((argc == 4 || argc == 5) && strcmp(argv[1], "--texture") == 0) {
+        Flan::TextureUsage usage = Flan::TextureUsage::Color;
+        if (argc == 5 && strcmp(argv[4], "normal") == 0) usage = Flan::TextureUsage::Normal;
+        if (argc == 5 && strcmp(argv[4], "linear") == 0) usage = Flan::TextureUsage::Linear;
+        if (argc == 5 && strcmp(argv[4], "packed") == 0) usage = Flan::TextureUsage::Packed;
+        return Flan::convert_texture(argv[2], argv[3], usage, &resources) ? 0 : 1;
+    }
+
+    // Checks
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--skin") == 0) {
+        return Flan::check_skinning(resources, argv[2], argc == 4 ? atoi(argv[3]) : 120) ? 0 : 1;
+    }
+    if ((argc == 3 || argc == 4) && strcmp(argv[1], "--crowd") == 0) {
+        return Flan::check_crowd(resources, argv[2], argc == 4 ? atoi(argv[3]) : 4096) ? 0 : 1;
+    }
+    if (argc >= 2 && argc <= 4 && strcmp(argv[1], "--stream") == 0) {
+        const std::string path = argc >= 3 ? argv[2] : Flan::write_check_fixture();
+        return !path.empty() && Flan::check_streaming(resources, path.c_str(), argc == 4 ? static_cast<size_t>(atoi(argv[3])) : 256) ? 0 : 1;
+    }
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "--virtual-texture") == 0) {
+        return Flan::check_virtual_texture(argc == 3 ? atoi(argv[2]) : 32) ? 0 : 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--texture-dedup") == 0) {
+        if (argc >= 3) {
+            return Flan::check_texture_dedup(resources, argc - 2, argv + 2) ? 0 : 1;
+        }
+        std::string path = Flan::write_check_fixture();
+        char* paths[] = { path.data() };
+        return !path.empty() && Flan::check_texture_dedup(resources, 1, paths) ? 0 : 1;
+    }
+    if ((argc == 2 || argc == 3) && strcmp(argv[1], "--atlas") == 0) {
+        const std::string path = argc == 3 ? argv[2] : Flan::write_check_fixture();
+        return !path.empty() && Flan::check_atlas(path.c_str()) ? 0 : 1;
+    }
+    if (argc == 2 && strcmp(argv[1], "--texture-compression") == 0) {
+        return Flan::check_texture_compression() ? 0 : 1;
+    }
+
+    print_usage();
+    return 1;
+}
@@ -7,13 +7,25 @@
 namespace Flan {
     typedef unsigned char           u8;
     typedef unsigned short          u16;
+#ifdef _WIN32
     typedef unsigned long           u32;
+#else
+    typedef unsigned int            u32; // long is 64 bit outside of Windows
+#endif
     typedef unsigned long long      u64;
     typedef signed char             i8;
     typedef signed short            i16;
+#ifdef _WIN32
     typedef signed long             i32;
+#else
+    typedef signed int              i32;
+#endif
     typedef signed long long        i64;
     typedef float                   f32;
     typedef double                  f64;
 
+    // Cooked files and GPU buffers are laid out with these
+    static_assert(sizeof(u8) == 1 && sizeof(u16) == 2 && sizeof(u32) == 4 && sizeof(u64) == 8, "Unsigned types have the wrong size");
+    static_assert(sizeof(i8) == 1 && sizeof(i16) == 2 && sizeof(i32) == 4 && sizeof(i64) == 8, "Signed types have the wrong size");
+
 }
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "GltfAccessors.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <tinygltf/tiny_gltf.h>
+
+namespace Flan {
+    // Finds the first byte of the accessor's data and the distance between elements
+    static const u8* get_accessor_data(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t& stride_out, int& n_components_out)
+    {
+        n_components_out = tinygltf::GetNumComponentsInType(accessor.type);
+        const int component_size = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+        if (n_components_out <= 0 || component_size <= 0 || accessor.bufferView < 0 || accessor.bufferView >= static_cast<int>(model.bufferViews.size())) {
+            return nullptr;
+        }
+
+        auto& bufferview = model.bufferViews[accessor.bufferView];
+        auto& buffer = model.buffers[bufferview.buffer].data;
+        const size_t element_size = static_cast<size_t>(component_size) * n_components_out;
+        stride_out = bufferview.byteStride != 0 ? bufferview.byteStride : element_size;
+
+        //Make sure the last element is still inside the buffer
+        const size_t start = bufferview.byteOffset + accessor.byteOffset;
+        if (accessor.count > 0 && start + stride_out * (accessor.count - 1) + element_size > buffer.size()) {
+            printf("[ERROR] Accessor reads past the end of its buffer!\n");
+            return nullptr;
+        }
+        return buffer.data() + start;
+    }
+
+    template <typename T>
+    static float read_component(const u8* data, bool normalized)
+    {
+        T value;
+        memcpy(&value, data, sizeof(T));
+        if (!normalized) {
+            return static_cast<float>(value);
+        }
+        //Signed types map the lowest value and the one above it both to -1
+        return std::max(static_cast<float>(value) / static_cast<float>(std::numeric_limits<T>::max()), -1.0f);
+    }
+
+    bool read_accessor_floats(const tinygltf::Model& model, int accessor_index, std::vector<float>& values_out, int& n_components_out)
+    {
+        if (accessor_index < 0 || accessor_index >= static_cast<int>(model.accessors.size())) {
+            return false;
+        }
+        auto& accessor = model.accessors[accessor_index];
+        size_t stride;
+        const u8* data = get_accessor_data(model, accessor, stride, n_components_out);
+        if (data == nullptr) {
+            return false;
+        }
+
+        const int component_size = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+        values_out.resize(accessor.count * n_components_out);
+        for (size_t i = 0; i < accessor.count; ++i) {
+            for (int c = 0; c < n_components_out; ++c) {
+                const u8* component = data + i * stride + static_cast<size_t>(c) * component_size;
+                float& value = values_out[i * n_components_out + c];
+                switch (accessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_FLOAT: value = read_component<float>(component, false); break;
+                case TINYGLTF_COMPONENT_TYPE_BYTE: value = read_component<int8_t>(component, accessor.normalized); break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: value = read_component<uint8_t>(component, accessor.normalized); break;
+                case TINYGLTF_COMPONENT_TYPE_SHORT: value = read_component<int16_t>(component, accessor.normalized); break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: value = read_component<uint16_t>(component, accessor.normalized); break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: value = read_component<uint32_t>(component, false); break;
+                default:
+                    printf("[ERROR] Accessor %i has unknown component type %i!\n", accessor_index, accessor.componentType);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool read_accessor_uints(const tinygltf::Model& model, int accessor_index, std::vector<u32>& values_out, int& n_components_out)
+    {
+        if (accessor_index < 0 || accessor_index >= static_cast<int>(model.accessors.size())) {
+            return false;
+        }
+        auto& accessor = model.accessors[accessor_index];
+        size_t stride;
+        const u8* data = get_accessor_data(model, accessor, stride, n_components_out);
+        if (data == nullptr) {
+            return false;
+        }
+
+        const int component_size = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+        values_out.resize(accessor.count * n_components_out);
+        for (size_t i = 0; i < accessor.count; ++i) {
+            for (int c = 0; c < n_components_out; ++c) {
+                const u8* component = data + i * stride + static_cast<size_t>(c) * component_size;
+                u32& value = values_out[i * n_components_out + c];
+                switch (accessor.componentType) {
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: value = *component; break;
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: { uint16_t v; memcpy(&v, component, sizeof(v)); value = v; break; }
+                case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: { uint32_t v; memcpy(&v, component, sizeof(v)); value = v; break; }
+                default:
+                    printf("[ERROR] Accessor %i is not an unsigned integer accessor!\n", accessor_index);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+}
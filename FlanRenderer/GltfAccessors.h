@@ -0,0 +1,18 @@
+#pragma once
+#include <vector>
+#include "FlanTypes.h"
+
+namespace tinygltf {
+    class Model;
+}
+
+// Readers for glTF accessors that honour the accessor and buffer view offsets, the byte stride and normalized
+// integer types. Every element is expanded to n_components values, so a VEC3 accessor gives 3 values per element.
+
+namespace Flan {
+    // Any component type, converted to float. Normalized integers are mapped to [0, 1] or [-1, 1]
+    bool read_accessor_floats(const tinygltf::Model& model, int accessor_index, std::vector<float>& values_out, int& n_components_out);
+
+    // Integer component types only, for indices and joint indices
+    bool read_accessor_uints(const tinygltf::Model& model, int accessor_index, std::vector<u32>& values_out, int& n_components_out);
+}
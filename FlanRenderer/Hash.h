@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include "FlanTypes.h"
+
+// 64 bit FNV-1a, for cache keys and content hashes. Not cryptographic, but stable across runs and platforms, so hashes
+// can be stored on disk.
+
+namespace Flan {
+    static constexpr u64 fnv_offset_basis = 0xcbf29ce484222325ull;
+    static constexpr u64 fnv_prime = 0x100000001b3ull;
+
+    inline u64 hash_bytes(const void* data, size_t size, u64 hash = fnv_offset_basis)
+    {
+        const u8* bytes = static_cast<const u8*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ bytes[i]) * fnv_prime;
+        }
+        return hash;
+    }
+
+    inline u64 hash_string(const std::string& string, u64 hash = fnv_offset_basis)
+    {
+        return hash_bytes(string.data(), string.size() + 1, hash);
+    }
+}
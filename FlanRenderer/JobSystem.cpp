@@ -0,0 +1,100 @@
+#include "JobSystem.h"
+
+#include <algorithm>
+
+namespace Flan {
+    JobSystem::JobSystem(size_t n_threads)
+    {
+        for (size_t i = 0; i < n_threads; ++i) {
+            m_workers.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    JobSystem::~JobSystem()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_shutting_down = true;
+        }
+        m_queue_signal.notify_all();
+        for (auto& worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    void JobSystem::submit(std::function<void()> job, JobCounter& counter)
+    {
+        counter.pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            m_queue.push_back({ std::move(job), &counter });
+        }
+        m_queue_signal.notify_one();
+    }
+
+    void JobSystem::wait(JobCounter& counter)
+    {
+        // Help out while our jobs are still running, this also prevents deadlocks when called from inside a job
+        while (counter.pending.load() > 0) {
+            if (!try_run_one()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    void JobSystem::parallel_for(size_t n_items, const std::function<void(size_t)>& function)
+    {
+        if (n_items == 0) {
+            return;
+        }
+
+        // A few batches per thread keeps the threads busy when items take uneven amounts of time
+        const size_t n_batches = std::min(n_items, (get_worker_count() + 1) * 4);
+        const size_t batch_size = (n_items + n_batches - 1) / n_batches;
+
+        JobCounter counter;
+        for (size_t begin = 0; begin < n_items; begin += batch_size) {
+            const size_t end = std::min(n_items, begin + batch_size);
+            submit([begin, end, &function] {
+                for (size_t i = begin; i < end; ++i) {
+                    function(i);
+                }
+            }, counter);
+        }
+        wait(counter);
+    }
+
+    bool JobSystem::try_run_one()
+    {
+        Job job;
+        {
+            std::lock_guard<std::mutex> lock(m_queue_mutex);
+            if (m_queue.empty()) {
+                return false;
+            }
+            job = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        job.function();
+        job.counter->pending.fetch_sub(1);
+        return true;
+    }
+
+    void JobSystem::worker_loop()
+    {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_queue_mutex);
+                m_queue_signal.wait(lock, [this] { return m_shutting_down || !m_queue.empty(); });
+                if (m_queue.empty()) {
+                    return;
+                }
+                job = std::move(m_queue.front());
+                m_queue.pop_front();
+            }
+            job.function();
+            job.counter->pending.fetch_sub(1);
+        }
+    }
+}
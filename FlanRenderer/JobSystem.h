@@ -0,0 +1,50 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Flan {
+    // Keeps track of how many jobs from one batch are still in flight, so the submitter can wait on just those
+    struct JobCounter {
+        std::atomic<size_t> pending{ 0 };
+    };
+
+    // A fixed pool of worker threads that pull jobs from a shared queue. Threads waiting on a counter help out with
+    // queued jobs instead of sleeping, so jobs can safely submit and wait on jobs of their own.
+    class JobSystem {
+    public:
+        JobSystem(size_t n_threads);
+        ~JobSystem();
+        void submit(std::function<void()> job, JobCounter& counter);
+        void wait(JobCounter& counter);
+        void parallel_for(size_t n_items, const std::function<void(size_t)>& function);
+        size_t get_worker_count() const { return m_workers.size(); }
+
+        inline static JobSystem* get_instance() {
+            if (instance == nullptr) {
+                const size_t n_cores = std::thread::hardware_concurrency();
+                instance = new JobSystem(n_cores > 1 ? n_cores - 1 : 1);
+            }
+            return instance;
+        }
+        inline static JobSystem* instance;
+
+    private:
+        struct Job {
+            std::function<void()> function;
+            JobCounter* counter;
+        };
+        bool try_run_one();
+        void worker_loop();
+
+        std::vector<std::thread> m_workers;
+        std::deque<Job> m_queue;
+        std::mutex m_queue_mutex;
+        std::condition_variable m_queue_signal;
+        bool m_shutting_down = false;
+    };
+}
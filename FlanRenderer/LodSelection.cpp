@@ -0,0 +1,72 @@
+#include "LodSelection.h"
+#include "Resources.h"
+#include "Hash.h"
+
+#include <algorithm>
+
+namespace Flan {
+    size_t LodHistoryKeyHash::operator()(const LodHistoryKey& key) const
+    {
+        //Field by field, so padding bytes never end up in the hash
+        u64 hash = hash_bytes(&key.model, sizeof(key.model));
+        hash = hash_bytes(&key.instance_id, sizeof(key.instance_id), hash);
+        hash = hash_bytes(&key.instance_index, sizeof(key.instance_index), hash);
+        return static_cast<size_t>(hash);
+    }
+
+    int LodHistory::get_previous_lod(const LodHistoryKey& key) const
+    {
+        const auto entry = m_entries.find(key);
+        return entry != m_entries.end() ? static_cast<int>(entry->second.lod) : -1;
+    }
+
+    void LodHistory::set_lod(const LodHistoryKey& key, u32 lod)
+    {
+        m_entries[key] = { lod, m_frame };
+    }
+
+    void LodHistory::end_frame(u32 max_unseen_frames)
+    {
+        std::erase_if(m_entries, [&](const auto& entry) { return m_frame - entry.second.last_frame > max_unseen_frames; });
+        ++m_frame;
+    }
+
+    float get_projection_scale(const glm::mat4& projection, float viewport_height)
+    {
+        // projection[1][1] is 1 / tan(fov_y / 2), which maps a unit at distance 1 to half the viewport height
+        return projection[1][1] * viewport_height * 0.5f;
+    }
+
+    float project_error(float error, float distance, float projection_scale)
+    {
+        return error * projection_scale / std::max(distance, 1e-4f);
+    }
+
+    u32 select_lod(const MeshLod* lods, size_t n_lods, const BoundingSphere& sphere, const glm::mat4& model_matrix,
+                   glm::vec3 camera_position, float projection_scale, int previous_lod, const LodSelectionSettings& settings)
+    {
+        if (n_lods <= 1) {
+            return 0;
+        }
+
+        // Errors are in model space, so scale them by the largest axis scale of the model matrix
+        const float scale = std::max({ glm::length(glm::vec3(model_matrix[0])), glm::length(glm::vec3(model_matrix[1])), glm::length(glm::vec3(model_matrix[2])) });
+        const glm::vec3 center = model_matrix * glm::vec4(sphere.center, 1.0f);
+        const float radius = sphere.radius * scale;
+
+        // Use the closest point of the bounding sphere, so nothing in the object is closer than the distance we use
+        const float distance = glm::length(center - camera_position) - radius;
+        if (distance <= 0.0f) {
+            return 0;
+        }
+
+        const float threshold = settings.pixel_threshold * settings.quality_bias;
+        for (int lod = static_cast<int>(n_lods) - 1; lod > 0; --lod) {
+            const float limit = (previous_lod >= 0 && lod > previous_lod) ? threshold * (1.0f - settings.hysteresis) : threshold;
+            if (project_error(lods[lod].error * scale, distance, projection_scale) <= limit) {
+                return static_cast<u32>(lod);
+            }
+        }
+        return 0;
+    }
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include "Bounds.h"
+#include "FlanTypes.h"
+
+namespace Flan {
+    struct MeshLod;
+
+    static constexpr size_t max_lod_levels = 8;
+
+    struct LodSelectionSettings {
+        // Largest error, in pixels, a LOD is allowed to show on screen
+        float pixel_threshold = 1.0f;
+
+        // Global quality knob, multiplies the threshold. Above 1 picks coarser LODs, below 1 finer ones
+        float quality_bias = 1.0f;
+
+        // Switching to a coarser LOD than last frame needs the error to be this much further below the threshold,
+        // which stops objects right at a boundary from flickering between two levels
+        float hysteresis = 0.25f;
+    };
+
+    // Per-LOD instance and triangle counts for one frame
+    struct LodStats {
+        u32 instances[max_lod_levels]{};
+        u64 triangles[max_lod_levels]{};
+        u32 draw_calls = 0; // Instances at the same LOD of the same mesh share one
+        void reset() { *this = LodStats{}; }
+    };
+
+    // One mesh instance of one drawn object, across frames
+    struct LodHistoryKey {
+        u64 model; // Resource handle of the model
+        u32 instance_id; // ModelDrawInfo::instance_id
+        u32 instance_index; // Into the model's instances
+        bool operator==(const LodHistoryKey& other) const = default;
+    };
+
+    struct LodHistoryKeyHash {
+        size_t operator()(const LodHistoryKey& key) const;
+    };
+
+    // The LOD every mesh instance picked last, for hysteresis. Entries that weren't drawn for a number of frames are
+    // dropped, so objects that come and go don't grow it forever
+    class LodHistory {
+    public:
+        int get_previous_lod(const LodHistoryKey& key) const; // -1 if unknown
+        void set_lod(const LodHistoryKey& key, u32 lod);
+        void end_frame(u32 max_unseen_frames); // Drops entries not set for more than max_unseen_frames frames
+        size_t size() const { return m_entries.size(); }
+
+    private:
+        struct Entry {
+            u32 lod;
+            u64 last_frame;
+        };
+        std::unordered_map<LodHistoryKey, Entry, LodHistoryKeyHash> m_entries;
+        u64 m_frame = 0;
+    };
+
+    // Pixels per world unit at distance 1, from the projection matrix and the viewport height
+    float get_projection_scale(const glm::mat4& projection, float viewport_height);
+
+    // Screen space size of a world space error at a given distance from the camera
+    float project_error(float error, float distance, float projection_scale);
+
+    // Pick the coarsest LOD whose projected error fits under the threshold. The bounding sphere is in model space,
+    // previous_lod is the level picked last frame for this object, or -1 if unknown
+    u32 select_lod(const MeshLod* lods, size_t n_lods, const BoundingSphere& sphere, const glm::mat4& model_matrix,
+                   glm::vec3 camera_position, float projection_scale, int previous_lod, const LodSelectionSettings& settings);
+}
@@ -0,0 +1,75 @@
+#include "MappedFile.h"
+
+#include <cstdio>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Flan {
+    bool MappedFile::open(const std::string& path, bool silent)
+    {
+        close();
+
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE) {
+            m_file = nullptr;
+            if (!silent)
+                printf("[ERROR] Failed to open file '%s'!\n", path.c_str());
+            return false;
+        }
+
+        LARGE_INTEGER file_size;
+        GetFileSizeEx(m_file, &file_size);
+        m_size = static_cast<size_t>(file_size.QuadPart);
+
+        m_mapping = m_size > 0 ? CreateFileMappingA(m_file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr) : nullptr;
+        m_data = m_mapping ? static_cast<u8*>(MapViewOfFile(m_mapping, FILE_MAP_COPY, 0, 0, 0)) : nullptr;
+#else
+        const int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0) {
+            if (!silent)
+                printf("[ERROR] Failed to open file '%s'!\n", path.c_str());
+            return false;
+        }
+
+        struct stat file_stat;
+        fstat(file, &file_stat);
+        m_size = static_cast<size_t>(file_stat.st_size);
+
+        void* mapping = m_size > 0 ? mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0) : MAP_FAILED;
+        m_data = mapping != MAP_FAILED ? static_cast<u8*>(mapping) : nullptr;
+        ::close(file);
+#endif
+
+        if (m_data == nullptr) {
+            if (!silent)
+                printf("[ERROR] Failed to map file '%s' into memory!\n", path.c_str());
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+#ifdef _WIN32
+        if (m_data) UnmapViewOfFile(m_data);
+        if (m_mapping) CloseHandle(m_mapping);
+        if (m_file) CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = nullptr;
+#else
+        if (m_data) munmap(m_data, m_size);
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+#include "FlanTypes.h"
+
+namespace Flan {
+    // A file mapped into memory. The mapping is copy-on-write: pages are shared with the OS file cache until
+    // something writes to them, and writes never reach the file on disk.
+    class MappedFile {
+    public:
+        MappedFile() {}
+        ~MappedFile() { close(); }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool open(const std::string& path, bool silent = false);
+        void close();
+        u8* get_data() const { return m_data; }
+        size_t get_size() const { return m_size; }
+
+    private:
+        u8* m_data = nullptr;
+        size_t m_size = 0;
+#ifdef _WIN32
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+#endif
+    };
+}
@@ -13,6 +13,8 @@ namespace Flan {
         ResourceHandle tex_rgh{ 0 };
         ResourceHandle tex_mtl{ 0 };
         ResourceHandle tex_emm{ 0 };
+        ResourceHandle tex_occ{ 0 };
+        ResourceHandle tex_orm{ 0 }; // Occlusion, roughness and metalness in one texture. tex_occ, when set, replaces its red
         glm::vec4 mul_col{ 1.0f, 1.0f, 1.0f, 1.0f };
         glm::vec3 mul_emm{ 1.0f, 1.0f, 1.0f };
         glm::vec2 mul_tex{ 1.0f, 1.0f };
@@ -0,0 +1,403 @@
+#include "MeshSimplifier.h"
+#include "Resources.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace Flan {
+    // Symmetric 4x4 matrix, only the upper triangle is stored. The total weight is kept so the error can be
+    // normalized back into a squared distance
+    struct Quadric {
+        double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+        double a11 = 0, a12 = 0, a13 = 0;
+        double a22 = 0, a23 = 0;
+        double a33 = 0;
+        double weight = 0;
+
+        static Quadric from_plane(glm::dvec3 n, double d, double weight)
+        {
+            Quadric q;
+            q.a00 = weight * n.x * n.x; q.a01 = weight * n.x * n.y; q.a02 = weight * n.x * n.z; q.a03 = weight * n.x * d;
+            q.a11 = weight * n.y * n.y; q.a12 = weight * n.y * n.z; q.a13 = weight * n.y * d;
+            q.a22 = weight * n.z * n.z; q.a23 = weight * n.z * d;
+            q.a33 = weight * d * d;
+            q.weight = weight;
+            return q;
+        }
+
+        void add(const Quadric& o)
+        {
+            a00 += o.a00; a01 += o.a01; a02 += o.a02; a03 += o.a03;
+            a11 += o.a11; a12 += o.a12; a13 += o.a13;
+            a22 += o.a22; a23 += o.a23;
+            a33 += o.a33;
+            weight += o.weight;
+        }
+
+        double evaluate(glm::dvec3 p) const
+        {
+            const double result =
+                a00 * p.x * p.x + 2 * a01 * p.x * p.y + 2 * a02 * p.x * p.z + 2 * a03 * p.x +
+                a11 * p.y * p.y + 2 * a12 * p.y * p.z + 2 * a13 * p.y +
+                a22 * p.z * p.z + 2 * a23 * p.z +
+                a33;
+            return weight > 0.0 ? std::max(result, 0.0) / weight : 0.0;
+        }
+    };
+
+    struct Collapse {
+        double cost;
+        u32 from;
+        u32 to;
+    };
+
+    static glm::vec3 triangle_normal(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+    {
+        return glm::cross(b - a, c - a);
+    }
+
+    static float triangle_uv_area(glm::vec2 a, glm::vec2 b, glm::vec2 c)
+    {
+        const glm::vec2 ab = b - a;
+        const glm::vec2 ac = c - a;
+        return ab.x * ac.y - ab.y * ac.x;
+    }
+
+    // Squared distance from a point to the closest point on a triangle (Ericson, Real-Time Collision Detection 5.1.5)
+    static float point_triangle_distance_squared(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+    {
+        const glm::vec3 ab = b - a;
+        const glm::vec3 ac = c - a;
+        const glm::vec3 ap = p - a;
+        const float d1 = glm::dot(ab, ap);
+        const float d2 = glm::dot(ac, ap);
+        if (d1 <= 0.0f && d2 <= 0.0f) return glm::dot(ap, ap);
+
+        const glm::vec3 bp = p - b;
+        const float d3 = glm::dot(ab, bp);
+        const float d4 = glm::dot(ac, bp);
+        if (d3 >= 0.0f && d4 <= d3) return glm::dot(bp, bp);
+
+        const float vc = d1 * d4 - d3 * d2;
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+            const glm::vec3 q = a + ab * (d1 / (d1 - d3));
+            return glm::dot(p - q, p - q);
+        }
+
+        const glm::vec3 cp = p - c;
+        const float d5 = glm::dot(ab, cp);
+        const float d6 = glm::dot(ac, cp);
+        if (d6 >= 0.0f && d5 <= d6) return glm::dot(cp, cp);
+
+        const float vb = d5 * d2 - d1 * d6;
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+            const glm::vec3 q = a + ac * (d2 / (d2 - d6));
+            return glm::dot(p - q, p - q);
+        }
+
+        const float va = d3 * d6 - d5 * d4;
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+            const glm::vec3 q = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            return glm::dot(p - q, p - q);
+        }
+
+        const float denominator = va + vb + vc;
+        if (denominator <= 0.0f) {
+            //Degenerate triangle, its edges were handled above
+            return std::min({ glm::dot(ap, ap), glm::dot(bp, bp), glm::dot(cp, cp) });
+        }
+        const glm::vec3 q = a + ab * (vb / denominator) + ac * (vc / denominator);
+        return glm::dot(p - q, p - q);
+    }
+
+    // Largest distance from the source mesh to the simplified one, sampled at the source vertices and triangle centres
+    // that the simplified mesh lost.
+    // The simplified triangles are bucketed in a uniform grid, and each sample searches rings of cells around it until
+    // no closer triangle can be left
+    static float measure_simplification_error(const Vertex* vertices, size_t n_verts, const u32* source_indices, size_t n_source_indices,
+                                              const std::vector<u32>& simplified_indices)
+    {
+        if (simplified_indices.empty() || n_source_indices == 0) {
+            return 0.0f;
+        }
+
+        //Simplified vertices are a subset of the source ones, so the source bounds hold both meshes
+        glm::vec3 bounds_min(FLT_MAX);
+        glm::vec3 bounds_max(-FLT_MAX);
+        for (size_t i = 0; i < n_source_indices; ++i) {
+            bounds_min = glm::min(bounds_min, vertices[source_indices[i]].position);
+            bounds_max = glm::max(bounds_max, vertices[source_indices[i]].position);
+        }
+        const size_t n_triangles = simplified_indices.size() / 3;
+        const int resolution = std::clamp(static_cast<int>(2.0 * std::cbrt(static_cast<double>(n_triangles))), 1, 128);
+        const glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+        const glm::vec3 cell_size = extent / static_cast<float>(resolution);
+        const auto cell_of = [&](glm::vec3 p) {
+            const glm::ivec3 cell = glm::ivec3((p - bounds_min) / cell_size);
+            return glm::clamp(cell, glm::ivec3(0), glm::ivec3(resolution - 1));
+        };
+        const auto cell_index = [&](glm::ivec3 cell) {
+            return static_cast<size_t>((cell.z * resolution + cell.y) * resolution + cell.x);
+        };
+
+        //Triangle lists per cell, in one array
+        const size_t n_cells = static_cast<size_t>(resolution) * resolution * resolution;
+        std::vector<u32> cell_offsets(n_cells + 1, 0);
+        std::vector<u32> cell_triangles;
+        for (int pass = 0; pass < 2; ++pass) {
+            std::vector<u32> fill;
+            if (pass == 1) {
+                for (size_t i = 0; i < n_cells; ++i) cell_offsets[i + 1] += cell_offsets[i];
+                cell_triangles.resize(cell_offsets[n_cells]);
+                fill.assign(cell_offsets.begin(), cell_offsets.end() - 1);
+            }
+            for (size_t t = 0; t < n_triangles; ++t) {
+                const glm::vec3 a = vertices[simplified_indices[t * 3 + 0]].position;
+                const glm::vec3 b = vertices[simplified_indices[t * 3 + 1]].position;
+                const glm::vec3 c = vertices[simplified_indices[t * 3 + 2]].position;
+                const glm::ivec3 first = cell_of(glm::min(a, glm::min(b, c)));
+                const glm::ivec3 last = cell_of(glm::max(a, glm::max(b, c)));
+                for (int z = first.z; z <= last.z; ++z) {
+                    for (int y = first.y; y <= last.y; ++y) {
+                        for (int x = first.x; x <= last.x; ++x) {
+                            const size_t cell = cell_index({ x, y, z });
+                            if (pass == 0) cell_offsets[cell + 1]++;
+                            else cell_triangles[fill[cell]++] = static_cast<u32>(t);
+                        }
+                    }
+                }
+            }
+        }
+
+        const auto distance_squared_to_simplified = [&](glm::vec3 p) {
+            const glm::ivec3 center = cell_of(p);
+            float best = FLT_MAX;
+            for (int ring = 0; ring < resolution; ++ring) {
+                for (int z = std::max(center.z - ring, 0); z <= std::min(center.z + ring, resolution - 1); ++z) {
+                    for (int y = std::max(center.y - ring, 0); y <= std::min(center.y + ring, resolution - 1); ++y) {
+                        for (int x = std::max(center.x - ring, 0); x <= std::min(center.x + ring, resolution - 1); ++x) {
+                            //Only the shell of this ring, the inside was searched already
+                            if (std::max({ abs(x - center.x), abs(y - center.y), abs(z - center.z) }) != ring) continue;
+                            const size_t cell = cell_index({ x, y, z });
+                            for (u32 i = cell_offsets[cell]; i < cell_offsets[cell + 1]; ++i) {
+                                const u32* triangle = &simplified_indices[cell_triangles[i] * 3];
+                                best = std::min(best, point_triangle_distance_squared(p, vertices[triangle[0]].position, vertices[triangle[1]].position, vertices[triangle[2]].position));
+                            }
+                        }
+                    }
+                }
+
+                //Anything outside the rings searched so far is at least as far away as their bounds
+                const glm::vec3 searched_min = bounds_min + glm::vec3(center - ring) * cell_size;
+                const glm::vec3 searched_max = bounds_min + glm::vec3(center + ring + 1) * cell_size;
+                const glm::vec3 margins = glm::min(p - searched_min, searched_max - p);
+                const float margin = std::min({ margins.x, margins.y, margins.z });
+                if (best <= margin * margin) break;
+            }
+            return best;
+        };
+
+        //Vertices the simplified mesh kept are on it, and so are the triangles between three of them, since collapses only
+        //remove triangles that lost a corner. Everything else is a sample
+        std::vector<bool> kept(n_verts, false);
+        for (u32 index : simplified_indices) kept[index] = true;
+        std::vector<glm::vec3> samples;
+        std::vector<bool> sampled(n_verts, false);
+        for (size_t i = 0; i + 2 < n_source_indices; i += 3) {
+            const u32* triangle = &source_indices[i];
+            if (kept[triangle[0]] && kept[triangle[1]] && kept[triangle[2]]) continue;
+            samples.push_back((vertices[triangle[0]].position + vertices[triangle[1]].position + vertices[triangle[2]].position) / 3.0f);
+            for (int c = 0; c < 3; ++c) {
+                if (kept[triangle[c]] || sampled[triangle[c]]) continue;
+                sampled[triangle[c]] = true;
+                samples.push_back(vertices[triangle[c]].position);
+            }
+        }
+
+        const size_t batch_size = 1024;
+        std::vector<float> batch_max((samples.size() + batch_size - 1) / batch_size, 0.0f);
+        JobSystem::get_instance()->parallel_for(batch_max.size(), [&](size_t batch) {
+            const size_t end = std::min(samples.size(), (batch + 1) * batch_size);
+            for (size_t i = batch * batch_size; i < end; ++i) {
+                batch_max[batch] = std::max(batch_max[batch], distance_squared_to_simplified(samples[i]));
+            }
+        });
+        const float max_distance_squared = batch_max.empty() ? 0.0f : *std::max_element(batch_max.begin(), batch_max.end());
+        return sqrtf(max_distance_squared);
+    }
+
+    float simplify_mesh(const Vertex* vertices, size_t n_verts, const u32* indices, size_t n_indices,
+                        size_t target_index_count, float max_error, std::vector<u32>& indices_out)
+    {
+        indices_out.assign(indices, indices + (n_indices / 3) * 3);
+
+        // Group vertices that share a position. A group with more than one vertex sits on an attribute seam
+        std::vector<u32> group_of(n_verts);
+        std::vector<u32> group_size;
+        {
+            struct PositionHash {
+                size_t operator()(const glm::vec3& p) const {
+                    u32 bits[3];
+                    memcpy(bits, &p, sizeof(bits));
+                    return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+                }
+            };
+            std::unordered_map<glm::vec3, u32, PositionHash> groups;
+            groups.reserve(n_verts);
+            for (size_t i = 0; i < n_verts; ++i) {
+                auto [it, inserted] = groups.try_emplace(vertices[i].position, static_cast<u32>(group_size.size()));
+                if (inserted) group_size.push_back(0);
+                group_of[i] = it->second;
+                group_size[it->second]++;
+            }
+        }
+        const size_t n_groups = group_size.size();
+
+        // Lock seam vertices, and vertices on edges that don't have exactly two triangles (open borders and non-manifold edges)
+        std::vector<bool> locked(n_verts, false);
+        {
+            std::unordered_map<u64, u32> edge_counts;
+            edge_counts.reserve(indices_out.size());
+            for (size_t i = 0; i < indices_out.size(); i += 3) {
+                for (int e = 0; e < 3; ++e) {
+                    u64 a = group_of[indices_out[i + e]];
+                    u64 b = group_of[indices_out[i + (e + 1) % 3]];
+                    if (a > b) std::swap(a, b);
+                    edge_counts[(a << 32) | b]++;
+                }
+            }
+            std::vector<bool> group_locked(n_groups, false);
+            for (auto& [edge, count] : edge_counts) {
+                if (count != 2) {
+                    group_locked[edge >> 32] = true;
+                    group_locked[edge & 0xFFFFFFFF] = true;
+                }
+            }
+            for (size_t i = 0; i < n_verts; ++i) {
+                locked[i] = group_locked[group_of[i]] || group_size[group_of[i]] > 1;
+            }
+        }
+
+        // Accumulate the area weighted plane of every triangle into its corners
+        std::vector<Quadric> quadrics(n_groups);
+        for (size_t i = 0; i < indices_out.size(); i += 3) {
+            const glm::dvec3 p0 = vertices[indices_out[i + 0]].position;
+            const glm::dvec3 p1 = vertices[indices_out[i + 1]].position;
+            const glm::dvec3 p2 = vertices[indices_out[i + 2]].position;
+            glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+            const double double_area = glm::length(normal);
+            if (double_area <= 0.0) continue;
+            normal /= double_area;
+            const Quadric q = Quadric::from_plane(normal, -glm::dot(normal, p0), double_area * 0.5);
+            for (int c = 0; c < 3; ++c) {
+                quadrics[group_of[indices_out[i + c]]].add(q);
+            }
+        }
+
+        const double max_cost = static_cast<double>(max_error) * max_error;
+        std::vector<u32> remap(n_verts);
+        std::vector<bool> touched(n_verts);
+        std::vector<Collapse> best(n_verts);
+        std::vector<Collapse> candidates;
+        std::vector<u32> adjacency_offsets;
+        std::vector<u32> adjacency;
+
+        while (indices_out.size() > target_index_count) {
+            // Vertex -> triangle adjacency for the current triangles
+            adjacency_offsets.assign(n_verts + 1, 0);
+            for (u32 index : indices_out) adjacency_offsets[index + 1]++;
+            for (size_t i = 0; i < n_verts; ++i) adjacency_offsets[i + 1] += adjacency_offsets[i];
+            adjacency.resize(indices_out.size());
+            {
+                std::vector<u32> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+                for (size_t i = 0; i < indices_out.size(); ++i) adjacency[fill[indices_out[i]]++] = static_cast<u32>(i / 3);
+            }
+
+            // Find the cheapest collapse for every unlocked vertex
+            for (size_t i = 0; i < n_verts; ++i) best[i] = { DBL_MAX, static_cast<u32>(i), static_cast<u32>(i) };
+            for (size_t i = 0; i < indices_out.size(); i += 3) {
+                for (int e = 0; e < 3; ++e) {
+                    for (int direction = 0; direction < 2; ++direction) {
+                        const u32 from = indices_out[i + (direction ? (e + 1) % 3 : e)];
+                        const u32 to = indices_out[i + (direction ? e : (e + 1) % 3)];
+                        if (locked[from] || group_of[from] == group_of[to]) continue;
+                        Quadric q = quadrics[group_of[from]];
+                        q.add(quadrics[group_of[to]]);
+                        const double cost = q.evaluate(vertices[to].position);
+                        if (cost < best[from].cost) best[from] = { cost, from, to };
+                    }
+                }
+            }
+            candidates.clear();
+            for (size_t i = 0; i < n_verts; ++i) {
+                if (best[i].cost <= max_cost) candidates.push_back(best[i]);
+            }
+            if (candidates.empty()) break;
+            std::sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+            // Collapse an independent set of edges, cheapest first. Each collapse removes about two triangles
+            const size_t collapses_wanted = (indices_out.size() - target_index_count) / 6 + 1;
+            size_t n_collapses = 0;
+            for (size_t i = 0; i < n_verts; ++i) remap[i] = static_cast<u32>(i);
+            std::fill(touched.begin(), touched.end(), false);
+
+            for (const Collapse& collapse : candidates) {
+                if (n_collapses >= collapses_wanted) break;
+                if (touched[collapse.from] || touched[collapse.to]) continue;
+
+                // Moving "from" onto "to" must not flip any of the remaining triangles around it, in 3D or in UV space
+                bool flips = false;
+                for (u32 a = adjacency_offsets[collapse.from]; a < adjacency_offsets[collapse.from + 1] && !flips; ++a) {
+                    const u32* triangle = &indices_out[adjacency[a] * 3];
+                    if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to) continue;
+                    const Vertex* corners[3];
+                    const Vertex* moved[3];
+                    for (int c = 0; c < 3; ++c) {
+                        corners[c] = &vertices[triangle[c]];
+                        moved[c] = triangle[c] == collapse.from ? &vertices[collapse.to] : corners[c];
+                    }
+                    const glm::vec3 normal_before = triangle_normal(corners[0]->position, corners[1]->position, corners[2]->position);
+                    const glm::vec3 normal_after = triangle_normal(moved[0]->position, moved[1]->position, moved[2]->position);
+                    const float uv_before = triangle_uv_area(corners[0]->texcoord0, corners[1]->texcoord0, corners[2]->texcoord0);
+                    const float uv_after = triangle_uv_area(moved[0]->texcoord0, moved[1]->texcoord0, moved[2]->texcoord0);
+                    flips = glm::dot(normal_before, normal_after) <= 0.0f || uv_before * uv_after < 0.0f;
+                }
+                if (flips) continue;
+
+                // Lock the whole neighbourhood for this pass, so the flip checks of later collapses stay valid
+                for (u32 a = adjacency_offsets[collapse.from]; a < adjacency_offsets[collapse.from + 1]; ++a) {
+                    for (int c = 0; c < 3; ++c) touched[indices_out[adjacency[a] * 3 + c]] = true;
+                }
+                touched[collapse.to] = true;
+
+                remap[collapse.from] = collapse.to;
+                quadrics[group_of[collapse.to]].add(quadrics[group_of[collapse.from]]);
+                ++n_collapses;
+            }
+            if (n_collapses == 0) break;
+
+            // Apply the collapses and drop the triangles that became degenerate
+            size_t write = 0;
+            for (size_t i = 0; i < indices_out.size(); i += 3) {
+                const u32 a = remap[indices_out[i + 0]];
+                const u32 b = remap[indices_out[i + 1]];
+                const u32 c = remap[indices_out[i + 2]];
+                if (a == b || b == c || a == c) continue;
+                indices_out[write++] = a;
+                indices_out[write++] = b;
+                indices_out[write++] = c;
+            }
+            indices_out.resize(write);
+        }
+
+        //Every collapse's cost only covers the planes merged into it so far, so the error is measured against the source
+        //mesh instead of added up from the collapses
+        if (indices_out.size() == (n_indices / 3) * 3) {
+            return 0.0f;
+        }
+        return measure_simplification_error(vertices, n_verts, indices, (n_indices / 3) * 3, indices_out);
+    }
+}
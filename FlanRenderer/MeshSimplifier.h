@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include "FlanTypes.h"
+
+namespace Flan {
+    struct Vertex;
+
+    struct LodSettings {
+        // Index count of each LOD level relative to the full resolution mesh, from fine to coarse
+        std::vector<float> target_ratios{ 0.5f, 0.25f, 0.125f };
+
+        // Maximum geometric error of any LOD, relative to the mesh's bounding sphere radius
+        float max_relative_error = 0.05f;
+
+        // Stop the chain once a level can't get below this fraction of the previous level's index count
+        float min_reduction = 0.9f;
+    };
+
+    // Simplify a triangle list with quadric error metrics (Garland & Heckbert), collapsing edges onto existing
+    // vertices so the vertex buffer can be shared between LODs. Vertices on attribute seams and open borders are
+    // locked, and collapses that would flip a triangle in either position or UV space are rejected, so UV layouts
+    // stay intact. Stops when the target index count is reached or no collapse is cheaper than max_error.
+    // Returns the largest distance from the source mesh to the simplified one, sampled at the source vertices and
+    // triangle centres, in the same units as the vertex positions. Every call starts from the source mesh, so this is
+    // the whole error of the result, not of the last collapse.
+    float simplify_mesh(const Vertex* vertices, size_t n_verts, const u32* indices, size_t n_indices,
+                        size_t target_index_count, float max_error, std::vector<u32>& indices_out);
+}
@@ -0,0 +1,115 @@
+#include "Meshlets.h"
+#include "Resources.h"
+
+namespace Flan {
+    void build_meshlets(const Vertex* vertices, size_t n_verts, const u32* indices, size_t n_indices, MeshletBuildResult& result,
+                        size_t max_vertices, size_t max_triangles)
+    {
+        // Local indices are stored as bytes
+        assert(max_vertices <= 256 && max_vertices >= 3 && max_triangles >= 1);
+
+        const size_t n_triangles = n_indices / 3;
+
+        // Build a vertex -> triangle adjacency list
+        std::vector<u32> adjacency_offsets(n_verts + 1, 0);
+        for (size_t i = 0; i < n_triangles * 3; ++i) {
+            adjacency_offsets[indices[i] + 1]++;
+        }
+        for (size_t i = 0; i < n_verts; ++i) {
+            adjacency_offsets[i + 1] += adjacency_offsets[i];
+        }
+        std::vector<u32> adjacency(n_triangles * 3);
+        {
+            std::vector<u32> fill = adjacency_offsets;
+            for (size_t i = 0; i < n_triangles * 3; ++i) {
+                adjacency[fill[indices[i]]++] = static_cast<u32>(i / 3);
+            }
+        }
+
+        std::vector<bool> triangle_used(n_triangles, false);
+        std::vector<int> local_index(n_verts, -1);
+        std::vector<u32> meshlet_vertices;
+        std::vector<u8> meshlet_triangles;
+        std::vector<u32> global_triangles;
+
+        auto count_new_vertices = [&](size_t triangle) {
+            int count = 0;
+            for (int c = 0; c < 3; ++c) {
+                count += local_index[indices[triangle * 3 + c]] < 0;
+            }
+            return count;
+        };
+
+        auto flush = [&]() {
+            if (meshlet_triangles.empty()) {
+                return;
+            }
+
+            // Compute the culling data from the triangles in mesh space
+            global_triangles.clear();
+            for (u8 local : meshlet_triangles) {
+                global_triangles.push_back(meshlet_vertices[local]);
+            }
+            Meshlet meshlet{};
+            meshlet.vertex_offset = static_cast<u32>(result.vertices.size());
+            meshlet.triangle_offset = static_cast<u32>(result.triangles.size());
+            meshlet.n_verts = static_cast<u32>(meshlet_vertices.size());
+            meshlet.n_triangles = static_cast<u32>(meshlet_triangles.size() / 3);
+            meshlet.sphere = compute_bounding_sphere(vertices, meshlet_vertices.data(), meshlet_vertices.size());
+            meshlet.cone = compute_normal_cone(vertices, global_triangles.data(), global_triangles.size(), meshlet.sphere);
+            result.meshlets.push_back(meshlet);
+            result.vertices.insert(result.vertices.end(), meshlet_vertices.begin(), meshlet_vertices.end());
+            result.triangles.insert(result.triangles.end(), meshlet_triangles.begin(), meshlet_triangles.end());
+
+            for (u32 vertex : meshlet_vertices) {
+                local_index[vertex] = -1;
+            }
+            meshlet_vertices.clear();
+            meshlet_triangles.clear();
+        };
+
+        size_t next_unused = 0;
+        for (size_t n_emitted = 0; n_emitted < n_triangles; ++n_emitted) {
+            // Look for the unused neighbouring triangle that adds the fewest new vertices
+            size_t best = SIZE_MAX;
+            int best_new_vertices = 4;
+            for (u32 vertex : meshlet_vertices) {
+                for (u32 i = adjacency_offsets[vertex]; i < adjacency_offsets[vertex + 1]; ++i) {
+                    const u32 triangle = adjacency[i];
+                    if (triangle_used[triangle]) continue;
+                    const int new_vertices = count_new_vertices(triangle);
+                    if (new_vertices < best_new_vertices) {
+                        best = triangle;
+                        best_new_vertices = new_vertices;
+                    }
+                }
+                if (best_new_vertices == 0) break;
+            }
+
+            // Nothing connected left, continue with the next triangle in index order
+            if (best == SIZE_MAX) {
+                while (triangle_used[next_unused]) {
+                    ++next_unused;
+                }
+                best = next_unused;
+                best_new_vertices = count_new_vertices(best);
+            }
+
+            // Start a new meshlet if this triangle doesn't fit
+            if (meshlet_vertices.size() + best_new_vertices > max_vertices || meshlet_triangles.size() / 3 >= max_triangles) {
+                flush();
+            }
+
+            for (int c = 0; c < 3; ++c) {
+                const u32 vertex = indices[best * 3 + c];
+                if (local_index[vertex] < 0) {
+                    local_index[vertex] = static_cast<int>(meshlet_vertices.size());
+                    meshlet_vertices.push_back(vertex);
+                }
+                meshlet_triangles.push_back(static_cast<u8>(local_index[vertex]));
+            }
+            triangle_used[best] = true;
+        }
+        flush();
+    }
+}
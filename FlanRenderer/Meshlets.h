@@ -0,0 +1,32 @@
+#pragma once
+#include <vector>
+#include "Bounds.h"
+
+namespace Flan {
+    struct Vertex;
+
+    static constexpr size_t meshlet_max_vertices = 64;
+    static constexpr size_t meshlet_max_triangles = 124;
+
+    // A small cluster of triangles with its own local index buffer. The local indices (3 per triangle) point
+    // into this meshlet's slice of the vertex list, which in turn holds indices into the mesh's vertex buffer.
+    struct Meshlet {
+        u32 vertex_offset;
+        u32 triangle_offset;
+        u32 n_verts;
+        u32 n_triangles;
+        BoundingSphere sphere;
+        NormalCone cone;
+    };
+
+    struct MeshletBuildResult {
+        std::vector<Meshlet> meshlets;
+        std::vector<u32> vertices;
+        std::vector<u8> triangles;
+    };
+
+    // Split a triangle list into meshlets and append them to the result. Triangles are grown greedily from the
+    // previous one, preferring the neighbour that adds the fewest new vertices, to keep meshlets compact.
+    void build_meshlets(const Vertex* vertices, size_t n_verts, const u32* indices, size_t n_indices, MeshletBuildResult& result,
+                        size_t max_vertices = meshlet_max_vertices, size_t max_triangles = meshlet_max_triangles);
+}
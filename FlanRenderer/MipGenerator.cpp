@@ -0,0 +1,346 @@
+#include "MipGenerator.h"
+#include "CpuFeatures.h"
+#include "JobSystem.h"
+#include "TextureResource.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace Flan {
+    // Rows handed to the job system at once
+    static constexpr u32 rows_per_job = 16;
+
+    // Radius of the windowed sinc filters, in destination texels
+    static constexpr float filter_radius = 3.0f;
+    static constexpr float kaiser_alpha = 4.0f;
+
+    static constexpr float pi = 3.14159265358979f;
+
+    // Source texels and weights of every destination texel along one axis
+    struct AxisTaps {
+        std::vector<u32> first; // Destination texel i uses taps first[i] to first[i + 1]
+        std::vector<u32> index;
+        std::vector<float> weight;
+    };
+
+    u32 get_mip_count(u32 width, u32 height)
+    {
+        u32 n_levels = 1;
+        for (u32 size = std::max(width, height); size > 1; size /= 2) {
+            n_levels++;
+        }
+        return n_levels;
+    }
+
+    u32 get_mip_size(u32 size, u32 level)
+    {
+        return std::max<u32>(size >> level, 1);
+    }
+
+    size_t get_mip_chain_pixels(u32 width, u32 height, u32 n_levels)
+    {
+        size_t n_pixels = 0;
+        for (u32 level = 0; level < n_levels; ++level) {
+            n_pixels += static_cast<size_t>(get_mip_size(width, level)) * get_mip_size(height, level);
+        }
+        return n_pixels;
+    }
+
+    static float sinc(float x)
+    {
+        if (fabsf(x) < 1e-5f) {
+            return 1.0f;
+        }
+        return sinf(pi * x) / (pi * x);
+    }
+
+    // Zeroth order modified Bessel function of the first kind, by its power series
+    static float bessel_i0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 32; ++k) {
+            term *= (x * 0.5f / static_cast<float>(k)) * (x * 0.5f / static_cast<float>(k));
+            sum += term;
+            if (term < sum * 1e-8f) break;
+        }
+        return sum;
+    }
+
+    static float evaluate_filter(MipFilter filter, float x)
+    {
+        const float t = x / filter_radius;
+        if (fabsf(t) >= 1.0f) {
+            return 0.0f;
+        }
+        if (filter == MipFilter::Kaiser) {
+            return sinc(x) * bessel_i0(kaiser_alpha * sqrtf(1.0f - t * t)) / bessel_i0(kaiser_alpha);
+        }
+        return sinc(x) * sinc(t);
+    }
+
+    static u32 get_edge_index(i64 index, u32 size, bool wrap)
+    {
+        if (wrap) {
+            const i64 wrapped = index % static_cast<i64>(size);
+            return static_cast<u32>(wrapped < 0 ? wrapped + size : wrapped);
+        }
+        return static_cast<u32>(std::clamp<i64>(index, 0, static_cast<i64>(size) - 1));
+    }
+
+    static void build_axis_taps(u32 src_size, u32 dst_size, const MipSettings& settings, AxisTaps& taps)
+    {
+        taps.first.assign(1, 0);
+        taps.index.clear();
+        taps.weight.clear();
+        const float scale = static_cast<float>(src_size) / static_cast<float>(dst_size);
+        for (u32 i = 0; i < dst_size; ++i) {
+            //Axes that keep their size, e.g. the width of a 1 texel wide texture, copy straight through
+            if (src_size == dst_size) {
+                taps.index.push_back(i);
+                taps.weight.push_back(1.0f);
+                taps.first.push_back(static_cast<u32>(taps.index.size()));
+                continue;
+            }
+
+            //Centre of the destination texel in source texels
+            const float center = (static_cast<float>(i) + 0.5f) * scale;
+            const float radius = settings.filter == MipFilter::Box ? scale * 0.5f : filter_radius * scale;
+            const i64 begin = static_cast<i64>(floorf(center - radius));
+            const i64 end = static_cast<i64>(ceilf(center + radius));
+            const size_t first_tap = taps.index.size();
+            float sum = 0.0f;
+            for (i64 j = begin; j < end; ++j) {
+                float weight;
+                if (settings.filter == MipFilter::Box) {
+                    //How much of the source texel the destination texel covers
+                    weight = std::min(static_cast<float>(j + 1), center + radius) - std::max(static_cast<float>(j), center - radius);
+                }
+                else {
+                    weight = evaluate_filter(settings.filter, (static_cast<float>(j) + 0.5f - center) / scale);
+                }
+                if (weight == 0.0f || (settings.filter == MipFilter::Box && weight < 0.0f)) {
+                    continue;
+                }
+                taps.index.push_back(get_edge_index(j, src_size, settings.wrap));
+                taps.weight.push_back(weight);
+                sum += weight;
+            }
+            for (size_t t = first_tap; t < taps.weight.size(); ++t) {
+                taps.weight[t] /= sum;
+            }
+            taps.first.push_back(static_cast<u32>(taps.index.size()));
+        }
+    }
+
+    // Filter one row of RGBA floats along x
+    static void filter_row(const float* src, const AxisTaps& taps, u32 dst_width, float* dst)
+    {
+        for (u32 x = 0; x < dst_width; ++x) {
+            __m128 sum = _mm_setzero_ps();
+            for (u32 t = taps.first[x]; t < taps.first[x + 1]; ++t) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(src + static_cast<size_t>(taps.index[t]) * 4), _mm_set1_ps(taps.weight[t])));
+            }
+            _mm_store_ps(dst + static_cast<size_t>(x) * 4, sum);
+        }
+    }
+
+    // Weighted sum of whole rows: out = rows[0] * weights[0] + rows[1] * weights[1] + ...
+    typedef void (*BlendRowsFn)(const float* const* rows, const float* weights, u32 n_rows, float* out, size_t n_floats);
+
+    static void blend_rows_sse(const float* const* rows, const float* weights, u32 n_rows, float* out, size_t n_floats)
+    {
+        for (size_t i = 0; i < n_floats; i += 4) {
+            __m128 sum = _mm_setzero_ps();
+            for (u32 r = 0; r < n_rows; ++r) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(rows[r] + i), _mm_set1_ps(weights[r])));
+            }
+            _mm_store_ps(out + i, sum);
+        }
+    }
+
+    FLAN_TARGET_AVX static void blend_rows_avx(const float* const* rows, const float* weights, u32 n_rows, float* out, size_t n_floats)
+    {
+        //Rows are whole RGBA texels, so a row that isn't a multiple of 8 floats ends in one SSE step
+        size_t i = 0;
+        for (; i + 8 <= n_floats; i += 8) {
+            __m256 sum = _mm256_setzero_ps();
+            for (u32 r = 0; r < n_rows; ++r) {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(rows[r] + i), _mm256_set1_ps(weights[r])));
+            }
+            _mm256_storeu_ps(out + i, sum);
+        }
+        if (i < n_floats) {
+            __m128 sum = _mm_setzero_ps();
+            for (u32 r = 0; r < n_rows; ++r) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_load_ps(rows[r] + i), _mm_set1_ps(weights[r])));
+            }
+            _mm_store_ps(out + i, sum);
+        }
+    }
+
+    static BlendRowsFn select_blend_rows()
+    {
+        return CpuFeatures::get().avx ? blend_rows_avx : blend_rows_sse;
+    }
+
+    // sRGB to linear for every 8 bit value
+    static const float* get_srgb_to_linear_table()
+    {
+        static const std::vector<float> table = [] {
+            std::vector<float> values(256);
+            for (int i = 0; i < 256; ++i) {
+                const float c = static_cast<float>(i) / 255.0f;
+                values[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    // Linear to 8 bit sRGB, in 4096 steps. That is finer than the steepest part of the curve near black
+    static constexpr u32 linear_to_srgb_steps = 4096;
+    static const u8* get_linear_to_srgb_table()
+    {
+        static const std::vector<u8> table = [] {
+            std::vector<u8> values(linear_to_srgb_steps);
+            for (u32 i = 0; i < linear_to_srgb_steps; ++i) {
+                const float c = static_cast<float>(i) / static_cast<float>(linear_to_srgb_steps - 1);
+                const float srgb = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+                values[i] = static_cast<u8>(std::clamp(srgb * 255.0f + 0.5f, 0.0f, 255.0f));
+            }
+            return values;
+        }();
+        return table.data();
+    }
+
+    static void pixels_to_floats(const Pixel32* pixels, size_t n_pixels, bool srgb, float* out)
+    {
+        const float* to_linear = get_srgb_to_linear_table();
+        constexpr float inverse_255 = 1.0f / 255.0f;
+        for (size_t i = 0; i < n_pixels; ++i) {
+            const Pixel32& pixel = pixels[i];
+            out[i * 4 + 0] = srgb ? to_linear[pixel.r] : static_cast<float>(pixel.r) * inverse_255;
+            out[i * 4 + 1] = srgb ? to_linear[pixel.g] : static_cast<float>(pixel.g) * inverse_255;
+            out[i * 4 + 2] = srgb ? to_linear[pixel.b] : static_cast<float>(pixel.b) * inverse_255;
+            out[i * 4 + 3] = static_cast<float>(pixel.a) * inverse_255;
+        }
+    }
+
+    // Clamp a filtered row, fix up normals, and write it out as 8 bit texels
+    static void floats_to_pixels(float* values, size_t n_pixels, const MipSettings& settings, Pixel32* out)
+    {
+        const u8* to_srgb = get_linear_to_srgb_table();
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (size_t i = 0; i < n_pixels; ++i) {
+            float* value = values + i * 4;
+            if (settings.normal_map) {
+                const float x = value[0] * 2.0f - 1.0f;
+                const float y = value[1] * 2.0f - 1.0f;
+                const float z = value[2] * 2.0f - 1.0f;
+                const float length = sqrtf(x * x + y * y + z * z);
+                const float inverse = length > 1e-6f ? 1.0f / length : 0.0f;
+                value[0] = x * inverse * 0.5f + 0.5f;
+                value[1] = y * inverse * 0.5f + 0.5f;
+                value[2] = length > 1e-6f ? z * inverse * 0.5f + 0.5f : 1.0f;
+            }
+
+            //The sinc filters overshoot near hard edges
+            _mm_store_ps(value, _mm_min_ps(_mm_max_ps(_mm_load_ps(value), zero), one));
+            Pixel32& pixel = out[i];
+            if (settings.srgb) {
+                constexpr float steps = static_cast<float>(linear_to_srgb_steps - 1);
+                pixel.r = to_srgb[static_cast<u32>(value[0] * steps + 0.5f)];
+                pixel.g = to_srgb[static_cast<u32>(value[1] * steps + 0.5f)];
+                pixel.b = to_srgb[static_cast<u32>(value[2] * steps + 0.5f)];
+            }
+            else {
+                pixel.r = static_cast<u8>(value[0] * 255.0f + 0.5f);
+                pixel.g = static_cast<u8>(value[1] * 255.0f + 0.5f);
+                pixel.b = static_cast<u8>(value[2] * 255.0f + 0.5f);
+            }
+            pixel.a = static_cast<u8>(value[3] * 255.0f + 0.5f);
+        }
+    }
+
+    void generate_mips(Pixel32* chain, u32 width, u32 height, u32 n_levels, const MipSettings& settings)
+    {
+        static const BlendRowsFn blend_rows = select_blend_rows();
+
+        n_levels = std::min(n_levels, get_mip_count(width, height));
+        if (settings.max_levels > 0) {
+            n_levels = std::min(n_levels, settings.max_levels);
+        }
+        if (n_levels <= 1 || chain == nullptr) {
+            return;
+        }
+
+        //Level 0 is converted a row at a time inside the first horizontal pass, later levels read the previous level's floats
+        std::vector<float> source;
+        std::vector<float> filtered_x;
+        std::vector<float> destination;
+        AxisTaps taps_x;
+        AxisTaps taps_y;
+        JobSystem* job_system = JobSystem::get_instance();
+        const Pixel32* src_pixels = chain;
+        Pixel32* dst_pixels = chain + static_cast<size_t>(width) * height;
+
+        for (u32 level = 1; level < n_levels; ++level) {
+            const u32 src_width = get_mip_size(width, level - 1);
+            const u32 src_height = get_mip_size(height, level - 1);
+            const u32 dst_width = get_mip_size(width, level);
+            const u32 dst_height = get_mip_size(height, level);
+            build_axis_taps(src_width, dst_width, settings, taps_x);
+            build_axis_taps(src_height, dst_height, settings, taps_y);
+
+            //Filter every source row along x
+            filtered_x.resize(static_cast<size_t>(dst_width) * src_height * 4);
+            const bool from_pixels = level == 1;
+            const u32 n_jobs_x = (src_height + rows_per_job - 1) / rows_per_job;
+            job_system->parallel_for(n_jobs_x, [&](size_t job) {
+                std::vector<float> row_values;
+                if (from_pixels) {
+                    row_values.resize(static_cast<size_t>(src_width) * 4);
+                }
+                const u32 end = std::min(src_height, static_cast<u32>(job + 1) * rows_per_job);
+                for (u32 y = static_cast<u32>(job) * rows_per_job; y < end; ++y) {
+                    const float* row = nullptr;
+                    if (from_pixels) {
+                        pixels_to_floats(src_pixels + static_cast<size_t>(y) * src_width, src_width, settings.srgb, row_values.data());
+                        row = row_values.data();
+                    }
+                    else {
+                        row = &source[static_cast<size_t>(y) * src_width * 4];
+                    }
+                    filter_row(row, taps_x, dst_width, &filtered_x[static_cast<size_t>(y) * dst_width * 4]);
+                }
+            });
+
+            //Then blend the filtered rows along y, and write out the level
+            destination.resize(static_cast<size_t>(dst_width) * dst_height * 4);
+            const u32 n_jobs_y = (dst_height + rows_per_job - 1) / rows_per_job;
+            job_system->parallel_for(n_jobs_y, [&](size_t job) {
+                std::vector<const float*> rows;
+                const u32 end = std::min(dst_height, static_cast<u32>(job + 1) * rows_per_job);
+                for (u32 y = static_cast<u32>(job) * rows_per_job; y < end; ++y) {
+                    const u32 first_tap = taps_y.first[y];
+                    const u32 n_taps = taps_y.first[y + 1] - first_tap;
+                    rows.resize(n_taps);
+                    for (u32 t = 0; t < n_taps; ++t) {
+                        rows[t] = &filtered_x[static_cast<size_t>(taps_y.index[first_tap + t]) * dst_width * 4];
+                    }
+                    float* out = &destination[static_cast<size_t>(y) * dst_width * 4];
+                    blend_rows(rows.data(), &taps_y.weight[first_tap], n_taps, out, static_cast<size_t>(dst_width) * 4);
+                    floats_to_pixels(out, dst_width, settings, dst_pixels + static_cast<size_t>(y) * dst_width);
+                }
+            });
+
+            std::swap(source, destination);
+            src_pixels = dst_pixels;
+            dst_pixels += static_cast<size_t>(dst_width) * dst_height;
+        }
+    }
+}
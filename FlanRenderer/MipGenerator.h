@@ -0,0 +1,39 @@
+#pragma once
+#include "FlanTypes.h"
+
+// CPU mip chain generation for RGBA8 textures. Every level is resampled from the one above it, kept in 32 bit float so
+// rounding doesn't build up down the chain. sRGB colour is converted to linear before filtering and back afterwards,
+// alpha is always linear. Normal maps are renormalized on every level.
+//
+// Resampling is separable: a horizontal pass with one RGBA pixel per SSE register, then a vertical pass that blends
+// whole rows 8 floats at a time with AVX. Rows are split across the job system.
+
+namespace Flan {
+    struct Pixel32;
+
+    enum struct MipFilter : u32 {
+        Box = 0, // Average of the pixels each texel covers, the cheapest, but a bit blurry and prone to aliasing
+        Kaiser, // Kaiser windowed sinc, sharp with little ringing
+        Lanczos, // Lanczos 3, the sharpest, with some ringing around hard edges
+    };
+
+    struct MipSettings {
+        MipFilter filter = MipFilter::Kaiser;
+        bool srgb = false; // RGB holds sRGB encoded colour
+        bool normal_map = false; // RGB holds unit vectors packed as v * 0.5 + 0.5
+        bool wrap = true; // Filter across the edges as if the texture tiles, otherwise clamp to them
+        u32 max_levels = 0; // 0 for a full chain down to 1x1
+    };
+
+    // Number of levels in a full chain, down to 1x1
+    u32 get_mip_count(u32 width, u32 height);
+
+    // Size of one level
+    u32 get_mip_size(u32 size, u32 level);
+
+    // Pixels in the first n_levels levels of a chain, stored back to back from level 0 down
+    size_t get_mip_chain_pixels(u32 width, u32 height, u32 n_levels);
+
+    // Fill levels 1 to n_levels - 1 of a chain, level 0 has to be in place already
+    void generate_mips(Pixel32* chain, u32 width, u32 height, u32 n_levels, const MipSettings& settings);
+}
@@ -4,22 +4,306 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #define STBI_MSC_SECURE_CRT
 #define TINYGLTF_NOEXCEPTION
+#define TINYGLTF_NO_EXTERNAL_IMAGE
 #define JSON_NOEXCEPTION
 #include <tinygltf/tiny_gltf.h>
+#include <algorithm>
+#include <array>
+#include <filesystem>
+#include <map>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
+#include "AnimationCompression.h"
+#include "CookedModel.h"
+#include "GltfAccessors.h"
+#include "JobSystem.h"
+#include "TextureAtlas.h"
 #include "TextureResource.h"
+#include "VertexKernels.h"
 
 
 
 namespace Flan {
-    bool ModelResource::load(std::string path, ResourceManager* resource_manager)
+    //The folder a file is in, ending in a separator so file names can be appended. Empty for a bare file name
+    static std::string get_folder(const std::string& path)
     {
+        const std::string folder = std::filesystem::path(path).parent_path().generic_string();
+        return folder.empty() ? "" : folder + "/";
+    }
+
+    //Texture maps share a file name root, e.g. "helmet_alb.png" and "helmet_nrm.png". Finds that root from the base colour texture
+    static bool get_material_texture_root(const tinygltf::Material& model_material, const tinygltf::Model& model, const std::string& path_to_model_folder, std::string& path_without_extension, std::string& file_extension)
+    {
+        int index_texture_colour = model_material.pbrMetallicRoughness.baseColorTexture.index;
+        if (index_texture_colour == -1)
+        {
+            return false;
+        }
+
+        //Find file path parts
+        int index_image_colour = model.textures[index_texture_colour].source;
+        auto& image = model.images[index_image_colour];
+        std::string file_path_from_model = image.uri;
+        std::string path_from_model_folder_to_texture_folder = get_folder(file_path_from_model);
+        file_extension = file_path_from_model.substr(file_path_from_model.find_last_of('.'));
+        std::string file_name_root;
+        if (file_path_from_model.find_last_of("alb.") != std::string::npos) {
+            file_name_root = file_path_from_model.substr(file_path_from_model.find_last_of('/') + 1, file_path_from_model.find_last_of("alb.") - file_path_from_model.find_last_of('/') - 4);
+        } else {
+            file_name_root = file_path_from_model.substr(file_path_from_model.find_last_of('/') + 1, file_path_from_model.size() - file_path_from_model.find_last_of('/') - 4);
+        }
+        path_without_extension = path_to_model_folder + path_from_model_folder_to_texture_folder + file_name_root;
+        return true;
+    }
+
+    //Occlusion maps are referenced by the glTF file directly, they don't follow the naming of the other maps
+    static std::string get_occlusion_texture_path(const tinygltf::Material& model_material, const tinygltf::Model& model, const std::string& path_to_model_folder)
+    {
+        const int index_texture = model_material.occlusionTexture.index;
+        if (index_texture < 0 || index_texture >= static_cast<int>(model.textures.size()))
+        {
+            return "";
+        }
+        const int index_image = model.textures[index_texture].source;
+        if (index_image < 0 || index_image >= static_cast<int>(model.images.size()) || model.images[index_image].uri.empty() || model.images[index_image].uri.rfind("data:", 0) == 0)
+        {
+            return "";
+        }
+        return path_to_model_folder + model.images[index_image].uri;
+    }
+
+    //Occlusion, roughness and metalness, as separate textures or packed into one, see TextureImportSettings::pack_orm
+    static void request_surface_textures(std::vector<TextureLoadRequest>& requests, const ResourceManager* resource_manager, const std::string& occlusion_path,
+                                         const std::string& roughness_path, const std::string& metal_path, MaterialResource& material)
+    {
+        if (occlusion_path.empty() && roughness_path.empty() && metal_path.empty())
+        {
+            return;
+        }
+        if (resource_manager->get_texture_import_settings().pack_orm)
+        {
+            requests.push_back({ get_packed_texture_name(occlusion_path, roughness_path, metal_path), TextureUsage::Packed, &material.tex_orm });
+            return;
+        }
+        if (!occlusion_path.empty())
+        {
+            requests.push_back({ occlusion_path, TextureUsage::Linear, &material.tex_occ });
+        }
+        if (!metal_path.empty())
+        {
+            requests.push_back({ metal_path, TextureUsage::Linear, &material.tex_mtl });
+        }
+        if (!roughness_path.empty())
+        {
+            requests.push_back({ roughness_path, TextureUsage::Linear, &material.tex_rgh });
+        }
+    }
+
+    //Images from a buffer view or a data URI are held by the model, the rest are files next to it
+    static bool is_embedded_image(const tinygltf::Image& image)
+    {
+        return image.uri.empty() || image.uri.rfind("data:", 0) == 0;
+    }
+
+    static constexpr char embedded_image_tag[] = "#image";
+
+    std::string get_embedded_image_name(const std::string& model_path, int image_index)
+    {
+        return model_path + embedded_image_tag + std::to_string(image_index);
+    }
+
+    bool split_embedded_image_name(const std::string& name, std::string& model_path_out, int& image_index_out)
+    {
+        const size_t tag = name.rfind(embedded_image_tag);
+        const size_t digits = tag == std::string::npos ? std::string::npos : tag + sizeof(embedded_image_tag) - 1;
+        if (digits == std::string::npos || digits == name.size() || name.find_first_not_of("0123456789", digits) != std::string::npos)
+        {
+            return false;
+        }
+        model_path_out = name.substr(0, tag);
+        image_index_out = atoi(name.c_str() + digits);
+        return true;
+    }
+
+    static int get_texture_image_index(const tinygltf::Model& model, int texture_index)
+    {
+        if (texture_index < 0 || texture_index >= static_cast<int>(model.textures.size()))
+        {
+            return -1;
+        }
+        const int image_index = model.textures[texture_index].source;
+        return image_index >= 0 && image_index < static_cast<int>(model.images.size()) ? image_index : -1;
+    }
+
+    //Base colour, normal, emissive, metallic-roughness and occlusion
+    static std::array<int, 5> get_material_texture_indices(const tinygltf::Material& model_material)
+    {
+        return { model_material.pbrMetallicRoughness.baseColorTexture.index, model_material.normalTexture.index, model_material.emissiveTexture.index,
+                 model_material.pbrMetallicRoughness.metallicRoughnessTexture.index, model_material.occlusionTexture.index };
+    }
+
+    //Materials with embedded images take every texture from the glTF material, instead of the file naming of get_material_texture_root
+    static bool uses_embedded_images(const tinygltf::Material& model_material, const tinygltf::Model& model)
+    {
+        for (int texture_index : get_material_texture_indices(model_material))
+        {
+            const int image_index = get_texture_image_index(model, texture_index);
+            if (image_index != -1 && is_embedded_image(model.images[image_index]))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //Embedded images are named after the model and their index, and decoded from the model's copy of the file
+    static void request_gltf_texture(std::vector<TextureLoadRequest>& requests, const tinygltf::Model& model, int texture_index, const std::string& model_path,
+                                     const std::string& path_to_model_folder, TextureUsage usage, ResourceHandle* handle_out)
+    {
+        const int image_index = get_texture_image_index(model, texture_index);
+        if (image_index == -1)
+        {
+            return;
+        }
+        const tinygltf::Image& image = model.images[image_index];
+        if (is_embedded_image(image))
+        {
+            requests.push_back({ get_embedded_image_name(model_path, image_index), usage, handle_out, &image });
+        }
+        else
+        {
+            requests.push_back({ path_to_model_folder + image.uri, usage, handle_out });
+        }
+    }
+
+    static bool get_gpu_instancing_transforms(const tinygltf::Node& node, const tinygltf::Model& model, std::vector<glm::mat4>& transforms_out);
+    static ModelNode get_node_rest_pose(const tinygltf::Node& node);
+
+    //Image data is not needed to find dependencies, so skip decoding it
+    static bool skip_image_data(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*)
+    {
+        return true;
+    }
+
+    //Keep embedded images encoded, they're decoded once when their textures load on the job system
+    static bool keep_encoded_image(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*)
+    {
+        image->image.assign(bytes, bytes + size);
+        image->as_is = true;
+        return true;
+    }
+
+    bool ModelResource::find_dependencies(const std::string& path, std::vector<std::string>& dependencies_out, std::vector<std::string>& optional_dependencies_out)
+    {
+        tinygltf::TinyGLTF loader;
+        tinygltf::Model model;
+        std::string error;
+        std::string warning;
+        loader.SetImageLoader(skip_image_data, nullptr);
+        loader.LoadASCIIFromFile(&model, &error, &warning, path);
+
+        if (!error.empty()) {
+            printf("[ERROR] %s\n", error.c_str());
+            return false;
+        }
+
+        std::string path_to_model_folder = get_folder(path);
+
+        //External buffers
+        for (auto& buffer : model.buffers)
+        {
+            if (!buffer.uri.empty() && buffer.uri.rfind("data:", 0) != 0)
+            {
+                dependencies_out.push_back(path_to_model_folder + buffer.uri);
+            }
+        }
+
+        //The texture maps load() picks up for every material
+        for (auto& model_material : model.materials)
+        {
+            std::string path_without_extension;
+            std::string file_extension;
+            if (uses_embedded_images(model_material, model))
+            {
+                for (int texture_index : get_material_texture_indices(model_material))
+                {
+                    const int image_index = get_texture_image_index(model, texture_index);
+                    if (image_index != -1 && !is_embedded_image(model.images[image_index]))
+                    {
+                        dependencies_out.push_back(path_to_model_folder + model.images[image_index].uri);
+                    }
+                }
+                continue;
+            }
+            if (get_material_texture_root(model_material, model, path_to_model_folder, path_without_extension, file_extension))
+            {
+                for (const char* suffix : { "alb", "nrm", "mtl", "rgh" })
+                {
+                    optional_dependencies_out.push_back(path_without_extension + suffix + file_extension);
+                }
+            }
+            const std::string occlusion_path = get_occlusion_texture_path(model_material, model, path_to_model_folder);
+            if (!occlusion_path.empty())
+            {
+                dependencies_out.push_back(occlusion_path);
+            }
+        }
+        return true;
+    }
+
+    bool ModelResource::read_embedded_images(const std::string& path, std::vector<std::vector<u8>>& images_out)
+    {
+        tinygltf::TinyGLTF loader;
+        tinygltf::Model model;
+        std::string error;
+        std::string warning;
+        loader.SetImageLoader(keep_encoded_image, nullptr);
+        loader.LoadASCIIFromFile(&model, &error, &warning, path);
+
+        if (!error.empty()) {
+            printf("[ERROR] %s\n", error.c_str());
+            return false;
+        }
+
+        images_out.clear();
+        images_out.resize(model.images.size());
+        for (size_t i = 0; i < model.images.size(); ++i)
+        {
+            if (is_embedded_image(model.images[i]))
+            {
+                images_out[i] = std::move(model.images[i].image);
+            }
+        }
+        return true;
+    }
+
+    bool ModelResource::load(std::string path, ResourceManager* resource_manager, const LodSettings& lod_settings, AnimationCompressionReport* animation_report_out)
+    {
+        cooked_file = nullptr;
+        meshes_cpu = nullptr;
+        meshes_gpu = nullptr;
+        materials_cpu = nullptr;
+        materials_gpu = nullptr;
+        n_meshes = 0;
+        n_materials = 0;
+        instances = nullptr;
+        n_instances = 0;
+        animations = nullptr;
+        n_animations = 0;
+        nodes = nullptr;
+        n_nodes = 0;
+        skins = nullptr;
+        n_skins = 0;
+
         //Load GLTF file
         tinygltf::TinyGLTF loader;
         tinygltf::Model model;
         std::string error;
         std::string warning;
 
+        loader.SetImageLoader(keep_encoded_image, nullptr);
         loader.LoadASCIIFromFile(&model, &error, &warning, path);
 
         if (!error.empty()) {
@@ -27,10 +311,12 @@ namespace Flan {
             return false;
         }
 
-        std::string path_to_model_folder = path.substr(0, path.find_last_of('/')) + "/";
+        std::string path_to_model_folder = get_folder(path);
 
-        //Parse materials
+        //Parse materials. Their textures are collected and loaded together once every material is known
         std::vector<MaterialResource> materials_vector;
+        std::vector<TextureLoadRequest> texture_requests;
+        materials_vector.reserve(model.materials.size());
         {
             for (auto& model_material : model.materials)
             {
@@ -45,121 +331,783 @@ namespace Flan {
                     model_material.pbrMetallicRoughness.baseColorFactor[3]
                 );
 
-                //Find base colour texture
-                int index_texture_colour = model_material.pbrMetallicRoughness.baseColorTexture.index;
-                if (index_texture_colour != -1)
+                //Embedded images go straight from the model to the textures, otherwise find the base colour texture
+                std::string path_without_extension;
+                std::string file_extension;
+                if (uses_embedded_images(model_material, model))
                 {
-                    //Find file path parts
-                    int index_image_colour = model.textures[index_texture_colour].source;
-                    auto image = model.images[index_image_colour];
-                    std::string file_path_from_model = image.uri;
-                    std::string path_from_model_folder_to_texture_folder = file_path_from_model.substr(0, file_path_from_model.find_last_of('/')) + "/";
-                    std::string file_extension = file_path_from_model.substr(file_path_from_model.find_last_of('.'));
-                    std::string file_name_root;
-                    if (file_path_from_model.find_last_of("alb.") != std::string::npos) {
-                        file_name_root = file_path_from_model.substr(file_path_from_model.find_last_of('/') + 1, file_path_from_model.find_last_of("alb.") - file_path_from_model.find_last_of('/') - 4);
-                    } else {
-                        file_name_root = file_path_from_model.substr(file_path_from_model.find_last_of('/') + 1, file_path_from_model.size() - file_path_from_model.find_last_of('/') - 4);
+                    //glTF keeps roughness and metalness in the green and blue of one image, the layout of tex_orm, and
+                    //often occlusion in its red
+                    MaterialResource& material = materials_vector.emplace_back(pbr_material);
+                    const tinygltf::PbrMetallicRoughness& metallic_roughness = model_material.pbrMetallicRoughness;
+                    request_gltf_texture(texture_requests, model, metallic_roughness.baseColorTexture.index, path, path_to_model_folder, TextureUsage::Color, &material.tex_col);
+                    request_gltf_texture(texture_requests, model, model_material.normalTexture.index, path, path_to_model_folder, TextureUsage::Normal, &material.tex_nrm);
+                    request_gltf_texture(texture_requests, model, model_material.emissiveTexture.index, path, path_to_model_folder, TextureUsage::Color, &material.tex_emm);
+                    request_gltf_texture(texture_requests, model, metallic_roughness.metallicRoughnessTexture.index, path, path_to_model_folder, TextureUsage::Packed, &material.tex_orm);
+                    if (get_texture_image_index(model, model_material.occlusionTexture.index) != get_texture_image_index(model, metallic_roughness.metallicRoughnessTexture.index))
+                    {
+                        request_gltf_texture(texture_requests, model, model_material.occlusionTexture.index, path, path_to_model_folder, TextureUsage::Linear, &material.tex_occ);
                     }
-                    std::string path_without_extension = path_to_model_folder + path_from_model_folder_to_texture_folder + file_name_root;
-
+                }
+                else if (get_material_texture_root(model_material, model, path_to_model_folder, path_without_extension, file_extension))
+                {
                     //Create textures - TODO: reassess whether this is scuffed or not
-                    ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - TexRes's - " + path;
-
-                    ResourceHandle handle_texture_alb = resource_manager->load_texture(path_without_extension + "alb" + file_extension);
-                    ResourceHandle handle_texture_nrm = resource_manager->load_texture(path_without_extension + "nrm" + file_extension);
-                    ResourceHandle handle_texture_mtl = resource_manager->load_texture(path_without_extension + "mtl" + file_extension);
-                    ResourceHandle handle_texture_rgh = resource_manager->load_texture(path_without_extension + "rgh" + file_extension);
-
-                    pbr_material.tex_col = handle_texture_alb;
-                    pbr_material.tex_nrm = handle_texture_nrm;
-                    pbr_material.tex_mtl = handle_texture_mtl;
-                    pbr_material.tex_rgh = handle_texture_rgh;
+                    //The handles are filled in by load_textures, the vector has its final capacity so the addresses hold
+                    MaterialResource& material = materials_vector.emplace_back(pbr_material);
+                    texture_requests.push_back({ path_without_extension + "alb" + file_extension, TextureUsage::Color, &material.tex_col });
+                    texture_requests.push_back({ path_without_extension + "nrm" + file_extension, TextureUsage::Normal, &material.tex_nrm });
+                    request_surface_textures(texture_requests, resource_manager, get_occlusion_texture_path(model_material, model, path_to_model_folder),
+                                             path_without_extension + "rgh" + file_extension, path_without_extension + "mtl" + file_extension, material);
+                }
+                else
+                {
+                    materials_vector.push_back(pbr_material);
                 }
-                materials_vector.push_back(pbr_material);
             }
         }
+        resource_manager->load_textures(texture_requests);
 
-        //Go through each node and add it to the primitive vector
-        std::unordered_map<int, MeshCPU> primitives;
+        //Go through each node and collect where every mesh is placed
+        std::vector<NodeInstance> node_instances;
         {
             //Get nodes
-            auto& scene = model.scenes[model.defaultScene];
-            traverse_nodes(scene.nodes, model, glm::mat4(1.0f), primitives);
+            auto& scene = model.scenes[model.defaultScene < 0 ? 0 : model.defaultScene];
+            traverse_nodes(scene.nodes, model, glm::mat4(1.0f), node_instances);
+        }
+
+        //Every glTF mesh is only built once, no matter how many nodes use it
+        std::map<int, std::vector<NodeInstance>> mesh_placements;
+        for (auto& node_instance : node_instances)
+        {
+            mesh_placements[node_instance.mesh].push_back(node_instance);
+        }
+        std::vector<PrimitiveWorkItem> work_items;
+        for (auto& [mesh_index, placements] : mesh_placements)
+        {
+            printf("Creating vertex array for mesh '%s' (%zu instances)\n", model.meshes[mesh_index].name.c_str(), placements.size());
+            for (int primitive_index = 0; primitive_index < static_cast<int>(model.meshes[mesh_index].primitives.size()); ++primitive_index)
+            {
+                work_items.push_back({ mesh_index, primitive_index });
+            }
+        }
+
+        //Build the vertex and index data for every primitive in parallel, in mesh space
+        std::vector<std::vector<Vertex>> work_vertices(work_items.size());
+        std::vector<std::vector<VertexSkin>> work_skins(work_items.size());
+        std::vector<std::vector<u32>> work_indices(work_items.size());
+        JobSystem::get_instance()->parallel_for(work_items.size(), [&](size_t i) {
+            auto& item = work_items[i];
+            auto& primitive = model.meshes[item.mesh].primitives[item.primitive];
+            create_vertex_array(work_vertices[i], work_skins[i], work_indices[i], primitive, model, glm::mat4(1.0f));
+        });
+
+        //Group the primitives of each glTF mesh by material, in work item order so the result doesn't depend on thread timing
+        std::map<std::pair<int, int>, std::vector<size_t>> batches;
+        for (size_t i = 0; i < work_items.size(); ++i)
+        {
+            auto& primitive = model.meshes[work_items[i].mesh].primitives[work_items[i].primitive];
+            batches[{ work_items[i].mesh, primitive.material }].push_back(i);
+        }
+
+        //Count the instances up front, every mesh of a glTF mesh gets all of its transforms
+        n_instances = 0;
+        for (auto& [key, items] : batches)
+        {
+            n_instances += mesh_placements[key.first].size();
         }
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Instances - " + path;
+        instances = static_cast<MeshInstance*>(dynamic_allocate(sizeof(MeshInstance) * n_instances));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
 
-        //Populate resource
+        //Populate resource, merging every batch into one mesh with a sub-mesh per primitive
         {
             ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Mesh - " + path;
-            meshes_cpu = (MeshCPU*)dynamic_allocate(sizeof(MeshCPU) * primitives.size());
+            meshes_cpu = (MeshCPU*)dynamic_allocate(sizeof(MeshCPU) * batches.size());
             ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Material - " + path;
-            materials_cpu = (MaterialResource*)dynamic_allocate(sizeof(MaterialResource) * primitives.size());
+            materials_cpu = (MaterialResource*)dynamic_allocate(sizeof(MaterialResource) * batches.size());
             n_meshes = 0;
             n_materials = 0;
 
-            int i = 0;
-            for (auto& [material_id, mesh] : primitives)
+            size_t instance_offset = 0;
+            for (auto& [key, items] : batches)
             {
+                const int material_id = key.second;
+                MeshCPU mesh{};
+                for (size_t item : items)
+                {
+                    mesh.n_verts += work_vertices[item].size();
+                    mesh.n_indices += work_indices[item].size();
+                }
+                mesh.n_sub_meshes = items.size();
+                const bool is_skinned = std::any_of(items.begin(), items.end(), [&](size_t item) { return !work_skins[item].empty(); });
+
+                ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - vertex buffers";
+                mesh.vertices = static_cast<Vertex*>(dynamic_allocate(sizeof(Vertex) * mesh.n_verts));
+                if (is_skinned)
+                {
+                    ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - skin weights";
+                    mesh.skin = static_cast<VertexSkin*>(dynamic_allocate(sizeof(VertexSkin) * mesh.n_verts));
+                }
+                ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
+                mesh.indices = static_cast<u32*>(dynamic_allocate(sizeof(u32) * mesh.n_indices));
+                ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - sub-meshes";
+                mesh.sub_meshes = static_cast<SubMesh*>(dynamic_allocate(sizeof(SubMesh) * mesh.n_sub_meshes));
+                ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+
+                //Append each primitive, offsetting its indices so they point into the merged vertex buffer
+                u32 vertex_offset = 0;
+                u32 index_offset = 0;
+                for (size_t sub_mesh_index = 0; sub_mesh_index < items.size(); ++sub_mesh_index)
+                {
+                    auto& vertices = work_vertices[items[sub_mesh_index]];
+                    auto& indices = work_indices[items[sub_mesh_index]];
+                    memcpy(&mesh.vertices[vertex_offset], vertices.data(), sizeof(Vertex) * vertices.size());
+                    if (is_skinned)
+                    {
+                        //Primitives without weights in a skinned mesh follow the first joint
+                        auto& skin = work_skins[items[sub_mesh_index]];
+                        std::copy(skin.begin(), skin.end(), &mesh.skin[vertex_offset]);
+                        std::fill(&mesh.skin[vertex_offset + skin.size()], &mesh.skin[vertex_offset + vertices.size()], VertexSkin{});
+                    }
+                    for (size_t i = 0; i < indices.size(); ++i)
+                    {
+                        mesh.indices[index_offset + i] = indices[i] + vertex_offset;
+                    }
+                    mesh.sub_meshes[sub_mesh_index] = { index_offset, static_cast<u32>(indices.size()), vertex_offset, static_cast<u32>(vertices.size()), 0, 0, {} };
+                    vertex_offset += static_cast<u32>(vertices.size());
+                    index_offset += static_cast<u32>(indices.size());
+                }
+
+                //Place the mesh everywhere its glTF mesh is used
+                auto& placements = mesh_placements[key.first];
+                mesh.first_instance = instance_offset;
+                mesh.n_instances = placements.size();
+                for (auto& placement : placements)
+                {
+                    instances[instance_offset++] = { placement.world_matrix, static_cast<u32>(n_meshes), placement.skin >= 0 ? static_cast<u32>(placement.skin) : no_skin };
+                }
+
+                //Primitives without a material get the default one
                 meshes_cpu[n_meshes] = mesh;
-                materials_cpu[n_materials] = materials_vector[material_id];
+                materials_cpu[n_materials] = material_id >= 0 ? materials_vector[material_id] : MaterialResource{};
                 n_meshes += 1;
                 n_materials += 1;
             }
         }
 
+        //Pack the small textures of the materials into atlases, which moves the UVs of the meshes that use them
+        if (resource_manager->get_texture_import_settings().atlas.enabled)
+        {
+            const TextureAtlasReport atlas_report = build_texture_atlases(meshes_cpu, materials_cpu, n_meshes, resource_manager);
+            if (atlas_report.n_pages > 0)
+            {
+                printf("Packed %zu of the %zu textures of '%s' into %zu atlas textures on %zu pages\n", atlas_report.n_packed, atlas_report.n_textures, path.c_str(),
+                       atlas_report.n_atlases, atlas_report.n_pages);
+            }
+        }
+
+        //Compute bounds for every mesh and sub-mesh, then combine the placed mesh AABBs into one for the whole model
+        JobSystem::get_instance()->parallel_for(n_meshes, [&](size_t mesh_index) {
+            MeshCPU& mesh = meshes_cpu[mesh_index];
+            mesh.bounds = compute_mesh_bounds(mesh.vertices, mesh.indices, mesh.n_indices);
+            for (size_t i = 0; i < mesh.n_sub_meshes; ++i)
+            {
+                SubMesh& sub_mesh = mesh.sub_meshes[i];
+                sub_mesh.bounds = compute_mesh_bounds(mesh.vertices, &mesh.indices[sub_mesh.first_index], sub_mesh.n_indices);
+            }
+        });
+        bounds = AABB{};
+        for (size_t i = 0; i < n_instances; ++i)
+        {
+            bounds = merge_aabb(bounds, transform_aabb(meshes_cpu[instances[i].mesh_index].bounds.aabb, instances[i].transform));
+        }
+
+        //Split every sub-mesh into meshlets
+        std::vector<MeshletBuildResult> meshlet_results(n_meshes);
+        JobSystem::get_instance()->parallel_for(n_meshes, [&](size_t mesh_index) {
+            MeshCPU& mesh = meshes_cpu[mesh_index];
+            MeshletBuildResult& result = meshlet_results[mesh_index];
+            std::vector<u32> local_indices;
+            for (size_t i = 0; i < mesh.n_sub_meshes; ++i)
+            {
+                //Build on the sub-mesh's own vertex range, so the adjacency data only covers that range
+                SubMesh& sub_mesh = mesh.sub_meshes[i];
+                local_indices.resize(sub_mesh.n_indices);
+                for (u32 j = 0; j < sub_mesh.n_indices; ++j)
+                {
+                    local_indices[j] = mesh.indices[sub_mesh.first_index + j] - sub_mesh.first_vertex;
+                }
+                const size_t first_vertex = result.vertices.size();
+                sub_mesh.first_meshlet = static_cast<u32>(result.meshlets.size());
+                build_meshlets(&mesh.vertices[sub_mesh.first_vertex], sub_mesh.n_verts, local_indices.data(), local_indices.size(), result);
+                sub_mesh.n_meshlets = static_cast<u32>(result.meshlets.size()) - sub_mesh.first_meshlet;
+                for (size_t j = first_vertex; j < result.vertices.size(); ++j)
+                {
+                    result.vertices[j] += sub_mesh.first_vertex;
+                }
+            }
+        });
+        for (size_t mesh_index = 0; mesh_index < n_meshes; ++mesh_index)
+        {
+            MeshCPU& mesh = meshes_cpu[mesh_index];
+            MeshletBuildResult& result = meshlet_results[mesh_index];
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - meshlets";
+            mesh.meshlets = static_cast<Meshlet*>(dynamic_allocate(sizeof(Meshlet) * result.meshlets.size()));
+            mesh.meshlet_vertices = static_cast<u32*>(dynamic_allocate(sizeof(u32) * result.vertices.size()));
+            mesh.meshlet_triangles = static_cast<u8*>(dynamic_allocate(sizeof(u8) * result.triangles.size()));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+            memcpy(mesh.meshlets, result.meshlets.data(), sizeof(Meshlet) * result.meshlets.size());
+            memcpy(mesh.meshlet_vertices, result.vertices.data(), sizeof(u32) * result.vertices.size());
+            memcpy(mesh.meshlet_triangles, result.triangles.data(), sizeof(u8) * result.triangles.size());
+            mesh.n_meshlets = result.meshlets.size();
+            mesh.n_meshlet_vertices = result.vertices.size();
+            mesh.n_meshlet_triangles = result.triangles.size() / 3;
+        }
+
+        //Generate the LOD chain. Every level is simplified from LOD 0 and shares its vertex buffer
+        std::vector<std::vector<std::vector<u32>>> lod_indices(n_meshes);
+        std::vector<std::vector<float>> lod_errors(n_meshes);
+        JobSystem::get_instance()->parallel_for(n_meshes, [&](size_t mesh_index) {
+            MeshCPU& mesh = meshes_cpu[mesh_index];
+            const float max_error = lod_settings.max_relative_error * mesh.bounds.sphere.radius;
+            size_t previous_count = mesh.n_indices;
+            for (float ratio : lod_settings.target_ratios)
+            {
+                std::vector<u32> indices;
+                const size_t target_count = static_cast<size_t>(static_cast<float>(mesh.n_indices) * ratio);
+                const float error = simplify_mesh(mesh.vertices, mesh.n_verts, mesh.indices, mesh.n_indices, target_count, max_error, indices);
+                if (indices.empty() || static_cast<float>(indices.size()) > static_cast<float>(previous_count) * lod_settings.min_reduction)
+                {
+                    break;
+                }
+                previous_count = indices.size();
+                lod_indices[mesh_index].push_back(std::move(indices));
+                lod_errors[mesh_index].push_back(error);
+            }
+        });
+        for (size_t mesh_index = 0; mesh_index < n_meshes; ++mesh_index)
+        {
+            MeshCPU& mesh = meshes_cpu[mesh_index];
+            size_t total_indices = mesh.n_indices;
+            for (auto& indices : lod_indices[mesh_index])
+            {
+                total_indices += indices.size();
+            }
+
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - LODs";
+            mesh.n_lods = lod_indices[mesh_index].size() + 1;
+            mesh.lods = static_cast<MeshLod*>(dynamic_allocate(sizeof(MeshLod) * mesh.n_lods));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
+            mesh.indices = static_cast<u32*>(dynamic_reallocate(mesh.indices, static_cast<u32>(sizeof(u32) * total_indices)));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+
+            mesh.lods[0] = { 0, static_cast<u32>(mesh.n_indices), 0.0f };
+            for (size_t lod = 1; lod < mesh.n_lods; ++lod)
+            {
+                auto& indices = lod_indices[mesh_index][lod - 1];
+                const u32 first_index = mesh.lods[lod - 1].first_index + mesh.lods[lod - 1].n_indices;
+                memcpy(&mesh.indices[first_index], indices.data(), sizeof(u32) * indices.size());
+                mesh.lods[lod] = { first_index, static_cast<u32>(indices.size()), lod_errors[mesh_index][lod - 1] };
+            }
+            mesh.n_indices = total_indices;
+        }
+
+        //Keep the node tree in its rest pose, the skins and animations refer to it by glTF node index
+        {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Nodes - " + path;
+            n_nodes = model.nodes.size();
+            nodes = static_cast<ModelNode*>(dynamic_allocate(sizeof(ModelNode) * n_nodes));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+            for (size_t i = 0; i < n_nodes; ++i)
+            {
+                nodes[i] = get_node_rest_pose(model.nodes[i]);
+            }
+            for (size_t i = 0; i < n_nodes; ++i)
+            {
+                for (int child : model.nodes[i].children)
+                {
+                    if (child >= 0 && child < static_cast<int>(n_nodes)) nodes[child].parent = static_cast<i32>(i);
+                }
+            }
+        }
+
+        //Resample the animations into runtime clips and compress them
+        {
+            std::vector<AnimationClip> clips(model.animations.size());
+            std::vector<AnimationCompressionReport> reports(model.animations.size());
+            std::vector<char> imported(model.animations.size(), 0);
+            JobSystem::get_instance()->parallel_for(model.animations.size(), [&](size_t i) {
+                std::vector<float> samples;
+                imported[i] = import_animation(model.animations[i], model, animation_default_sample_rate, clips[i], &samples);
+                if (imported[i]) compress_animation(clips[i], nodes, n_nodes, AnimationCompressionSettings{}, &reports[i], &samples);
+            });
+            if (animation_report_out != nullptr) {
+                *animation_report_out = AnimationCompressionReport{};
+                for (auto& report : reports) animation_report_out->add(report);
+            }
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Animations - " + path;
+            animations = static_cast<AnimationClip*>(dynamic_allocate(sizeof(AnimationClip) * clips.size()));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+            for (size_t i = 0; i < clips.size(); ++i)
+            {
+                if (imported[i]) animations[n_animations++] = clips[i];
+            }
+        }
+
+        //Import the skins, a skin without inverse bind matrices uses identity matrices
+        {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Skins - " + path;
+            skins = static_cast<Skin*>(dynamic_allocate(sizeof(Skin) * model.skins.size()));
+            for (auto& gltf_skin : model.skins)
+            {
+                Skin& skin = skins[n_skins++];
+                skin.n_joints = static_cast<u32>(gltf_skin.joints.size());
+                skin.joints = static_cast<u32*>(dynamic_allocate(sizeof(u32) * skin.n_joints));
+                skin.inverse_bind_matrices = static_cast<glm::mat4*>(dynamic_allocate(sizeof(glm::mat4) * skin.n_joints));
+
+                std::vector<float> matrices;
+                int n_components = 0;
+                const bool has_matrices = gltf_skin.inverseBindMatrices >= 0 && read_accessor_floats(model, gltf_skin.inverseBindMatrices, matrices, n_components) &&
+                                          n_components == 16 && matrices.size() >= static_cast<size_t>(skin.n_joints) * 16;
+                if (gltf_skin.inverseBindMatrices >= 0 && !has_matrices)
+                {
+                    printf("[ERROR] Skin '%s' has invalid inverse bind matrices, using identity matrices instead\n", gltf_skin.name.c_str());
+                }
+                for (u32 i = 0; i < skin.n_joints; ++i)
+                {
+                    const int joint = gltf_skin.joints[i];
+                    skin.joints[i] = joint >= 0 && joint < static_cast<int>(n_nodes) ? static_cast<u32>(joint) : 0;
+                    skin.inverse_bind_matrices[i] = has_matrices ? glm::make_mat4(&matrices[static_cast<size_t>(i) * 16]) : glm::mat4(1.0f);
+                }
+            }
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        }
+
         resource_type = ResourceType::Model;
         scheduled_for_unload = false;
         return true;
     }
 
-    void ModelResource::traverse_nodes(std::vector<int>& node_indices, tinygltf::Model& model, glm::mat4 local_transform, std::unordered_map<int, MeshCPU>& primitives_processed)
+    //Local transform of a node, either its matrix or its translation, rotation and scale
+    static glm::mat4 get_node_matrix(const tinygltf::Node& node)
+    {
+        glm::mat4 local_matrix(1.0f);
+        if (node.matrix.size() == 16)
+        {
+            for (int i = 0; i < 16; ++i) { local_matrix[i / 4][i % 4] = static_cast<float>(node.matrix[i]); }
+            return local_matrix;
+        }
+        if (node.translation.size() == 3)
+        {
+            local_matrix = glm::translate(local_matrix, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+        }
+        if (node.rotation.size() == 4)
+        {
+            local_matrix *= glm::mat4_cast(glm::quat(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2])));
+        }
+        if (node.scale.size() == 3)
+        {
+            local_matrix = glm::scale(local_matrix, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+        }
+        return local_matrix;
+    }
+
+    //Rest pose of a node. Nodes with a matrix get it split into translation, rotation and scale, which animated nodes
+    //can't have, so this is only an approximation for matrices with shear
+    static ModelNode get_node_rest_pose(const tinygltf::Node& node)
+    {
+        ModelNode rest_pose{ glm::vec3(0.0f), glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f), -1 };
+        if (node.matrix.size() == 16)
+        {
+            const glm::mat4 matrix = get_node_matrix(node);
+            glm::mat3 rotation(matrix);
+            rest_pose.translation = glm::vec3(matrix[3]);
+            rest_pose.scale = glm::vec3(glm::length(rotation[0]), glm::length(rotation[1]), glm::length(rotation[2]));
+            if (glm::determinant(rotation) < 0.0f) rest_pose.scale.x = -rest_pose.scale.x;
+            for (int i = 0; i < 3; ++i)
+            {
+                if (rest_pose.scale[i] != 0.0f) rotation[i] /= rest_pose.scale[i];
+            }
+            rest_pose.rotation = glm::normalize(glm::quat_cast(rotation));
+            return rest_pose;
+        }
+        if (node.translation.size() == 3) rest_pose.translation = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
+        if (node.rotation.size() == 4) rest_pose.rotation = glm::quat(static_cast<float>(node.rotation[3]), static_cast<float>(node.rotation[0]), static_cast<float>(node.rotation[1]), static_cast<float>(node.rotation[2]));
+        if (node.scale.size() == 3) rest_pose.scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
+        return rest_pose;
+    }
+
+    void ModelResource::traverse_nodes(const std::vector<int>& node_indices, const tinygltf::Model& model, glm::mat4 local_transform, std::vector<NodeInstance>& instances_out)
     {
         //Loop over all nodes
         for (auto& node_index : node_indices)
         {
             //Get node
             auto& node = model.nodes[node_index];
+            const glm::mat4 local_matrix = local_transform * get_node_matrix(node);
 
-            //Convert matrix in gltf model to glm::mat4. If the matrix doesn't exist, just set it to identity matrix
-            glm::mat4 local_matrix(1.0f);
-            int i = 0;
-            for (const auto& value : node.matrix) { local_matrix[i / 4][i % 4] = static_cast<float>(value); i++; }
-            local_matrix = local_transform * local_matrix;
-
-            //If it has a mesh, process it
+            //If it has a mesh, place it. With EXT_mesh_gpu_instancing the node places it once per instance, with the
+            //instance transform applied before the node transform. A skinned mesh is placed by its joints instead, and
+            //glTF says to ignore the transform of its node
             if (node.mesh != -1)
             {
-                //Get mesh
-                auto& mesh = model.meshes[node.mesh];
-                auto& primitives = mesh.primitives;
-                for (auto& primitive : primitives)
+                std::vector<glm::mat4> instance_transforms;
+                if (node.skin >= 0 && node.skin < static_cast<int>(model.skins.size()))
+                {
+                    instances_out.push_back({ node.mesh, glm::mat4(1.0f), node.skin });
+                }
+                else if (get_gpu_instancing_transforms(node, model, instance_transforms))
                 {
-                    printf("Creating vertex array for mesh '%s'\n", node.name.c_str());
-                    //primitive.material
-                    MeshCPU mesh_buffer_data{};
-                    create_vertex_array(mesh_buffer_data, primitive, model, local_matrix);
-                    primitives_processed[primitive.material] = mesh_buffer_data;
+                    for (auto& instance_transform : instance_transforms)
+                    {
+                        instances_out.push_back({ node.mesh, local_matrix * instance_transform, -1 });
+                    }
+                }
+                else
+                {
+                    instances_out.push_back({ node.mesh, local_matrix, -1 });
                 }
             }
 
             //If it has children, process those
             if (!node.children.empty())
             {
-                traverse_nodes(node.children, model, local_matrix, primitives_processed);
+                traverse_nodes(node.children, model, local_matrix, instances_out);
+            }
+        }
+    }
+
+    bool ModelResource::load_cooked(const std::string& path, ResourceManager* resource_manager)
+    {
+        meshes_cpu = nullptr;
+        meshes_gpu = nullptr;
+        materials_cpu = nullptr;
+        materials_gpu = nullptr;
+        n_meshes = 0;
+        n_materials = 0;
+        instances = nullptr;
+        n_instances = 0;
+        animations = nullptr;
+        n_animations = 0;
+        nodes = nullptr;
+        n_nodes = 0;
+        skins = nullptr;
+        n_skins = 0;
+
+        //Map the file. The mesh data is used in place, so the mapping lives as long as the model
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Cooked file - " + path;
+        cooked_file = new (dynamic_allocate(sizeof(MappedFile))) MappedFile();
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        if (!cooked_file->open(path))
+        {
+            return false;
+        }
+        u8* base = cooked_file->get_data();
+        const size_t file_size = cooked_file->get_size();
+
+        //Validate the header and make sure every block is inside the file
+        CookedModelHeader header;
+        if (file_size < sizeof(header))
+        {
+            printf("[ERROR] Cooked model '%s' is too small to be valid!\n", path.c_str());
+            return false;
+        }
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, cooked_model_magic, sizeof(header.magic)) != 0 || header.version != cooked_model_version || header.file_size != file_size)
+        {
+            printf("[ERROR] Cooked model '%s' is not a version %u cooked model, re-cook it!\n", path.c_str(), static_cast<unsigned>(cooked_model_version));
+            return false;
+        }
+        auto in_file = [&](u64 offset, u64 count, u64 stride) {
+            return count == 0 || (offset % cooked_model_alignment == 0 && offset <= file_size && count <= (file_size - offset) / stride);
+        };
+        if (!in_file(header.meshes_offset, header.n_meshes, sizeof(CookedMesh)) || !in_file(header.materials_offset, header.n_materials, sizeof(CookedMaterial)) ||
+            !in_file(header.instances_offset, header.n_instances, sizeof(MeshInstance)) || !in_file(header.nodes_offset, header.n_nodes, sizeof(ModelNode)) ||
+            !in_file(header.skins_offset, header.n_skins, sizeof(CookedSkin)) || !in_file(header.animations_offset, header.n_animations, sizeof(CookedAnimation)) ||
+            !in_file(header.images_offset, header.n_images, sizeof(CookedImage)))
+        {
+            printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+            return false;
+        }
+        const CookedMesh* cooked_meshes = reinterpret_cast<const CookedMesh*>(base + header.meshes_offset);
+        const CookedMaterial* cooked_materials = reinterpret_cast<const CookedMaterial*>(base + header.materials_offset);
+        const CookedSkin* cooked_skins = reinterpret_cast<const CookedSkin*>(base + header.skins_offset);
+        const CookedAnimation* cooked_animations = reinterpret_cast<const CookedAnimation*>(base + header.animations_offset);
+
+        //Point the meshes at their data inside the mapping
+        n_meshes = static_cast<size_t>(header.n_meshes);
+        n_materials = static_cast<size_t>(header.n_materials);
+        n_instances = static_cast<size_t>(header.n_instances);
+        n_nodes = static_cast<size_t>(header.n_nodes);
+        n_skins = 0;
+        animations = nullptr;
+        n_animations = 0;
+        instances = reinterpret_cast<MeshInstance*>(base + header.instances_offset);
+        nodes = reinterpret_cast<ModelNode*>(base + header.nodes_offset);
+        bounds = header.bounds;
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Mesh - " + path;
+        meshes_cpu = (MeshCPU*)dynamic_allocate(sizeof(MeshCPU) * n_meshes);
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Material - " + path;
+        materials_cpu = (MaterialResource*)dynamic_allocate(sizeof(MaterialResource) * n_materials);
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Skins - " + path;
+        skins = static_cast<Skin*>(dynamic_allocate(sizeof(Skin) * static_cast<size_t>(header.n_skins)));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Animations - " + path;
+        animations = static_cast<AnimationClip*>(dynamic_allocate(sizeof(AnimationClip) * static_cast<size_t>(header.n_animations)));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+
+        //Joints and parents index the node table, so they get checked like offsets
+        for (size_t i = 0; i < n_nodes; ++i)
+        {
+            if (nodes[i].parent >= static_cast<i32>(n_nodes))
+            {
+                printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                return false;
+            }
+        }
+        for (size_t i = 0; i < header.n_skins; ++i)
+        {
+            const CookedSkin& cooked = cooked_skins[i];
+            if (!in_file(cooked.joints_offset, cooked.n_joints, sizeof(u32)) || !in_file(cooked.inverse_bind_matrices_offset, cooked.n_joints, sizeof(glm::mat4)))
+            {
+                printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                return false;
+            }
+            Skin& skin = skins[n_skins++];
+            skin.joints = reinterpret_cast<u32*>(base + cooked.joints_offset);
+            skin.inverse_bind_matrices = reinterpret_cast<glm::mat4*>(base + cooked.inverse_bind_matrices_offset);
+            skin.n_joints = static_cast<u32>(cooked.n_joints);
+            for (u32 j = 0; j < skin.n_joints; ++j)
+            {
+                if (skin.joints[j] >= n_nodes)
+                {
+                    printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                    return false;
+                }
+            }
+        }
+
+        //Clips are sampled in place too. Everything the sampler indexes with gets checked against the blocks
+        for (size_t i = 0; i < header.n_animations; ++i)
+        {
+            const CookedAnimation& cooked = cooked_animations[i];
+            bool valid = cooked.name_offset != 0 && cooked.name_offset < file_size && memchr(base + cooked.name_offset, '\0', file_size - cooked.name_offset) != nullptr &&
+                         in_file(cooked.tracks_offset, cooked.n_tracks, sizeof(AnimationTrack)) && cooked.n_frames > 0 &&
+                         cooked.n_channels % animation_lane_width == 0 && static_cast<u64>(cooked.rotation_stride) * 4 <= cooked.n_channels;
+            if (valid && cooked.is_compressed)
+            {
+                valid = in_file(cooked.track_keys_offset, cooked.n_tracks, sizeof(AnimationTrackKeys)) && in_file(cooked.key_frames_offset, cooked.n_key_frames, sizeof(u16)) &&
+                        in_file(cooked.key_data_offset, cooked.n_key_data_bytes, sizeof(u8));
+            }
+            else if (valid)
+            {
+                valid = in_file(cooked.keys_offset, static_cast<u64>(cooked.n_frames) * cooked.n_channels, sizeof(u16)) &&
+                        in_file(cooked.channel_offsets_offset, cooked.n_channels, sizeof(float)) && in_file(cooked.channel_scales_offset, cooked.n_channels, sizeof(float));
+            }
+            const AnimationTrack* tracks = reinterpret_cast<const AnimationTrack*>(base + cooked.tracks_offset);
+            const AnimationTrackKeys* track_keys = reinterpret_cast<const AnimationTrackKeys*>(base + cooked.track_keys_offset);
+            for (u32 t = 0; valid && t < cooked.n_tracks; ++t)
+            {
+                const u64 n_components = tracks[t].path == AnimationPath::Rotation ? 4 : 3;
+                valid = tracks[t].target_node < n_nodes && tracks[t].path <= AnimationPath::Scale &&
+                        tracks[t].first_channel + (n_components - 1) * tracks[t].component_stride < cooked.n_channels;
+                if (valid && cooked.is_compressed)
+                {
+                    const AnimationTrackKeys& keys = track_keys[t];
+                    valid = keys.n_keys > 0 && (keys.key_size == 1 || keys.key_size == 2) && static_cast<u64>(keys.first_key) + keys.n_keys <= cooked.n_key_frames &&
+                            keys.key_data_offset + keys.n_keys * n_components * keys.key_size <= cooked.n_key_data_bytes;
+                }
+            }
+            if (!valid)
+            {
+                printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                return false;
+            }
+
+            AnimationClip& clip = animations[n_animations++];
+            clip = AnimationClip{};
+            clip.name = reinterpret_cast<char*>(base + cooked.name_offset);
+            clip.duration = cooked.duration;
+            clip.sample_rate = cooked.sample_rate;
+            clip.n_frames = cooked.n_frames;
+            clip.n_channels = cooked.n_channels;
+            clip.n_tracks = cooked.n_tracks;
+            clip.rotation_stride = cooked.rotation_stride;
+            clip.tracks = reinterpret_cast<AnimationTrack*>(base + cooked.tracks_offset);
+            if (cooked.is_compressed)
+            {
+                clip.track_keys = reinterpret_cast<AnimationTrackKeys*>(base + cooked.track_keys_offset);
+                clip.key_frames = reinterpret_cast<u16*>(base + cooked.key_frames_offset);
+                clip.key_data = base + cooked.key_data_offset;
+            }
+            else
+            {
+                clip.keys = reinterpret_cast<u16*>(base + cooked.keys_offset);
+                clip.channel_offsets = reinterpret_cast<float*>(base + cooked.channel_offsets_offset);
+                clip.channel_scales = reinterpret_cast<float*>(base + cooked.channel_scales_offset);
+            }
+        }
+
+        for (size_t i = 0; i < n_meshes; ++i)
+        {
+            const CookedMesh& cooked = cooked_meshes[i];
+            if (!in_file(cooked.vertices_offset, cooked.n_verts, sizeof(Vertex)) ||
+                !in_file(cooked.skin_offset, cooked.n_verts, sizeof(VertexSkin)) ||
+                !in_file(cooked.indices_offset, cooked.n_indices, sizeof(u32)) ||
+                !in_file(cooked.lods_offset, cooked.n_lods, sizeof(MeshLod)) ||
+                !in_file(cooked.sub_meshes_offset, cooked.n_sub_meshes, sizeof(SubMesh)) ||
+                !in_file(cooked.meshlets_offset, cooked.n_meshlets, sizeof(Meshlet)) ||
+                !in_file(cooked.meshlet_vertices_offset, cooked.n_meshlet_vertices, sizeof(u32)) ||
+                !in_file(cooked.meshlet_triangles_offset, cooked.n_meshlet_triangles, sizeof(u8) * 3) ||
+                cooked.first_instance > n_instances || cooked.n_instances > n_instances - cooked.first_instance)
+            {
+                printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                n_meshes = i;
+                return false;
+            }
+
+            MeshCPU& mesh = meshes_cpu[i];
+            mesh.vertices = reinterpret_cast<Vertex*>(base + cooked.vertices_offset);
+            mesh.skin = cooked.skin_offset != 0 ? reinterpret_cast<VertexSkin*>(base + cooked.skin_offset) : nullptr;
+            mesh.indices = reinterpret_cast<u32*>(base + cooked.indices_offset);
+            mesh.lods = reinterpret_cast<MeshLod*>(base + cooked.lods_offset);
+            mesh.sub_meshes = reinterpret_cast<SubMesh*>(base + cooked.sub_meshes_offset);
+            mesh.meshlets = reinterpret_cast<Meshlet*>(base + cooked.meshlets_offset);
+            mesh.meshlet_vertices = reinterpret_cast<u32*>(base + cooked.meshlet_vertices_offset);
+            mesh.meshlet_triangles = base + cooked.meshlet_triangles_offset;
+            mesh.n_verts = cooked.n_verts;
+            mesh.n_indices = cooked.n_indices;
+            mesh.n_lods = cooked.n_lods;
+            mesh.n_sub_meshes = cooked.n_sub_meshes;
+            mesh.n_meshlets = cooked.n_meshlets;
+            mesh.n_meshlet_vertices = cooked.n_meshlet_vertices;
+            mesh.n_meshlet_triangles = cooked.n_meshlet_triangles;
+            mesh.first_instance = static_cast<size_t>(cooked.first_instance);
+            mesh.n_instances = static_cast<size_t>(cooked.n_instances);
+            mesh.bounds = cooked.bounds;
+        }
+
+        //Materials reference their textures by path, every texture of the model is loaded in one batch
+        std::vector<TextureLoadRequest> texture_requests;
+        auto get_path_at = [&](u64 offset) -> std::string {
+            if (offset == 0 || offset >= file_size || memchr(base + offset, '\0', file_size - offset) == nullptr)
+            {
+                return "";
+            }
+            return reinterpret_cast<const char*>(base + offset);
+        };
+
+        //Embedded images are decoded from their copy in the file, like the glTF loader decodes them from the model.
+        //The copies have to outlive the batch
+        std::map<std::string, tinygltf::Image> embedded_images;
+        const CookedImage* cooked_images = reinterpret_cast<const CookedImage*>(base + header.images_offset);
+        for (size_t i = 0; i < header.n_images; ++i)
+        {
+            const std::string name = get_path_at(cooked_images[i].name_offset);
+            if (name.empty() || cooked_images[i].data_offset > file_size || cooked_images[i].n_bytes > file_size - cooked_images[i].data_offset)
+            {
+                printf("[ERROR] Cooked model '%s' is corrupt!\n", path.c_str());
+                return false;
+            }
+            tinygltf::Image& image = embedded_images[name];
+            image.image.assign(base + cooked_images[i].data_offset, base + cooked_images[i].data_offset + cooked_images[i].n_bytes);
+            image.as_is = true;
+        }
+
+        auto request_texture_at = [&](u64 offset, TextureUsage usage, ResourceHandle* handle_out) {
+            const std::string texture_path = get_path_at(offset);
+            if (!texture_path.empty())
+            {
+                const auto embedded_image = embedded_images.find(texture_path);
+                texture_requests.push_back({ texture_path, usage, handle_out, embedded_image != embedded_images.end() ? &embedded_image->second : nullptr });
+            }
+        };
+        for (size_t i = 0; i < n_materials; ++i)
+        {
+            const CookedMaterial& cooked = cooked_materials[i];
+            MaterialResource& material = materials_cpu[i];
+            material = MaterialResource{};
+            request_texture_at(cooked.tex_col_path_offset, TextureUsage::Color, &material.tex_col);
+            request_texture_at(cooked.tex_nrm_path_offset, TextureUsage::Normal, &material.tex_nrm);
+            request_texture_at(cooked.tex_emm_path_offset, TextureUsage::Color, &material.tex_emm);
+            if (cooked.tex_orm_path_offset != 0)
+            {
+                request_texture_at(cooked.tex_orm_path_offset, TextureUsage::Packed, &material.tex_orm);
+                request_texture_at(cooked.tex_occ_path_offset, TextureUsage::Linear, &material.tex_occ);
+            }
+            else
+            {
+                request_surface_textures(texture_requests, resource_manager, get_path_at(cooked.tex_occ_path_offset), get_path_at(cooked.tex_rgh_path_offset),
+                                         get_path_at(cooked.tex_mtl_path_offset), material);
             }
+            material.mul_col = cooked.mul_col;
+            material.mul_emm = cooked.mul_emm;
+            material.mul_tex = cooked.mul_tex;
+            material.mul_nrm = cooked.mul_nrm;
+            material.mul_rgh = cooked.mul_rgh;
+            material.mul_mtl = cooked.mul_mtl;
         }
+        resource_manager->load_textures(texture_requests);
+
+        resource_type = ResourceType::Model;
+        scheduled_for_unload = false;
+        return true;
     }
 
     void ModelResource::unload()
     {
-        //dynamic_free(meshes);
-        //dynamic_free(materials);
-        //dynamic_free(this);
+        //A cooked model's data points into its mapping, only the tables around it were allocated
+        const bool owns_data = cooked_file == nullptr;
+        if (owns_data)
+        {
+            for (size_t i = 0; i < n_meshes; ++i)
+            {
+                MeshCPU& mesh = meshes_cpu[i];
+                dynamic_free(mesh.vertices);
+                dynamic_free(mesh.skin);
+                dynamic_free(mesh.indices);
+                dynamic_free(mesh.lods);
+                dynamic_free(mesh.sub_meshes);
+                dynamic_free(mesh.meshlets);
+                dynamic_free(mesh.meshlet_vertices);
+                dynamic_free(mesh.meshlet_triangles);
+            }
+            for (size_t i = 0; i < n_animations; ++i)
+            {
+                AnimationClip& clip = animations[i];
+                dynamic_free(clip.name);
+                dynamic_free(clip.tracks);
+                dynamic_free(clip.keys);
+                dynamic_free(clip.channel_offsets);
+                dynamic_free(clip.channel_scales);
+                dynamic_free(clip.track_keys);
+                dynamic_free(clip.key_frames);
+                dynamic_free(clip.key_data);
+            }
+            for (size_t i = 0; i < n_skins; ++i)
+            {
+                dynamic_free(skins[i].joints);
+                dynamic_free(skins[i].inverse_bind_matrices);
+            }
+            dynamic_free(instances);
+            dynamic_free(nodes);
+        }
+        dynamic_free(meshes_cpu);
+        dynamic_free(materials_cpu);
+        dynamic_free(animations);
+        dynamic_free(skins);
+
+        //Textures belong to the resource manager, and the GPU side to the renderer
+        if (cooked_file != nullptr)
+        {
+            cooked_file->~MappedFile();
+            dynamic_free(cooked_file);
+        }
+        dynamic_free(this);
     }
     
 
     template <typename src_type, typename dst_type>
-    std::vector<dst_type> pad_components_to_type(src_type* source, size_t n_comp_src, size_t n_comp_dst, size_t n_items, bool normalized) {
+    std::vector<dst_type> pad_components_to_type(const src_type* source, size_t n_comp_src, size_t n_comp_dst, size_t n_items, bool normalized) {
         std::vector<dst_type> out_vector;
 
         // For each item
@@ -182,7 +1130,7 @@ namespace Flan {
         return out_vector;
     }
     template <typename glm_type>
-    std::vector<glm_type> gltf_to_glm(void* pointer, tinygltf::Accessor accessor) {
+    std::vector<glm_type> gltf_to_glm(const void* pointer, const tinygltf::Accessor& accessor) {
         std::vector<glm_type> out;
 
         // Get number of components
@@ -208,25 +1156,25 @@ namespace Flan {
         // Get component type and convert to glm type
         switch (accessor.componentType) {
         case TINYGLTF_COMPONENT_TYPE_FLOAT:
-            out = pad_components_to_type<float, glm_type>((float*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<float, glm_type>((const float*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_BYTE:
-            out = pad_components_to_type<int8_t, glm_type>((int8_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<int8_t, glm_type>((const int8_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_SHORT:
-            out = pad_components_to_type<int16_t, glm_type>((int16_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<int16_t, glm_type>((const int16_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_INT:
-            out = pad_components_to_type<int32_t, glm_type>((int32_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<int32_t, glm_type>((const int32_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
-            out = pad_components_to_type<uint8_t, glm_type>((uint8_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<uint8_t, glm_type>((const uint8_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
-            out = pad_components_to_type<uint16_t, glm_type>((uint16_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<uint16_t, glm_type>((const uint16_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
-            out = pad_components_to_type<uint32_t, glm_type>((uint32_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
+            out = pad_components_to_type<uint32_t, glm_type>((const uint32_t*)pointer, n_components, glm_type::length(), accessor.count, accessor.normalized);
             break;
         default:
             printf("unknown gltf component type %i!\n", accessor.type);
@@ -235,7 +1183,52 @@ namespace Flan {
     }
 
 
-    void ModelResource::create_vertex_array(MeshCPU& mesh_out, tinygltf::Primitive primitive_in, tinygltf::Model model, glm::mat4 trans_mat)
+    //Reads the per-instance TRS arrays of EXT_mesh_gpu_instancing. Missing attributes default to identity
+    static bool get_gpu_instancing_transforms(const tinygltf::Node& node, const tinygltf::Model& model, std::vector<glm::mat4>& transforms_out)
+    {
+        auto extension = node.extensions.find("EXT_mesh_gpu_instancing");
+        if (extension == node.extensions.end() || !extension->second.Has("attributes"))
+        {
+            return false;
+        }
+        const tinygltf::Value& attributes = extension->second.Get("attributes");
+
+        auto read_attribute = [&](const char* name, auto& values_out) {
+            using glm_type = typename std::remove_reference_t<decltype(values_out)>::value_type;
+            if (!attributes.Has(name)) return;
+            const int accessor_index = attributes.Get(name).GetNumberAsInt();
+            if (accessor_index < 0 || accessor_index >= static_cast<int>(model.accessors.size())) return;
+            auto& accessor = model.accessors[accessor_index];
+            if (accessor.bufferView < 0) return;
+            auto& bufferview = model.bufferViews[accessor.bufferView];
+            assert(bufferview.byteStride == 0 && "byte_stride is not zero!");
+            values_out = gltf_to_glm<glm_type>(&model.buffers[bufferview.buffer].data[bufferview.byteOffset + accessor.byteOffset], accessor);
+        };
+        std::vector<glm::vec3> translations;
+        std::vector<glm::vec4> rotations;
+        std::vector<glm::vec3> scales;
+        read_attribute("TRANSLATION", translations);
+        read_attribute("ROTATION", rotations);
+        read_attribute("SCALE", scales);
+
+        const size_t n_instances = std::max({ translations.size(), rotations.size(), scales.size() });
+        if (n_instances == 0)
+        {
+            return false;
+        }
+        transforms_out.resize(n_instances);
+        for (size_t i = 0; i < n_instances; ++i)
+        {
+            glm::mat4 transform(1.0f);
+            if (i < translations.size()) transform = glm::translate(transform, translations[i]);
+            if (i < rotations.size()) transform *= glm::mat4_cast(glm::quat(rotations[i].w, rotations[i].x, rotations[i].y, rotations[i].z));
+            if (i < scales.size()) transform = glm::scale(transform, scales[i]);
+            transforms_out[i] = transform;
+        }
+        return true;
+    }
+
+    void ModelResource::create_vertex_array(std::vector<Vertex>& vertices_out, std::vector<VertexSkin>& skin_out, std::vector<u32>& indices_out, const tinygltf::Primitive& primitive_in, const tinygltf::Model& model, glm::mat4 trans_mat)
     {
         std::vector<glm::vec3> position_pointer;
         std::vector<glm::vec3> normal_pointer;
@@ -259,11 +1252,9 @@ namespace Flan {
 
             //Find location in buffer
             auto& buffer_base = model.buffers[bufferview.buffer].data;
-            void* buffer_pointer = &buffer_base[bufferview.byteOffset];
+            const void* buffer_pointer = &buffer_base[bufferview.byteOffset];
             assert(bufferview.byteStride == 0 && "byte_stride is not zero!");
 
-            printf("\nname: %s\n", name.c_str());
-
             if (name._Equal("POSITION"))
             {
                 position_pointer = gltf_to_glm<glm::vec3>(buffer_pointer, accessor);
@@ -288,6 +1279,7 @@ namespace Flan {
         }
 
         //Find indices
+        if (primitive_in.indices >= 0)
         {
             //Get accessor
             auto& accessor = model.accessors[primitive_in.indices];
@@ -298,14 +1290,22 @@ namespace Flan {
 
             //Find location in buffer
             auto& buffer_base = model.buffers[bufferview.buffer].data;
-            void* buffer_pointer = &buffer_base[bufferview.byteOffset];
+            const void* buffer_pointer = &buffer_base[bufferview.byteOffset];
             int buffer_length = accessor.count;
             indices.reserve(buffer_length);
             assert(bufferview.byteStride == 0 && "byte_stride is not zero!");
 
+            if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE)
+            {
+                auto* indices_raw = static_cast<const uint8_t*>(buffer_pointer);
+                for (int i = 0; i < buffer_length; i++)
+                {
+                    indices.push_back(indices_raw[i]);
+                }
+            }
             if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
             {
-                auto* indices_raw = static_cast<uint16_t*>(buffer_pointer);
+                auto* indices_raw = static_cast<const uint16_t*>(buffer_pointer);
                 for (int i = 0; i < buffer_length; i++)
                 {
                     indices.push_back(indices_raw[i]);
@@ -313,7 +1313,7 @@ namespace Flan {
             }
             if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
             {
-                auto* indices_raw = static_cast<uint32_t*>(buffer_pointer);
+                auto* indices_raw = static_cast<const uint32_t*>(buffer_pointer);
                 for (int i = 0; i < buffer_length; i++)
                 {
                     indices.push_back(indices_raw[i]);
@@ -321,35 +1321,82 @@ namespace Flan {
             }
         }
 
-        //Create vertex array
+        //Bake the transform and gamma conversion into the attribute arrays, once per unique vertex
         {
-            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - vertex buffers";
-            mesh_out.vertices = static_cast<Vertex*>(dynamic_allocate(sizeof(Vertex) * indices.size()));
-            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
-            mesh_out.indices = static_cast<u32*>(dynamic_allocate(sizeof(u32) * indices.size()));
-            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
-            mesh_out.n_verts = 0;
-            mesh_out.n_indices = 0;
-            int i = 0;
-            for (int index : indices)
+            const glm::mat3 normal_matrix = glm::mat3(trans_mat);
+            transform_points(position_pointer.data(), position_pointer.size(), trans_mat);
+            transform_vectors(reinterpret_cast<float*>(normal_pointer.data()), 3, normal_pointer.size(), normal_matrix);
+            transform_vectors(reinterpret_cast<float*>(tangent_pointer.data()), 4, tangent_pointer.size(), normal_matrix);
+            linear_to_gamma(colour_pointer.data(), colour_pointer.size());
+        }
+
+        //Create vertex array, keeping the indexing from the glTF file so shared vertices stay shared
+        {
+            vertices_out.resize(position_pointer.size());
+            for (size_t i = 0; i < vertices_out.size(); i++)
             {
                 Vertex vertex;
-                if (!position_pointer.empty()) { vertex.position = trans_mat * glm::vec4(position_pointer[index], 1.0f); }
-                if (!normal_pointer.empty()) { vertex.normal = glm::mat3(trans_mat) * (normal_pointer[index]); }
-                if (!tangent_pointer.empty()) { vertex.tangent = glm::mat3(trans_mat) * (glm::vec3(tangent_pointer[index])); }
-                if (!colour_pointer.empty()) {
-                    vertex.colour = {
-                        std::min(1.0f, powf(colour_pointer[index].x, 1.0f / 2.2f)),
-                        std::min(1.0f, powf(colour_pointer[index].y, 1.0f / 2.2f)),
-                        std::min(1.0f, powf(colour_pointer[index].z, 1.0f / 2.2f)),
-                    };
+                vertex.position = position_pointer[i];
+                if (i < normal_pointer.size()) { vertex.normal = normal_pointer[i]; }
+                if (i < tangent_pointer.size()) { vertex.tangent = glm::vec3(tangent_pointer[i]); }
+                if (i < colour_pointer.size()) { vertex.colour = glm::vec3(colour_pointer[i]); }
+                if (i < texcoord_pointer.size()) { vertex.texcoord0 = texcoord_pointer[i]; }
+                vertices_out[i] = vertex;
+            }
+
+            //Skin weights, normalized so they add up to 1. Vertices without any weight follow the first joint
+            auto joints_attribute = primitive_in.attributes.find("JOINTS_0");
+            auto weights_attribute = primitive_in.attributes.find("WEIGHTS_0");
+            if (joints_attribute != primitive_in.attributes.end() && weights_attribute != primitive_in.attributes.end())
+            {
+                std::vector<u32> joints;
+                std::vector<float> weights;
+                int n_joint_components = 0;
+                int n_weight_components = 0;
+                if (read_accessor_uints(model, joints_attribute->second, joints, n_joint_components) && read_accessor_floats(model, weights_attribute->second, weights, n_weight_components) &&
+                    n_joint_components == 4 && n_weight_components == 4)
+                {
+                    skin_out.resize(vertices_out.size());
+                    const size_t n_skinned = std::min({ vertices_out.size(), joints.size() / 4, weights.size() / 4 });
+                    for (size_t i = 0; i < n_skinned; i++)
+                    {
+                        VertexSkin skin;
+                        float total_weight = 0.0f;
+                        for (int j = 0; j < 4; j++)
+                        {
+                            skin.joints[j] = static_cast<u16>(std::min<u32>(joints[i * 4 + j], UINT16_MAX));
+                            skin.weights[j] = std::max(weights[i * 4 + j], 0.0f);
+                            total_weight += skin.weights[j];
+                        }
+                        if (total_weight > 0.0f)
+                        {
+                            for (float& weight : skin.weights) weight /= total_weight;
+                        }
+                        else
+                        {
+                            skin = VertexSkin{};
+                        }
+                        skin_out[i] = skin;
+                    }
+                }
+                else
+                {
+                    printf("[ERROR] Primitive has unreadable JOINTS_0 or WEIGHTS_0, it will not be skinned\n");
+                }
+            }
+
+            //Non-indexed primitives just use every vertex in order
+            if (primitive_in.indices < 0)
+            {
+                indices_out.resize(vertices_out.size());
+                for (size_t i = 0; i < indices_out.size(); i++)
+                {
+                    indices_out[i] = static_cast<u32>(i);
                 }
-                if (!texcoord_pointer.empty()) { vertex.texcoord0 = texcoord_pointer[index]; }
-                mesh_out.vertices[mesh_out.n_verts] = vertex;
-                mesh_out.indices[i] = i;
-                mesh_out.n_verts++;
-                mesh_out.n_indices++;
-                i++;
+            }
+            else
+            {
+                indices_out.assign(indices.begin(), indices.end());
             }
         }
     }
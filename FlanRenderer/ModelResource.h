@@ -2,9 +2,33 @@
 #include "Resources.h"
 #include <string>
 #include "MaterialResource.h"
+#include "MeshSimplifier.h"
+#include "MappedFile.h"
+#include "Animation.h"
+#include "Skinning.h"
 #include <tinygltf/tiny_gltf.h>
 
 namespace Flan {
+    struct AnimationCompressionReport;
+
+    // One primitive of a unique glTF mesh to build vertex data for
+    struct PrimitiveWorkItem {
+        int mesh;
+        int primitive;
+    };
+
+    // A glTF mesh placed in the scene, found while walking the node tree
+    struct NodeInstance {
+        int mesh;
+        glm::mat4 world_matrix;
+        int skin; // -1 if the node isn't skinned
+    };
+
+    // Textures of images embedded in a glTF model, from a buffer view or a data URI, are named after the model and
+    // the image's index: "<model path>#image<index>"
+    std::string get_embedded_image_name(const std::string& model_path, int image_index);
+    bool split_embedded_image_name(const std::string& name, std::string& model_path_out, int& image_index_out); // False for other names
+
     struct ModelResource
     {
         static std::string name_string() { return "ModelResource"; }
@@ -14,11 +38,28 @@ namespace Flan {
         MeshGPU* meshes_gpu;
         MaterialResource* materials_cpu;
         MaterialGPU* materials_gpu;
+        MeshInstance* instances; // Sorted by mesh, see MeshCPU::first_instance
         size_t n_meshes;
         size_t n_materials;
-        bool load(std::string path, ResourceManager* resource_manager);
-        void unload();
-        void traverse_nodes(std::vector<int>& node_indices, tinygltf::Model& model, glm::mat4 local_transform, std::unordered_map<int, MeshCPU>& primitives_processed);
-        void create_vertex_array(MeshCPU& mesh_out, tinygltf::Primitive primitive_in, tinygltf::Model model, glm::mat4 trans_mat);
+        size_t n_instances;
+        AnimationClip* animations;
+        size_t n_animations;
+        ModelNode* nodes; // Every glTF node in its rest pose, for posing skins, see Skinning.h
+        size_t n_nodes;
+        Skin* skins;
+        size_t n_skins;
+        AABB bounds;
+        MappedFile* cooked_file; // Set when the mesh data points into a mapped cooked model, see CookedModel.h
+        // animation_report_out gets how well the animations compressed, see AnimationCompression.h
+        bool load(std::string path, ResourceManager* resource_manager, const LodSettings& lod_settings = LodSettings{},
+                  AnimationCompressionReport* animation_report_out = nullptr);
+        // Files, other than the glTF itself, that load() reads. The optional ones are the texture maps load() looks for by
+        // the name of the base colour map, it does without the ones that don't exist
+        static bool find_dependencies(const std::string& path, std::vector<std::string>& dependencies_out, std::vector<std::string>& optional_dependencies_out);
+        static bool read_embedded_images(const std::string& path, std::vector<std::vector<u8>>& images_out); // Encoded bytes of every embedded image, empty for the others
+        bool load_cooked(const std::string& path, ResourceManager* resource_manager);
+        void unload(); // Frees the model and everything it owns, textures stay with the resource manager
+        void traverse_nodes(const std::vector<int>& node_indices, const tinygltf::Model& model, glm::mat4 local_transform, std::vector<NodeInstance>& instances_out);
+        void create_vertex_array(std::vector<Vertex>& vertices_out, std::vector<VertexSkin>& skin_out, std::vector<u32>& indices_out, const tinygltf::Primitive& primitive_in, const tinygltf::Model& model, glm::mat4 trans_mat);
     };
 }
\ No newline at end of file
@@ -2,8 +2,11 @@
 #include "HelperFunctions.h"
 #include "ModelResource.h"
 #include "RootParameter.h"
+#include "Skinning.h"
 #include "TextureResource.h"
 
+#include <algorithm>
+
 namespace Flan {
     Flan::D3D12_Command::D3D12_Command(ID3D12Device* device, D3D12_COMMAND_LIST_TYPE type) {
         // Create command queue description
@@ -457,10 +460,11 @@ namespace Flan {
         
 
         // Create root parameters
-        RootParameter parameters[3];
+        RootParameter parameters[4];
         parameters[0].as_constants(32, D3D12_SHADER_VISIBILITY_VERTEX, 0); // Camera transform buffer
-        parameters[1].as_constants(16, D3D12_SHADER_VISIBILITY_VERTEX, 1); // Camera transform buffer
+        parameters[1].as_constants(1, D3D12_SHADER_VISIBILITY_VERTEX, 1); // First instance of the draw in the instance buffer
         parameters[2].as_descriptor_table(D3D12_SHADER_VISIBILITY_PIXEL, &texture_range, 1); // Camera transform buffer
+        parameters[3].as_srv(D3D12_SHADER_VISIBILITY_VERTEX, 0, 1); // Instance transforms of this frame
 
         // Create root signature
         RootSignatureDesc root_signature_desc{ &parameters[0], _countof(parameters), nullptr, 0, D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT };
@@ -494,6 +498,8 @@ namespace Flan {
         create_device();
         create_command();
         create_descriptor_heaps();
+        create_per_frame_buffers();
+        m_texture_streamer.init(m_texture_streamer.get_settings());
         // Create a window
         if (!create_window(w, h, "FlanRenderer (DirectX 12)")) {
             throw std::exception("Could not create window!");
@@ -509,17 +515,95 @@ namespace Flan {
         return true;
     }
 
+    void RendererDX12::create_upload_buffer(size_t size, ComPtr<ID3D12Resource>& buffer_out, u8*& data_out)
+    {
+        D3D12_HEAP_PROPERTIES upload_heap_props = {
+            D3D12_HEAP_TYPE_UPLOAD, // The CPU writes these every frame, the GPU reads them straight from upload memory
+            D3D12_CPU_PAGE_PROPERTY_UNKNOWN,
+            D3D12_MEMORY_POOL_UNKNOWN, 1, 1 };
+
+        D3D12_RESOURCE_DESC buffer_desc = {
+            D3D12_RESOURCE_DIMENSION_BUFFER,
+            0,
+            size,
+            1,
+            1,
+            1,
+            DXGI_FORMAT_UNKNOWN,
+            {1, 0},
+            D3D12_TEXTURE_LAYOUT_ROW_MAJOR,
+            D3D12_RESOURCE_FLAG_NONE,
+        };
+
+        // Upload heaps can stay mapped, and the CPU never reads them back
+        const D3D12_RANGE read_range = { 0, 0 };
+        throw_if_failed(m_device->CreateCommittedResource(&upload_heap_props, D3D12_HEAP_FLAG_NONE, &buffer_desc,
+                                                          D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&buffer_out)));
+        throw_if_failed(buffer_out->Map(0, &read_range, reinterpret_cast<void**>(&data_out)));
+    }
+
+    void RendererDX12::create_per_frame_buffers()
+    {
+        for (UINT i = 0; i < m_backbuffer_count; i++) {
+            create_upload_buffer(m_dynamic_vertex_buffer_size, m_dynamic_vertex_buffers[i], m_dynamic_vertex_data[i]);
+            create_upload_buffer(m_instance_buffer_size, m_instance_buffers[i], m_instance_data[i]);
+        }
+    }
+
+    bool RendererDX12::allocate_dynamic_vertices(const Vertex* vertices, size_t n_verts, D3D12_VERTEX_BUFFER_VIEW& view_out)
+    {
+        // Copy the vertices into this frame's dynamic vertex buffer, the GPU is done with it since begin_frame waited on its fence
+        const size_t size = sizeof(Vertex) * n_verts;
+        if (m_dynamic_vertex_offset + size > m_dynamic_vertex_buffer_size) {
+            printf("[ERROR] Dynamic vertex buffer is full, %zu vertices are drawn in their bind pose this frame\n", n_verts);
+            return false;
+        }
+        memcpy(m_dynamic_vertex_data[m_frame_index] + m_dynamic_vertex_offset, vertices, size);
+        view_out = D3D12_VERTEX_BUFFER_VIEW{
+            m_dynamic_vertex_buffers[m_frame_index]->GetGPUVirtualAddress() + m_dynamic_vertex_offset,
+            static_cast<UINT>(size),
+            sizeof(Vertex),
+        };
+        m_dynamic_vertex_offset += size;
+        return true;
+    }
+
+    bool RendererDX12::allocate_instance_transforms(const glm::mat4* transforms, size_t n_transforms, u32& first_instance_out)
+    {
+        // Same as the dynamic vertices, this frame's instance buffer is free again once begin_frame waited on its fence
+        if (m_instance_count + n_transforms > m_instance_buffer_size / sizeof(glm::mat4)) {
+            printf("[ERROR] Instance buffer is full, %zu instances aren't drawn this frame\n", n_transforms);
+            return false;
+        }
+        memcpy(m_instance_data[m_frame_index] + m_instance_count * sizeof(glm::mat4), transforms, sizeof(glm::mat4) * n_transforms);
+        first_instance_out = static_cast<u32>(m_instance_count);
+        m_instance_count += n_transforms;
+        return true;
+    }
+
     void RendererDX12::begin_frame()
     {
         m_command.begin_frame();
+        m_dynamic_vertex_offset = 0;
+        m_instance_count = 0;
 
-        // Handle deferred frees
+        // Handle deferred frees, the last frame with this index has retired its fence
         for (void* pointer : m_to_be_deallocated[m_frame_index]) {
             m_renderer_allocator.release(pointer);
         }
         m_to_be_deallocated[m_frame_index].clear();
+        for (ID3D12Resource* resource : m_to_be_released[m_frame_index]) {
+            resource->Release();
+        }
+        m_to_be_released[m_frame_index].clear();
         m_cbv_heap.do_deferred_releases(m_frame_index);
 
+        // Upload the textures added since the last frame, and the levels the last streaming update made resident
+        update_streamed_textures(m_pending_texture_uploads.data(), m_pending_texture_uploads.size());
+        m_pending_texture_uploads.clear();
+        const std::vector<u32>& changed_textures = m_texture_streamer.get_changed_textures();
+        update_streamed_textures(changed_textures.data(), changed_textures.size());
+
         // Update camera constant buffer
         struct {
             glm::mat4 view;
@@ -530,12 +614,16 @@ namespace Flan {
         // todo: un-hardcode this
         camera_matrices.projection = glm::perspectiveRH_ZO(glm::radians(90.f), 16.f/9.f, 0.1f, 1000.f);
 
+        m_view_matrix = camera_matrices.view;
+        m_projection_matrix = camera_matrices.projection;
+
         //m_camera_matrix.update_data(m_device.Get(), &camera_matrices, sizeof(camera_matrices));
 
         // Bind root signature
         auto* command_list = m_command.get_command_list();
         command_list->SetGraphicsRootSignature(m_root_signature.Get());
         command_list->SetGraphicsRoot32BitConstants(0, 32, &camera_matrices, 0);
+        command_list->SetGraphicsRootShaderResourceView(3, m_instance_buffers[m_frame_index]->GetGPUVirtualAddress());
 
         // Bind pipeline state
         command_list->SetPipelineState(m_pipeline_state_object);
@@ -565,6 +653,11 @@ namespace Flan {
         command_list->ClearDepthStencilView(m_dsv_handles[m_frame_index].cpu, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr); // Clear the depth buffer
         command_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST); // We draw triangles
 
+        // Set up LOD selection for this frame
+        m_lod_stats.reset();
+        const glm::vec3 camera_position = glm::vec3(glm::inverse(m_view_matrix)[3]);
+        const float projection_scale = get_projection_scale(m_projection_matrix, m_viewport.Height);
+
         // Loop over each model
         for (size_t i = 0; i < m_model_queue_length; ++i) {
             // Get the model draw info for this entry
@@ -572,35 +665,108 @@ namespace Flan {
 
             // Get the mesh from the resource manager
             ModelResource* model_resource = m_resource_manager->get_resource<ModelResource>(curr_model_info.model_to_draw);
-            auto vertex_buffer_view = model_resource->meshes_gpu->vertex_buffer_view;
-            auto index_buffer_view = model_resource->meshes_gpu->index_buffer_view;
-            auto n_verts = model_resource->meshes_cpu->n_indices;
-
-            // todo: Get the albedo material from the mesh and bind the texture to the shader resource view
-            TextureGPU& texture = model_resource->materials_gpu->tex_col;
 
             // Set root descriptor table
             ID3D12DescriptorHeap* desc_heap[] = {
                 m_srv_heap.get_heap(),
             };
 
-            // Create and set a model matrix for this model
-            glm::mat4 model_matrix = curr_model_info.transform.get_model_matrix();
+            // Get the model matrix for this model
+            const glm::mat4 model_matrix = curr_model_info.transform.get_model_matrix();
             command_list->SetDescriptorHeaps(_countof(desc_heap), desc_heap);
-            command_list->SetGraphicsRoot32BitConstants(1, 16, &model_matrix, 0);
             command_list->SetGraphicsRootDescriptorTable(2, m_srv_heap.get_gpu_start());
 
-            // Bind the vertex buffer
-            command_list->IASetVertexBuffers(0, 1, &vertex_buffer_view); // Bind vertex buffer
-            command_list->IASetIndexBuffer(&index_buffer_view); // Bind index buffer
-
-            // todo: Set up the sampler
-            //command_list->
-
-            // Submit draw call
-            command_list->DrawIndexedInstanced(n_verts, 1, 0, 0, 0);
+            // Each mesh holds the primitives of one material in one glTF mesh. Its instances are drawn with one instanced
+            // draw per LOD, the vertex shader reads their transforms from this frame's instance buffer
+            for (size_t mesh_index = 0; mesh_index < model_resource->n_meshes; ++mesh_index) {
+                auto vertex_buffer_view = model_resource->meshes_gpu[mesh_index].vertex_buffer_view;
+                auto index_buffer_view = model_resource->meshes_gpu[mesh_index].index_buffer_view;
+                MeshCPU& mesh_cpu = model_resource->meshes_cpu[mesh_index];
+
+                // todo: Get the albedo material from the mesh and bind the texture to the shader resource view
+                const TextureGPU* texture = get_texture(model_resource->materials_gpu[mesh_index].tex_col);
+
+                // Bind the vertex buffer
+                command_list->IASetVertexBuffers(0, 1, &vertex_buffer_view); // Bind vertex buffer
+                command_list->IASetIndexBuffer(&index_buffer_view); // Bind index buffer
+
+                // todo: Set up the sampler
+                //command_list->
+
+                // Instances are collected per LOD first, so each level is one draw
+                if (m_lod_batches.size() < mesh_cpu.n_lods) {
+                    m_lod_batches.resize(mesh_cpu.n_lods);
+                }
+                for (auto& batch : m_lod_batches) {
+                    batch.clear();
+                }
+
+                for (size_t instance_index = mesh_cpu.first_instance; instance_index < mesh_cpu.first_instance + mesh_cpu.n_instances; ++instance_index) {
+                    const glm::mat4 instance_matrix = model_matrix * model_resource->instances[instance_index].transform;
+
+                    // Skinned instances draw from the vertices the CPU skinned for this frame
+                    const Vertex* skinned_vertices = curr_model_info.skinned_model != nullptr ? curr_model_info.skinned_model->get_vertices(instance_index) : nullptr;
+                    D3D12_VERTEX_BUFFER_VIEW skinned_vertex_buffer_view;
+                    const bool is_skinned = skinned_vertices != nullptr && allocate_dynamic_vertices(skinned_vertices, mesh_cpu.n_verts, skinned_vertex_buffer_view);
+
+                    // Pick the level of detail, remembering it per instance for hysteresis
+                    const LodHistoryKey history_key{ curr_model_info.model_to_draw, curr_model_info.instance_id, static_cast<u32>(instance_index) };
+                    const int previous_lod = curr_model_info.instance_id != 0 ? m_lod_history.get_previous_lod(history_key) : -1;
+                    const u32 lod_index = select_lod(mesh_cpu.lods, mesh_cpu.n_lods, model_resource->meshes_gpu[mesh_index].bounds.sphere, instance_matrix,
+                                                     camera_position, projection_scale, previous_lod, m_lod_settings);
+                    if (curr_model_info.instance_id != 0) {
+                        m_lod_history.set_lod(history_key, lod_index);
+                    }
+                    auto& lod = mesh_cpu.lods[lod_index];
+                    const size_t stats_index = std::min<size_t>(lod_index, max_lod_levels - 1);
+                    m_lod_stats.instances[stats_index] += 1;
+                    m_lod_stats.triangles[stats_index] += lod.n_indices / 3;
+
+                    // Tell texture streaming how big this instance's textures are on screen
+                    if (mesh_index < model_resource->n_materials) {
+                        const MeshGPU& mesh_gpu = model_resource->meshes_gpu[mesh_index];
+                        const float scale = std::max({ glm::length(glm::vec3(instance_matrix[0])), glm::length(glm::vec3(instance_matrix[1])), glm::length(glm::vec3(instance_matrix[2])) });
+                        const glm::vec3 center = instance_matrix * glm::vec4(mesh_gpu.bounds.sphere.center, 1.0f);
+                        const MaterialGPU& material = model_resource->materials_gpu[mesh_index];
+                        for (const u32 stream_index : { material.tex_col, material.tex_nrm, material.tex_rgh, material.tex_mtl, material.tex_occ, material.tex_orm }) {
+                            m_texture_streamer.request_footprint(stream_index, center, mesh_gpu.bounds.sphere.radius * scale, mesh_gpu.uv_density * scale, camera_position, projection_scale);
+                        }
+                    }
+
+                    // Skinned instances have vertices of their own, so they can't share a draw
+                    if (!is_skinned) {
+                        m_lod_batches[lod_index].push_back(instance_matrix);
+                        continue;
+                    }
+                    u32 first_instance;
+                    if (allocate_instance_transforms(&instance_matrix, 1, first_instance)) {
+                        command_list->IASetVertexBuffers(0, 1, &skinned_vertex_buffer_view);
+                        command_list->SetGraphicsRoot32BitConstant(1, first_instance, 0);
+                        command_list->DrawIndexedInstanced(lod.n_indices, 1, lod.first_index, 0, 0);
+                        command_list->IASetVertexBuffers(0, 1, &vertex_buffer_view);
+                        m_lod_stats.draw_calls += 1;
+                    }
+                }
+
+                // Submit one draw call per LOD
+                for (size_t lod_index = 0; lod_index < mesh_cpu.n_lods; ++lod_index) {
+                    const std::vector<glm::mat4>& batch = m_lod_batches[lod_index];
+                    u32 first_instance;
+                    if (batch.empty() || !allocate_instance_transforms(batch.data(), batch.size(), first_instance)) {
+                        continue;
+                    }
+                    const MeshLod& lod = mesh_cpu.lods[lod_index];
+                    command_list->SetGraphicsRoot32BitConstant(1, first_instance, 0);
+                    command_list->DrawIndexedInstanced(lod.n_indices, static_cast<UINT>(batch.size()), lod.first_index, 0, 0);
+                    m_lod_stats.draw_calls += 1;
+                }
+            }
         }
         m_model_queue_length = 0;
+        m_lod_history.end_frame(m_lod_history_frames);
+
+        // Stream texture levels for what this frame drew, the next frame picks up the ones that changed
+        m_texture_streamer.update();
 
         D3D12_RESOURCE_BARRIER present_barrier;
         present_barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
@@ -638,51 +804,295 @@ namespace Flan {
         return glfwWindowShouldClose(window) != 0;
     }
 
-    TextureGPU RendererDX12::upload_texture(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards) {
+    RendererDX12::~RendererDX12()
+    {
+        // Streaming loads still in flight write into the streamer, and the GPU may still read the streamed textures
+        m_texture_streamer.release();
+        if (m_device != nullptr && m_command.get_command_queue() != nullptr) {
+            wait_for_queue();
+        }
+        for (const StreamedTextureGPU& streamed : m_streamed_textures) {
+            if (streamed.texture.resource != nullptr) {
+                streamed.texture.resource->Release();
+            }
+        }
+        for (auto& resources : m_to_be_released) {
+            for (ID3D12Resource* resource : resources) {
+                resource->Release();
+            }
+            resources.clear();
+        }
+        m_streamed_textures.clear();
+        m_pending_texture_uploads.clear();
+        m_texture_uploads.clear();
+    }
+
+    // BC4 and BC5 have no sRGB variant, they only hold linear data
+    static DXGI_FORMAT get_dxgi_format(TextureFormat format, bool is_srgb) {
+        switch (format) {
+        case TextureFormat::BC1: return is_srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+        case TextureFormat::BC3: return is_srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+        case TextureFormat::BC4: return DXGI_FORMAT_BC4_UNORM;
+        case TextureFormat::BC5: return DXGI_FORMAT_BC5_UNORM;
+        case TextureFormat::BC7: return is_srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+        case TextureFormat::R8: return DXGI_FORMAT_R8_UNORM;
+        case TextureFormat::RG8: return DXGI_FORMAT_R8G8_UNORM;
+        default: return is_srgb ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+        }
+    }
+
+    u32 RendererDX12::upload_texture(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards) {
         // Get texture resource
         TextureResource* resource = m_resource_manager->get_resource<TextureResource>(texture_handle);
-        if (resource->resource_type == ResourceType::Invalid) {
-            return TextureGPU{ nullptr, 0 };
+        if (resource == nullptr || resource->resource_type == ResourceType::Invalid) {
+            return no_streamed_texture;
+        }
+        const auto uploaded = m_texture_uploads.find({ resource, is_srgb });
+        if (uploaded != m_texture_uploads.end()) {
+            return uploaded->second;
         }
 
+        // Only the levels streaming keeps resident go to the GPU, the next begin_frame creates the resource
+        const u32 stream_index = m_texture_streamer.add_texture(resource);
+        if (stream_index == no_streamed_texture) {
+            return no_streamed_texture;
+        }
+        m_streamed_textures.resize(std::max<size_t>(m_streamed_textures.size(), stream_index + 1));
+        m_streamed_textures[stream_index].texture.handle = m_srv_heap.allocate();
+        m_streamed_textures[stream_index].is_srgb = is_srgb;
+        m_pending_texture_uploads.push_back(stream_index);
+
+        // We're done!
+        m_texture_uploads[{ resource, is_srgb }] = stream_index;
+        return stream_index;
+    }
+
+    static D3D12_RESOURCE_BARRIER get_transition_barrier(ID3D12Resource* resource, UINT subresource, D3D12_RESOURCE_STATES before, D3D12_RESOURCE_STATES after) {
+        D3D12_RESOURCE_BARRIER barrier;
+        barrier.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
+        barrier.Flags = D3D12_RESOURCE_BARRIER_FLAG_NONE;
+        barrier.Transition.pResource = resource;
+        barrier.Transition.StateBefore = before;
+        barrier.Transition.StateAfter = after;
+        barrier.Transition.Subresource = subresource;
+        return barrier;
+    }
+
+    void RendererDX12::update_streamed_textures(const u32* stream_indices, size_t n_textures) {
+        if (n_textures == 0) {
+            return;
+        }
+        auto* command_list = m_command.get_command_list();
+
         // Define heap properties
         D3D12_HEAP_PROPERTIES heap_properties = {};
         heap_properties.Type = D3D12_HEAP_TYPE_DEFAULT;
 
-        // Define resource description based on the texture resource
-        D3D12_RESOURCE_DESC resource_desc = {};
-        resource_desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-        resource_desc.Width = resource->width;
-        resource_desc.Height = resource->height;
-        resource_desc.DepthOrArraySize = 1;
-        resource_desc.MipLevels = 1;
-        resource_desc.Format = is_srgb ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
-        resource_desc.SampleDesc.Count = 1;
-        resource_desc.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-        // Create a texture resource
-        TextureGPU texture_gpu;
-        m_device->CreateCommittedResource(
-            &heap_properties, 
-            D3D12_HEAP_FLAG_NONE, 
-            &resource_desc, 
-            D3D12_RESOURCE_STATE_COMMON, 
-            nullptr, 
-            IID_PPV_ARGS(&texture_gpu.resource)
-        );
-
-        // Create a Shader Resource View
-        D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
-        srv_desc.Format = resource_desc.Format;
-        srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-        srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-        srv_desc.Texture2D.MipLevels = 1;
-        srv_desc.Texture2D.MostDetailedMip = 0;
-        texture_gpu.handle = m_srv_heap.allocate();
-        m_device->CreateShaderResourceView(texture_gpu.resource, &srv_desc, texture_gpu.handle.cpu);
+        // A texture gets a new resource when levels finer than its resource holds became resident, or when its resource
+        // holds too many levels that were dropped. Otherwise only the resident levels it never had data for are copied
+        struct LevelCopy {
+            ID3D12Resource* source;
+            UINT source_subresource;
+            ID3D12Resource* destination;
+            UINT destination_subresource;
+        };
+        std::vector<LevelCopy> level_copies;
+        std::vector<SubresourceUpload> uploads;
+        std::vector<D3D12_RESOURCE_BARRIER> barriers_before;
+        std::vector<D3D12_RESOURCE_BARRIER> barriers_after;
+        const auto add_upload = [&](u32 stream_index, ID3D12Resource* destination, const D3D12_RESOURCE_DESC& desc, u32 first_level, u32 from_level, u32 to_level) {
+            const TextureResource* resource = m_texture_streamer.get_source(stream_index);
+            SubresourceUpload& upload = uploads.emplace_back();
+            upload.destination = destination;
+            upload.desc = desc;
+            upload.first_subresource = from_level - first_level;
+            for (u32 level = from_level; level < to_level; ++level) {
+                D3D12_SUBRESOURCE_DATA& subresource = upload.subresources.emplace_back();
+                subresource.pData = m_texture_streamer.get_mip_data(stream_index, level);
+                subresource.RowPitch = resource->get_mip_row_pitch(level);
+                subresource.SlicePitch = static_cast<LONG_PTR>(resource->get_mip_bytes(level));
+            }
+        };
+        for (size_t i = 0; i < n_textures; ++i) {
+            const u32 stream_index = stream_indices[i];
+            StreamedTextureGPU& streamed = m_streamed_textures[stream_index];
+            const TextureResource* resource = m_texture_streamer.get_source(stream_index);
+            const u32 resident_level = m_texture_streamer.get_resident_mip(stream_index);
+            const u32 n_levels = resource->n_mips;
+
+            const bool grows = streamed.texture.resource == nullptr || resident_level < streamed.first_level;
+            const bool shrinks = resident_level > streamed.first_level + m_streamed_levels_kept;
+            if (grows || shrinks) {
+                // Define resource description based on the texture resource
+                D3D12_RESOURCE_DESC resource_desc = {};
+                resource_desc.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+                resource_desc.Width = resource->get_mip_width(resident_level);
+                resource_desc.Height = resource->get_mip_height(resident_level);
+                resource_desc.DepthOrArraySize = 1;
+                resource_desc.MipLevels = static_cast<UINT16>(n_levels - resident_level);
+                resource_desc.Format = get_dxgi_format(resource->format, streamed.is_srgb);
+                resource_desc.SampleDesc.Count = 1;
+                resource_desc.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+                // Create a texture resource
+                ID3D12Resource* new_resource = nullptr;
+                throw_if_failed(m_device->CreateCommittedResource(&heap_properties, D3D12_HEAP_FLAG_NONE, &resource_desc, D3D12_RESOURCE_STATE_COPY_DEST, nullptr,
+                                                                  IID_PPV_ARGS(&new_resource)));
+
+                // The levels the old resource has data for are copied on the GPU, only the others come from the CPU. This
+                // frame's copies read the old resource, so it goes once this frame's fence retires
+                u32 copied_level = n_levels;
+                if (streamed.texture.resource != nullptr) {
+                    copied_level = std::max(resident_level, streamed.uploaded_level);
+                    barriers_before.push_back(get_transition_barrier(streamed.texture.resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES,
+                                                                     D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE));
+                    for (u32 level = copied_level; level < n_levels; ++level) {
+                        level_copies.push_back({ streamed.texture.resource, level - streamed.first_level, new_resource, level - resident_level });
+                    }
+                    release_later(streamed.texture.resource);
+                }
+                if (resident_level < copied_level) {
+                    add_upload(stream_index, new_resource, resource_desc, resident_level, resident_level, copied_level);
+                }
+                barriers_after.push_back(get_transition_barrier(new_resource, D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES, D3D12_RESOURCE_STATE_COPY_DEST,
+                                                                D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+                streamed.texture.resource = new_resource;
+                streamed.first_level = resident_level;
+                streamed.uploaded_level = resident_level;
+            }
+            else if (resident_level < streamed.uploaded_level) {
+                // Only the new levels, earlier frames sampled the others and are done before this frame's copies run
+                for (u32 level = resident_level; level < streamed.uploaded_level; ++level) {
+                    barriers_before.push_back(get_transition_barrier(streamed.texture.resource, level - streamed.first_level,
+                                                                     D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST));
+                    barriers_after.push_back(get_transition_barrier(streamed.texture.resource, level - streamed.first_level, D3D12_RESOURCE_STATE_COPY_DEST,
+                                                                    D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE));
+                }
+                add_upload(stream_index, streamed.texture.resource, streamed.texture.resource->GetDesc(), streamed.first_level, resident_level, streamed.uploaded_level);
+                streamed.uploaded_level = resident_level;
+            }
+        }
 
-        // We're done!
-        return texture_gpu;
+        // Record the copies before this frame's draws
+        if (!barriers_before.empty()) {
+            command_list->ResourceBarrier(static_cast<UINT>(barriers_before.size()), barriers_before.data());
+        }
+        for (const LevelCopy& copy : level_copies) {
+            D3D12_TEXTURE_COPY_LOCATION copy_destination = {};
+            copy_destination.pResource = copy.destination;
+            copy_destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+            copy_destination.SubresourceIndex = copy.destination_subresource;
+            D3D12_TEXTURE_COPY_LOCATION copy_source = {};
+            copy_source.pResource = copy.source;
+            copy_source.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+            copy_source.SubresourceIndex = copy.source_subresource;
+            command_list->CopyTextureRegion(&copy_destination, 0, 0, 0, &copy_source, nullptr);
+        }
+        record_subresource_uploads(uploads.data(), uploads.size());
+        if (!barriers_after.empty()) {
+            command_list->ResourceBarrier(static_cast<UINT>(barriers_after.size()), barriers_after.data());
+        }
+
+        for (size_t i = 0; i < n_textures; ++i) {
+            // The view is clamped to the resident levels. It's rewritten in place, end_frame waits for its frame's fence so
+            // no earlier frame still reads it
+            const StreamedTextureGPU& streamed = m_streamed_textures[stream_indices[i]];
+            const D3D12_RESOURCE_DESC resource_desc = streamed.texture.resource->GetDesc();
+            D3D12_SHADER_RESOURCE_VIEW_DESC srv_desc{};
+            srv_desc.Format = resource_desc.Format;
+            srv_desc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+            srv_desc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+            srv_desc.Texture2D.MipLevels = resource_desc.MipLevels;
+            srv_desc.Texture2D.MostDetailedMip = 0;
+            srv_desc.Texture2D.ResourceMinLODClamp = static_cast<float>(m_texture_streamer.get_resident_mip(stream_indices[i]) - streamed.first_level);
+            m_device->CreateShaderResourceView(streamed.texture.resource, &srv_desc, streamed.texture.handle.cpu);
+        }
+    }
+
+    void RendererDX12::record_subresource_uploads(const SubresourceUpload* uploads, size_t n_uploads) {
+        if (n_uploads == 0) {
+            return;
+        }
+
+        // Find where every subresource of every destination goes in one linear upload buffer
+        std::vector<std::vector<D3D12_PLACED_SUBRESOURCE_FOOTPRINT>> footprints(n_uploads);
+        std::vector<std::vector<UINT>> row_counts(n_uploads);
+        std::vector<std::vector<UINT64>> row_sizes(n_uploads);
+        UINT64 upload_size = 0;
+        for (size_t i = 0; i < n_uploads; ++i) {
+            const UINT n_subresources = static_cast<UINT>(uploads[i].subresources.size());
+            footprints[i].resize(n_subresources);
+            row_counts[i].resize(n_subresources);
+            row_sizes[i].resize(n_subresources);
+            const UINT64 offset = (upload_size + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) & ~static_cast<UINT64>(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1);
+            UINT64 size = 0;
+            m_device->GetCopyableFootprints(&uploads[i].desc, uploads[i].first_subresource, n_subresources, offset, footprints[i].data(), row_counts[i].data(), row_sizes[i].data(), &size);
+            upload_size = offset + size;
+        }
+
+        D3D12_HEAP_PROPERTIES upload_heap_properties = {};
+        upload_heap_properties.Type = D3D12_HEAP_TYPE_UPLOAD;
+        D3D12_RESOURCE_DESC upload_desc = {};
+        upload_desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+        upload_desc.Width = upload_size;
+        upload_desc.Height = 1;
+        upload_desc.DepthOrArraySize = 1;
+        upload_desc.MipLevels = 1;
+        upload_desc.SampleDesc.Count = 1;
+        upload_desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+        ComPtr<ID3D12Resource> upload_buffer;
+        throw_if_failed(m_device->CreateCommittedResource(&upload_heap_properties, D3D12_HEAP_FLAG_NONE, &upload_desc,
+                                                          D3D12_RESOURCE_STATE_GENERIC_READ, nullptr, IID_PPV_ARGS(&upload_buffer)));
+
+        // Fill it row by row, the buffer's rows are padded to the copy pitch alignment
+        u8* mapped = nullptr;
+        D3D12_RANGE read_range = { 0, 0 };
+        throw_if_failed(upload_buffer->Map(0, &read_range, reinterpret_cast<void**>(&mapped)));
+        for (size_t i = 0; i < n_uploads; ++i) {
+            for (size_t j = 0; j < uploads[i].subresources.size(); ++j) {
+                const u8* source = static_cast<const u8*>(uploads[i].subresources[j].pData);
+                u8* target = mapped + footprints[i][j].Offset;
+                for (UINT row = 0; row < row_counts[i][j]; ++row) {
+                    memcpy(target + static_cast<size_t>(row) * footprints[i][j].Footprint.RowPitch, source + static_cast<size_t>(row) * uploads[i].subresources[j].RowPitch, row_sizes[i][j]);
+                }
+            }
+        }
+        upload_buffer->Unmap(0, nullptr);
+
+        // Record the copies on this frame's command list, the destinations have to be in the copy destination state
+        auto* command_list = m_command.get_command_list();
+        for (size_t i = 0; i < n_uploads; ++i) {
+            for (size_t j = 0; j < uploads[i].subresources.size(); ++j) {
+                D3D12_TEXTURE_COPY_LOCATION copy_destination = {};
+                copy_destination.pResource = uploads[i].destination;
+                copy_destination.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+                copy_destination.SubresourceIndex = uploads[i].first_subresource + static_cast<UINT>(j);
+                D3D12_TEXTURE_COPY_LOCATION copy_source = {};
+                copy_source.pResource = upload_buffer.Get();
+                copy_source.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+                copy_source.PlacedFootprint = footprints[i][j];
+                command_list->CopyTextureRegion(&copy_destination, 0, 0, 0, &copy_source, nullptr);
+            }
+        }
+
+        // The upload buffer stays until the copies have run
+        release_later(upload_buffer.Detach());
+    }
+
+    void RendererDX12::release_later(ID3D12Resource* resource) {
+        m_to_be_released[m_frame_index].push_back(resource);
+    }
+
+    void RendererDX12::wait_for_queue() {
+        ComPtr<ID3D12Fence> fence;
+        throw_if_failed(m_device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+        const HANDLE fence_event = CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS);
+        m_command.get_command_queue()->Signal(fence.Get(), 1);
+        if (fence->GetCompletedValue() < 1) {
+            fence->SetEventOnCompletion(1, fence_event);
+            WaitForSingleObject(fence_event, INFINITE);
+        }
+        CloseHandle(fence_event);
     }
 
     void RendererDX12::upload_mesh(ResourceHandle handle, ResourceManager& resource_manager) {
@@ -705,6 +1115,8 @@ namespace Flan {
             model->materials_gpu[i].tex_nrm = upload_texture(model->materials_cpu[i].tex_nrm, false, true);
             model->materials_gpu[i].tex_mtl = upload_texture(model->materials_cpu[i].tex_mtl, false, true);
             model->materials_gpu[i].tex_rgh = upload_texture(model->materials_cpu[i].tex_rgh, false, true);
+            model->materials_gpu[i].tex_occ = upload_texture(model->materials_cpu[i].tex_occ, false, true);
+            model->materials_gpu[i].tex_orm = upload_texture(model->materials_cpu[i].tex_orm, false, true);
         }
 
         // For each mesh
@@ -713,6 +1125,10 @@ namespace Flan {
             MeshCPU& mesh_cpu = model->meshes_cpu[i];
             MeshGPU& mesh_gpu = model->meshes_gpu[i];
 
+            // Keep the bounds around on the GPU side
+            mesh_gpu.bounds = mesh_cpu.bounds;
+            mesh_gpu.uv_density = compute_uv_density(mesh_cpu.vertices, mesh_cpu.indices, mesh_cpu.n_lods > 0 ? mesh_cpu.lods[0].n_indices : mesh_cpu.n_indices);
+
             // Only the GPU needs this data, set the range accordingly
             mesh_gpu.vertex_buffer_range = { 0, 0 };
             mesh_gpu.index_buffer_range = { 0, 0 };
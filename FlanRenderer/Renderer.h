@@ -15,16 +15,20 @@
 #include <chrono>
 #include <wrl.h>
 #include <string_view>
+#include <unordered_map>
 
 #include "CommonDefines.h"
 #include "Descriptor.h"
 #include "FlanTypes.h"
 #include "DynamicAllocator.h"
 #include "Input.h"
+#include "LodSelection.h"
 #include "Resources.h"
+#include "TextureStreaming.h"
 
 namespace Flan {
     using Microsoft::WRL::ComPtr;
+    class SkinnedModelInstance;
 
     class D3D12_Command {
     public:
@@ -157,6 +161,8 @@ namespace Flan {
     struct ModelDrawInfo {
         ResourceHandle model_to_draw;
         Transform transform;
+        u32 instance_id = 0; // Identifies this object across frames for LOD hysteresis, 0 disables hysteresis
+        const SkinnedModelInstance* skinned_model = nullptr; // Poses the skinned mesh instances, without it they're drawn in their bind pose
     };
 
     struct ConstBuffer {
@@ -190,15 +196,25 @@ namespace Flan {
             assert(resource_manager != nullptr);
             m_resource_manager = resource_manager;
         }
+        ~RendererDX12();
         bool create_window(int width, int height, std::string_view name) override;
         bool init(int w, int h) override;
         void begin_frame() override;
         void end_frame() override;
         void draw_model(ModelDrawInfo model) override;
         bool should_close() override;
-        TextureGPU upload_texture(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards);
+        // Starts streaming a texture, the next begin_frame uploads its resident levels. Returns its stream index, or
+        // no_streamed_texture if it couldn't be uploaded
+        u32 upload_texture(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards);
+        // The current resource and view of an uploaded texture, nullptr for no_streamed_texture. Streaming replaces the
+        // resource, so this is only valid until the next begin_frame
+        const TextureGPU* get_texture(u32 stream_index) const { return stream_index < m_streamed_textures.size() ? &m_streamed_textures[stream_index].texture : nullptr; }
         void upload_mesh(ResourceHandle handle, ResourceManager& resource_manager);
         void set_camera_transform(const Transform& transform);
+        void set_lod_settings(const LodSelectionSettings& settings) { m_lod_settings = settings; }
+        const LodStats& get_lod_stats() const { return m_lod_stats; }
+        void set_texture_streaming_settings(const TextureStreamingSettings& settings) { m_texture_streamer.set_settings(settings); }
+        const TextureStreamingStats& get_texture_streaming_stats() const { return m_texture_streamer.get_stats(); }
     private:
         void create_hwnd(int width, int height, std::string_view name);
         void create_swapchain(int width, int height);
@@ -208,6 +224,21 @@ namespace Flan {
         void create_pipeline_state_object();
         void create_descriptor_heaps();
         void create_root_signature();
+        void create_per_frame_buffers();
+        bool allocate_dynamic_vertices(const Vertex* vertices, size_t n_verts, D3D12_VERTEX_BUFFER_VIEW& view_out);
+        bool allocate_instance_transforms(const glm::mat4* transforms, size_t n_transforms, u32& first_instance_out);
+        void create_upload_buffer(size_t size, ComPtr<ID3D12Resource>& buffer_out, u8*& data_out); // Persistently mapped
+        // Copies into a range of subresources of a resource, starting at first_subresource
+        struct SubresourceUpload {
+            ID3D12Resource* destination;
+            D3D12_RESOURCE_DESC desc;
+            UINT first_subresource;
+            std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+        };
+        void update_streamed_textures(const u32* stream_indices, size_t n_textures); // Uploads the levels that became resident, on this frame's command list
+        void record_subresource_uploads(const SubresourceUpload* uploads, size_t n_uploads); // Through one upload buffer, released with this frame
+        void release_later(ID3D12Resource* resource); // Takes over the reference, and releases it once this frame's fence retires
+        void wait_for_queue(); // Until the GPU has finished everything submitted so far
         void free_later(void* data_pointer);
         Shader load_shader(const std::string& path);
         UINT m_frame_index;
@@ -226,16 +257,58 @@ namespace Flan {
             {1, 1, 1}
         };
 
+        glm::mat4 m_view_matrix{ 1.0f };
+        glm::mat4 m_projection_matrix{ 1.0f };
+
         // Draw queues
         ModelDrawInfo* m_model_queue = nullptr;
         size_t m_model_queue_length = 0;
 
+        // LOD selection
+        LodSelectionSettings m_lod_settings;
+        LodStats m_lod_stats;
+        LodHistory m_lod_history;
+        std::vector<std::vector<glm::mat4>> m_lod_batches; // Transforms of the instances of one mesh, by LOD
+        static constexpr u32 m_lod_history_frames = 60; // Objects not drawn for this long start over without hysteresis
+
+        // Stream indices of uploaded textures by resource and sRGB view. Deduplicated textures share a resource, so they
+        // share the upload
+        std::map<std::pair<const TextureResource*, bool>, u32> m_texture_uploads;
+
+        // Texture streaming. A texture's resource holds the levels from first_level down, and its view is clamped to the
+        // resident ones, so dropped levels stay in the resource until more than m_streamed_levels_kept of them are
+        // dropped. Levels finer than first_level need a new resource, which copies the levels the old one has on the GPU
+        struct StreamedTextureGPU {
+            TextureGPU texture{ nullptr, {} };
+            bool is_srgb = false;
+            u32 first_level = 0;
+            u32 uploaded_level = ~0u; // Levels from this one down hold data, finer ones haven't been resident yet
+        };
+        static constexpr u32 m_streamed_levels_kept = 1;
+        TextureStreamer m_texture_streamer;
+        std::vector<StreamedTextureGPU> m_streamed_textures; // By stream index
+        std::vector<u32> m_pending_texture_uploads; // Added since the last begin_frame
+
         // Descriptors
         DescriptorHeap m_dsv_heap;
         DescriptorHeap m_rtv_heap;
         DescriptorHeap m_cbv_heap;
         DescriptorHeap m_srv_heap;
 
+        // Per-frame dynamic vertex buffers, for vertex data the CPU writes every frame, like skinned meshes. Each frame
+        // fills its own persistently mapped upload buffer from the start
+        static constexpr size_t m_dynamic_vertex_buffer_size = 64 MB;
+        ComPtr<ID3D12Resource> m_dynamic_vertex_buffers[m_backbuffer_count];
+        u8* m_dynamic_vertex_data[m_backbuffer_count]{};
+        size_t m_dynamic_vertex_offset = 0;
+
+        // Per-frame instance buffers, the transforms of every instance drawn this frame. Draws pass the index of their
+        // first instance in a root constant, since SV_InstanceID starts at 0 for every draw
+        static constexpr size_t m_instance_buffer_size = 4 MB;
+        ComPtr<ID3D12Resource> m_instance_buffers[m_backbuffer_count];
+        u8* m_instance_data[m_backbuffer_count]{};
+        size_t m_instance_count = 0;
+
         // Swapchain
         ComPtr<IDXGISwapChain3> m_swapchain = nullptr;
         ComPtr<ID3D12Resource> m_render_targets[m_backbuffer_count];
@@ -252,5 +325,6 @@ namespace Flan {
         ComPtr<ID3D12Debug1> m_debug_interface;// If we're in release mode, this variable will be unused
 #endif
         std::vector<void*> m_to_be_deallocated[m_backbuffer_count]{};
+        std::vector<ID3D12Resource*> m_to_be_released[m_backbuffer_count]{};
     };
 }
\ No newline at end of file
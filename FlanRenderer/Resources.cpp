@@ -1,12 +1,77 @@
 #include "Resources.h"
 #include "HelperFunctions.h"
 #include "ModelResource.h"
+#include "CookedModel.h"
 #include "Descriptor.h"
 #include "Renderer.h"
 #include "TextureResource.h"
+#include "JobSystem.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <filesystem>
 
 namespace Flan {
 
+    std::string get_packed_texture_name(const std::string& red_path, const std::string& green_path, const std::string& blue_path)
+    {
+        return red_path + "|" + green_path + "|" + blue_path;
+    }
+
+    void split_packed_texture_name(const std::string& name, std::string (&paths_out)[3])
+    {
+        size_t start = 0;
+        for (u32 channel = 0; channel < 3; ++channel) {
+            const size_t end = channel < 2 ? name.find('|', start) : std::string::npos;
+            paths_out[channel] = name.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            start = end == std::string::npos ? name.size() : end + 1;
+        }
+    }
+
+    // The same image is stored differently for each usage, so each usage gets a handle of its own
+    static ResourceHandle get_texture_handle(const std::string& path, TextureUsage usage)
+    {
+        const u32 usage_index = static_cast<u32>(usage);
+        return hash_bytes(&usage_index, sizeof(usage_index), hash_string(path));
+    }
+
+    // Bytes of every level, without any padding a container file puts between them
+    static size_t get_texture_payload_bytes(const TextureResource& texture)
+    {
+        size_t bytes = 0;
+        for (u32 level = 0; level < texture.n_mips; ++level) {
+            bytes += texture.get_mip_bytes(level);
+        }
+        return bytes;
+    }
+
+    // Hash of everything that ends up on the GPU: the layout, the usage and the bytes of every level
+    static u64 hash_texture_payload(const TextureResource& texture)
+    {
+        if (texture.resource_type != ResourceType::Texture) {
+            return 0;
+        }
+        const u32 layout[] = { static_cast<u32>(texture.width), static_cast<u32>(texture.height), texture.n_mips, static_cast<u32>(texture.format), static_cast<u32>(texture.usage) };
+        u64 hash = hash_bytes(layout, sizeof(layout));
+        for (u32 level = 0; level < texture.n_mips; ++level) {
+            hash = hash_bytes(texture.get_mip_data(level), texture.get_mip_bytes(level), hash);
+        }
+        return hash;
+    }
+
+    static bool texture_payloads_equal(const TextureResource& a, const TextureResource& b)
+    {
+        if (a.width != b.width || a.height != b.height || a.n_mips != b.n_mips || a.format != b.format || a.usage != b.usage) {
+            return false;
+        }
+        for (u32 level = 0; level < a.n_mips; ++level) {
+            if (memcmp(a.get_mip_data(level), b.get_mip_data(level), a.get_mip_bytes(level)) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     ResourceManager::ResourceManager()
     {
     }
@@ -18,11 +83,18 @@ namespace Flan {
         // Generate a hash for the resource
         ResourceHandle handle = std::hash<std::string>{}(path);
 
-        // Load mesh from gltf
+        // Load mesh from a cooked model if that's what we got, otherwise from gltf
         ModelResource* model = (ModelResource*)dynamic_allocate(sizeof(ModelResource));
-        model->load(path, this);
+        const std::string cooked_extension = cooked_model_extension;
+        if (path.size() >= cooked_extension.size() && path.compare(path.size() - cooked_extension.size(), cooked_extension.size(), cooked_extension) == 0) {
+            model->load_cooked(path, this);
+        }
+        else {
+            model->load(path, this);
+        }
 
         // Add the resource to the resources map
+        std::lock_guard<std::mutex> lock(resource_mutex);
         loaded_resource_data[handle] = model;
         loaded_resource_type[handle] = ResourceType::Model;
 
@@ -30,19 +102,133 @@ namespace Flan {
         return handle;
     }
 
-    ResourceHandle ResourceManager::load_texture(const std::string& path) {
+    ResourceHandle ResourceManager::load_texture(const std::string& path, TextureUsage usage) {
         // Generate a hash for the resource
-        ResourceHandle handle = std::hash<std::string>{}(path);
+        ResourceHandle handle = get_texture_handle(path, usage);
 
         // Load mesh from gltf
         TextureResource* texture = (TextureResource*)dynamic_allocate(sizeof(TextureResource));
-        texture->load(path, this);
+        texture->load(path, this, usage);
+        const u64 payload_hash = hash_texture_payload(*texture);
 
         // Add the resource to the resources map
-        loaded_resource_data[handle] = texture;
-        loaded_resource_type[handle] = ResourceType::Texture;
+        std::lock_guard<std::mutex> lock(resource_mutex);
+        add_texture(handle, texture, payload_hash);
 
         // Give the handle back to the player
         return handle;
     }
+
+    void ResourceManager::load_textures(const std::vector<TextureLoadRequest>& requests) {
+        // Find the paths that still need loading, once each
+        struct PendingTexture {
+            ResourceHandle handle;
+            const TextureLoadRequest* request;
+            u64 file_size;
+            TextureResource* texture;
+            u64 payload_hash;
+        };
+        std::vector<PendingTexture> pending;
+        std::map<ResourceHandle, bool> queued;
+        {
+            std::lock_guard<std::mutex> lock(resource_mutex);
+            for (const TextureLoadRequest& request : requests) {
+                const ResourceHandle handle = get_texture_handle(request.path, request.usage);
+                if (request.handle_out != nullptr) {
+                    *request.handle_out = handle;
+                }
+                if (loaded_resource_data.find(handle) == loaded_resource_data.end() && queued.emplace(handle, true).second) {
+                    pending.push_back({ handle, &request, 0, nullptr, 0 });
+                }
+            }
+        }
+
+        // Largest files first, so a big texture doesn't start last and hold up the whole batch
+        for (PendingTexture& texture : pending) {
+            std::error_code error;
+            if (texture.request->image != nullptr) {
+                texture.file_size = texture.request->image->image.size();
+            }
+            else if (texture.request->usage == TextureUsage::Packed) {
+                std::string source_paths[3];
+                split_packed_texture_name(texture.request->path, source_paths);
+                for (const std::string& source_path : source_paths) {
+                    const u64 source_size = source_path.empty() ? 0 : std::filesystem::file_size(source_path, error);
+                    texture.file_size += error ? 0 : source_size;
+                }
+            }
+            else {
+                texture.file_size = std::filesystem::file_size(texture.request->path, error);
+            }
+        }
+        std::stable_sort(pending.begin(), pending.end(), [](const PendingTexture& a, const PendingTexture& b) { return a.file_size > b.file_size; });
+
+        // Decode in parallel. Mip generation and compression inside each load split their rows across the job system too
+        JobSystem::get_instance()->parallel_for(pending.size(), [&](size_t i) {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - " + pending[i].request->path;
+            TextureResource* texture = (TextureResource*)dynamic_allocate(sizeof(TextureResource));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+            if (pending[i].request->image != nullptr) {
+                texture->load(*pending[i].request->image, pending[i].request->path, this, pending[i].request->usage);
+            }
+            else {
+                texture->load(pending[i].request->path, this, pending[i].request->usage);
+            }
+            pending[i].texture = texture;
+            pending[i].payload_hash = hash_texture_payload(*texture);
+        });
+
+        // Add the resources to the resources map
+        std::lock_guard<std::mutex> lock(resource_mutex);
+        for (const PendingTexture& texture : pending) {
+            add_texture(texture.handle, texture.texture, texture.payload_hash);
+        }
+    }
+
+    ResourceHandle ResourceManager::insert_texture(const std::string& name, TextureResource* texture) {
+        // Same handle as loading it by that name would give
+        ResourceHandle handle = get_texture_handle(name, texture->usage);
+        const u64 payload_hash = hash_texture_payload(*texture);
+
+        // Add the resource to the resources map, unless something else got there first
+        std::lock_guard<std::mutex> lock(resource_mutex);
+        if (loaded_resource_data.find(handle) != loaded_resource_data.end()) {
+            texture->unload();
+            return handle;
+        }
+        add_texture(handle, texture, payload_hash);
+        return handle;
+    }
+
+    void ResourceManager::add_texture(ResourceHandle handle, TextureResource* texture, u64 payload_hash) {
+        // A texture whose payload is already loaded is freed, and its handle points at the one already there
+        if (texture->resource_type == ResourceType::Texture) {
+            const size_t payload_bytes = get_texture_payload_bytes(*texture);
+            texture_dedup_report.n_textures++;
+            texture_dedup_report.bytes_loaded += payload_bytes;
+            TextureResource* shared = nullptr;
+            const auto range = textures_by_payload.equal_range(payload_hash);
+            for (auto it = range.first; it != range.second && shared == nullptr; ++it) {
+                if (texture_payloads_equal(*it->second, *texture)) {
+                    shared = it->second;
+                }
+            }
+            if (shared != nullptr) {
+                texture_dedup_report.bytes_saved += payload_bytes;
+                texture->unload();
+                texture = shared;
+            }
+            else {
+                texture_dedup_report.n_unique++;
+                textures_by_payload.emplace(payload_hash, texture);
+            }
+        }
+        loaded_resource_data[handle] = texture;
+        loaded_resource_type[handle] = ResourceType::Texture;
+    }
+
+    TextureDedupReport ResourceManager::get_texture_dedup_report() {
+        std::lock_guard<std::mutex> lock(resource_mutex);
+        return texture_dedup_report;
+    }
 }
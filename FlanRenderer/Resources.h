@@ -5,15 +5,23 @@
 #include <mutex>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include "DynamicAllocator.h"
 #include <glm/glm.hpp>
 #include <iostream>
 #include <fstream>
 
+#include "Bounds.h"
 #include "Descriptor.h"
+#include "Meshlets.h"
+#include "TextureCompression.h"
 
 // A descriptor heap keeps track of descriptor handles, and manages allocation and deallocation. 
 
+namespace tinygltf {
+    struct Image;
+}
+
 namespace Flan {
     using Microsoft::WRL::ComPtr;
 
@@ -26,6 +34,12 @@ namespace Flan {
         glm::vec2 texcoord1 = { 0, 0 };
     };
 
+    // Up to 4 joints per vertex, with weights that add up to 1. Kept out of Vertex, so only skinned meshes pay for it
+    struct VertexSkin {
+        u16 joints[4] = { 0, 0, 0, 0 }; // Indices into the skin's joint list
+        float weights[4] = { 1, 0, 0, 0 };
+    };
+
     struct MeshGPU {
         // Resources
         ID3D12Resource* vertex_buffer_resource;
@@ -42,13 +56,62 @@ namespace Flan {
         // Buffer Data
         u8* vertex_buffer_data;
         u8* index_buffer_data;
+
+        // Copied from the CPU mesh, so culling doesn't need the CPU side data
+        MeshBounds bounds;
+
+        // World units per UV unit in mesh space, for texture streaming, see compute_uv_density
+        float uv_density;
+    };
+
+    // A range of a merged mesh that came from one glTF primitive
+    struct SubMesh {
+        u32 first_index;
+        u32 n_indices;
+        u32 first_vertex;
+        u32 n_verts;
+        u32 first_meshlet;
+        u32 n_meshlets;
+        MeshBounds bounds;
+    };
+
+    // A range of the index buffer that draws the whole mesh at one detail level
+    struct MeshLod {
+        u32 first_index;
+        u32 n_indices;
+        float error; // Largest geometric error compared to LOD 0, in model space units
+    };
+
+    static constexpr u32 no_skin = ~0u;
+
+    // One placement of a mesh in a model, from a glTF node or an EXT_mesh_gpu_instancing entry
+    struct MeshInstance {
+        glm::mat4 transform; // Mesh space to model space, identity for skinned instances since the joints place them
+        u32 mesh_index;
+        u32 skin_index; // Index in ModelResource::skins, or no_skin
     };
 
     struct MeshCPU {
         Vertex* vertices;
-        u32* indices;
+        VertexSkin* skin; // One per vertex, null if the mesh isn't skinned
+        u32* indices; // LOD 0 first, followed by the lower LODs
+        MeshLod* lods;
+        size_t n_lods;
+        SubMesh* sub_meshes;
         size_t n_verts;
         size_t n_indices;
+        size_t n_sub_meshes;
+        MeshBounds bounds; // In mesh space, instances place it in the model
+        size_t first_instance; // Range in ModelResource::instances
+        size_t n_instances;
+
+        // Meshlets, see Meshlets.h. Each sub-mesh has its own range of meshlets
+        Meshlet* meshlets;
+        u32* meshlet_vertices;
+        u8* meshlet_triangles;
+        size_t n_meshlets;
+        size_t n_meshlet_vertices;
+        size_t n_meshlet_triangles;
     };
 
     struct TextureGPU {
@@ -57,13 +120,17 @@ namespace Flan {
         DescriptorHandle handle;
     };
 
+    // Textures are stream indices in the renderer, see RendererDX12::get_texture, since streaming replaces their
+    // resources. ~0u for maps the material doesn't have
     struct MaterialGPU
     {
-        TextureGPU tex_col;
-        TextureGPU tex_nrm;
-        TextureGPU tex_rgh;
-        TextureGPU tex_mtl;
-        TextureGPU tex_emm;
+        u32 tex_col;
+        u32 tex_nrm;
+        u32 tex_rgh;
+        u32 tex_mtl;
+        u32 tex_emm;
+        u32 tex_occ;
+        u32 tex_orm; // Occlusion, roughness and metalness in red, green and blue, when the material is packed
         glm::vec4 mul_col;
         glm::vec3 mul_nrm;
         float mul_rgh;
@@ -80,16 +147,102 @@ namespace Flan {
         Texture,
     };
 
+    // What a texture holds, which decides how it's filtered and stored
+    enum struct TextureUsage {
+        Color = 0, // sRGB encoded colour, like albedo or emission
+        Normal, // Tangent space normals packed into RGB
+        Linear, // Other data, like roughness or metalness
+        Packed, // Independent linear channels, from one image or from separate ones, see get_packed_texture_name
+    };
+
+    // Packing a model's small textures into shared atlas textures on import, see TextureAtlas.h
+    struct TextureAtlasSettings {
+        bool enabled = false;
+
+        // Textures this size and smaller on both sides are packed
+        u32 max_texture_size = 256;
+
+        // Atlas textures are at most this size per side, and shrink to what they hold
+        u32 page_size = 2048;
+
+        // Mip levels of the atlas textures. Packed textures are placed on multiples of 4 << (n_levels - 1) texels, so
+        // every level of them starts on a whole block, and textures whose size isn't a multiple of that aren't packed
+        u32 n_levels = 3;
+
+        // Texels around each packed texture at the full size level, repeating its edge, so filtering doesn't take texels
+        // from its neighbours. Rounded up to the placement multiple
+        u32 padding = 16;
+    };
+
+    // What textures are stored as when they're imported from an image
+    struct TextureImportSettings {
+        // Block compress, see TextureCompression.h. Without it single and two channel data is stored as R8 and RG8
+        bool compress = true;
+        TextureCompressionQuality quality = TextureCompressionQuality::Normal;
+
+        // For colour textures: BC7, or BC1 at half the size, which turns into BC3 for textures with alpha
+        TextureFormat color_format = TextureFormat::BC7;
+
+        // Load a material's occlusion, roughness and metalness as one texture, MaterialResource::tex_orm
+        bool pack_orm = false;
+
+        // Imported textures are kept here between runs, see TextureCache.h. Empty turns the cache off
+        std::string cache_directory = "Assets/Cache/Textures";
+
+        // Atlas textures built for models, which are kept in the cache directory too
+        TextureAtlasSettings atlas;
+    };
+
+    // Packed textures are named after the images their channels come from, joined by '|'. Empty paths leave their
+    // channel white
+    std::string get_packed_texture_name(const std::string& red_path, const std::string& green_path, const std::string& blue_path);
+    void split_packed_texture_name(const std::string& name, std::string (&paths_out)[3]);
+
+    // A texture to load as part of a batch, see ResourceManager::load_textures
+    struct TextureLoadRequest {
+        std::string path; // Only names the texture when it comes from an image
+        TextureUsage usage = TextureUsage::Color;
+        ResourceHandle* handle_out = nullptr; // Gets the handle of the texture, can be null
+        const tinygltf::Image* image = nullptr; // Embedded in a glTF model, which has to outlive the batch
+    };
+
+    // What texture deduplication has found so far, see ResourceManager::get_texture_dedup_report
+    struct TextureDedupReport {
+        size_t n_textures = 0; // Textures loaded, counting every copy
+        size_t n_unique = 0; // Distinct payloads among them
+        size_t bytes_loaded = 0; // Payload bytes, counting every copy
+        size_t bytes_saved = 0; // Payload bytes of the copies that were freed
+    };
+
+    struct TextureResource;
+
     class ResourceManager {
     public:
         ResourceManager();
         ~ResourceManager();
         ResourceHandle load_mesh(const std::string& path);
-        ResourceHandle load_texture(const std::string& path);
+        ResourceHandle load_texture(const std::string& path, TextureUsage usage = TextureUsage::Color); // The handle depends on the usage too
+
+        // Load a batch of textures concurrently on the job system. Each path is loaded once per usage however many
+        // requests share it, and the ones that are already loaded are skipped
+        void load_textures(const std::vector<TextureLoadRequest>& requests);
+
+        // Add a texture that was built rather than loaded, like an atlas, under a name. The manager takes it over. If a
+        // texture by that name is already loaded, the new one is unloaded and the handle keeps pointing at the old one
+        ResourceHandle insert_texture(const std::string& name, TextureResource* texture);
+
+        // Textures with the same format, size, usage and level bytes are only kept once. Their handles all resolve to
+        // the same TextureResource, whatever paths they were loaded from
+        TextureDedupReport get_texture_dedup_report();
+
+        // Formats and encoder effort for the textures loaded after this
+        void set_texture_import_settings(const TextureImportSettings& settings) { texture_import_settings = settings; }
+        const TextureImportSettings& get_texture_import_settings() const { return texture_import_settings; }
 
         template <typename T> 
         T* get_resource(ResourceHandle handle) {
             // todo: add checks for this
+            std::lock_guard<std::mutex> lock(resource_mutex);
             return reinterpret_cast<T*>(loaded_resource_data[handle]);
         }
 
@@ -103,6 +256,15 @@ namespace Flan {
     private:
         std::map<ResourceHandle, void*> loaded_resource_data;
         std::map<ResourceHandle, ResourceType> loaded_resource_type;
+        TextureImportSettings texture_import_settings;
+
+        // Loaded textures by the hash of their payload, for deduplication. Called with resource_mutex held
+        void add_texture(ResourceHandle handle, TextureResource* texture, u64 payload_hash);
+        std::unordered_multimap<u64, TextureResource*> textures_by_payload;
+        TextureDedupReport texture_dedup_report;
+
+        // Resources can be loaded from worker threads, e.g. by the asset pipeline
+        std::mutex resource_mutex;
     };
 
     static void read_file(const std::string& path, size_t& size_bytes, char*& data, const bool silent)
@@ -4,11 +4,18 @@ cbuffer camera_transform : register(b0)
     row_major matrix projection;
 };
 
-cbuffer model_transform : register(b1)
+cbuffer draw_constants : register(b1)
 {
-    row_major matrix model;
+    uint first_instance; // Where this draw's instances start in instance_transforms
 };
 
+// Every instance drawn this frame, see RendererDX12::allocate_instance_transforms
+struct InstanceData
+{
+    row_major float4x4 model;
+};
+StructuredBuffer<InstanceData> instance_transforms : register(t0, space1);
+
 
 struct VertexInput
 {
@@ -30,8 +37,9 @@ struct VertexOutput
     float3 texcoord1 : TEXCOORD1;
 };
 
-VertexOutput main(VertexInput vertex_input)
+VertexOutput main(VertexInput vertex_input, uint instance_id : SV_InstanceID)
 {
+    float4x4 model = instance_transforms[first_instance + instance_id].model;
     VertexOutput output;
     float4 position = float4(vertex_input.position, 1.0f);
     position = mul(position, model);
@@ -39,7 +47,7 @@ VertexOutput main(VertexInput vertex_input)
     position = mul(position, projection);
     output.position = position;
     output.colour = vertex_input.colour;
-    output.normal = mul(vertex_input.normal, model);
+    output.normal = mul(vertex_input.normal, (float3x3)model);
     output.tangent = vertex_input.tangent;
     output.texcoord0 = vertex_input.texcoord0;
     output.texcoord1 = vertex_input.texcoord1;
@@ -0,0 +1,323 @@
+#include "Skinning.h"
+#include "Animation.h"
+#include "CpuFeatures.h"
+#include "JobSystem.h"
+#include "ModelResource.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+namespace Flan {
+    static constexpr size_t block_size = 8;
+    static constexpr size_t skinning_verts_per_job = 4096; // Multiple of block_size, so only the last range of an instance has a tail
+
+    void get_node_order(const ModelNode* nodes, size_t n_nodes, std::vector<u32>& order_out)
+    {
+        //Sort by depth, which puts every parent before its children. The depth walk is capped, so a broken hierarchy
+        //with a cycle can't hang it
+        std::vector<size_t> depths(n_nodes);
+        for (size_t i = 0; i < n_nodes; ++i) {
+            size_t depth = 0;
+            for (i32 parent = nodes[i].parent; parent >= 0 && depth <= n_nodes; parent = nodes[parent].parent) {
+                ++depth;
+            }
+            depths[i] = depth;
+        }
+        order_out.resize(n_nodes);
+        std::iota(order_out.begin(), order_out.end(), 0);
+        std::stable_sort(order_out.begin(), order_out.end(), [&](u32 a, u32 b) { return depths[a] < depths[b]; });
+    }
+
+    void apply_pose(const AnimationClip& clip, const float* pose, ModelNode* nodes, size_t n_nodes)
+    {
+        for (u32 i = 0; i < clip.n_tracks; ++i) {
+            const AnimationTrack& track = clip.tracks[i];
+            if (track.target_node >= n_nodes) {
+                continue;
+            }
+            ModelNode& node = nodes[track.target_node];
+            switch (track.path) {
+            case AnimationPath::Translation: node.translation = get_pose_vec3(pose, track); break;
+            case AnimationPath::Rotation: node.rotation = get_pose_quat(pose, track); break;
+            case AnimationPath::Scale: node.scale = get_pose_vec3(pose, track); break;
+            }
+        }
+    }
+
+    void compute_node_matrices(const ModelNode* nodes, const u32* order, size_t n_nodes, glm::mat4* matrices_out)
+    {
+        for (size_t i = 0; i < n_nodes; ++i) {
+            const u32 node_index = order[i];
+            const ModelNode& node = nodes[node_index];
+
+            //translate * rotate * scale, without the full matrix products
+            const glm::mat3 rotation = glm::mat3_cast(node.rotation);
+            glm::mat4 local;
+            local[0] = glm::vec4(rotation[0] * node.scale.x, 0.0f);
+            local[1] = glm::vec4(rotation[1] * node.scale.y, 0.0f);
+            local[2] = glm::vec4(rotation[2] * node.scale.z, 0.0f);
+            local[3] = glm::vec4(node.translation, 1.0f);
+            matrices_out[node_index] = node.parent >= 0 ? matrices_out[node.parent] * local : local;
+        }
+    }
+
+    void compute_skin_palette(const Skin& skin, const glm::mat4* node_matrices, glm::mat4* palette_out)
+    {
+        for (u32 i = 0; i < skin.n_joints; ++i) {
+            palette_out[i] = node_matrices[skin.joints[i]] * skin.inverse_bind_matrices[i];
+        }
+    }
+
+    // Skin 8 vertices, the range doesn't have to be aligned
+    typedef void (*SkinBlockFn)(const Vertex* vertices, const VertexSkin* skin, const glm::mat4* palette, u32 n_joints, Vertex* vertices_out);
+
+    static glm::vec3 normalize_or_keep(const glm::vec3& vector, const glm::vec3& fallback)
+    {
+        const float length_squared = glm::dot(vector, vector);
+        return length_squared > 1e-20f ? vector / sqrtf(length_squared) : fallback;
+    }
+
+    static void skin_vertex_scalar(const Vertex& vertex, const VertexSkin& skin, const glm::mat4* palette, u32 n_joints, Vertex& vertex_out)
+    {
+        glm::mat4 matrix(0.0f);
+        for (int i = 0; i < 4; ++i) {
+            matrix += palette[std::min<u32>(skin.joints[i], n_joints - 1)] * skin.weights[i];
+        }
+        const glm::mat3 rotation(matrix);
+        vertex_out = vertex;
+        vertex_out.position = glm::vec3(matrix * glm::vec4(vertex.position, 1.0f));
+        vertex_out.normal = normalize_or_keep(rotation * vertex.normal, vertex.normal);
+        vertex_out.tangent = normalize_or_keep(rotation * vertex.tangent, vertex.tangent);
+    }
+
+    static void skin_block_scalar(const Vertex* vertices, const VertexSkin* skin, const glm::mat4* palette, u32 n_joints, Vertex* vertices_out)
+    {
+        for (size_t i = 0; i < block_size; ++i) {
+            skin_vertex_scalar(vertices[i], skin[i], palette, n_joints, vertices_out[i]);
+        }
+    }
+
+    FLAN_TARGET_AVX2 static void transform_vector_avx2(const __m256* matrix, __m256& x, __m256& y, __m256& z)
+    {
+        const __m256 out_x = _mm256_fmadd_ps(matrix[6], z, _mm256_fmadd_ps(matrix[3], y, _mm256_mul_ps(matrix[0], x)));
+        const __m256 out_y = _mm256_fmadd_ps(matrix[7], z, _mm256_fmadd_ps(matrix[4], y, _mm256_mul_ps(matrix[1], x)));
+        const __m256 out_z = _mm256_fmadd_ps(matrix[8], z, _mm256_fmadd_ps(matrix[5], y, _mm256_mul_ps(matrix[2], x)));
+
+        //Normalize, leaving degenerate vectors as they were
+        const __m256 length_squared = _mm256_fmadd_ps(out_z, out_z, _mm256_fmadd_ps(out_y, out_y, _mm256_mul_ps(out_x, out_x)));
+        const __m256 valid = _mm256_cmp_ps(length_squared, _mm256_set1_ps(1e-20f), _CMP_GT_OQ);
+        const __m256 inverse = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_max_ps(length_squared, _mm256_set1_ps(1e-20f))));
+        x = _mm256_blendv_ps(x, _mm256_mul_ps(out_x, inverse), valid);
+        y = _mm256_blendv_ps(y, _mm256_mul_ps(out_y, inverse), valid);
+        z = _mm256_blendv_ps(z, _mm256_mul_ps(out_z, inverse), valid);
+    }
+
+    FLAN_TARGET_AVX2 static void skin_block_avx2(const Vertex* vertices, const VertexSkin* skin, const glm::mat4* palette, u32 n_joints, Vertex* vertices_out)
+    {
+        alignas(32) int32_t joint_offsets[4][block_size];
+        alignas(32) float weights[4][block_size];
+        alignas(32) float attributes[9][block_size]; // Position, normal and tangent, one component per row
+
+        //AoS -> SoA. Joint indices become element offsets into the palette, clamped so bad data can't read past its end
+        const u32 last_joint = n_joints - 1;
+        for (size_t i = 0; i < block_size; ++i) {
+            for (int k = 0; k < 4; ++k) {
+                joint_offsets[k][i] = static_cast<int32_t>(std::min<u32>(skin[i].joints[k], last_joint) * 16);
+                weights[k][i] = skin[i].weights[k];
+            }
+            for (int c = 0; c < 3; ++c) {
+                attributes[c][i] = vertices[i].position[c];
+                attributes[3 + c][i] = vertices[i].normal[c];
+                attributes[6 + c][i] = vertices[i].tangent[c];
+            }
+        }
+
+        //Blend the top 3 rows of the 4 weighted joint matrices of every vertex. blended[column * 3 + row]
+        const float* palette_base = reinterpret_cast<const float*>(palette);
+        __m256 blended[12];
+        for (int k = 0; k < 4; ++k) {
+            const __m256i offsets = _mm256_load_si256(reinterpret_cast<const __m256i*>(joint_offsets[k]));
+            const __m256 weight = _mm256_load_ps(weights[k]);
+            for (int column = 0; column < 4; ++column) {
+                for (int row = 0; row < 3; ++row) {
+                    const __m256 element = _mm256_i32gather_ps(palette_base + column * 4 + row, offsets, 4);
+                    __m256& target = blended[column * 3 + row];
+                    target = k == 0 ? _mm256_mul_ps(element, weight) : _mm256_fmadd_ps(element, weight, target);
+                }
+            }
+        }
+
+        //Positions get the full matrix, normals and tangents only the rotation and scale
+        __m256 x = _mm256_load_ps(attributes[0]);
+        __m256 y = _mm256_load_ps(attributes[1]);
+        __m256 z = _mm256_load_ps(attributes[2]);
+        _mm256_store_ps(attributes[0], _mm256_fmadd_ps(blended[6], z, _mm256_fmadd_ps(blended[3], y, _mm256_fmadd_ps(blended[0], x, blended[9]))));
+        _mm256_store_ps(attributes[1], _mm256_fmadd_ps(blended[7], z, _mm256_fmadd_ps(blended[4], y, _mm256_fmadd_ps(blended[1], x, blended[10]))));
+        _mm256_store_ps(attributes[2], _mm256_fmadd_ps(blended[8], z, _mm256_fmadd_ps(blended[5], y, _mm256_fmadd_ps(blended[2], x, blended[11]))));
+        for (int attribute = 3; attribute < 9; attribute += 3) {
+            x = _mm256_load_ps(attributes[attribute]);
+            y = _mm256_load_ps(attributes[attribute + 1]);
+            z = _mm256_load_ps(attributes[attribute + 2]);
+            transform_vector_avx2(blended, x, y, z);
+            _mm256_store_ps(attributes[attribute], x);
+            _mm256_store_ps(attributes[attribute + 1], y);
+            _mm256_store_ps(attributes[attribute + 2], z);
+        }
+
+        //SoA -> AoS
+        for (size_t i = 0; i < block_size; ++i) {
+            Vertex& vertex = vertices_out[i];
+            vertex = vertices[i];
+            vertex.position = { attributes[0][i], attributes[1][i], attributes[2][i] };
+            vertex.normal = { attributes[3][i], attributes[4][i], attributes[5][i] };
+            vertex.tangent = { attributes[6][i], attributes[7][i], attributes[8][i] };
+        }
+    }
+
+    static SkinBlockFn select_skin_block()
+    {
+        const CpuFeatures& features = CpuFeatures::get();
+        return features.avx2 && features.fma ? skin_block_avx2 : skin_block_scalar;
+    }
+
+    void skin_vertices(const Vertex* vertices, const VertexSkin* skin, size_t n_verts, const glm::mat4* palette, u32 n_joints, Vertex* vertices_out)
+    {
+        static const SkinBlockFn skin_block = select_skin_block();
+        if (n_joints == 0) {
+            memcpy(vertices_out, vertices, sizeof(Vertex) * n_verts);
+            return;
+        }
+
+        size_t i = 0;
+        for (; i + block_size <= n_verts; i += block_size) {
+            skin_block(&vertices[i], &skin[i], palette, n_joints, &vertices_out[i]);
+        }
+        for (; i < n_verts; ++i) {
+            skin_vertex_scalar(vertices[i], skin[i], palette, n_joints, vertices_out[i]);
+        }
+    }
+
+    bool SkinnedModelInstance::init(const ModelResource* model, u32 n_frames)
+    {
+        m_model = model;
+        m_n_frames = std::max<u32>(n_frames, 1);
+        m_frame = 0;
+        get_node_order(model->nodes, model->n_nodes, m_node_order);
+        m_posed_nodes.resize(model->n_nodes);
+        m_node_matrices.resize(model->n_nodes);
+
+        //One palette per skin
+        m_palette_offsets.resize(model->n_skins);
+        size_t n_palette_matrices = 0;
+        for (size_t i = 0; i < model->n_skins; ++i) {
+            m_palette_offsets[i] = n_palette_matrices;
+            n_palette_matrices += model->skins[i].n_joints;
+        }
+        m_palettes.resize(n_palette_matrices);
+
+        //Every instance of a skinned mesh that has a skin gets its own output, split into ranges for the job system
+        m_output_offsets.assign(model->n_instances, SIZE_MAX);
+        m_ranges.clear();
+        m_n_skinned_verts = 0;
+        for (size_t i = 0; i < model->n_instances; ++i) {
+            const MeshInstance& instance = model->instances[i];
+            const MeshCPU& mesh = model->meshes_cpu[instance.mesh_index];
+            if (instance.skin_index >= model->n_skins || mesh.skin == nullptr) {
+                continue;
+            }
+            m_output_offsets[i] = m_n_skinned_verts;
+            for (size_t first = 0; first < mesh.n_verts; first += skinning_verts_per_job) {
+                m_ranges.push_back({ static_cast<u32>(i), first, std::min(skinning_verts_per_job, mesh.n_verts - first) });
+            }
+            m_n_skinned_verts += mesh.n_verts;
+        }
+
+        if (m_n_skinned_verts > 0) {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "Skinning - Output vertices";
+            m_output = static_cast<Vertex*>(dynamic_allocate(static_cast<u32>(sizeof(Vertex) * m_n_skinned_verts * m_n_frames)));
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+            if (m_output == nullptr) {
+                printf("[ERROR] Failed to allocate %zu skinned vertices!\n", m_n_skinned_verts * m_n_frames);
+                m_n_skinned_verts = 0;
+                m_ranges.clear();
+                return false;
+            }
+        }
+
+        //Start out in the rest pose, so there's always something to read
+        update(nullptr, 0.0f);
+        return true;
+    }
+
+    void SkinnedModelInstance::release()
+    {
+        if (m_output != nullptr) {
+            dynamic_free(m_output);
+            m_output = nullptr;
+        }
+        m_n_skinned_verts = 0;
+        m_ranges.clear();
+        m_model = nullptr;
+    }
+
+    void SkinnedModelInstance::update(const AnimationClip* clip, float time, bool looping)
+    {
+        if (m_model == nullptr) {
+            return;
+        }
+
+        if (clip == nullptr || clip->n_frames == 0) {
+            update_with_pose(nullptr, nullptr);
+            return;
+        }
+        if (clip != m_clip) {
+            m_clip = clip;
+            m_cursors.assign(clip->n_tracks, 0);
+        }
+        m_pose.resize(clip->n_channels);
+        sample_animation(*clip, &time, 1, m_pose.data(), looping, m_cursors.data());
+        update_with_pose(clip, m_pose.data());
+    }
+
+    void SkinnedModelInstance::update_with_pose(const AnimationClip* clip, const float* pose)
+    {
+        if (m_model == nullptr) {
+            return;
+        }
+
+        //Pose the node tree and build the palettes
+        std::copy(m_model->nodes, m_model->nodes + m_model->n_nodes, m_posed_nodes.begin());
+        if (clip != nullptr && pose != nullptr) {
+            apply_pose(*clip, pose, m_posed_nodes.data(), m_posed_nodes.size());
+        }
+        compute_node_matrices(m_posed_nodes.data(), m_node_order.data(), m_posed_nodes.size(), m_node_matrices.data());
+        for (size_t i = 0; i < m_model->n_skins; ++i) {
+            compute_skin_palette(m_model->skins[i], m_node_matrices.data(), &m_palettes[m_palette_offsets[i]]);
+        }
+
+        //Skin into the next frame's buffers
+        const u32 frame = (m_frame + 1) % m_n_frames;
+        Vertex* frame_output = m_output + static_cast<size_t>(frame) * m_n_skinned_verts;
+        JobSystem::get_instance()->parallel_for(m_ranges.size(), [&](size_t i) {
+            const SkinningRange& range = m_ranges[i];
+            const MeshInstance& instance = m_model->instances[range.instance];
+            const MeshCPU& mesh = m_model->meshes_cpu[instance.mesh_index];
+            const Skin& skin = m_model->skins[instance.skin_index];
+            skin_vertices(&mesh.vertices[range.first_vertex], &mesh.skin[range.first_vertex], range.n_verts, &m_palettes[m_palette_offsets[instance.skin_index]],
+                          skin.n_joints, &frame_output[m_output_offsets[range.instance] + range.first_vertex]);
+        });
+        m_frame = frame;
+    }
+
+    const Vertex* SkinnedModelInstance::get_vertices(size_t instance_index) const
+    {
+        if (m_output == nullptr || instance_index >= m_output_offsets.size() || m_output_offsets[instance_index] == SIZE_MAX) {
+            return nullptr;
+        }
+        return m_output + static_cast<size_t>(m_frame) * m_n_skinned_verts + m_output_offsets[instance_index];
+    }
+}
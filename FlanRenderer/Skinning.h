@@ -0,0 +1,95 @@
+#pragma once
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include "CommonDefines.h"
+#include "FlanTypes.h"
+#include "Resources.h"
+
+// CPU linear blend skinning. Every skinned vertex is moved by the weighted sum of up to 4 joint matrices, taken from a
+// palette with one matrix per joint: the joint's model space matrix times its inverse bind matrix.
+//
+// The vertex kernel works on blocks of 8 vertices in SoA form. With AVX2, the 4 weighted palette matrices of each
+// vertex are gathered and blended 8 vertices at a time, then applied to the positions, normals and tangents. Meshes
+// are split into ranges of blocks across the job system.
+//
+// Skinned vertices are written to plain CPU memory, so they can be checked without a GPU. The renderer copies them to
+// its per-frame dynamic vertex buffers.
+
+namespace Flan {
+    struct AnimationClip;
+    struct ModelResource;
+
+    // Rest pose of a glTF node. Nodes keep their glTF index, so animation tracks and skins can refer to them directly
+    struct ModelNode {
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+        i32 parent; // -1 for root nodes
+    };
+
+    struct Skin {
+        u32* joints; // Node index of every joint
+        glm::mat4* inverse_bind_matrices; // Model space to joint space in the bind pose
+        u32 n_joints;
+    };
+
+    // Node indices with every parent before its children
+    void get_node_order(const ModelNode* nodes, size_t n_nodes, std::vector<u32>& order_out);
+
+    // Overwrite the translation, rotation and scale of every node the clip animates with its value in a sampled pose
+    void apply_pose(const AnimationClip& clip, const float* pose, ModelNode* nodes, size_t n_nodes);
+
+    // Model space matrix of every node
+    void compute_node_matrices(const ModelNode* nodes, const u32* order, size_t n_nodes, glm::mat4* matrices_out);
+
+    // Palette matrix of every joint in a skin
+    void compute_skin_palette(const Skin& skin, const glm::mat4* node_matrices, glm::mat4* palette_out);
+
+    // Skin a range of vertices on the calling thread. Attributes other than the position, normal and tangent are copied
+    void skin_vertices(const Vertex* vertices, const VertexSkin* skin, size_t n_verts, const glm::mat4* palette, u32 n_joints, Vertex* vertices_out);
+
+    // Poses one copy of a model and skins all of its skinned instances. Every update writes to the next of n_frames
+    // sets of output buffers, so the result of a previous update stays valid while it is being read, e.g. copied to
+    // the GPU or checked by a test
+    class SkinnedModelInstance {
+    public:
+        bool init(const ModelResource* model, u32 n_frames = m_backbuffer_count);
+        void release();
+
+        // Pose the model with a clip at the given time, or in its rest pose when clip is null, then skin it
+        void update(const AnimationClip* clip, float time, bool looping = true);
+
+        // Pose the model with a pose of the clip sampled elsewhere, e.g. by an AnimationScheduler, then skin it
+        void update_with_pose(const AnimationClip* clip, const float* pose);
+
+        // Vertices of a mesh instance after the last update, or null if that instance isn't skinned
+        const Vertex* get_vertices(size_t instance_index) const;
+        const ModelResource* get_model() const { return m_model; }
+        size_t get_vertex_count() const { return m_n_skinned_verts; }
+
+    private:
+        // One job's worth of vertices of one skinned instance
+        struct SkinningRange {
+            u32 instance;
+            size_t first_vertex;
+            size_t n_verts;
+        };
+
+        const ModelResource* m_model = nullptr;
+        u32 m_n_frames = 0;
+        u32 m_frame = 0;
+        std::vector<u32> m_node_order;
+        std::vector<ModelNode> m_posed_nodes;
+        std::vector<glm::mat4> m_node_matrices;
+        std::vector<float> m_pose;
+        const AnimationClip* m_clip = nullptr; // The clip m_cursors belong to
+        std::vector<u16> m_cursors; // Key cursor of every track, see sample_animation
+        std::vector<size_t> m_palette_offsets; // First palette matrix of every skin
+        std::vector<glm::mat4> m_palettes;
+        std::vector<size_t> m_output_offsets; // First output vertex of every instance within a frame, or SIZE_MAX
+        std::vector<SkinningRange> m_ranges;
+        Vertex* m_output = nullptr; // n_frames sets of m_n_skinned_verts vertices
+        size_t m_n_skinned_verts = 0;
+    };
+}
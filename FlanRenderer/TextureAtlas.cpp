@@ -0,0 +1,365 @@
+#include "TextureAtlas.h"
+#include "TextureCache.h"
+#include "Hash.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <map>
+
+namespace Flan {
+    // Every texture slot of a material, in the order atlas pages keep them
+    static constexpr size_t n_atlas_slots = 7;
+    static ResourceHandle MaterialResource::* const atlas_slots[n_atlas_slots] = {
+        &MaterialResource::tex_col, &MaterialResource::tex_nrm, &MaterialResource::tex_rgh, &MaterialResource::tex_mtl,
+        &MaterialResource::tex_emm, &MaterialResource::tex_occ, &MaterialResource::tex_orm,
+    };
+
+    using AtlasHandles = std::array<ResourceHandle, n_atlas_slots>;
+
+    // Atlas textures are named after this and the key of their page set
+    static constexpr const char* atlas_name_prefix = "atlas_";
+
+    // A material's textures, and the meshes that sample them
+    struct AtlasSet {
+        AtlasHandles handles;
+        std::array<TextureResource*, n_atlas_slots> textures;
+        u32 width;
+        u32 height;
+        std::vector<size_t> meshes;
+        u32 page;
+        u32 x; // Of the rectangle, padding included
+        u32 y;
+    };
+
+    struct AtlasPage {
+        u32 width;
+        u32 height;
+        std::vector<size_t> sets;
+        AtlasHandles handles;
+    };
+
+    void SkylinePacker::init(u32 width, u32 height)
+    {
+        m_width = width;
+        m_height = height;
+        m_skyline.assign(1, Segment{ 0, 0, width });
+        m_used_width = 0;
+        m_used_height = 0;
+    }
+
+    bool SkylinePacker::insert(u32 width, u32 height, u32& x_out, u32& y_out)
+    {
+        //Try the rectangle's left edge at the start of every segment, where it rests on the highest segment under it
+        size_t best = m_skyline.size();
+        u32 best_x = 0;
+        u32 best_y = 0;
+        u32 best_top = ~0u;
+        for (size_t i = 0; i < m_skyline.size(); ++i) {
+            const u32 x = m_skyline[i].x;
+            if (x + width > m_width) {
+                break;
+            }
+            u32 y = 0;
+            for (size_t j = i; j < m_skyline.size() && m_skyline[j].x < x + width; ++j) {
+                y = std::max(y, m_skyline[j].y);
+            }
+            if (y + height <= m_height && y + height < best_top) {
+                best = i;
+                best_x = x;
+                best_y = y;
+                best_top = y + height;
+            }
+        }
+        if (best == m_skyline.size()) {
+            return false;
+        }
+
+        //The top of the rectangle replaces the segments it covers, the last one of them only partly
+        const u32 end = best_x + width;
+        while (best < m_skyline.size() && m_skyline[best].x < end) {
+            Segment& segment = m_skyline[best];
+            if (segment.x + segment.width <= end) {
+                m_skyline.erase(m_skyline.begin() + best);
+            }
+            else {
+                segment.width = segment.x + segment.width - end;
+                segment.x = end;
+                break;
+            }
+        }
+        m_skyline.insert(m_skyline.begin() + best, Segment{ best_x, best_top, width });
+        for (size_t i = 0; i + 1 < m_skyline.size();) {
+            if (m_skyline[i].y == m_skyline[i + 1].y) {
+                m_skyline[i].width += m_skyline[i + 1].width;
+                m_skyline.erase(m_skyline.begin() + i + 1);
+            }
+            else {
+                i++;
+            }
+        }
+
+        x_out = best_x;
+        y_out = best_y;
+        m_used_width = std::max(m_used_width, end);
+        m_used_height = std::max(m_used_height, best_top);
+        return true;
+    }
+
+    // Copy one level of a texture into the same level of an atlas, with its padding around it. Positions are in texels
+    // of that level, and whole blocks for the compressed formats, whose padding repeats the edge blocks
+    static void copy_level_padded(const TextureResource& source, TextureResource& atlas, u32 level, u32 x, u32 y, u32 padding)
+    {
+        const u32 unit = is_block_compressed(source.format) ? 4 : 1;
+        const size_t unit_bytes = get_texture_row_bytes(source.format, unit);
+        const size_t source_units_x = get_texture_row_bytes(source.format, source.get_mip_width(level)) / unit_bytes;
+        const u32 source_units_y = get_texture_row_count(source.format, source.get_mip_height(level));
+        const u32 padding_units = padding / unit;
+        const size_t source_pitch = source.get_mip_row_pitch(level);
+        const size_t atlas_pitch = atlas.get_mip_row_pitch(level);
+        u8* target = atlas.get_mip_data(level) + static_cast<size_t>(y / unit) * atlas_pitch + static_cast<size_t>(x / unit) * unit_bytes;
+
+        for (u32 row = 0; row < source_units_y + 2 * padding_units; ++row) {
+            const u32 source_row = static_cast<u32>(std::clamp(static_cast<int>(row) - static_cast<int>(padding_units), 0, static_cast<int>(source_units_y) - 1));
+            const u8* source_data = source.get_mip_data(level) + source_row * source_pitch;
+            u8* target_row = target + row * atlas_pitch;
+            for (u32 column = 0; column < padding_units; ++column) {
+                memcpy(target_row + column * unit_bytes, source_data, unit_bytes);
+            }
+            memcpy(target_row + padding_units * unit_bytes, source_data, source_units_x * unit_bytes);
+            for (u32 column = 0; column < padding_units; ++column) {
+                memcpy(target_row + (padding_units + source_units_x + column) * unit_bytes, source_data + (source_units_x - 1) * unit_bytes, unit_bytes);
+            }
+        }
+    }
+
+    // The atlas texture of one slot of a page, from the cache if it's there, built and stored otherwise
+    static TextureResource* get_atlas_texture(const AtlasPage& page, const std::vector<AtlasSet>& sets, size_t slot, u32 padding, const TextureAtlasSettings& settings,
+                                              const std::string& name, const std::string& cache_path)
+    {
+        const TextureResource& first = *sets[page.sets[0]].textures[slot];
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexAtlas - " + name;
+        TextureResource* atlas = new (dynamic_allocate(sizeof(TextureResource))) TextureResource(0, 0, nullptr, nullptr);
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        if (!cache_path.empty() && std::filesystem::exists(cache_path) && atlas->load_container(cache_path, first.usage, true, name)) {
+            if (atlas->width == static_cast<int>(page.width) && atlas->height == static_cast<int>(page.height) && atlas->format == first.format && atlas->n_mips == settings.n_levels) {
+                return atlas;
+            }
+            atlas->unload();
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexAtlas - " + name;
+            atlas = new (dynamic_allocate(sizeof(TextureResource))) TextureResource(0, 0, nullptr, nullptr);
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        }
+
+        //Every level of every texture goes where the page's layout puts it, the space between them stays black
+        atlas->name = static_cast<char*>(dynamic_allocate(name.size() + 1));
+        strcpy_s(atlas->name, name.size() + 1, name.c_str());
+        atlas->width = static_cast<int>(page.width);
+        atlas->height = static_cast<int>(page.height);
+        atlas->n_mips = settings.n_levels;
+        atlas->usage = first.usage;
+        atlas->format = first.format;
+        for (u32 level = 0; level < atlas->n_mips; ++level) {
+            atlas->mip_offsets[level] = get_texture_chain_bytes(atlas->format, page.width, page.height, level);
+        }
+        const size_t atlas_bytes = get_texture_chain_bytes(atlas->format, page.width, page.height, atlas->n_mips);
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexAtlas - levels - " + name;
+        atlas->data = static_cast<u8*>(dynamic_allocate(atlas_bytes));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        memset(atlas->data, 0, atlas_bytes);
+        for (size_t set_index : page.sets) {
+            const AtlasSet& set = sets[set_index];
+            for (u32 level = 0; level < atlas->n_mips; ++level) {
+                copy_level_padded(*set.textures[slot], *atlas, level, set.x >> level, set.y >> level, padding >> level);
+            }
+        }
+        atlas->resource_type = ResourceType::Texture;
+        atlas->scheduled_for_unload = false;
+        if (!cache_path.empty()) {
+            store_cached_texture(*atlas, cache_path);
+        }
+        return atlas;
+    }
+
+    // Different textures the materials use, a texture loaded under several paths counts once
+    static size_t count_textures(const MaterialResource* materials, size_t n_materials, ResourceManager* resource_manager)
+    {
+        std::vector<const TextureResource*> textures;
+        for (size_t i = 0; i < n_materials; ++i) {
+            for (ResourceHandle MaterialResource::* slot : atlas_slots) {
+                const TextureResource* texture = materials[i].*slot != 0 ? resource_manager->get_resource<TextureResource>(materials[i].*slot) : nullptr;
+                if (texture != nullptr && texture->resource_type == ResourceType::Texture) {
+                    textures.push_back(texture);
+                }
+            }
+        }
+        std::sort(textures.begin(), textures.end());
+        return static_cast<size_t>(std::unique(textures.begin(), textures.end()) - textures.begin());
+    }
+
+    bool is_texture_atlas_name(const std::string& name)
+    {
+        const std::string file_name = std::filesystem::path(name).filename().string();
+        return file_name.rfind(atlas_name_prefix, 0) == 0;
+    }
+
+    TextureAtlasReport build_texture_atlases(MeshCPU* meshes, MaterialResource* materials, size_t n_meshes, ResourceManager* resource_manager)
+    {
+        TextureAtlasReport report;
+        TextureAtlasSettings settings = resource_manager->get_texture_import_settings().atlas;
+        settings.n_levels = std::clamp<u32>(settings.n_levels, 1, max_texture_mips);
+        const std::string& cache_directory = resource_manager->get_texture_import_settings().cache_directory;
+        const u32 alignment = 4u << (settings.n_levels - 1);
+        const u32 padding = (settings.padding + alignment - 1) / alignment * alignment;
+        report.n_textures = count_textures(materials, n_meshes, resource_manager);
+
+        //Find the meshes whose textures can move, and group them by material, since the same material can be on several
+        std::vector<AtlasSet> sets;
+        std::map<AtlasHandles, size_t> set_indices;
+        for (size_t mesh_index = 0; mesh_index < n_meshes; ++mesh_index) {
+            const MaterialResource& material = materials[mesh_index];
+            AtlasSet set{};
+            bool eligible = material.mul_tex == glm::vec2(1.0f, 1.0f);
+            bool any = false;
+            for (size_t slot = 0; slot < n_atlas_slots && eligible; ++slot) {
+                //Textures that failed to load are drawn as no texture at all, so they stay as they are
+                set.handles[slot] = material.*atlas_slots[slot];
+                const TextureResource* texture = set.handles[slot] != 0 ? resource_manager->get_resource<TextureResource>(set.handles[slot]) : nullptr;
+                if (texture == nullptr || texture->resource_type != ResourceType::Texture) {
+                    set.handles[slot] = 0;
+                    continue;
+                }
+                const u32 width = static_cast<u32>(texture->width);
+                const u32 height = static_cast<u32>(texture->height);
+                if (any && (width != set.width || height != set.height)) {
+                    eligible = false;
+                }
+                if (width > settings.max_texture_size || height > settings.max_texture_size || width % alignment != 0 || height % alignment != 0 || texture->n_mips < settings.n_levels) {
+                    eligible = false;
+                }
+                set.textures[slot] = const_cast<TextureResource*>(texture);
+                set.width = width;
+                set.height = height;
+                any = true;
+            }
+            if (!eligible || !any) {
+                continue;
+            }
+
+            //UVs a little past the edge, from rounding in the exporter, land in the padding
+            const MeshCPU& mesh = meshes[mesh_index];
+            const float margin_u = 0.5f / static_cast<float>(set.width);
+            const float margin_v = 0.5f / static_cast<float>(set.height);
+            for (size_t i = 0; i < mesh.n_verts && eligible; ++i) {
+                const glm::vec2& uv = mesh.vertices[i].texcoord0;
+                eligible = uv.x >= -margin_u && uv.x <= 1.0f + margin_u && uv.y >= -margin_v && uv.y <= 1.0f + margin_v;
+            }
+            if (!eligible) {
+                continue;
+            }
+            const auto [it, inserted] = set_indices.emplace(set.handles, sets.size());
+            if (inserted) {
+                sets.push_back(set);
+            }
+            sets[it->second].meshes.push_back(mesh_index);
+        }
+
+        //Sets can share a page when they have the same format in every slot
+        std::map<std::array<int, n_atlas_slots>, std::vector<size_t>> groups;
+        for (size_t i = 0; i < sets.size(); ++i) {
+            std::array<int, n_atlas_slots> formats;
+            for (size_t slot = 0; slot < n_atlas_slots; ++slot) {
+                formats[slot] = sets[i].handles[slot] != 0 ? static_cast<int>(sets[i].textures[slot]->format) : -1;
+            }
+            groups[formats].push_back(i);
+        }
+
+        //Pack every group, largest sets first. A page holding a single set saves nothing, so it's left out
+        std::vector<AtlasPage> pages;
+        for (auto& [formats, group] : groups) {
+            std::stable_sort(group.begin(), group.end(), [&](size_t a, size_t b) {
+                return sets[a].height != sets[b].height ? sets[a].height > sets[b].height : sets[a].width > sets[b].width;
+            });
+            std::vector<SkylinePacker> packers;
+            std::vector<std::vector<size_t>> packed;
+            for (size_t set_index : group) {
+                AtlasSet& set = sets[set_index];
+                const u32 width = set.width + 2 * padding;
+                const u32 height = set.height + 2 * padding;
+                bool placed = false;
+                for (size_t page = 0; page < packers.size() && !placed; ++page) {
+                    placed = packers[page].insert(width, height, set.x, set.y);
+                    set.page = static_cast<u32>(page);
+                }
+                if (!placed) {
+                    packers.emplace_back().init(settings.page_size, settings.page_size);
+                    packed.emplace_back();
+                    placed = packers.back().insert(width, height, set.x, set.y);
+                    set.page = static_cast<u32>(packers.size() - 1);
+                }
+                if (placed) {
+                    packed[set.page].push_back(set_index);
+                }
+            }
+            for (size_t page = 0; page < packers.size(); ++page) {
+                if (packed[page].size() >= 2) {
+                    pages.push_back({ packers[page].get_used_width(), packers[page].get_used_height(), packed[page], {} });
+                }
+            }
+        }
+
+        //Make the atlas of every slot the page's sets use. Its name comes from everything that ends up in it
+        for (AtlasPage& page : pages) {
+            for (size_t slot = 0; slot < n_atlas_slots; ++slot) {
+                page.handles[slot] = 0;
+                const AtlasSet& first = sets[page.sets[0]];
+                if (first.handles[slot] == 0) {
+                    continue;
+                }
+                const u32 layout[] = { texture_atlas_version, static_cast<u32>(slot), static_cast<u32>(first.textures[slot]->format), static_cast<u32>(first.textures[slot]->usage),
+                                       page.width, page.height, settings.n_levels, padding };
+                u64 key = hash_bytes(layout, sizeof(layout));
+                for (size_t set_index : page.sets) {
+                    const AtlasSet& set = sets[set_index];
+                    const u32 rectangle[] = { set.x, set.y, set.width, set.height };
+                    key = hash_bytes(rectangle, sizeof(rectangle), key);
+                    for (u32 level = 0; level < settings.n_levels; ++level) {
+                        key = hash_bytes(set.textures[slot]->get_mip_data(level), set.textures[slot]->get_mip_bytes(level), key);
+                    }
+                }
+                char name[32];
+                snprintf(name, sizeof(name), "%s%016llx", atlas_name_prefix, static_cast<unsigned long long>(key));
+                const std::string cache_path = cache_directory.empty() ? "" : cache_directory + "/" + name + ".dds";
+                const std::string atlas_name = cache_path.empty() ? std::string(name) : cache_path;
+                TextureResource* atlas = get_atlas_texture(page, sets, slot, padding, settings, atlas_name, cache_path);
+                page.handles[slot] = resource_manager->insert_texture(atlas_name, atlas);
+                report.n_atlases++;
+            }
+            report.n_pages++;
+
+            //Point the materials at the atlases, and move the UVs to the set's rectangle, inside its padding
+            for (size_t set_index : page.sets) {
+                const AtlasSet& set = sets[set_index];
+                const glm::vec2 scale(static_cast<float>(set.width) / static_cast<float>(page.width), static_cast<float>(set.height) / static_cast<float>(page.height));
+                const glm::vec2 offset(static_cast<float>(set.x + padding) / static_cast<float>(page.width), static_cast<float>(set.y + padding) / static_cast<float>(page.height));
+                for (size_t mesh_index : set.meshes) {
+                    MeshCPU& mesh = meshes[mesh_index];
+                    for (size_t i = 0; i < mesh.n_verts; ++i) {
+                        mesh.vertices[i].texcoord0 = offset + mesh.vertices[i].texcoord0 * scale;
+                    }
+                    for (size_t slot = 0; slot < n_atlas_slots; ++slot) {
+                        if (set.handles[slot] != 0) {
+                            materials[mesh_index].*atlas_slots[slot] = page.handles[slot];
+                        }
+                    }
+                    report.n_meshes++;
+                }
+            }
+        }
+
+        report.n_textures_after = count_textures(materials, n_meshes, resource_manager);
+        report.n_packed = report.n_textures + report.n_atlases - report.n_textures_after;
+        return report;
+    }
+}
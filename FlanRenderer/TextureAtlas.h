@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include "MaterialResource.h"
+#include "TextureResource.h"
+
+// Texture atlases. Every texture a material uses is a resource and a descriptor of its own, however small it is. On
+// import, the small textures of a model are packed into shared atlas textures instead, and the meshes that sample them
+// get their UVs moved to where their textures ended up.
+//
+// A mesh samples every texture of its material with the same UVs, so what gets packed is a material's set of textures
+// as a whole: one rectangle, at the same place in an atlas texture per slot (colour, normal, emission and so on). Sets
+// that share a page have the same formats in the same slots, and all textures of a set have the same size. Sets are
+// placed with a skyline packer, largest first.
+//
+// Each packed texture keeps its own mip levels, copied level by level, down to TextureAtlasSettings::n_levels. Its
+// place and its padding are multiples of the size that halves to one block at the last level, so every level of it is
+// whole blocks and block compressed textures are copied without decoding them. The padding repeats the texture's edge.
+//
+// Only meshes whose UVs stay within 0 to 1 are moved, since a texture that repeats can't be sampled out of an atlas,
+// and the same goes for materials that scale their UVs. Atlas textures are stored in the texture cache directory and
+// named after their file, so the next import finds them again. Without a cache directory they only live in memory.
+// Cooked models store the atlas textures they use in the model itself, see CookedImage, since the cache can be cleared.
+
+namespace Flan {
+    // Bump when the layout or contents of atlas textures change, so stored ones are no longer found
+    static constexpr u32 texture_atlas_version = 1;
+
+    // Bottom-left skyline packing: rectangles rest on the lowest spot of the outline of what's placed so far
+    class SkylinePacker {
+    public:
+        void init(u32 width, u32 height);
+
+        // Where a rectangle fits, as low as possible, then as far left as possible. False if it doesn't fit anywhere
+        bool insert(u32 width, u32 height, u32& x_out, u32& y_out);
+
+        // Extent of what's been placed
+        u32 get_used_width() const { return m_used_width; }
+        u32 get_used_height() const { return m_used_height; }
+
+    private:
+        struct Segment {
+            u32 x;
+            u32 y;
+            u32 width;
+        };
+
+        std::vector<Segment> m_skyline;
+        u32 m_width = 0;
+        u32 m_height = 0;
+        u32 m_used_width = 0;
+        u32 m_used_height = 0;
+    };
+
+    struct TextureAtlasReport {
+        size_t n_textures = 0; // Different textures the model's materials used before packing
+        size_t n_packed = 0; // Of those, the ones no material uses any more
+        size_t n_atlases = 0; // Atlas textures made, one per slot of every page
+        size_t n_pages = 0;
+        size_t n_meshes = 0; // Meshes whose UVs were moved into a page
+        size_t n_textures_after = 0; // Different textures the materials use after packing, atlases included
+    };
+
+    // True for the names build_texture_atlases gives its atlas textures
+    bool is_texture_atlas_name(const std::string& name);
+
+    // Pack the small textures of a model's materials into atlas textures, with the settings in the resource manager's
+    // texture import settings. Mesh i uses material i, like in ModelResource
+    TextureAtlasReport build_texture_atlases(MeshCPU* meshes, MaterialResource* materials, size_t n_meshes, ResourceManager* resource_manager);
+}
@@ -0,0 +1,49 @@
+#include "TextureCache.h"
+#include "TextureContainer.h"
+#include "Hash.h"
+
+#include <filesystem>
+
+namespace Flan {
+    u64 get_texture_cache_key(u64 source_hash, TextureUsage usage, const TextureImportSettings& settings)
+    {
+        //Only what changes the stored texture, so e.g. pack_orm doesn't split the cache
+        const u32 values[] = {
+            texture_cache_version,
+            static_cast<u32>(usage),
+            settings.compress ? 1u : 0u,
+            static_cast<u32>(settings.quality),
+            static_cast<u32>(settings.color_format),
+        };
+        u64 key = hash_bytes(&source_hash, sizeof(source_hash));
+        for (const u32 value : values) {
+            key = hash_bytes(&value, sizeof(value), key);
+        }
+        return key;
+    }
+
+    std::string get_texture_cache_path(const std::string& cache_directory, u64 key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.dds", static_cast<unsigned long long>(key));
+        return cache_directory + "/" + name;
+    }
+
+    void store_cached_texture(TextureResource& texture, const std::string& cache_path)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(std::filesystem::path(cache_path).parent_path(), error);
+        if (texture.mapped_file != nullptr || !write_dds(texture, cache_path, true)) {
+            return;
+        }
+
+        //Map the entry like a warm load would, and let go of the levels in memory
+        TextureResource cached(0, 0, nullptr, nullptr);
+        if (!cached.load_container(cache_path, texture.usage, true, texture.name)) {
+            return;
+        }
+        dynamic_free(texture.data);
+        dynamic_free(texture.name);
+        texture = cached;
+    }
+}
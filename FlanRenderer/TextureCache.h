@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include "TextureResource.h"
+
+// Imported textures are kept on disk between runs, as DDS files holding the final mip chain in the format they're
+// uploaded in. An entry is named after a hash of the source image bytes and everything that changes how they're
+// imported: the usage, the import settings and texture_cache_version. A warm load hashes the source and maps its entry
+// like any other DDS file, so decoding, mip generation and compression are skipped entirely.
+//
+// Entries only appear once they're complete, see write_dds, so threads and processes can fill the cache at the same
+// time. Writers racing on one key write the same bytes, and whichever finishes last replaces the other's entry.
+
+namespace Flan {
+    // Bump when the output of import or compression changes, so entries from before are no longer found
+    static constexpr u32 texture_cache_version = 2;
+
+    u64 get_texture_cache_key(u64 source_hash, TextureUsage usage, const TextureImportSettings& settings);
+    std::string get_texture_cache_path(const std::string& cache_directory, u64 key);
+
+    // Store an imported texture, then map its levels from the entry instead of keeping them in memory, so streaming
+    // reads the levels that aren't resident from the file. Failing isn't an error, the texture stays as it is and the
+    // next load imports it again
+    void store_cached_texture(TextureResource& texture, const std::string& cache_path);
+}
@@ -0,0 +1,953 @@
+#include "TextureCompression.h"
+#include "CpuFeatures.h"
+#include "JobSystem.h"
+#include "TextureResource.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace Flan {
+    // Rows of blocks are handed to the job system in batches of this many
+    static constexpr u32 block_rows_per_job = 4;
+
+    // Which pixels of a block belong to the second subset, one bit per pixel, for the 64 two subset partitions of BC7
+    static constexpr u16 bc7_partitions[64] = {
+        0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+        0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+        0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+        0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+    };
+
+    // Pixel of the second subset whose index drops its top bit
+    static constexpr u8 bc7_anchors[64] = {
+        15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+        15, 2, 8, 2, 2, 8, 8, 15, 2, 8, 2, 2, 8, 8, 2, 2,
+        15, 15, 6, 8, 2, 8, 15, 15, 2, 8, 2, 2, 2, 15, 15, 6,
+        6, 2, 6, 8, 15, 15, 2, 2, 15, 15, 15, 15, 15, 2, 2, 15,
+    };
+
+    // Interpolation weights out of 64 for 2, 3 and 4 bit indices
+    static constexpr u8 bc7_weights_2[4] = { 0, 21, 43, 64 };
+    static constexpr u8 bc7_weights_3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+    static constexpr u8 bc7_weights_4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // One 4x4 block, a row of 16 floats per channel so 4 or 8 pixels fit in a register
+    struct alignas(32) BlockPixels {
+        float channels[4][16];
+    };
+
+    // A palette of up to 16 RGBA entries
+    struct BlockPalette {
+        float entries[16][4];
+        u32 n_entries;
+    };
+
+    static u32 get_block_bytes(TextureFormat format)
+    {
+        switch (format) {
+        case TextureFormat::BC1:
+        case TextureFormat::BC4:
+            return 8;
+        case TextureFormat::BC3:
+        case TextureFormat::BC5:
+        case TextureFormat::BC7:
+            return 16;
+        default:
+            return 0;
+        }
+    }
+
+    static u32 get_pixel_bytes(TextureFormat format)
+    {
+        switch (format) {
+        case TextureFormat::R8:
+            return 1;
+        case TextureFormat::RG8:
+            return 2;
+        default:
+            return static_cast<u32>(sizeof(Pixel32));
+        }
+    }
+
+    bool is_block_compressed(TextureFormat format)
+    {
+        return get_block_bytes(format) != 0;
+    }
+
+    u32 get_texture_row_bytes(TextureFormat format, u32 width)
+    {
+        if (!is_block_compressed(format)) {
+            return width * get_pixel_bytes(format);
+        }
+        return (width + 3) / 4 * get_block_bytes(format);
+    }
+
+    u32 get_texture_row_count(TextureFormat format, u32 height)
+    {
+        return is_block_compressed(format) ? (height + 3) / 4 : height;
+    }
+
+    size_t get_texture_level_bytes(TextureFormat format, u32 width, u32 height)
+    {
+        return static_cast<size_t>(get_texture_row_bytes(format, width)) * get_texture_row_count(format, height);
+    }
+
+    size_t get_texture_chain_bytes(TextureFormat format, u32 width, u32 height, u32 n_levels)
+    {
+        size_t bytes = 0;
+        for (u32 level = 0; level < n_levels; ++level) {
+            bytes += get_texture_level_bytes(format, std::max<u32>(width >> level, 1), std::max<u32>(height >> level, 1));
+        }
+        return bytes;
+    }
+
+    // Nearest palette entry of every pixel by squared distance over all 4 channels, and the distance to it
+    using FindIndicesFn = void(*)(const BlockPixels& block, const BlockPalette& palette, u8* indices, float* errors);
+
+    static void find_indices_sse2(const BlockPixels& block, const BlockPalette& palette, u8* indices, float* errors)
+    {
+        for (u32 p = 0; p < 16; p += 4) {
+            const __m128 r = _mm_load_ps(&block.channels[0][p]);
+            const __m128 g = _mm_load_ps(&block.channels[1][p]);
+            const __m128 b = _mm_load_ps(&block.channels[2][p]);
+            const __m128 a = _mm_load_ps(&block.channels[3][p]);
+            __m128 best = _mm_set1_ps(FLT_MAX);
+            __m128i best_index = _mm_setzero_si128();
+            for (u32 e = 0; e < palette.n_entries; ++e) {
+                const __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette.entries[e][0]));
+                const __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette.entries[e][1]));
+                const __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette.entries[e][2]));
+                const __m128 da = _mm_sub_ps(a, _mm_set1_ps(palette.entries[e][3]));
+                const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+                const __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+                best = _mm_min_ps(distance, best);
+                best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(static_cast<int>(e))), _mm_andnot_si128(closer, best_index));
+            }
+            alignas(16) int32_t lanes[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), best_index);
+            _mm_storeu_ps(errors + p, best);
+            for (u32 i = 0; i < 4; ++i) {
+                indices[p + i] = static_cast<u8>(lanes[i]);
+            }
+        }
+    }
+
+    FLAN_TARGET_AVX static void find_indices_avx(const BlockPixels& block, const BlockPalette& palette, u8* indices, float* errors)
+    {
+        for (u32 p = 0; p < 16; p += 8) {
+            const __m256 r = _mm256_load_ps(&block.channels[0][p]);
+            const __m256 g = _mm256_load_ps(&block.channels[1][p]);
+            const __m256 b = _mm256_load_ps(&block.channels[2][p]);
+            const __m256 a = _mm256_load_ps(&block.channels[3][p]);
+            __m256 best = _mm256_set1_ps(FLT_MAX);
+            __m256 best_index = _mm256_setzero_ps();
+            for (u32 e = 0; e < palette.n_entries; ++e) {
+                const __m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette.entries[e][0]));
+                const __m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette.entries[e][1]));
+                const __m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette.entries[e][2]));
+                const __m256 da = _mm256_sub_ps(a, _mm256_set1_ps(palette.entries[e][3]));
+                const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dr, dr), _mm256_mul_ps(dg, dg)), _mm256_add_ps(_mm256_mul_ps(db, db), _mm256_mul_ps(da, da)));
+                const __m256 closer = _mm256_cmp_ps(distance, best, _CMP_LT_OQ);
+                best = _mm256_min_ps(distance, best);
+                best_index = _mm256_blendv_ps(best_index, _mm256_set1_ps(static_cast<float>(e)), closer);
+            }
+            alignas(32) int32_t lanes[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_cvttps_epi32(best_index));
+            _mm256_storeu_ps(errors + p, best);
+            for (u32 i = 0; i < 8; ++i) {
+                indices[p + i] = static_cast<u8>(lanes[i]);
+            }
+        }
+    }
+
+    static FindIndicesFn select_find_indices()
+    {
+        return CpuFeatures::get().avx ? find_indices_avx : find_indices_sse2;
+    }
+
+    static float find_indices(const BlockPixels& block, const BlockPalette& palette, u32 mask, u8* indices)
+    {
+        static const FindIndicesFn find = select_find_indices();
+        alignas(32) float errors[16];
+        find(block, palette, indices, errors);
+        float error = 0.0f;
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                error += errors[p];
+            }
+        }
+        return error;
+    }
+
+    // Ends of the extent of the pixels in mask along their principal axis, found with a few power iterations on their
+    // covariance. The first n_channels channels are fitted, the rest keep their mean
+    static void fit_line(const BlockPixels& block, u32 mask, u32 n_channels, float* low, float* high)
+    {
+        float mean[4] = { 0, 0, 0, 0 };
+        u32 n_pixels = 0;
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                for (u32 c = 0; c < 4; ++c) {
+                    mean[c] += block.channels[c][p];
+                }
+                n_pixels++;
+            }
+        }
+        for (u32 c = 0; c < 4; ++c) {
+            mean[c] /= static_cast<float>(std::max<u32>(n_pixels, 1));
+            low[c] = mean[c];
+            high[c] = mean[c];
+        }
+
+        float covariance[4][4]{};
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                for (u32 i = 0; i < n_channels; ++i) {
+                    for (u32 j = i; j < n_channels; ++j) {
+                        covariance[i][j] += (block.channels[i][p] - mean[i]) * (block.channels[j][p] - mean[j]);
+                    }
+                }
+            }
+        }
+
+        //Start from the channel that varies most, it's never orthogonal to the axis we're after
+        u32 widest = 0;
+        for (u32 i = 0; i < n_channels; ++i) {
+            for (u32 j = 0; j < i; ++j) {
+                covariance[i][j] = covariance[j][i];
+            }
+            if (covariance[i][i] > covariance[widest][widest]) {
+                widest = i;
+            }
+        }
+        if (covariance[widest][widest] <= 0.0f) {
+            return;
+        }
+        float axis[4] = { 0, 0, 0, 0 };
+        axis[widest] = 1.0f;
+        for (u32 iteration = 0; iteration < 8; ++iteration) {
+            float next[4] = { 0, 0, 0, 0 };
+            float length = 0.0f;
+            for (u32 i = 0; i < n_channels; ++i) {
+                for (u32 j = 0; j < n_channels; ++j) {
+                    next[i] += covariance[i][j] * axis[j];
+                }
+                length += next[i] * next[i];
+            }
+            if (length <= 0.0f) {
+                break;
+            }
+            const float scale = 1.0f / sqrtf(length);
+            for (u32 i = 0; i < n_channels; ++i) {
+                axis[i] = next[i] * scale;
+            }
+        }
+
+        float t_min = FLT_MAX;
+        float t_max = -FLT_MAX;
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                float t = 0.0f;
+                for (u32 c = 0; c < n_channels; ++c) {
+                    t += (block.channels[c][p] - mean[c]) * axis[c];
+                }
+                t_min = std::min(t_min, t);
+                t_max = std::max(t_max, t);
+            }
+        }
+        for (u32 c = 0; c < n_channels; ++c) {
+            low[c] = std::clamp(mean[c] + axis[c] * t_min, 0.0f, 255.0f);
+            high[c] = std::clamp(mean[c] + axis[c] * t_max, 0.0f, 255.0f);
+        }
+    }
+
+    // Least squares endpoints for the pixels in mask given their indices, where index i sits at index_weights[i]
+    // between low and high. Returns false if the indices don't pin down both endpoints
+    static bool refine_endpoints(const BlockPixels& block, u32 mask, const u8* indices, const float* index_weights, u32 n_channels, float* low, float* high)
+    {
+        float aa = 0.0f;
+        float ab = 0.0f;
+        float bb = 0.0f;
+        float ax[4] = { 0, 0, 0, 0 };
+        float bx[4] = { 0, 0, 0, 0 };
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                const float b = index_weights[indices[p]];
+                const float a = 1.0f - b;
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (u32 c = 0; c < n_channels; ++c) {
+                    ax[c] += a * block.channels[c][p];
+                    bx[c] += b * block.channels[c][p];
+                }
+            }
+        }
+        const float determinant = aa * bb - ab * ab;
+        if (fabsf(determinant) < 1e-6f) {
+            return false;
+        }
+        const float inverse = 1.0f / determinant;
+        for (u32 c = 0; c < n_channels; ++c) {
+            low[c] = std::clamp((ax[c] * bb - bx[c] * ab) * inverse, 0.0f, 255.0f);
+            high[c] = std::clamp((bx[c] * aa - ax[c] * ab) * inverse, 0.0f, 255.0f);
+        }
+        return true;
+    }
+
+    static void load_block(const Pixel32* pixels, u32 width, u32 height, u32 block_x, u32 block_y, u8 (&channels)[4][16])
+    {
+        for (u32 y = 0; y < 4; ++y) {
+            const u32 source_y = std::min(block_y * 4 + y, height - 1);
+            for (u32 x = 0; x < 4; ++x) {
+                const u32 source_x = std::min(block_x * 4 + x, width - 1);
+                const Pixel32& pixel = pixels[static_cast<size_t>(source_y) * width + source_x];
+                channels[0][y * 4 + x] = pixel.r;
+                channels[1][y * 4 + x] = pixel.g;
+                channels[2][y * 4 + x] = pixel.b;
+                channels[3][y * 4 + x] = pixel.a;
+            }
+        }
+    }
+
+    // 128 bits filled from the lowest bit up, as BC7 blocks are laid out
+    struct BlockBitWriter {
+        u64 words[2] = { 0, 0 };
+        u32 position = 0;
+
+        void write(u64 value, u32 n_bits)
+        {
+            const u32 word = position >> 6;
+            const u32 shift = position & 63;
+            words[word] |= value << shift;
+            if (shift + n_bits > 64) {
+                words[word + 1] |= value >> (64 - shift);
+            }
+            position += n_bits;
+        }
+    };
+
+    // BC4
+
+    // Nearest of 8 palette values for each of 16 pixels, 16 at once. Returns the squared error
+    static u32 find_bc4_indices(const u8* values, const u8* palette, u8* indices)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+        __m128i best = _mm_set1_epi8(-1);
+        __m128i best_index = _mm_setzero_si128();
+        for (u32 e = 0; e < 8; ++e) {
+            const __m128i entry = _mm_set1_epi8(static_cast<char>(palette[e]));
+            const __m128i distance = _mm_sub_epi8(_mm_max_epu8(pixels, entry), _mm_min_epu8(pixels, entry));
+            const __m128i next = _mm_min_epu8(distance, best);
+            const __m128i closer = _mm_andnot_si128(_mm_cmpeq_epi8(next, best), _mm_set1_epi8(-1));
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi8(static_cast<char>(e))), _mm_andnot_si128(closer, best_index));
+            best = next;
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(indices), best_index);
+
+        const __m128i low = _mm_unpacklo_epi8(best, _mm_setzero_si128());
+        const __m128i high = _mm_unpackhi_epi8(best, _mm_setzero_si128());
+        __m128i sum = _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+        return static_cast<u32>(_mm_cvtsi128_si32(sum));
+    }
+
+    // Palette of a BC4 block: 6 interpolated values if endpoint 0 is the larger one, otherwise 4 with 0 and 255
+    static void get_bc4_palette(u32 e0, u32 e1, u8* palette)
+    {
+        palette[0] = static_cast<u8>(e0);
+        palette[1] = static_cast<u8>(e1);
+        if (e0 > e1) {
+            for (u32 i = 1; i < 7; ++i) {
+                palette[i + 1] = static_cast<u8>(((7 - i) * e0 + i * e1 + 3) / 7);
+            }
+        }
+        else {
+            for (u32 i = 1; i < 5; ++i) {
+                palette[i + 1] = static_cast<u8>(((5 - i) * e0 + i * e1 + 2) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+    }
+
+    struct Bc4Candidate {
+        u32 e0;
+        u32 e1;
+        u8 indices[16];
+        u32 error;
+    };
+
+    static void try_bc4(const u8* values, u32 e0, u32 e1, Bc4Candidate& best)
+    {
+        u8 palette[8];
+        get_bc4_palette(e0, e1, palette);
+        Bc4Candidate candidate;
+        candidate.e0 = e0;
+        candidate.e1 = e1;
+        candidate.error = find_bc4_indices(values, palette, candidate.indices);
+        if (candidate.error < best.error) {
+            best = candidate;
+        }
+    }
+
+    static void encode_bc4(const u8* values, TextureCompressionQuality quality, u8* out)
+    {
+        u32 min_value = 255;
+        u32 max_value = 0;
+        u32 inner_min = 255;
+        u32 inner_max = 0;
+        for (u32 p = 0; p < 16; ++p) {
+            min_value = std::min<u32>(min_value, values[p]);
+            max_value = std::max<u32>(max_value, values[p]);
+            if (values[p] != 0 && values[p] != 255) {
+                inner_min = std::min<u32>(inner_min, values[p]);
+                inner_max = std::max<u32>(inner_max, values[p]);
+            }
+        }
+
+        Bc4Candidate best{};
+        best.error = UINT32_MAX;
+        if (min_value == max_value) {
+            try_bc4(values, min_value, min_value, best);
+        }
+        else {
+            try_bc4(values, max_value, min_value, best);
+        }
+
+        if (quality != TextureCompressionQuality::Fast && best.error > 0) {
+            //Blocks that touch 0 or 255 can spend the interpolated values on the rest, the extremes come for free
+            if ((min_value == 0 || max_value == 255) && inner_min <= inner_max) {
+                try_bc4(values, inner_min, inner_max, best);
+            }
+
+            //Least squares on the 8 value palette moves the endpoints off the extremes, which spreads the steps better
+            const u32 n_iterations = quality == TextureCompressionQuality::High ? 3 : 1;
+            for (u32 iteration = 0; iteration < n_iterations && best.e0 > best.e1; ++iteration) {
+                BlockPixels block;
+                for (u32 p = 0; p < 16; ++p) {
+                    block.channels[0][p] = static_cast<float>(values[p]);
+                }
+                static constexpr float index_weights[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+                float low[4];
+                float high[4];
+                if (!refine_endpoints(block, 0xFFFF, best.indices, index_weights, 1, low, high)) {
+                    break;
+                }
+                const u32 e0 = static_cast<u32>(low[0] + 0.5f);
+                const u32 e1 = static_cast<u32>(high[0] + 0.5f);
+                if (e0 <= e1) {
+                    break;
+                }
+                const u32 previous = best.error;
+                if (quality == TextureCompressionQuality::High) {
+                    for (u32 i = std::max<u32>(e0, 1) - 1; i <= std::min<u32>(e0 + 1, 255); ++i) {
+                        for (u32 j = std::max<u32>(e1, 1) - 1; j <= std::min<u32>(e1 + 1, 255); ++j) {
+                            if (i > j) try_bc4(values, i, j, best);
+                        }
+                    }
+                }
+                else {
+                    try_bc4(values, e0, e1, best);
+                }
+                if (best.error == previous) {
+                    break;
+                }
+            }
+        }
+
+        u64 bits = 0;
+        for (u32 p = 0; p < 16; ++p) {
+            bits |= static_cast<u64>(best.indices[p]) << (p * 3);
+        }
+        out[0] = static_cast<u8>(best.e0);
+        out[1] = static_cast<u8>(best.e1);
+        for (u32 i = 0; i < 6; ++i) {
+            out[2 + i] = static_cast<u8>(bits >> (i * 8));
+        }
+    }
+
+    // BC1
+
+    static u16 pack_565(const float* colour)
+    {
+        const u32 r = static_cast<u32>(colour[0] * (31.0f / 255.0f) + 0.5f);
+        const u32 g = static_cast<u32>(colour[1] * (63.0f / 255.0f) + 0.5f);
+        const u32 b = static_cast<u32>(colour[2] * (31.0f / 255.0f) + 0.5f);
+        return static_cast<u16>((r << 11) | (g << 5) | b);
+    }
+
+    static void unpack_565(u16 packed, float* colour)
+    {
+        const u32 r = (packed >> 11) & 31;
+        const u32 g = (packed >> 5) & 63;
+        const u32 b = packed & 31;
+        colour[0] = static_cast<float>((r << 3) | (r >> 2));
+        colour[1] = static_cast<float>((g << 2) | (g >> 4));
+        colour[2] = static_cast<float>((b << 3) | (b >> 2));
+        colour[3] = 0.0f;
+    }
+
+    // Error of a pair of 5:6:5 endpoints in the 4 colour mode, with the indices that go with them
+    static float evaluate_bc1(const BlockPixels& block, u16 c0, u16 c1, u8* indices)
+    {
+        BlockPalette palette;
+        palette.n_entries = 4;
+        unpack_565(c0, palette.entries[0]);
+        unpack_565(c1, palette.entries[1]);
+        for (u32 c = 0; c < 4; ++c) {
+            palette.entries[2][c] = (palette.entries[0][c] * 2.0f + palette.entries[1][c]) / 3.0f;
+            palette.entries[3][c] = (palette.entries[0][c] + palette.entries[1][c] * 2.0f) / 3.0f;
+        }
+        return find_indices(block, palette, 0xFFFF, indices);
+    }
+
+    // The colour half of BC1 and BC3. Alpha has to be zeroed in block. Always uses the 4 colour mode, which is the
+    // only one BC3 has
+    static void encode_bc1_colour(const BlockPixels& block, TextureCompressionQuality quality, u8* out)
+    {
+        float low[4];
+        float high[4];
+        fit_line(block, 0xFFFF, 3, low, high);
+        u16 c0 = pack_565(high);
+        u16 c1 = pack_565(low);
+        u8 indices[16];
+        float error = evaluate_bc1(block, c0, c1, indices);
+
+        const u32 n_iterations = quality == TextureCompressionQuality::Fast ? 0 : (quality == TextureCompressionQuality::High ? 4 : 2);
+        for (u32 iteration = 0; iteration < n_iterations && error > 0.0f; ++iteration) {
+            static constexpr float index_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+            if (!refine_endpoints(block, 0xFFFF, indices, index_weights, 3, high, low)) {
+                break;
+            }
+            const u16 refined_c0 = pack_565(high);
+            const u16 refined_c1 = pack_565(low);
+            u8 refined_indices[16];
+            const float refined_error = evaluate_bc1(block, refined_c0, refined_c1, refined_indices);
+            if (refined_error >= error) {
+                break;
+            }
+            c0 = refined_c0;
+            c1 = refined_c1;
+            error = refined_error;
+            memcpy(indices, refined_indices, sizeof(indices));
+        }
+
+        //The 4 colour mode needs the first endpoint to be the larger one. Swapping them swaps 0 with 1 and 2 with 3
+        u32 swap = 0;
+        if (c0 < c1) {
+            std::swap(c0, c1);
+            swap = 1;
+        }
+        u32 bits = 0;
+        for (u32 p = 0; p < 16; ++p) {
+            const u32 index = c0 == c1 ? 0 : indices[p] ^ swap;
+            bits |= index << (p * 2);
+        }
+        memcpy(out, &c0, 2);
+        memcpy(out + 2, &c1, 2);
+        memcpy(out + 4, &bits, 4);
+    }
+
+    // BC7
+
+    struct Bc7Mode {
+        u32 mode;
+        u32 color_bits; // Per endpoint channel, before the p-bit
+        bool has_alpha;
+        u32 index_bits;
+        bool shared_pbit; // One p-bit for both endpoints of a subset
+    };
+
+    static constexpr Bc7Mode bc7_mode_1 = { 1, 6, false, 3, true };
+    static constexpr Bc7Mode bc7_mode_6 = { 6, 7, true, 4, false };
+
+    // Endpoints of one subset as stored
+    struct Bc7Endpoints {
+        u32 codes[2][4];
+        u32 pbits[2];
+    };
+
+    static const u8* get_bc7_weights(u32 index_bits)
+    {
+        return index_bits == 2 ? bc7_weights_2 : (index_bits == 3 ? bc7_weights_3 : bc7_weights_4);
+    }
+
+    // An endpoint channel of bits bits and a p-bit, expanded to 8 bits
+    static u32 expand_bc7(u32 code, u32 pbit, u32 bits)
+    {
+        const u32 value = (code << 1) | pbit;
+        const u32 total = bits + 1;
+        return total == 8 ? value : (value << (8 - total)) | (value >> (2 * total - 8));
+    }
+
+    // Nearest code for an endpoint channel with a given p-bit, as the 8 bit value it expands to
+    static u32 quantize_bc7(float value, u32 pbit, u32 bits, u32& code)
+    {
+        const i32 max_code = (1 << bits) - 1;
+        const float scaled = value * static_cast<float>((1 << (bits + 1)) - 1) / 255.0f;
+        const i32 guess = static_cast<i32>(floorf((scaled - static_cast<float>(pbit)) * 0.5f + 0.5f));
+        u32 best_value = 0;
+        float best_error = FLT_MAX;
+        for (i32 candidate = std::max<i32>(guess - 1, 0); candidate <= std::min<i32>(guess + 1, max_code); ++candidate) {
+            const u32 expanded = expand_bc7(static_cast<u32>(candidate), pbit, bits);
+            const float error = fabsf(static_cast<float>(expanded) - value);
+            if (error < best_error) {
+                best_error = error;
+                best_value = expanded;
+                code = static_cast<u32>(candidate);
+            }
+        }
+        return best_value;
+    }
+
+    // Quantize a pair of endpoints for a mode with every choice of p-bits, and keep the one with the lowest error over
+    // the pixels in mask. Opaque pixels only keep alpha 255 with both p-bits set, so that's the only choice for them
+    static float quantize_bc7_subset(const BlockPixels& block, u32 mask, const Bc7Mode& mode, const float* low, const float* high, Bc7Endpoints& endpoints, u8* indices)
+    {
+        const u8* weights = get_bc7_weights(mode.index_bits);
+        const u32 n_options = mode.shared_pbit ? 2 : 4;
+        bool opaque = mode.has_alpha;
+        for (u32 pixels = mask; pixels != 0 && opaque; pixels &= pixels - 1) {
+            opaque = block.channels[3][std::countr_zero(pixels)] == 255.0f;
+        }
+        float best_error = FLT_MAX;
+        for (u32 option = opaque ? n_options - 1 : 0; option < n_options; ++option) {
+            Bc7Endpoints candidate;
+            candidate.pbits[0] = option & 1;
+            candidate.pbits[1] = mode.shared_pbit ? option & 1 : option >> 1;
+
+            float ends[2][4];
+            for (u32 c = 0; c < 4; ++c) {
+                if (c == 3 && (!mode.has_alpha || opaque)) {
+                    //Modes without alpha decode it as 255, opaque ones store the top code
+                    const u32 code = mode.has_alpha ? (1u << mode.color_bits) - 1 : 0;
+                    ends[0][c] = 255.0f;
+                    ends[1][c] = 255.0f;
+                    candidate.codes[0][c] = code;
+                    candidate.codes[1][c] = code;
+                    continue;
+                }
+                ends[0][c] = static_cast<float>(quantize_bc7(low[c], candidate.pbits[0], mode.color_bits, candidate.codes[0][c]));
+                ends[1][c] = static_cast<float>(quantize_bc7(high[c], candidate.pbits[1], mode.color_bits, candidate.codes[1][c]));
+            }
+
+            BlockPalette palette;
+            palette.n_entries = 1u << mode.index_bits;
+            for (u32 i = 0; i < palette.n_entries; ++i) {
+                for (u32 c = 0; c < 4; ++c) {
+                    //Integer interpolation, as the decoder does it
+                    const u32 e0 = static_cast<u32>(ends[0][c]);
+                    const u32 e1 = static_cast<u32>(ends[1][c]);
+                    palette.entries[i][c] = static_cast<float>(((64 - weights[i]) * e0 + weights[i] * e1 + 32) >> 6);
+                }
+            }
+            u8 candidate_indices[16];
+            const float error = find_indices(block, palette, mask, candidate_indices);
+            if (error < best_error) {
+                best_error = error;
+                endpoints = candidate;
+                memcpy(indices, candidate_indices, 16);
+            }
+        }
+        return best_error;
+    }
+
+    // Fit, quantize and refine the endpoints of one subset
+    static float encode_bc7_subset(const BlockPixels& block, u32 mask, const Bc7Mode& mode, u32 n_iterations, Bc7Endpoints& endpoints, u8* indices)
+    {
+        const u32 n_channels = mode.has_alpha ? 4 : 3;
+        float low[4];
+        float high[4];
+        fit_line(block, mask, n_channels, low, high);
+        float error = quantize_bc7_subset(block, mask, mode, low, high, endpoints, indices);
+
+        const u8* weights = get_bc7_weights(mode.index_bits);
+        float index_weights[16];
+        for (u32 i = 0; i < (1u << mode.index_bits); ++i) {
+            index_weights[i] = static_cast<float>(weights[i]) / 64.0f;
+        }
+        for (u32 iteration = 0; iteration < n_iterations && error > 0.0f; ++iteration) {
+            if (!refine_endpoints(block, mask, indices, index_weights, n_channels, low, high)) {
+                break;
+            }
+            Bc7Endpoints refined;
+            u8 refined_indices[16];
+            const float refined_error = quantize_bc7_subset(block, mask, mode, low, high, refined, refined_indices);
+            if (refined_error >= error) {
+                break;
+            }
+            error = refined_error;
+            endpoints = refined;
+            memcpy(indices, refined_indices, 16);
+        }
+        return error;
+    }
+
+    // Sums over a set of pixels, enough to find how far they are from the line that fits them best
+    struct ColourMoments {
+        float n_pixels = 0.0f;
+        float sums[3] = { 0, 0, 0 };
+        float products[6] = { 0, 0, 0, 0, 0, 0 }; // rr, rg, rb, gg, gb, bb
+    };
+
+    static void add_moments(ColourMoments& moments, const BlockPixels& block, u32 pixel, float sign)
+    {
+        const float r = block.channels[0][pixel];
+        const float g = block.channels[1][pixel];
+        const float b = block.channels[2][pixel];
+        moments.n_pixels += sign;
+        moments.sums[0] += sign * r;
+        moments.sums[1] += sign * g;
+        moments.sums[2] += sign * b;
+        moments.products[0] += sign * r * r;
+        moments.products[1] += sign * r * g;
+        moments.products[2] += sign * r * b;
+        moments.products[3] += sign * g * g;
+        moments.products[4] += sign * g * b;
+        moments.products[5] += sign * b * b;
+    }
+
+    // Squared distance of the pixels to the line through them, the variance the principal axis doesn't explain. An
+    // estimate of how well a subset compresses
+    static float get_line_residual(const ColourMoments& moments)
+    {
+        if (moments.n_pixels < 2.0f) {
+            return 0.0f;
+        }
+        const float inverse = 1.0f / moments.n_pixels;
+        const float* s = moments.sums;
+        const float c[3][3] = {
+            { moments.products[0] - s[0] * s[0] * inverse, moments.products[1] - s[0] * s[1] * inverse, moments.products[2] - s[0] * s[2] * inverse },
+            { moments.products[1] - s[0] * s[1] * inverse, moments.products[3] - s[1] * s[1] * inverse, moments.products[4] - s[1] * s[2] * inverse },
+            { moments.products[2] - s[0] * s[2] * inverse, moments.products[4] - s[1] * s[2] * inverse, moments.products[5] - s[2] * s[2] * inverse },
+        };
+        const float trace = c[0][0] + c[1][1] + c[2][2];
+        if (trace <= 0.0f) {
+            return 0.0f;
+        }
+
+        //Power iterations from the row of the widest channel, the largest eigenvalue is the variance along the axis
+        const u32 widest = c[0][0] >= c[1][1] ? (c[0][0] >= c[2][2] ? 0 : 2) : (c[1][1] >= c[2][2] ? 1 : 2);
+        float axis[3] = { c[widest][0], c[widest][1], c[widest][2] };
+        for (u32 iteration = 0; iteration < 4; ++iteration) {
+            const float next[3] = {
+                c[0][0] * axis[0] + c[0][1] * axis[1] + c[0][2] * axis[2],
+                c[1][0] * axis[0] + c[1][1] * axis[1] + c[1][2] * axis[2],
+                c[2][0] * axis[0] + c[2][1] * axis[1] + c[2][2] * axis[2],
+            };
+            const float length = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+            if (length <= 0.0f) {
+                return trace;
+            }
+            axis[0] = next[0] / length;
+            axis[1] = next[1] / length;
+            axis[2] = next[2] / length;
+        }
+        float variance = 0.0f;
+        for (u32 i = 0; i < 3; ++i) {
+            variance += axis[i] * (c[i][0] * axis[0] + c[i][1] * axis[1] + c[i][2] * axis[2]);
+        }
+        return std::max(trace - variance, 0.0f);
+    }
+
+    // Swap the endpoints of a subset if its anchor pixel's index has the top bit set, the format leaves that bit out
+    static void fix_bc7_anchor(Bc7Endpoints& endpoints, u8* indices, u32 mask, u32 anchor, u32 index_bits)
+    {
+        const u32 top = 1u << (index_bits - 1);
+        if ((indices[anchor] & top) == 0) {
+            return;
+        }
+        for (u32 c = 0; c < 4; ++c) {
+            std::swap(endpoints.codes[0][c], endpoints.codes[1][c]);
+        }
+        std::swap(endpoints.pbits[0], endpoints.pbits[1]);
+        const u32 max_index = (1u << index_bits) - 1;
+        for (u32 p = 0; p < 16; ++p) {
+            if (mask & (1u << p)) {
+                indices[p] = static_cast<u8>(max_index - indices[p]);
+            }
+        }
+    }
+
+    static void write_bc7_mode_6(Bc7Endpoints endpoints, u8* indices, u8* out)
+    {
+        fix_bc7_anchor(endpoints, indices, 0xFFFF, 0, 4);
+        BlockBitWriter writer;
+        writer.write(1u << 6, 7);
+        for (u32 c = 0; c < 4; ++c) {
+            writer.write(endpoints.codes[0][c], 7);
+            writer.write(endpoints.codes[1][c], 7);
+        }
+        writer.write(endpoints.pbits[0], 1);
+        writer.write(endpoints.pbits[1], 1);
+        for (u32 p = 0; p < 16; ++p) {
+            writer.write(indices[p], p == 0 ? 3 : 4);
+        }
+        memcpy(out, writer.words, 16);
+    }
+
+    static void write_bc7_mode_1(u32 partition, Bc7Endpoints* endpoints, u8* indices, u8* out)
+    {
+        const u32 second = bc7_partitions[partition];
+        const u32 anchor = bc7_anchors[partition];
+        fix_bc7_anchor(endpoints[0], indices, ~second & 0xFFFF, 0, 3);
+        fix_bc7_anchor(endpoints[1], indices, second, anchor, 3);
+        BlockBitWriter writer;
+        writer.write(1u << 1, 2);
+        writer.write(partition, 6);
+        for (u32 c = 0; c < 3; ++c) {
+            for (u32 s = 0; s < 2; ++s) {
+                writer.write(endpoints[s].codes[0][c], 6);
+                writer.write(endpoints[s].codes[1][c], 6);
+            }
+        }
+        writer.write(endpoints[0].pbits[0], 1);
+        writer.write(endpoints[1].pbits[0], 1);
+        for (u32 p = 0; p < 16; ++p) {
+            writer.write(indices[p], p == 0 || p == anchor ? 2 : 3);
+        }
+        memcpy(out, writer.words, 16);
+    }
+
+    static void encode_bc7(const BlockPixels& block, bool opaque, TextureCompressionQuality quality, u8* out)
+    {
+        const u32 n_iterations = quality == TextureCompressionQuality::Fast ? 0 : (quality == TextureCompressionQuality::High ? 2 : 1);
+        Bc7Endpoints endpoints;
+        u8 indices[16];
+        const float error = encode_bc7_subset(block, 0xFFFF, bc7_mode_6, n_iterations, endpoints, indices);
+        if (quality == TextureCompressionQuality::Fast || !opaque || error == 0.0f) {
+            write_bc7_mode_6(endpoints, indices, out);
+            return;
+        }
+
+        //Rank the partitions by how far their subsets are from a line each, and only encode the best few
+        ColourMoments all;
+        for (u32 p = 0; p < 16; ++p) {
+            add_moments(all, block, p, 1.0f);
+        }
+        float residuals[64];
+        u8 order[64];
+        for (u32 partition = 0; partition < 64; ++partition) {
+            ColourMoments first = all;
+            ColourMoments second;
+            for (u32 mask = bc7_partitions[partition]; mask != 0; mask &= mask - 1) {
+                const u32 p = std::countr_zero(mask);
+                add_moments(first, block, p, -1.0f);
+                add_moments(second, block, p, 1.0f);
+            }
+            residuals[partition] = get_line_residual(first) + get_line_residual(second);
+            order[partition] = static_cast<u8>(partition);
+        }
+        const u32 n_partitions = quality == TextureCompressionQuality::High ? 16 : 4;
+        std::partial_sort(order, order + n_partitions, order + 64, [&](u8 a, u8 b) { return residuals[a] < residuals[b]; });
+
+        float best_error = error;
+        u32 best_partition = 64;
+        Bc7Endpoints best_endpoints[2];
+        u8 best_indices[16];
+        for (u32 i = 0; i < n_partitions; ++i) {
+            const u32 partition = order[i];
+            const u32 second = bc7_partitions[partition];
+            Bc7Endpoints subset_endpoints[2];
+            u8 subset_indices[2][16];
+            const float first_error = encode_bc7_subset(block, ~second & 0xFFFF, bc7_mode_1, n_iterations, subset_endpoints[0], subset_indices[0]);
+            if (first_error >= best_error) {
+                continue;
+            }
+            const float total = first_error + encode_bc7_subset(block, second, bc7_mode_1, n_iterations, subset_endpoints[1], subset_indices[1]);
+            if (total < best_error) {
+                best_error = total;
+                best_partition = partition;
+                best_endpoints[0] = subset_endpoints[0];
+                best_endpoints[1] = subset_endpoints[1];
+                for (u32 p = 0; p < 16; ++p) {
+                    best_indices[p] = subset_indices[(second >> p) & 1][p];
+                }
+            }
+        }
+
+        if (best_partition == 64) {
+            write_bc7_mode_6(endpoints, indices, out);
+        }
+        else {
+            write_bc7_mode_1(best_partition, best_endpoints, best_indices, out);
+        }
+    }
+
+    static void encode_block(const u8 (&channels)[4][16], TextureFormat format, TextureCompressionQuality quality, u8* out)
+    {
+        if (format == TextureFormat::BC4 || format == TextureFormat::BC5) {
+            encode_bc4(channels[0], quality, out);
+            if (format == TextureFormat::BC5) {
+                encode_bc4(channels[1], quality, out + 8);
+            }
+            return;
+        }
+
+        BlockPixels block;
+        bool opaque = true;
+        for (u32 p = 0; p < 16; ++p) {
+            for (u32 c = 0; c < 4; ++c) {
+                block.channels[c][p] = static_cast<float>(channels[c][p]);
+            }
+            opaque &= channels[3][p] == 255;
+        }
+        if (format == TextureFormat::BC7) {
+            encode_bc7(block, opaque, quality, out);
+            return;
+        }
+
+        //BC1 and BC3 colour ignores alpha, BC3 stores it in a BC4 block in front
+        std::fill_n(block.channels[3], 16, 0.0f);
+        if (format == TextureFormat::BC3) {
+            encode_bc4(channels[3], quality, out);
+            out += 8;
+        }
+        encode_bc1_colour(block, quality, out);
+    }
+
+    void compress_texture(const Pixel32* pixels, u32 width, u32 height, TextureFormat format, TextureCompressionQuality quality, u8* out)
+    {
+        if (format == TextureFormat::RGBA8) {
+            memcpy(out, pixels, get_texture_level_bytes(format, width, height));
+            return;
+        }
+        if (format == TextureFormat::R8 || format == TextureFormat::RG8) {
+            const size_t n_pixels = static_cast<size_t>(width) * height;
+            for (size_t i = 0; i < n_pixels; ++i) {
+                if (format == TextureFormat::R8) {
+                    out[i] = pixels[i].r;
+                }
+                else {
+                    out[i * 2] = pixels[i].r;
+                    out[i * 2 + 1] = pixels[i].g;
+                }
+            }
+            return;
+        }
+
+        const u32 blocks_x = (width + 3) / 4;
+        const u32 blocks_y = (height + 3) / 4;
+        const u32 block_bytes = get_block_bytes(format);
+        const size_t n_jobs = (blocks_y + block_rows_per_job - 1) / block_rows_per_job;
+        JobSystem::get_instance()->parallel_for(n_jobs, [&](size_t job) {
+            const u32 first_row = static_cast<u32>(job) * block_rows_per_job;
+            const u32 end_row = std::min(blocks_y, first_row + block_rows_per_job);
+            for (u32 block_y = first_row; block_y < end_row; ++block_y) {
+                u8* row = out + static_cast<size_t>(block_y) * blocks_x * block_bytes;
+                for (u32 block_x = 0; block_x < blocks_x; ++block_x) {
+                    u8 channels[4][16];
+                    load_block(pixels, width, height, block_x, block_y, channels);
+                    encode_block(channels, format, quality, row + static_cast<size_t>(block_x) * block_bytes);
+                }
+            }
+        });
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include "FlanTypes.h"
+
+// CPU encoders for the BC block compressed formats. Every format stores the texture as 4x4 pixel blocks:
+// - BC1: RGB, two 5:6:5 endpoints and 2 bit indices, 8 bytes per block
+// - BC3: BC1 colour after a BC4 block for alpha, 16 bytes
+// - BC4: one channel, two 8 bit endpoints and 3 bit indices, 8 bytes
+// - BC5: two BC4 blocks, red and green, 16 bytes. Normal maps keep x and y, shaders rebuild z
+// - BC7: RGBA, 16 bytes. Encoded with mode 6, one pair of RGBA endpoints with 4 bit indices, and for opaque blocks
+//   also mode 1, two pairs of RGB endpoints over one of 64 partitions of the block with 3 bit indices
+//
+// R8 and RG8 are uncompressed, for one or two channel data when compression is off.
+//
+// Indices are found by trying every palette entry for every pixel, 4 pixels at a time with SSE or 8 with AVX. Rows of
+// blocks are split across the job system.
+
+namespace Flan {
+    struct Pixel32;
+
+    enum struct TextureFormat : u32 {
+        RGBA8 = 0,
+        BC1,
+        BC3,
+        BC4,
+        BC5,
+        BC7,
+        R8,
+        RG8,
+    };
+
+    enum struct TextureCompressionQuality : u32 {
+        Fast = 0, // Endpoints from the extent of the block along its main axis, BC7 only uses mode 6
+        Normal, // Endpoints refined with least squares, BC7 also tries the 4 most promising partitions of mode 1
+        High, // More refinement, and the 16 most promising partitions
+    };
+
+    bool is_block_compressed(TextureFormat format);
+
+    // Bytes in a row of pixels, or a row of blocks for the compressed formats
+    u32 get_texture_row_bytes(TextureFormat format, u32 width);
+
+    // Rows of pixels, or rows of blocks
+    u32 get_texture_row_count(TextureFormat format, u32 height);
+
+    size_t get_texture_level_bytes(TextureFormat format, u32 width, u32 height);
+
+    // Bytes in the first n_levels levels of a chain, stored back to back from level 0 down
+    size_t get_texture_chain_bytes(TextureFormat format, u32 width, u32 height, u32 n_levels);
+
+    // Encode one level, out needs get_texture_level_bytes bytes. Blocks that stick out of small levels repeat the last
+    // row and column. R8 and RG8 keep the first channels of each pixel
+    void compress_texture(const Pixel32* pixels, u32 width, u32 height, TextureFormat format, TextureCompressionQuality quality, u8* out);
+}
@@ -0,0 +1,461 @@
+#include "TextureContainer.h"
+#include "MipGenerator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <vector>
+
+namespace Flan {
+    static constexpr u32 dds_magic = 0x20534444; // "DDS "
+    static constexpr u32 dds_flags_required = 0x1 | 0x2 | 0x4 | 0x1000; // Caps, height, width, pixel format
+    static constexpr u32 dds_flag_pitch = 0x8;
+    static constexpr u32 dds_flag_mip_map_count = 0x20000;
+    static constexpr u32 dds_flag_linear_size = 0x80000;
+    static constexpr u32 dds_flag_depth = 0x800000;
+    static constexpr u32 dds_pixel_format_alpha = 0x1;
+    static constexpr u32 dds_pixel_format_four_cc = 0x4;
+    static constexpr u32 dds_pixel_format_rgb = 0x40;
+    static constexpr u32 dds_pixel_format_luminance = 0x20000;
+    static constexpr u32 dds_caps_complex = 0x8;
+    static constexpr u32 dds_caps_texture = 0x1000;
+    static constexpr u32 dds_caps_mip_map = 0x400000;
+    static constexpr u32 dds_caps2_cube_map = 0x200;
+    static constexpr u32 dds_caps2_volume = 0x200000;
+    static constexpr u32 dds_dimension_texture_2d = 3;
+    static constexpr u32 dds_misc_texture_cube = 0x4;
+
+    static constexpr u32 make_four_cc(char a, char b, char c, char d)
+    {
+        return static_cast<u32>(static_cast<u8>(a)) | (static_cast<u32>(static_cast<u8>(b)) << 8) | (static_cast<u32>(static_cast<u8>(c)) << 16) | (static_cast<u32>(static_cast<u8>(d)) << 24);
+    }
+
+    struct DdsPixelFormat {
+        u32 size;
+        u32 flags;
+        u32 four_cc;
+        u32 rgb_bit_count;
+        u32 r_mask;
+        u32 g_mask;
+        u32 b_mask;
+        u32 a_mask;
+    };
+
+    struct DdsHeader {
+        u32 size;
+        u32 flags;
+        u32 height;
+        u32 width;
+        u32 pitch_or_linear_size;
+        u32 depth;
+        u32 mip_map_count;
+        u32 reserved1[11];
+        DdsPixelFormat pixel_format;
+        u32 caps;
+        u32 caps2;
+        u32 caps3;
+        u32 caps4;
+        u32 reserved2;
+    };
+
+    struct DdsHeaderDx10 {
+        u32 dxgi_format;
+        u32 resource_dimension;
+        u32 misc_flag;
+        u32 array_size;
+        u32 misc_flags2;
+    };
+
+    static_assert(sizeof(DdsHeader) == 124 && sizeof(DdsHeaderDx10) == 20, "DDS headers have a fixed size");
+
+    static constexpr u8 ktx2_identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    struct Ktx2Header {
+        u8 identifier[12];
+        u32 vk_format;
+        u32 type_size;
+        u32 pixel_width;
+        u32 pixel_height;
+        u32 pixel_depth;
+        u32 layer_count;
+        u32 face_count;
+        u32 level_count;
+        u32 supercompression_scheme;
+        u32 dfd_byte_offset;
+        u32 dfd_byte_length;
+        u32 kvd_byte_offset;
+        u32 kvd_byte_length;
+        u64 sgd_byte_offset;
+        u64 sgd_byte_length;
+    };
+
+    struct Ktx2Level {
+        u64 byte_offset;
+        u64 byte_length;
+        u64 uncompressed_byte_length;
+    };
+
+    static_assert(sizeof(Ktx2Header) == 80 && sizeof(Ktx2Level) == 24, "KTX2 headers have a fixed size");
+
+    // DXGI_FORMAT values, spelled out so this doesn't need the DXGI headers
+    struct DxgiFormatMapping {
+        u32 dxgi_format;
+        TextureFormat format;
+        bool srgb;
+    };
+
+    static constexpr DxgiFormatMapping dxgi_formats[] = {
+        { 28, TextureFormat::RGBA8, false }, { 29, TextureFormat::RGBA8, true },
+        { 49, TextureFormat::RG8, false },
+        { 61, TextureFormat::R8, false },
+        { 71, TextureFormat::BC1, false }, { 72, TextureFormat::BC1, true },
+        { 77, TextureFormat::BC3, false }, { 78, TextureFormat::BC3, true },
+        { 80, TextureFormat::BC4, false },
+        { 83, TextureFormat::BC5, false },
+        { 98, TextureFormat::BC7, false }, { 99, TextureFormat::BC7, true },
+    };
+
+    // VkFormat values
+    struct VkFormatMapping {
+        u32 vk_format;
+        TextureFormat format;
+        bool srgb;
+    };
+
+    static constexpr VkFormatMapping vk_formats[] = {
+        { 9, TextureFormat::R8, false }, { 16, TextureFormat::RG8, false },
+        { 37, TextureFormat::RGBA8, false }, { 43, TextureFormat::RGBA8, true },
+        { 131, TextureFormat::BC1, false }, { 132, TextureFormat::BC1, true }, { 133, TextureFormat::BC1, false }, { 134, TextureFormat::BC1, true },
+        { 137, TextureFormat::BC3, false }, { 138, TextureFormat::BC3, true },
+        { 139, TextureFormat::BC4, false },
+        { 141, TextureFormat::BC5, false },
+        { 145, TextureFormat::BC7, false }, { 146, TextureFormat::BC7, true },
+    };
+
+    bool is_texture_container_path(const std::string& path)
+    {
+        const size_t dot = path.find_last_of('.');
+        if (dot == std::string::npos) {
+            return false;
+        }
+        std::string extension = path.substr(dot + 1);
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+        return extension == "dds" || extension == "ktx2";
+    }
+
+    //Reject sizes the GPU can't create a texture with, before any level offsets are worked out from them
+    static bool check_layout_size(const TextureContainerLayout& layout, const char* kind, const std::string& path, bool silent)
+    {
+        if (layout.width == 0 || layout.height == 0) {
+            if (!silent)
+                printf("[ERROR] %s file '%s' has no pixels!\n", kind, path.c_str());
+            return false;
+        }
+        if (layout.n_mips > std::min(get_mip_count(layout.width, layout.height), max_texture_mips)) {
+            if (!silent)
+                printf("[ERROR] %s file '%s' has %u mip levels, more than %ux%u can have!\n", kind, path.c_str(), static_cast<unsigned>(layout.n_mips),
+                       static_cast<unsigned>(layout.width), static_cast<unsigned>(layout.height));
+            return false;
+        }
+
+        //D3D12 only takes block compressed textures whose size is a whole number of blocks
+        if (is_block_compressed(layout.format) && (layout.width % 4 != 0 || layout.height % 4 != 0)) {
+            if (!silent)
+                printf("[ERROR] %s file '%s' is block compressed, but %ux%u is not a multiple of 4!\n", kind, path.c_str(), static_cast<unsigned>(layout.width),
+                       static_cast<unsigned>(layout.height));
+            return false;
+        }
+        return true;
+    }
+
+    static bool parse_dds(const u8* data, size_t size, TextureContainerLayout& layout, const std::string& path, bool silent)
+    {
+        DdsHeader header;
+        if (size < 4 + sizeof(header)) {
+            if (!silent)
+                printf("[ERROR] DDS file '%s' is too small to be valid!\n", path.c_str());
+            return false;
+        }
+        memcpy(&header, data + 4, sizeof(header));
+        size_t offset = 4 + sizeof(header);
+        if (header.size != sizeof(DdsHeader) || (header.flags & dds_flags_required) != dds_flags_required) {
+            if (!silent)
+                printf("[ERROR] DDS file '%s' has an invalid header!\n", path.c_str());
+            return false;
+        }
+        if ((header.flags & dds_flag_depth) || (header.caps2 & (dds_caps2_cube_map | dds_caps2_volume))) {
+            if (!silent)
+                printf("[ERROR] DDS file '%s' is a cube map or volume, only 2D textures are supported!\n", path.c_str());
+            return false;
+        }
+
+        //Newer formats like BC7 and sRGB variants are in the DX10 header, older files use a four character code or masks
+        const DdsPixelFormat& pixel_format = header.pixel_format;
+        bool found = false;
+        if ((pixel_format.flags & dds_pixel_format_four_cc) && pixel_format.four_cc == make_four_cc('D', 'X', '1', '0')) {
+            DdsHeaderDx10 header_dx10;
+            if (size < offset + sizeof(header_dx10)) {
+                if (!silent)
+                    printf("[ERROR] DDS file '%s' is too small to be valid!\n", path.c_str());
+                return false;
+            }
+            memcpy(&header_dx10, data + offset, sizeof(header_dx10));
+            offset += sizeof(header_dx10);
+            if (header_dx10.resource_dimension != dds_dimension_texture_2d || header_dx10.array_size > 1 || (header_dx10.misc_flag & dds_misc_texture_cube)) {
+                if (!silent)
+                    printf("[ERROR] DDS file '%s' is not a single 2D texture!\n", path.c_str());
+                return false;
+            }
+            for (const DxgiFormatMapping& mapping : dxgi_formats) {
+                if (mapping.dxgi_format == header_dx10.dxgi_format) {
+                    layout.format = mapping.format;
+                    layout.srgb = mapping.srgb;
+                    found = true;
+                }
+            }
+        }
+        else if (pixel_format.flags & dds_pixel_format_four_cc) {
+            const u32 code = pixel_format.four_cc;
+            found = true;
+            if (code == make_four_cc('D', 'X', 'T', '1')) layout.format = TextureFormat::BC1;
+            else if (code == make_four_cc('D', 'X', 'T', '5')) layout.format = TextureFormat::BC3;
+            else if (code == make_four_cc('A', 'T', 'I', '1') || code == make_four_cc('B', 'C', '4', 'U')) layout.format = TextureFormat::BC4;
+            else if (code == make_four_cc('A', 'T', 'I', '2') || code == make_four_cc('B', 'C', '5', 'U')) layout.format = TextureFormat::BC5;
+            else found = false;
+        }
+        else if ((pixel_format.flags & dds_pixel_format_rgb) && (pixel_format.flags & dds_pixel_format_alpha) && pixel_format.rgb_bit_count == 32 &&
+                 pixel_format.r_mask == 0x000000FF && pixel_format.g_mask == 0x0000FF00 && pixel_format.b_mask == 0x00FF0000 && pixel_format.a_mask == 0xFF000000) {
+            layout.format = TextureFormat::RGBA8;
+            found = true;
+        }
+        else if ((pixel_format.flags & dds_pixel_format_luminance) && !(pixel_format.flags & dds_pixel_format_alpha) && pixel_format.rgb_bit_count == 8) {
+            layout.format = TextureFormat::R8;
+            found = true;
+        }
+        if (!found) {
+            if (!silent)
+                printf("[ERROR] DDS file '%s' has an unsupported pixel format!\n", path.c_str());
+            return false;
+        }
+
+        //Levels are stored back to back from the largest down
+        layout.width = header.width;
+        layout.height = header.height;
+        layout.n_mips = (header.flags & dds_flag_mip_map_count) ? std::max<u32>(header.mip_map_count, 1) : 1;
+        if (!check_layout_size(layout, "DDS", path, silent)) {
+            return false;
+        }
+        for (u32 level = 0; level < layout.n_mips; ++level) {
+            layout.mip_offsets[level] = offset;
+            offset += get_texture_level_bytes(layout.format, std::max<u32>(layout.width >> level, 1), std::max<u32>(layout.height >> level, 1));
+        }
+        if (offset > size) {
+            if (!silent)
+                printf("[ERROR] DDS file '%s' is truncated, its mip chain needs %zu bytes but the file has %zu!\n", path.c_str(), offset, size);
+            return false;
+        }
+        return true;
+    }
+
+    static bool parse_ktx2(const u8* data, size_t size, TextureContainerLayout& layout, const std::string& path, bool silent)
+    {
+        Ktx2Header header;
+        if (size < sizeof(header)) {
+            if (!silent)
+                printf("[ERROR] KTX2 file '%s' is too small to be valid!\n", path.c_str());
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        if (header.pixel_depth > 1 || header.layer_count > 1 || header.face_count != 1) {
+            if (!silent)
+                printf("[ERROR] KTX2 file '%s' is not a single 2D texture!\n", path.c_str());
+            return false;
+        }
+        if (header.supercompression_scheme != 0) {
+            if (!silent)
+                printf("[ERROR] KTX2 file '%s' is supercompressed, which is not supported!\n", path.c_str());
+            return false;
+        }
+        bool found = false;
+        for (const VkFormatMapping& mapping : vk_formats) {
+            if (mapping.vk_format == header.vk_format) {
+                layout.format = mapping.format;
+                layout.srgb = mapping.srgb;
+                found = true;
+            }
+        }
+        if (!found) {
+            if (!silent)
+                printf("[ERROR] KTX2 file '%s' has an unsupported format!\n", path.c_str());
+            return false;
+        }
+
+        //A level count of 0 asks the loader to generate mips, we use the one level there is
+        layout.width = header.pixel_width;
+        layout.height = header.pixel_height;
+        layout.n_mips = std::max<u32>(header.level_count, 1);
+        if (!check_layout_size(layout, "KTX2", path, silent)) {
+            return false;
+        }
+        if (size < sizeof(header) + sizeof(Ktx2Level) * layout.n_mips) {
+            if (!silent)
+                printf("[ERROR] KTX2 file '%s' has an invalid level index!\n", path.c_str());
+            return false;
+        }
+
+        //The level index gives every level its own offset, files store them from the smallest up
+        for (u32 level = 0; level < layout.n_mips; ++level) {
+            Ktx2Level entry;
+            memcpy(&entry, data + sizeof(header) + sizeof(Ktx2Level) * level, sizeof(entry));
+            const size_t level_bytes = get_texture_level_bytes(layout.format, std::max<u32>(layout.width >> level, 1), std::max<u32>(layout.height >> level, 1));
+            if (entry.byte_length < level_bytes || entry.byte_offset > size || level_bytes > size - entry.byte_offset) {
+                if (!silent)
+                    printf("[ERROR] KTX2 file '%s' is truncated or corrupt at mip level %u!\n", path.c_str(), static_cast<unsigned>(level));
+                return false;
+            }
+            layout.mip_offsets[level] = static_cast<size_t>(entry.byte_offset);
+        }
+        return true;
+    }
+
+    bool parse_texture_container(const u8* data, size_t size, TextureContainerLayout& layout_out, const std::string& path, bool silent)
+    {
+        layout_out = TextureContainerLayout{};
+        bool parsed = false;
+        u32 magic = 0;
+        if (size >= sizeof(magic)) {
+            memcpy(&magic, data, sizeof(magic));
+        }
+        if (magic == dds_magic) {
+            parsed = parse_dds(data, size, layout_out, path, silent);
+        }
+        else if (size >= sizeof(ktx2_identifier) && memcmp(data, ktx2_identifier, sizeof(ktx2_identifier)) == 0) {
+            parsed = parse_ktx2(data, size, layout_out, path, silent);
+        }
+        else {
+            if (!silent)
+                printf("[ERROR] '%s' is not a DDS or KTX2 file!\n", path.c_str());
+            return false;
+        }
+        return parsed;
+    }
+
+    bool is_texture_container_data(const u8* data, size_t size)
+    {
+        u32 magic = 0;
+        if (size >= sizeof(magic)) {
+            memcpy(&magic, data, sizeof(magic));
+        }
+        return magic == dds_magic || (size >= sizeof(ktx2_identifier) && memcmp(data, ktx2_identifier, sizeof(ktx2_identifier)) == 0);
+    }
+
+    //Headers of a DDS file with a DX10 header, for a loaded texture
+    static void get_dds_headers(const TextureResource& texture, DdsHeader& header, DdsHeaderDx10& header_dx10)
+    {
+        const bool srgb = texture.usage == TextureUsage::Color;
+        u32 dxgi_format = 0;
+        for (const DxgiFormatMapping& mapping : dxgi_formats) {
+            //Formats without an sRGB variant are written as they are
+            if (mapping.format == texture.format && (dxgi_format == 0 || mapping.srgb == srgb)) {
+                dxgi_format = mapping.dxgi_format;
+            }
+        }
+
+        header = DdsHeader{};
+        header.size = sizeof(DdsHeader);
+        header.flags = dds_flags_required | dds_flag_mip_map_count | (is_block_compressed(texture.format) ? dds_flag_linear_size : dds_flag_pitch);
+        header.height = static_cast<u32>(texture.height);
+        header.width = static_cast<u32>(texture.width);
+        header.pitch_or_linear_size = static_cast<u32>(is_block_compressed(texture.format) ? texture.get_mip_bytes(0) : texture.get_mip_row_pitch(0));
+        header.mip_map_count = texture.n_mips;
+        header.pixel_format.size = sizeof(DdsPixelFormat);
+        header.pixel_format.flags = dds_pixel_format_four_cc;
+        header.pixel_format.four_cc = make_four_cc('D', 'X', '1', '0');
+        header.caps = dds_caps_texture | (texture.n_mips > 1 ? dds_caps_complex | dds_caps_mip_map : 0);
+        header_dx10 = DdsHeaderDx10{};
+        header_dx10.dxgi_format = dxgi_format;
+        header_dx10.resource_dimension = dds_dimension_texture_2d;
+        header_dx10.array_size = 1;
+    }
+
+    bool write_dds(const TextureResource& texture, const std::string& path, bool silent)
+    {
+        DdsHeader header;
+        DdsHeaderDx10 header_dx10;
+        get_dds_headers(texture, header, header_dx10);
+
+        //Write to a temporary file first, so a failed write never leaves a truncated texture behind. Each writer gets its
+        //own temporary file, so several can write the same path at once, the last rename wins
+        const std::string temp_path = path + "." + std::to_string(std::random_device{}()) + ".tmp";
+        std::error_code error;
+        {
+            std::ofstream file_stream(temp_path, std::ios::binary | std::ios::trunc);
+            if (file_stream.is_open() == false)
+            {
+                if (!silent)
+                    printf("[ERROR] Failed to open file '%s' for writing!\n", temp_path.c_str());
+                return false;
+            }
+            file_stream.write(reinterpret_cast<const char*>(&dds_magic), sizeof(dds_magic));
+            file_stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file_stream.write(reinterpret_cast<const char*>(&header_dx10), sizeof(header_dx10));
+            for (u32 level = 0; level < texture.n_mips; ++level) {
+                file_stream.write(reinterpret_cast<const char*>(texture.get_mip_data(level)), static_cast<std::streamsize>(texture.get_mip_bytes(level)));
+            }
+            if (!file_stream)
+            {
+                if (!silent)
+                    printf("[ERROR] Failed to write file '%s'!\n", temp_path.c_str());
+                file_stream.close();
+                std::filesystem::remove(temp_path, error);
+                return false;
+            }
+        }
+        std::filesystem::rename(temp_path, path, error);
+        if (error)
+        {
+            if (!silent)
+                printf("[ERROR] Failed to move '%s' to '%s': %s\n", temp_path.c_str(), path.c_str(), error.message().c_str());
+            std::filesystem::remove(temp_path, error);
+            return false;
+        }
+        return true;
+    }
+
+    void write_dds(const TextureResource& texture, std::vector<u8>& bytes_out)
+    {
+        DdsHeader header;
+        DdsHeaderDx10 header_dx10;
+        get_dds_headers(texture, header, header_dx10);
+        const auto append = [&bytes_out](const void* data, size_t size) {
+            bytes_out.insert(bytes_out.end(), static_cast<const u8*>(data), static_cast<const u8*>(data) + size);
+        };
+        bytes_out.clear();
+        append(&dds_magic, sizeof(dds_magic));
+        append(&header, sizeof(header));
+        append(&header_dx10, sizeof(header_dx10));
+        for (u32 level = 0; level < texture.n_mips; ++level) {
+            append(texture.get_mip_data(level), texture.get_mip_bytes(level));
+        }
+    }
+
+    bool convert_texture(const std::string& input_path, const std::string& output_path, TextureUsage usage, ResourceManager* resource_manager)
+    {
+        const TextureResource* texture = resource_manager->get_resource<TextureResource>(resource_manager->load_texture(input_path, usage));
+        if (texture == nullptr || texture->resource_type != ResourceType::Texture)
+        {
+            printf("[ERROR] Failed to convert texture '%s', it could not be loaded!\n", input_path.c_str());
+            return false;
+        }
+        if (!write_dds(*texture, output_path))
+        {
+            return false;
+        }
+        printf("Converted texture '%s' to '%s', %ux%u with %u mips\n", input_path.c_str(), output_path.c_str(), static_cast<unsigned>(texture->width), static_cast<unsigned>(texture->height),
+               static_cast<unsigned>(texture->n_mips));
+        return true;
+    }
+}
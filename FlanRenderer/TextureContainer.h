@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "TextureResource.h"
+
+// DDS and KTX2 texture files. Both hold a texture in the layout the GPU takes, with its mip chain, so loading one only
+// maps the file and points the texture at its levels. Nothing gets decoded or copied until upload.
+//
+// Readers take 2D textures in the formats of TextureFormat: RGBA8, R8, RG8, BC1, BC3, BC4, BC5 and BC7, from legacy
+// DDS files, DDS files with a DX10 header, and KTX2 files without supercompression. Cube maps, arrays and volumes are
+// rejected. Files are written as DDS with a DX10 header, so offline conversion does the decode and compression once.
+
+namespace Flan {
+    // Where a texture's levels are in a DDS or KTX2 file
+    struct TextureContainerLayout {
+        u32 width = 0;
+        u32 height = 0;
+        u32 n_mips = 0;
+        TextureFormat format = TextureFormat::RGBA8;
+        bool srgb = false; // Only informative, the texture's usage decides how it's sampled
+        size_t mip_offsets[max_texture_mips]{}; // From the start of the file
+    };
+
+    // True for paths ending in .dds or .ktx2, in any case
+    bool is_texture_container_path(const std::string& path);
+
+    // True for data that starts like a DDS or KTX2 file
+    bool is_texture_container_data(const u8* data, size_t size);
+
+    // Read the headers of a DDS or KTX2 file in memory. Checks that the GPU can create the texture, with no more levels
+    // than its size allows and BC textures a whole number of blocks in size, and that every level fits in the file
+    bool parse_texture_container(const u8* data, size_t size, TextureContainerLayout& layout_out, const std::string& path, bool silent = false);
+
+    // Write a loaded texture with its whole mip chain. The file only appears once it's complete
+    bool write_dds(const TextureResource& texture, const std::string& path, bool silent = false);
+    void write_dds(const TextureResource& texture, std::vector<u8>& bytes_out); // The same file, in memory
+
+    // Offline conversion: load an image like load_texture does, with mips and compression, and write it as DDS
+    bool convert_texture(const std::string& input_path, const std::string& output_path, TextureUsage usage, ResourceManager* resource_manager);
+}
@@ -1,6 +1,14 @@
 #include "TextureResource.h"
+#include "MipGenerator.h"
+#include "TextureCompression.h"
+#include "TextureContainer.h"
+#include "MappedFile.h"
+#include "Hash.h"
+#include "TextureCache.h"
 
 #include <stb/stb_image.h>
+#include <tinygltf/tiny_gltf.h>
+#include <algorithm>
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -8,49 +16,402 @@
 #define JSON_NOEXCEPTION
 
 namespace Flan {
-    bool TextureResource::load(const std::string path, ResourceManager const* resource_manager, bool silent)
+    static bool has_alpha(const Pixel32* pixels, u32 width, u32 height)
     {
-        //Get name
-        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - name - " + path;
+        const size_t n_pixels = static_cast<size_t>(width) * height;
+        for (size_t i = 0; i < n_pixels; ++i) {
+            if (pixels[i].a != 255) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-        //Load image file
-        int channels;
+    // Block compressed, BC7 for colour and packed channels, BC5 for the x and y of normals, BC4 for single channel data.
+    // D3D12 only takes block compressed textures whose size is a whole number of blocks, the rest are stored uncompressed
+    // with only the channels they use
+    static TextureFormat choose_format(TextureUsage usage, u32 width, u32 height, bool alpha, const TextureImportSettings& settings)
+    {
+        const bool compress = settings.compress && width % 4 == 0 && height % 4 == 0;
+        switch (usage) {
+        case TextureUsage::Normal:
+            return compress ? TextureFormat::BC5 : TextureFormat::RG8;
+        case TextureUsage::Linear:
+            return compress ? TextureFormat::BC4 : TextureFormat::R8;
+        case TextureUsage::Packed:
+            return compress ? TextureFormat::BC7 : TextureFormat::RGBA8;
+        default:
+            if (!compress) {
+                return TextureFormat::RGBA8;
+            }
+            return settings.color_format == TextureFormat::BC1 && alpha ? TextureFormat::BC3 : settings.color_format;
+        }
+    }
+
+    //Decode an image file held in memory. 0 desired channels keeps the file's own
+    static u8* decode_image(const std::string& path, const u8* encoded, size_t encoded_size, int desired_channels, int& width, int& height, int& channels)
+    {
         ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - data - " + path;
-        uint8_t* u8_data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        u8* pixels = stbi_load_from_memory(encoded, static_cast<int>(encoded_size), &width, &height, &channels, desired_channels);
         ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        if (pixels != nullptr && desired_channels != 0) {
+            channels = desired_channels;
+        }
+        return pixels;
+    }
+
+    //Allocate a full mip chain for the texture's size, the caller fills in level 0
+    static Pixel32* allocate_mip_chain(TextureResource& texture, const std::string& path)
+    {
+        texture.n_mips = std::min(get_mip_count(texture.width, texture.height), max_texture_mips);
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - mips - " + path;
+        Pixel32* mips = static_cast<Pixel32*>(dynamic_allocate(get_mip_chain_pixels(texture.width, texture.height, texture.n_mips) * sizeof(Pixel32)));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        return mips;
+    }
+
+    //Filter the rest of the chain from level 0, and store every level in the format for the texture's usage. The texture
+    //takes over the chain
+    static void store_mip_chain(TextureResource& texture, Pixel32* mips, const std::string& path, ResourceManager const* resource_manager)
+    {
+        const u32 width = texture.width;
+        const u32 height = texture.height;
+        MipSettings mip_settings;
+        mip_settings.srgb = texture.usage == TextureUsage::Color;
+        mip_settings.normal_map = texture.usage == TextureUsage::Normal;
+        generate_mips(mips, width, height, texture.n_mips, mip_settings);
+
+        //Convert every level, the RGBA chain isn't needed after that
+        const TextureImportSettings& settings = resource_manager->get_texture_import_settings();
+        texture.format = choose_format(texture.usage, width, height, has_alpha(mips, width, height), settings);
+        for (u32 level = 0; level < texture.n_mips; ++level) {
+            texture.mip_offsets[level] = get_texture_chain_bytes(texture.format, width, height, level);
+        }
+        if (texture.format == TextureFormat::RGBA8) {
+            texture.data = reinterpret_cast<u8*>(mips);
+            return;
+        }
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - levels - " + path;
+        texture.data = static_cast<u8*>(dynamic_allocate(get_texture_chain_bytes(texture.format, width, height, texture.n_mips)));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        for (u32 level = 0; level < texture.n_mips; ++level) {
+            compress_texture(mips + get_mip_chain_pixels(width, height, level), texture.get_mip_width(level), texture.get_mip_height(level), texture.format, settings.quality, texture.get_mip_data(level));
+        }
+        dynamic_free(mips);
+    }
+
+    //Copy 8 bit pixels with 1 to 4 channels into the top of a full mip chain, and build the texture from it. Single
+    //channel data only keeps the first channel
+    static void import_pixels(TextureResource& texture, const u8* pixels, int channels, const std::string& name, TextureUsage usage, ResourceManager const* resource_manager)
+    {
+        texture.name = static_cast<char*>(dynamic_allocate(name.size() + 1));
+        strcpy_s(texture.name, name.size() + 1, name.c_str());
+
+        texture.usage = usage;
+        Pixel32* mips = allocate_mip_chain(texture, name);
+        const size_t n_pixels = static_cast<size_t>(texture.width) * texture.height;
+        for (size_t i = 0; i < n_pixels; ++i) {
+            const u8* pixel = pixels + i * channels;
+            if (usage == TextureUsage::Linear || channels <= 2) {
+                mips[i] = { pixel[0], pixel[0], pixel[0], usage != TextureUsage::Linear && channels == 2 ? pixel[1] : u8(255) };
+            }
+            else {
+                mips[i] = { pixel[0], pixel[1], pixel[2], channels == 4 ? pixel[3] : u8(255) };
+            }
+        }
+        store_mip_chain(texture, mips, name, resource_manager);
+        texture.resource_type = ResourceType::Texture;
+        texture.scheduled_for_unload = false;
+    }
+
+    //The texture cache entry for a source, or an empty path when the cache is off
+    static std::string get_cache_path(u64 source_hash, TextureUsage usage, ResourceManager const* resource_manager)
+    {
+        const TextureImportSettings& settings = resource_manager->get_texture_import_settings();
+        if (settings.cache_directory.empty()) {
+            return "";
+        }
+        return get_texture_cache_path(settings.cache_directory, get_texture_cache_key(source_hash, usage, settings));
+    }
 
-        //Error checking
-        if (u8_data == nullptr)
+    //Map the texture cache entry of an encoded image, or decode and import it and fill the entry
+    static bool load_image_bytes(TextureResource& texture, const std::string& name, const u8* encoded, size_t encoded_size, TextureUsage usage, ResourceManager const* resource_manager, bool silent)
+    {
+        const std::string cache_path = get_cache_path(hash_bytes(encoded, encoded_size), usage, resource_manager);
+        if (!cache_path.empty() && texture.load_container(cache_path, usage, true, name))
+        {
+            return true;
+        }
+
+        int channels;
+        u8* pixels = encoded_size == 0 ? nullptr : decode_image(name, encoded, encoded_size, usage == TextureUsage::Linear ? 0 : 4, texture.width, texture.height, channels);
+        if (pixels == nullptr)
+        {
+            if (!silent)
+                printf("[ERROR] Image '%s' could not be decoded!\n", name.c_str());
+            texture.resource_type = ResourceType::Invalid;
+            return false;
+        }
+        import_pixels(texture, pixels, channels, name, usage, resource_manager);
+        stbi_image_free(pixels);
+        if (!cache_path.empty())
+        {
+            store_cached_texture(texture, cache_path);
+        }
+        return true;
+    }
+
+    bool TextureResource::load(const std::string path, ResourceManager const* resource_manager, TextureUsage texture_usage, bool silent)
+    {
+        mapped_file = nullptr;
+        if (texture_usage == TextureUsage::Packed && path.find('|') != std::string::npos)
+        {
+            return load_packed(path, resource_manager, silent);
+        }
+
+        //Containers already hold the final layout, they skip decoding, mip generation and compression
+        if (is_texture_container_path(path))
+        {
+            return load_container(path, texture_usage, silent);
+        }
+
+        //Map the image file, it's hashed for the texture cache and decoded straight from the mapping
+        MappedFile source;
+        if (!source.open(path, true))
         {
             if (!silent)
                 printf("[ERROR] Image '%s' could not be loaded from disk!\n", path.c_str());
             resource_type = ResourceType::Invalid;
             return false;
         }
+        return load_image_bytes(*this, path, source.get_data(), source.get_size(), texture_usage, resource_manager, silent);
+    }
+
+    bool TextureResource::load(const tinygltf::Image& image, const std::string& image_name, ResourceManager const* resource_manager, TextureUsage texture_usage, bool silent)
+    {
+        mapped_file = nullptr;
+
+        //Containers, like the atlas textures cooked models store, already hold the final layout
+        if (image.as_is && is_texture_container_data(image.image.data(), image.image.size()))
+        {
+            return load_container(image.image.data(), image.image.size(), texture_usage, silent, image_name);
+        }
+
+        //Pixels tinygltf already decoded are used as they are, encoded files are decoded here
+        if (!image.as_is && image.width > 0 && image.height > 0 && image.bits == 8 && image.component >= 1 && image.component <= 4 &&
+            image.image.size() >= static_cast<size_t>(image.width) * image.height * image.component)
+        {
+            width = image.width;
+            height = image.height;
+            import_pixels(*this, image.image.data(), image.component, image_name, texture_usage, resource_manager);
+            return true;
+        }
+        return load_image_bytes(*this, image_name, image.image.data(), image.image.size(), texture_usage, resource_manager, silent);
+    }
+
+    bool TextureResource::load_packed(const std::string& packed_name, ResourceManager const* resource_manager, bool silent)
+    {
+        //Map every source, the cache key covers all of them
+        std::string source_paths[3];
+        split_packed_texture_name(packed_name, source_paths);
+        MappedFile sources[3];
+        u64 source_hash = fnv_offset_basis;
+        for (u32 channel = 0; channel < 3; ++channel)
+        {
+            if (!source_paths[channel].empty() && !sources[channel].open(source_paths[channel], true))
+            {
+                if (!silent)
+                    printf("[ERROR] Image '%s' could not be loaded from disk!\n", source_paths[channel].c_str());
+                resource_type = ResourceType::Invalid;
+                return false;
+            }
+            const u64 source_size = sources[channel].get_size();
+            source_hash = hash_bytes(&source_size, sizeof(source_size), source_hash);
+            source_hash = hash_bytes(sources[channel].get_data(), sources[channel].get_size(), source_hash);
+        }
+        const std::string cache_path = get_cache_path(source_hash, TextureUsage::Packed, resource_manager);
+        if (!cache_path.empty() && load_container(cache_path, TextureUsage::Packed, true, packed_name))
+        {
+            return true;
+        }
 
-        //Pad if no alpha channel
-        if (channels != 4)
+        //Decode the first channel of every source, they all need to be the same size
+        u8* channels[3] = { nullptr, nullptr, nullptr };
+        int strides[3] = { 1, 1, 1 };
+        width = 0;
+        height = 0;
+        bool valid = true;
+        for (u32 channel = 0; channel < 3 && valid; ++channel)
+        {
+            if (source_paths[channel].empty())
+            {
+                continue;
+            }
+            int source_width;
+            int source_height;
+            channels[channel] = sources[channel].get_size() == 0 ? nullptr : decode_image(source_paths[channel], sources[channel].get_data(), sources[channel].get_size(), 0, source_width, source_height, strides[channel]);
+            if (channels[channel] == nullptr)
+            {
+                if (!silent)
+                    printf("[ERROR] Image '%s' could not be decoded!\n", source_paths[channel].c_str());
+                valid = false;
+            }
+            else if (width != 0 && (source_width != width || source_height != height))
+            {
+                if (!silent)
+                    printf("[ERROR] Image '%s' is %ix%i, but the other images packed with it are %ix%i!\n", source_paths[channel].c_str(), source_width, source_height, width, height);
+                valid = false;
+            }
+            width = source_width;
+            height = source_height;
+        }
+        if (valid && width == 0)
         {
             if (!silent)
-                printf("[ERROR] Image '%s' is not RGBA 32-bit!\n", path.c_str());
+                printf("[ERROR] Packed texture '%s' has no images!\n", packed_name.c_str());
+            valid = false;
+        }
+        if (!valid)
+        {
+            for (u8* pixels : channels) {
+                if (pixels != nullptr) {
+                    stbi_image_free(pixels);
+                }
+            }
+            resource_type = ResourceType::Invalid;
+            return false;
+        }
+
+        //Set name
+        name = static_cast<char*>(dynamic_allocate(packed_name.size() + 1));
+        strcpy_s(name, packed_name.size() + 1, packed_name.c_str());
+
+        //Interleave the channels into the top of the chain, missing ones are white
+        usage = TextureUsage::Packed;
+        Pixel32* mips = allocate_mip_chain(*this, packed_name);
+        const size_t n_pixels = static_cast<size_t>(width) * height;
+        for (size_t i = 0; i < n_pixels; ++i) {
+            mips[i].r = channels[0] ? channels[0][i * strides[0]] : 255;
+            mips[i].g = channels[1] ? channels[1][i * strides[1]] : 255;
+            mips[i].b = channels[2] ? channels[2][i * strides[2]] : 255;
+            mips[i].a = 255;
+        }
+        for (u8* pixels : channels) {
+            if (pixels != nullptr) {
+                stbi_image_free(pixels);
+            }
+        }
+        store_mip_chain(*this, mips, packed_name, resource_manager);
+
+        resource_type = ResourceType::Texture;
+        scheduled_for_unload = false;
+        if (!cache_path.empty())
+        {
+            store_cached_texture(*this, cache_path);
+        }
+        return true;
+    }
+
+    bool TextureResource::load_container(const std::string& path, TextureUsage texture_usage, bool silent, const std::string& texture_name)
+    {
+        //Map the file, the levels are used in place so the mapping lives as long as the texture
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - mapped file - " + path;
+        mapped_file = new (dynamic_allocate(sizeof(MappedFile))) MappedFile();
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        TextureContainerLayout layout;
+        const bool valid = mapped_file->open(path, silent) && parse_texture_container(mapped_file->get_data(), mapped_file->get_size(), layout, path, silent);
+        if (!valid)
+        {
+            mapped_file->~MappedFile();
+            dynamic_free(mapped_file);
+            mapped_file = nullptr;
+            resource_type = ResourceType::Invalid;
+            return false;
         }
 
         //Set name
-        name = static_cast<char*>(dynamic_allocate(path.size() + 1));
-        strcpy_s(name, path.size() + 1, path.c_str());
+        const std::string& new_name = texture_name.empty() ? path : texture_name;
+        name = static_cast<char*>(dynamic_allocate(new_name.size() + 1));
+        strcpy_s(name, new_name.size() + 1, new_name.c_str());
 
-        //Set data
-        data = reinterpret_cast<Pixel32*>(u8_data);
+        width = static_cast<int>(layout.width);
+        height = static_cast<int>(layout.height);
+        n_mips = layout.n_mips;
+        usage = texture_usage;
+        format = layout.format;
+        data = mapped_file->get_data();
+        std::copy(layout.mip_offsets, layout.mip_offsets + max_texture_mips, mip_offsets);
+        resource_type = ResourceType::Texture;
+        scheduled_for_unload = false;
+        return true;
+    }
+
+    bool TextureResource::load_container(const u8* container, size_t size, TextureUsage texture_usage, bool silent, const std::string& texture_name)
+    {
+        mapped_file = nullptr;
+        TextureContainerLayout layout;
+        if (!parse_texture_container(container, size, layout, texture_name, silent))
+        {
+            resource_type = ResourceType::Invalid;
+            return false;
+        }
+
+        //Set name
+        name = static_cast<char*>(dynamic_allocate(texture_name.size() + 1));
+        strcpy_s(name, texture_name.size() + 1, texture_name.c_str());
 
-        //Return
+        //The container doesn't outlive the texture, so its levels are copied, back to back from the full size level
+        width = static_cast<int>(layout.width);
+        height = static_cast<int>(layout.height);
+        n_mips = layout.n_mips;
+        usage = texture_usage;
+        format = layout.format;
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - levels - " + texture_name;
+        data = static_cast<u8*>(dynamic_allocate(get_texture_chain_bytes(format, layout.width, layout.height, n_mips)));
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+        for (u32 level = 0; level < n_mips; ++level) {
+            mip_offsets[level] = get_texture_chain_bytes(format, layout.width, layout.height, level);
+            memcpy(get_mip_data(level), container + layout.mip_offsets[level], get_mip_bytes(level));
+        }
         resource_type = ResourceType::Texture;
         scheduled_for_unload = false;
         return true;
     }
 
+    u32 TextureResource::get_mip_width(u32 level) const
+    {
+        return get_mip_size(width, level);
+    }
+
+    u32 TextureResource::get_mip_height(u32 level) const
+    {
+        return get_mip_size(height, level);
+    }
+
+    u8* TextureResource::get_mip_data(u32 level) const
+    {
+        return data + mip_offsets[level];
+    }
+
+    u32 TextureResource::get_mip_row_pitch(u32 level) const
+    {
+        return get_texture_row_bytes(format, get_mip_width(level));
+    }
+
+    size_t TextureResource::get_mip_bytes(u32 level) const
+    {
+        return get_texture_level_bytes(format, get_mip_width(level), get_mip_height(level));
+    }
+
     void TextureResource::unload()
     {
-        dynamic_free(data);
+        if (mapped_file != nullptr) {
+            mapped_file->~MappedFile();
+            dynamic_free(mapped_file);
+        }
+        else {
+            dynamic_free(data);
+        }
         dynamic_free(name);
         dynamic_free(this);
     }
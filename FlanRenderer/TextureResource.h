@@ -6,6 +6,11 @@ namespace tinygltf {
 }
 
 namespace Flan {
+    class MappedFile;
+
+    // D3D12 textures are at most 16384 pixels wide, 15 levels
+    static constexpr u32 max_texture_mips = 16;
+
     struct Pixel32
     {
         uint8_t r = 255;
@@ -21,12 +26,27 @@ namespace Flan {
         bool scheduled_for_unload = false;
         int width = 0;
         int height = 0;
-        Pixel32* data = nullptr;
+        u32 n_mips = 1;
+        TextureUsage usage = TextureUsage::Color;
+        TextureFormat format = TextureFormat::RGBA8;
+        u8* data = nullptr; // Every mip level in format, from the full size level down
+        size_t mip_offsets[max_texture_mips]{}; // Of each level in data
+        MappedFile* mapped_file = nullptr; // Set when data points into a mapped DDS or KTX2 file, see TextureContainer.h
         char* name = nullptr;
-        bool load(std::string path, ResourceManager const* resource_manager, bool silent = false);
-        bool load(tinygltf::Image image, ResourceManager const* resource_manager);
+        bool load(std::string path, ResourceManager const* resource_manager, TextureUsage usage = TextureUsage::Color, bool silent = false);
+        // An image held by a glTF model, from a buffer view or a data URI. It's decoded here, unless tinygltf already did.
+        // Kept as is, it can also be a DDS or KTX2 file, like the atlas textures cooked models store
+        bool load(const tinygltf::Image& image, const std::string& image_name, ResourceManager const* resource_manager, TextureUsage usage = TextureUsage::Color, bool silent = false);
+        bool load_container(const std::string& path, TextureUsage usage, bool silent, const std::string& texture_name = ""); // Named after the file by default
+        bool load_container(const u8* container, size_t size, TextureUsage usage, bool silent, const std::string& texture_name); // Copies the levels out of memory
+        bool load_packed(const std::string& packed_name, ResourceManager const* resource_manager, bool silent);
         void unload();
-        TextureResource(int width_, int height_, Pixel32* data_, char* name_)
+        u32 get_mip_width(u32 level) const;
+        u32 get_mip_height(u32 level) const;
+        u8* get_mip_data(u32 level) const;
+        u32 get_mip_row_pitch(u32 level) const; // Bytes per row of pixels, or of blocks
+        size_t get_mip_bytes(u32 level) const;
+        TextureResource(int width_, int height_, u8* data_, char* name_)
         {
             scheduled_for_unload = false;
             resource_type = ResourceType::Texture;
@@ -40,4 +60,4 @@ namespace Flan {
             scheduled_for_unload = true;
         }
     };
-}
+}
\ No newline at end of file
@@ -0,0 +1,318 @@
+#include "TextureStreaming.h"
+#include "LodSelection.h"
+#include "TextureCompression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <queue>
+
+namespace Flan {
+    float compute_uv_density(const Vertex* vertices, const u32* indices, size_t n_indices)
+    {
+        double world_area = 0.0;
+        double uv_area = 0.0;
+        for (size_t i = 0; i + 2 < n_indices; i += 3) {
+            const Vertex& a = vertices[indices[i + 0]];
+            const Vertex& b = vertices[indices[i + 1]];
+            const Vertex& c = vertices[indices[i + 2]];
+            world_area += glm::length(glm::cross(b.position - a.position, c.position - a.position));
+            const glm::vec2 uv_ab = b.texcoord0 - a.texcoord0;
+            const glm::vec2 uv_ac = c.texcoord0 - a.texcoord0;
+            uv_area += std::abs(uv_ab.x * uv_ac.y - uv_ab.y * uv_ac.x);
+        }
+        if (uv_area <= 0.0) {
+            return 0.0f;
+        }
+        return static_cast<float>(std::sqrt(world_area / uv_area));
+    }
+
+    float get_required_mip(u32 width, u32 height, float uv_density, float distance, float projection_scale)
+    {
+        //Without any UV area the whole mesh samples one texel, so the smallest level does
+        if (uv_density <= 0.0f) {
+            return FLT_MAX;
+        }
+
+        //Texels and pixels per world unit, each level halves the texels
+        const float texels_per_unit = std::sqrt(static_cast<float>(width) * static_cast<float>(height)) / uv_density;
+        const float pixels_per_unit = project_error(1.0f, distance, projection_scale);
+        return std::log2(texels_per_unit / pixels_per_unit);
+    }
+
+    void TextureStreamer::init(const TextureStreamingSettings& settings)
+    {
+        release();
+        m_settings = settings;
+        m_settings.max_loads_in_flight = std::max<u32>(settings.max_loads_in_flight, 1);
+    }
+
+    void TextureStreamer::release()
+    {
+        wait_for_loads();
+        for (const FinishedLoad& load : m_finished) {
+            if (!m_textures[load.texture].in_place) {
+                dynamic_free(load.data);
+            }
+        }
+        m_finished.clear();
+        m_n_loads_in_flight = 0;
+        for (StreamedTexture& texture : m_textures) {
+            drop_levels(texture, max_texture_mips);
+        }
+        m_textures.clear();
+        m_changed.clear();
+        m_frame = 0;
+        m_stats.reset();
+    }
+
+    u32 TextureStreamer::add_texture(const TextureResource* source)
+    {
+        if (source == nullptr || source->resource_type != ResourceType::Texture || source->n_mips == 0) {
+            return no_streamed_texture;
+        }
+
+        StreamedTexture texture{};
+        texture.source = source;
+        texture.in_place = source->mapped_file == nullptr;
+        texture.tail_mip = source->n_mips - 1;
+        for (u32 level = 0; level < source->n_mips; ++level) {
+            if (std::max(source->get_mip_width(level), source->get_mip_height(level)) <= m_settings.min_resident_size) {
+                texture.tail_mip = level;
+                break;
+            }
+        }
+
+        //GPUs only take block compressed textures that are a multiple of 4 pixels in size, so the finest resident
+        //level can't go past the last level that is
+        if (is_block_compressed(source->format)) {
+            for (u32 level = 0; level <= texture.tail_mip; ++level) {
+                if (source->get_mip_width(level) % 4 != 0 || source->get_mip_height(level) % 4 != 0) {
+                    texture.tail_mip = level > 0 ? level - 1 : 0;
+                    break;
+                }
+            }
+        }
+
+        //The tail is small, copy it right away so there's always something to sample
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexStream - tail";
+        for (u32 level = texture.tail_mip; level < source->n_mips; ++level) {
+            if (texture.in_place) {
+                texture.levels[level] = source->get_mip_data(level);
+                continue;
+            }
+            texture.levels[level] = static_cast<u8*>(dynamic_allocate(source->get_mip_bytes(level)));
+            memcpy(texture.levels[level], source->get_mip_data(level), source->get_mip_bytes(level));
+        }
+        texture.resident_mip = texture.tail_mip;
+        texture.wanted_mip = texture.tail_mip;
+        texture.loading_mip = no_streamed_texture;
+        texture.requested_mip = FLT_MAX;
+        texture.priority = -1.0f;
+        texture.last_needed_mip = texture.tail_mip;
+        texture.last_needed_frame = m_frame;
+
+        m_textures.push_back(texture);
+        return static_cast<u32>(m_textures.size() - 1);
+    }
+
+    void TextureStreamer::request_mip(u32 texture, float mip, float priority)
+    {
+        if (texture >= m_textures.size()) {
+            return;
+        }
+        StreamedTexture& streamed = m_textures[texture];
+        streamed.requested_mip = std::min(streamed.requested_mip, mip);
+        streamed.priority = std::max(streamed.priority, priority);
+    }
+
+    void TextureStreamer::request_footprint(u32 texture, glm::vec3 center, float radius, float uv_density, glm::vec3 camera_position, float projection_scale)
+    {
+        if (texture >= m_textures.size()) {
+            return;
+        }
+
+        //The closest point of the bounding sphere decides the level, its size on screen the priority
+        const TextureResource* source = m_textures[texture].source;
+        const float center_distance = glm::length(center - camera_position);
+        const float distance = std::max(center_distance - radius, 0.0f);
+        const float mip = get_required_mip(static_cast<u32>(source->width), static_cast<u32>(source->height), uv_density, distance, projection_scale);
+        request_mip(texture, mip, project_error(radius, center_distance, projection_scale));
+    }
+
+    void TextureStreamer::update()
+    {
+        m_frame++;
+        m_stats.reset();
+        m_changed.clear();
+        m_stats.n_textures = static_cast<u32>(m_textures.size());
+
+        //Pick up the loads that finished since the last update. A level only becomes resident right below the finest
+        //one, and only if it's still wanted
+        std::vector<FinishedLoad> finished;
+        {
+            std::lock_guard<std::mutex> lock(m_finished_mutex);
+            finished.swap(m_finished);
+        }
+        for (const FinishedLoad& load : finished) {
+            StreamedTexture& texture = m_textures[load.texture];
+            texture.loading_mip = no_streamed_texture;
+            m_n_loads_in_flight--;
+            m_stats.n_loads_finished++;
+            if (load.level + 1 == texture.resident_mip && load.level >= texture.wanted_mip) {
+                texture.levels[load.level] = load.data;
+                texture.resident_mip = load.level;
+                m_changed.push_back(load.texture);
+            }
+            else if (!texture.in_place) {
+                dynamic_free(load.data);
+            }
+        }
+
+        //Finest level each texture needs, held for drop_delay frames after the last request that needed it
+        size_t wanted_bytes = 0;
+        for (StreamedTexture& texture : m_textures) {
+            const bool requested = texture.priority >= 0.0f;
+            u32 needed = texture.tail_mip;
+            if (requested) {
+                m_stats.n_requested++;
+                const float mip = std::floor(texture.requested_mip + m_settings.mip_bias);
+                needed = mip <= 0.0f ? 0 : std::min(texture.tail_mip, static_cast<u32>(std::min(mip, static_cast<float>(max_texture_mips))));
+            }
+            if (needed <= texture.last_needed_mip) {
+                texture.last_needed_mip = needed;
+                texture.last_needed_frame = m_frame;
+            }
+            else if (m_frame - texture.last_needed_frame > m_settings.drop_delay) {
+                texture.last_needed_mip = needed;
+                texture.last_needed_frame = m_frame;
+            }
+            texture.last_priority = requested ? texture.priority : 0.0f;
+            texture.wanted_mip = texture.last_needed_mip;
+            wanted_bytes += get_chain_bytes(texture, texture.wanted_mip);
+            m_stats.full_bytes += get_chain_bytes(texture, 0);
+            texture.requested_mip = FLT_MAX;
+            texture.priority = -1.0f;
+        }
+        m_stats.wanted_bytes = wanted_bytes;
+
+        //Over the budget, take levels from where they cost the least: the textures that matter least, and that save the
+        //most bytes. Each level a texture gives up makes it 4 times less likely to give up the next one, so no texture
+        //is stripped down to its tail while the others keep everything
+        if (wanted_bytes > m_settings.memory_budget) {
+            const auto get_cost = [](const StreamedTexture& texture) {
+                const double levels_given_up = static_cast<double>(texture.wanted_mip - texture.last_needed_mip);
+                return static_cast<double>(texture.last_priority) * std::exp2(2.0 * levels_given_up) / static_cast<double>(texture.source->get_mip_bytes(texture.wanted_mip));
+            };
+            using Candidate = std::pair<double, u32>;
+            std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> candidates;
+            for (u32 i = 0; i < m_textures.size(); ++i) {
+                if (m_textures[i].wanted_mip < m_textures[i].tail_mip) {
+                    candidates.push({ get_cost(m_textures[i]), i });
+                }
+            }
+            while (wanted_bytes > m_settings.memory_budget && !candidates.empty()) {
+                StreamedTexture& texture = m_textures[candidates.top().second];
+                const u32 index = candidates.top().second;
+                candidates.pop();
+                wanted_bytes -= texture.source->get_mip_bytes(texture.wanted_mip);
+                texture.wanted_mip++;
+                if (texture.wanted_mip < texture.tail_mip) {
+                    candidates.push({ get_cost(texture), index });
+                }
+            }
+        }
+
+        //Drop what isn't wanted any more, and queue what's missing
+        std::vector<std::pair<float, u32>> loads;
+        for (u32 i = 0; i < m_textures.size(); ++i) {
+            StreamedTexture& texture = m_textures[i];
+            if (texture.wanted_mip > texture.last_needed_mip) {
+                m_stats.n_over_budget++;
+            }
+            if (texture.resident_mip < texture.wanted_mip) {
+                drop_levels(texture, texture.wanted_mip);
+                m_changed.push_back(i);
+            }
+            if (texture.resident_mip > texture.wanted_mip) {
+                m_stats.n_missing++;
+                if (texture.loading_mip == no_streamed_texture) {
+                    loads.push_back({ texture.last_priority * static_cast<float>(texture.resident_mip - texture.wanted_mip), i });
+                }
+            }
+        }
+
+        //Biggest on screen and furthest from what they want first
+        std::sort(loads.begin(), loads.end(), std::greater<std::pair<float, u32>>());
+        for (const auto& load : loads) {
+            if (m_n_loads_in_flight >= m_settings.max_loads_in_flight) {
+                break;
+            }
+            load_level(load.second, m_textures[load.second].resident_mip - 1);
+        }
+
+        //A texture can both finish a load and drop levels in one update
+        std::sort(m_changed.begin(), m_changed.end());
+        m_changed.erase(std::unique(m_changed.begin(), m_changed.end()), m_changed.end());
+        for (const StreamedTexture& texture : m_textures) {
+            m_stats.resident_bytes += get_chain_bytes(texture, texture.resident_mip);
+        }
+        m_stats.n_loads_in_flight = m_n_loads_in_flight;
+    }
+
+    void TextureStreamer::wait_for_loads()
+    {
+        JobSystem::get_instance()->wait(m_loads);
+    }
+
+    void TextureStreamer::load_level(u32 texture, u32 level)
+    {
+        StreamedTexture& streamed = m_textures[texture];
+        streamed.loading_mip = level;
+        m_n_loads_in_flight++;
+        m_stats.n_loads_started++;
+
+        //Levels already in memory are resident as soon as the next update picks them up
+        const TextureResource* source = streamed.source;
+        if (streamed.in_place) {
+            std::lock_guard<std::mutex> lock(m_finished_mutex);
+            m_finished.push_back({ texture, level, source->get_mip_data(level) });
+            return;
+        }
+
+        //Copying out of a mapped source is where the file actually gets read
+        JobSystem::get_instance()->submit([this, source, texture, level]() {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexStream - level";
+            const size_t bytes = source->get_mip_bytes(level);
+            u8* data = static_cast<u8*>(dynamic_allocate(bytes));
+            memcpy(data, source->get_mip_data(level), bytes);
+            std::lock_guard<std::mutex> lock(m_finished_mutex);
+            m_finished.push_back({ texture, level, data });
+        }, m_loads);
+    }
+
+    void TextureStreamer::drop_levels(StreamedTexture& texture, u32 first_kept)
+    {
+        const u32 end = std::min(first_kept, texture.source->n_mips);
+        for (u32 level = 0; level < end; ++level) {
+            if (texture.levels[level] != nullptr) {
+                if (!texture.in_place) {
+                    dynamic_free(texture.levels[level]);
+                }
+                texture.levels[level] = nullptr;
+                m_stats.n_levels_dropped++;
+            }
+        }
+        texture.resident_mip = std::max(texture.resident_mip, end);
+    }
+
+    size_t TextureStreamer::get_chain_bytes(const StreamedTexture& texture, u32 first_level) const
+    {
+        size_t bytes = 0;
+        for (u32 level = first_level; level < texture.source->n_mips; ++level) {
+            bytes += texture.source->get_mip_bytes(level);
+        }
+        return bytes;
+    }
+}
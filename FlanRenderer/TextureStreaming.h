@@ -0,0 +1,143 @@
+#pragma once
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+#include "JobSystem.h"
+#include "TextureResource.h"
+
+// Mip streaming. Every streamed texture keeps its small levels resident all the time, and the finer ones only while
+// something on screen needs them. Each frame, the meshes that use a texture report how big it is on screen: the
+// distance to their bounding sphere and how many world units one UV unit covers give the texels per pixel, and its
+// log2 is the level the texture needs. The finest level asked for over the frame is the one the texture wants.
+//
+// Missing levels stream in from the texture's source one at a time, from coarse to fine, on the job system. The
+// textures that cover the most of the screen and are furthest from what they want go first. Levels nobody asked for
+// in a while are dropped. When what every texture wants doesn't fit the memory budget, the textures with the lowest
+// priority give up their finest levels until it does.
+//
+// Streaming only decides which levels are resident, it doesn't touch the GPU. Sources loaded from DDS, KTX2 or the
+// texture cache are file mappings, and the streamer keeps its own copy of their resident levels, so the levels that
+// aren't resident only take up page cache the OS can take back. Sources imported with the texture cache off hold their
+// whole chain in memory anyway, their levels are used where they are.
+
+namespace Flan {
+    static constexpr u32 no_streamed_texture = ~0u;
+
+    struct TextureStreamingSettings {
+        // Bytes of resident levels across every streamed texture. The levels that are always resident count too, and
+        // are kept even if they don't fit
+        size_t memory_budget = 256 MB;
+
+        // Levels this size and smaller are loaded up front and never dropped
+        u32 min_resident_size = 64;
+
+        // Added to every requested level. Above 0 streams blurrier textures
+        float mip_bias = 0.0f;
+
+        // Levels being loaded at once
+        u32 max_loads_in_flight = 8;
+
+        // Frames a level stays resident after the last request that needed it, so a texture that's briefly out of
+        // view doesn't stream its levels in again
+        u32 drop_delay = 60;
+    };
+
+    // Counts for one update of the streamer
+    struct TextureStreamingStats {
+        u32 n_textures = 0;
+        u32 n_requested = 0; // Textures something asked for this frame
+        u32 n_loads_started = 0;
+        u32 n_loads_finished = 0;
+        u32 n_loads_in_flight = 0;
+        u32 n_levels_dropped = 0;
+        u32 n_over_budget = 0; // Textures kept coarser than they want by the budget
+        u32 n_missing = 0; // Textures whose resident level is coarser than wanted, streaming or over budget
+        size_t resident_bytes = 0;
+        size_t wanted_bytes = 0; // What every texture's wanted level down to the smallest would take
+        size_t full_bytes = 0; // What every texture's whole chain would take
+        void reset() { *this = TextureStreamingStats{}; }
+    };
+
+    // World units one unit of UV covers on a mesh, from the area of its triangles in both spaces. 0 if the mesh has no
+    // UV area
+    float compute_uv_density(const Vertex* vertices, const u32* indices, size_t n_indices);
+
+    // Level that shows about one texel per pixel, for a texture on a surface with a given UV density seen from a
+    // distance. projection_scale comes from get_projection_scale. Not clamped to the texture's levels
+    float get_required_mip(u32 width, u32 height, float uv_density, float distance, float projection_scale);
+
+    class TextureStreamer {
+    public:
+        void init(const TextureStreamingSettings& settings = TextureStreamingSettings{});
+        void release();
+        void set_settings(const TextureStreamingSettings& settings) { m_settings = settings; }
+        const TextureStreamingSettings& get_settings() const { return m_settings; }
+
+        // Start streaming a texture. Its levels are copied out of the source when they're needed, or used in place when
+        // the source isn't mapped, so the source has to outlive the streamer. The levels that are always resident are loaded before this returns. Returns its index
+        u32 add_texture(const TextureResource* source);
+
+        // Ask for a level for this frame, with a priority, like the texture's size on screen in pixels. A texture keeps
+        // the finest level and the highest priority it was asked for
+        void request_mip(u32 texture, float mip, float priority);
+
+        // Ask for what a texture needs on a mesh with a world space bounding sphere and UV density
+        void request_footprint(u32 texture, glm::vec3 center, float radius, float uv_density, glm::vec3 camera_position, float projection_scale);
+
+        // Finish the loads that are done, pick what every texture keeps under the budget, drop levels and start loads.
+        // Requests made before this are for this update, and the ones after it for the next one
+        void update();
+
+        // Block until every load in flight is done. They get picked up by the next update
+        void wait_for_loads();
+
+        // Finest level that's resident, every coarser level is too
+        u32 get_resident_mip(u32 texture) const { return m_textures[texture].resident_mip; }
+        u32 get_wanted_mip(u32 texture) const { return m_textures[texture].wanted_mip; }
+        const u8* get_mip_data(u32 texture, u32 level) const { return m_textures[texture].levels[level]; }
+        const TextureResource* get_source(u32 texture) const { return m_textures[texture].source; }
+
+        // Textures whose resident levels changed in the last update, to upload again
+        const std::vector<u32>& get_changed_textures() const { return m_changed; }
+        size_t get_texture_count() const { return m_textures.size(); }
+        const TextureStreamingStats& get_stats() const { return m_stats; }
+
+    private:
+        struct StreamedTexture {
+            const TextureResource* source;
+            u8* levels[max_texture_mips]; // Null for levels that aren't resident
+            bool in_place; // The source's levels are in memory, levels point into them instead of holding copies
+            u32 resident_mip;
+            u32 tail_mip; // First level that's always resident
+            u32 wanted_mip; // After the budget
+            u32 loading_mip; // no_streamed_texture if nothing is in flight
+            float requested_mip; // Finest level asked for this frame
+            float priority; // Highest priority asked for this frame
+            float last_priority; // Of the last update, 0 if nothing asked for the texture
+            u32 last_needed_mip; // Finest level asked for within drop_delay frames
+            u64 last_needed_frame;
+        };
+
+        struct FinishedLoad {
+            u32 texture;
+            u32 level;
+            u8* data;
+        };
+
+        void load_level(u32 texture, u32 level);
+        void drop_levels(StreamedTexture& texture, u32 first_kept);
+        size_t get_chain_bytes(const StreamedTexture& texture, u32 first_level) const;
+
+        TextureStreamingSettings m_settings;
+        u64 m_frame = 0;
+        std::vector<StreamedTexture> m_textures;
+        std::vector<u32> m_changed;
+        TextureStreamingStats m_stats;
+
+        // Loads run on the job system and hand their level back here
+        JobCounter m_loads;
+        std::mutex m_finished_mutex;
+        std::vector<FinishedLoad> m_finished;
+        u32 m_n_loads_in_flight = 0;
+    };
+}
@@ -0,0 +1,144 @@
+#include "VertexKernels.h"
+#include "CpuFeatures.h"
+
+#include <immintrin.h>
+#include <algorithm>
+#include <cmath>
+
+namespace Flan {
+    static constexpr size_t block_size = 8;
+
+    // Matrix is passed as 3 rows of 4 floats: out.x = r[0]*x + r[1]*y + r[2]*z + r[3], etc.
+    typedef void (*TransformBlockFn)(const float* rows, float* x, float* y, float* z);
+
+    static void transform_block_sse(const float* rows, float* x, float* y, float* z)
+    {
+        for (size_t i = 0; i < block_size; i += 4) {
+            const __m128 in_x = _mm_load_ps(x + i);
+            const __m128 in_y = _mm_load_ps(y + i);
+            const __m128 in_z = _mm_load_ps(z + i);
+            __m128 out[3];
+            for (int r = 0; r < 3; ++r) {
+                __m128 acc = _mm_set1_ps(rows[r * 4 + 3]);
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(rows[r * 4 + 0]), in_x));
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(rows[r * 4 + 1]), in_y));
+                acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(rows[r * 4 + 2]), in_z));
+                out[r] = acc;
+            }
+            _mm_store_ps(x + i, out[0]);
+            _mm_store_ps(y + i, out[1]);
+            _mm_store_ps(z + i, out[2]);
+        }
+    }
+
+    FLAN_TARGET_AVX static void transform_block_avx(const float* rows, float* x, float* y, float* z)
+    {
+        const __m256 in_x = _mm256_load_ps(x);
+        const __m256 in_y = _mm256_load_ps(y);
+        const __m256 in_z = _mm256_load_ps(z);
+        __m256 out[3];
+        for (int r = 0; r < 3; ++r) {
+            __m256 acc = _mm256_set1_ps(rows[r * 4 + 3]);
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(rows[r * 4 + 0]), in_x));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(rows[r * 4 + 1]), in_y));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(rows[r * 4 + 2]), in_z));
+            out[r] = acc;
+        }
+        _mm256_store_ps(x, out[0]);
+        _mm256_store_ps(y, out[1]);
+        _mm256_store_ps(z, out[2]);
+    }
+
+    static TransformBlockFn select_transform_block()
+    {
+        return CpuFeatures::get().avx ? transform_block_avx : transform_block_sse;
+    }
+
+    static void transform_strided(float* data, size_t stride, size_t count, const float* rows)
+    {
+        static const TransformBlockFn transform_block = select_transform_block();
+        alignas(32) float x[block_size];
+        alignas(32) float y[block_size];
+        alignas(32) float z[block_size];
+
+        for (size_t base = 0; base < count; base += block_size) {
+            const size_t n = std::min(block_size, count - base);
+
+            // AoS -> SoA, padding the last block with zeroes
+            for (size_t i = 0; i < block_size; ++i) {
+                if (i < n) {
+                    const float* v = data + (base + i) * stride;
+                    x[i] = v[0]; y[i] = v[1]; z[i] = v[2];
+                }
+                else {
+                    x[i] = 0.0f; y[i] = 0.0f; z[i] = 0.0f;
+                }
+            }
+
+            transform_block(rows, x, y, z);
+
+            // SoA -> AoS
+            for (size_t i = 0; i < n; ++i) {
+                float* v = data + (base + i) * stride;
+                v[0] = x[i]; v[1] = y[i]; v[2] = z[i];
+            }
+        }
+    }
+
+    void transform_points(glm::vec3* points, size_t count, const glm::mat4& matrix)
+    {
+        // glm matrices are column major, so matrix[column][row]
+        const float rows[12] = {
+            matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0],
+            matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1],
+            matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2],
+        };
+        transform_strided(reinterpret_cast<float*>(points), 3, count, rows);
+    }
+
+    void transform_vectors(float* vectors, size_t stride, size_t count, const glm::mat3& matrix)
+    {
+        const float rows[12] = {
+            matrix[0][0], matrix[1][0], matrix[2][0], 0.0f,
+            matrix[0][1], matrix[1][1], matrix[2][1], 0.0f,
+            matrix[0][2], matrix[1][2], matrix[2][2], 0.0f,
+        };
+        transform_strided(vectors, stride, count, rows);
+    }
+
+    // x^(1/2.2) sampled at 4096 points over [0, 1] and linearly interpolated. The curve is too steep in the first interval for that, so it uses powf instead
+    static constexpr int gamma_lut_size = 4096;
+
+    static const float* get_gamma_lut()
+    {
+        static float lut[gamma_lut_size + 1];
+        static bool initialized = [] {
+            for (int i = 0; i <= gamma_lut_size; ++i) {
+                lut[i] = powf(static_cast<float>(i) / gamma_lut_size, 1.0f / 2.2f);
+            }
+            return true;
+        }();
+        (void)initialized;
+        return lut;
+    }
+
+    void linear_to_gamma(glm::vec4* colours, size_t count)
+    {
+        const float* lut = get_gamma_lut();
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                // Values outside of [0, 1] get clamped, NaN ends up as 0
+                float value = colours[i][c];
+                if (!(value > 0.0f)) value = 0.0f;
+                value = std::min(value, 1.0f) * gamma_lut_size;
+                if (value < 1.0f) {
+                    colours[i][c] = powf(value / gamma_lut_size, 1.0f / 2.2f);
+                    continue;
+                }
+                const int index = std::min(static_cast<int>(value), gamma_lut_size - 1);
+                const float t = value - static_cast<float>(index);
+                colours[i][c] = lut[index] + (lut[index + 1] - lut[index]) * t;
+            }
+        }
+    }
+}
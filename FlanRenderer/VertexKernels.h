@@ -0,0 +1,16 @@
+#pragma once
+#include <glm/glm.hpp>
+
+// Batch kernels for the per-vertex work done while importing meshes. Transforms run in blocks of 8 vertices,
+// which are converted to SoA form so the SSE/AVX path can process a full block per instruction.
+
+namespace Flan {
+    // Transform positions in place by a 4x4 matrix, with w = 1
+    void transform_points(glm::vec3* points, size_t count, const glm::mat4& matrix);
+
+    // Transform direction vectors in place by a 3x3 matrix. Stride is in floats, so the xyz of vec4 tangents can be transformed with stride 4
+    void transform_vectors(float* vectors, size_t stride, size_t count, const glm::mat3& matrix);
+
+    // Convert linear vertex colours to gamma space in place (rgb = min(1, x^(1/2.2)), alpha is left alone)
+    void linear_to_gamma(glm::vec4* colours, size_t count);
+}
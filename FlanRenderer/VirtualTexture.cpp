@@ -0,0 +1,389 @@
+#include "VirtualTexture.h"
+#include "TextureCompression.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace Flan {
+    // Copy a tile and its border out of a level. Texels outside of the level repeat its edge
+    static void copy_tile(const TextureResource& source, u32 level, u32 tile_x, u32 tile_y, u32 tile_size, u32 border, u8* tile_out)
+    {
+        //Whole blocks for the compressed formats, pixels otherwise
+        const int unit = is_block_compressed(source.format) ? 4 : 1;
+        const size_t unit_bytes = get_texture_row_bytes(source.format, unit);
+        const int level_units_x = static_cast<int>(get_texture_row_bytes(source.format, source.get_mip_width(level)) / unit_bytes);
+        const int level_units_y = static_cast<int>(get_texture_row_count(source.format, source.get_mip_height(level)));
+        const int tile_units = static_cast<int>(tile_size + 2 * border) / unit;
+        const int origin_x = (static_cast<int>(tile_x * tile_size) - static_cast<int>(border)) / unit;
+        const int origin_y = (static_cast<int>(tile_y * tile_size) - static_cast<int>(border)) / unit;
+        const int inside_begin = std::clamp(-origin_x, 0, tile_units);
+        const int inside_end = std::clamp(level_units_x - origin_x, inside_begin, tile_units);
+
+        const u8* level_data = source.get_mip_data(level);
+        const size_t level_pitch = source.get_mip_row_pitch(level);
+        for (int row = 0; row < tile_units; ++row) {
+            const u8* source_row = level_data + static_cast<size_t>(std::clamp(origin_y + row, 0, level_units_y - 1)) * level_pitch;
+            u8* target_row = tile_out + static_cast<size_t>(row) * tile_units * unit_bytes;
+            for (int column = 0; column < inside_begin; ++column) {
+                memcpy(target_row + column * unit_bytes, source_row, unit_bytes);
+            }
+            memcpy(target_row + inside_begin * unit_bytes, source_row + (origin_x + inside_begin) * unit_bytes, (inside_end - inside_begin) * unit_bytes);
+            for (int column = inside_end; column < tile_units; ++column) {
+                memcpy(target_row + column * unit_bytes, source_row + (level_units_x - 1) * unit_bytes, unit_bytes);
+            }
+        }
+    }
+
+    bool VirtualTexture::init(const TextureResource* source, const VirtualTextureSettings& settings, bool silent)
+    {
+        if (source == nullptr || source->resource_type != ResourceType::Texture) {
+            if (!silent) printf("[ERROR] Virtual texture needs a loaded texture!\n");
+            return false;
+        }
+        const u32 tile_size = settings.tile_size;
+        const u32 border = settings.border;
+        const VirtualTileLoader loader = [source, tile_size, border](u32 level, u32 tile_x, u32 tile_y, u8* tile_out) {
+            copy_tile(*source, level, tile_x, tile_y, tile_size, border, tile_out);
+        };
+        if (!init_layout(static_cast<u32>(source->width), static_cast<u32>(source->height), source->format, settings, silent)) {
+            return false;
+        }
+        if (source->n_mips < m_n_levels) {
+            if (!silent) printf("[ERROR] Texture '%s' has %u mip levels, a virtual texture with %u pixel tiles needs %u!\n", source->name, source->n_mips, tile_size, m_n_levels);
+            release();
+            return false;
+        }
+        release();
+        return init(static_cast<u32>(source->width), static_cast<u32>(source->height), source->format, loader, settings, silent);
+    }
+
+    bool VirtualTexture::init(u32 width, u32 height, TextureFormat format, const VirtualTileLoader& loader, const VirtualTextureSettings& settings, bool silent)
+    {
+        release();
+        if (!init_layout(width, height, format, settings, silent)) {
+            return false;
+        }
+        m_loader = loader;
+
+        //The cache, one texture of tiles
+        const u32 n_slots = m_settings.cache_tiles_x * m_settings.cache_tiles_y;
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "VirtualTexture - cache";
+        m_cache = static_cast<u8*>(dynamic_allocate(get_tile_bytes() * n_slots));
+        memset(m_cache, 0, get_tile_bytes() * n_slots);
+        m_slots.assign(n_slots, CacheSlot{ no_virtual_page, 0, no_virtual_page, no_virtual_page });
+        for (u32 slot = n_slots; slot > 0; --slot) {
+            m_free_slots.push_back(slot - 1);
+        }
+
+        //The root covers the whole texture, so every page has something to fall back to
+        ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "VirtualTexture - tile";
+        u8* root = static_cast<u8*>(dynamic_allocate(get_tile_bytes()));
+        m_loader(m_n_levels - 1, 0, 0, root);
+        const u32 root_slot = m_free_slots.back();
+        m_free_slots.pop_back();
+        place_tile(root_slot, pack_virtual_page(m_n_levels - 1, 0, 0), root);
+        dynamic_free(root);
+        return true;
+    }
+
+    bool VirtualTexture::init_layout(u32 width, u32 height, TextureFormat format, const VirtualTextureSettings& settings, bool silent)
+    {
+        const u32 tile_texels = settings.tile_size + 2 * settings.border;
+        if (width == 0 || height == 0 || settings.tile_size == 0) {
+            if (!silent) printf("[ERROR] Virtual texture of %ux%u with %u pixel tiles is empty!\n", width, height, settings.tile_size);
+            return false;
+        }
+        if (is_block_compressed(format) && (settings.tile_size % 4 != 0 || settings.border % 4 != 0)) {
+            if (!silent) printf("[ERROR] Block compressed virtual textures need tiles and borders of a multiple of 4 pixels, not %u and %u!\n", settings.tile_size, settings.border);
+            return false;
+        }
+        if (settings.cache_tiles_x == 0 || settings.cache_tiles_y == 0 || settings.cache_tiles_x > 256 || settings.cache_tiles_y > 256 || settings.cache_tiles_x * settings.cache_tiles_y < 2) {
+            if (!silent) printf("[ERROR] Virtual texture cache of %ux%u tiles is not between 2 tiles and 256x256!\n", settings.cache_tiles_x, settings.cache_tiles_y);
+            return false;
+        }
+        if ((width + settings.tile_size - 1) / settings.tile_size > max_virtual_page_count || (height + settings.tile_size - 1) / settings.tile_size > max_virtual_page_count) {
+            if (!silent) printf("[ERROR] Virtual texture of %ux%u has more than %u pages of %u pixels per side!\n", width, height, max_virtual_page_count, settings.tile_size);
+            return false;
+        }
+        m_settings = settings;
+        m_settings.max_decodes_in_flight = std::max<u32>(settings.max_decodes_in_flight, 1);
+        m_width = width;
+        m_height = height;
+        m_format = format;
+        m_tile_row_bytes = get_texture_row_bytes(format, tile_texels);
+        m_tile_rows = get_texture_row_count(format, tile_texels);
+
+        //Levels down to the one that fits in a single tile
+        m_levels.clear();
+        for (u32 level = 0;; ++level) {
+            const u32 level_width = std::max<u32>(width >> level, 1);
+            const u32 level_height = std::max<u32>(height >> level, 1);
+            VirtualLevel virtual_level;
+            virtual_level.n_pages_x = (level_width + settings.tile_size - 1) / settings.tile_size;
+            virtual_level.n_pages_y = (level_height + settings.tile_size - 1) / settings.tile_size;
+            virtual_level.slots.assign(static_cast<size_t>(virtual_level.n_pages_x) * virtual_level.n_pages_y, no_virtual_page);
+            virtual_level.page_table.assign(virtual_level.slots.size(), 0);
+            virtual_level.dirty = true;
+            m_levels.push_back(std::move(virtual_level));
+            if (level_width <= settings.tile_size && level_height <= settings.tile_size) {
+                break;
+            }
+        }
+        m_n_levels = static_cast<u32>(m_levels.size());
+        return true;
+    }
+
+    void VirtualTexture::release()
+    {
+        wait_for_decodes();
+        for (const DecodedTile& tile : m_decoded) {
+            dynamic_free(tile.data);
+        }
+        m_decoded.clear();
+        m_decoding.clear();
+        if (m_cache != nullptr) {
+            dynamic_free(m_cache);
+            m_cache = nullptr;
+        }
+        m_slots.clear();
+        m_free_slots.clear();
+        m_dirty_slots.clear();
+        m_most_recent = no_virtual_page;
+        m_least_recent = no_virtual_page;
+        m_levels.clear();
+        m_n_levels = 0;
+        m_requests.clear();
+        m_loader = nullptr;
+        m_frame = 0;
+        m_stats.reset();
+        m_frame_stats.reset();
+    }
+
+    void VirtualTexture::add_feedback(const u32* entries, size_t n_entries)
+    {
+        //Sorted, so every page is handled once however many pixels sampled it
+        m_feedback.assign(entries, entries + n_entries);
+        std::sort(m_feedback.begin(), m_feedback.end());
+        for (size_t begin = 0, end = 0; begin < m_feedback.size(); begin = end) {
+            const u32 page = m_feedback[begin];
+            while (end < m_feedback.size() && m_feedback[end] == page) {
+                end++;
+            }
+            const u32 n_samples = static_cast<u32>(end - begin);
+            u32 level = get_virtual_page_level(page);
+            u32 x = get_virtual_page_x(page);
+            u32 y = get_virtual_page_y(page);
+            if (page == no_virtual_page || level >= m_n_levels || x >= m_levels[level].n_pages_x || y >= m_levels[level].n_pages_y) {
+                continue;
+            }
+
+            m_stats.n_samples += n_samples;
+            m_stats.n_pages++;
+            if (is_resident(level, x, y)) {
+                m_stats.n_hits += n_samples;
+                m_stats.n_page_hits++;
+            }
+
+            //The page and every parent it falls back to are in use. Missing ones are requested
+            for (; level < m_n_levels; ++level, x >>= 1, y >>= 1) {
+                const VirtualLevel& virtual_level = m_levels[level];
+                x = std::min(x, virtual_level.n_pages_x - 1);
+                y = std::min(y, virtual_level.n_pages_y - 1);
+                const u32 slot = virtual_level.slots[static_cast<size_t>(y) * virtual_level.n_pages_x + x];
+                if (slot != no_virtual_page) {
+                    touch(slot);
+                }
+                else {
+                    m_requests[pack_virtual_page(level, x, y)] += n_samples;
+                }
+            }
+        }
+    }
+
+    void VirtualTexture::update()
+    {
+        //Decoded tiles go to a free slot, or replace the least recently used tile. Tiles in use this frame stay
+        std::vector<DecodedTile> decoded;
+        {
+            std::lock_guard<std::mutex> lock(m_decoded_mutex);
+            decoded.swap(m_decoded);
+        }
+        for (const DecodedTile& tile : decoded) {
+            m_decoding.erase(tile.page);
+            m_stats.n_decodes_finished++;
+            u32 slot = no_virtual_page;
+            if (!m_free_slots.empty()) {
+                slot = m_free_slots.back();
+                m_free_slots.pop_back();
+            }
+            else if (m_least_recent != no_virtual_page && m_slots[m_least_recent].last_used_frame < m_frame) {
+                slot = m_least_recent;
+                const u32 evicted = m_slots[slot].page;
+                const u32 level = get_virtual_page_level(evicted);
+                m_levels[level].slots[static_cast<size_t>(get_virtual_page_y(evicted)) * m_levels[level].n_pages_x + get_virtual_page_x(evicted)] = no_virtual_page;
+                update_page_table(level, get_virtual_page_x(evicted), get_virtual_page_y(evicted));
+                m_stats.n_evictions++;
+            }
+            if (slot == no_virtual_page) {
+                m_stats.n_dropped++;
+            }
+            else {
+                place_tile(slot, tile.page, tile.data);
+            }
+            dynamic_free(tile.data);
+        }
+
+        //Coarse levels first, so missing pages get a closer parent soon, then the pages most pixels wanted. The feedback
+        //came before the tiles above, so some of the requests just became resident
+        std::vector<std::pair<u32, u32>> requests;
+        for (const auto& [page, n_samples] : m_requests) {
+            if (m_decoding.find(page) == m_decoding.end() && !is_resident(get_virtual_page_level(page), get_virtual_page_x(page), get_virtual_page_y(page))) {
+                requests.push_back({ page, n_samples });
+            }
+        }
+        std::sort(requests.begin(), requests.end(), [](const std::pair<u32, u32>& a, const std::pair<u32, u32>& b) {
+            const u32 level_a = get_virtual_page_level(a.first);
+            const u32 level_b = get_virtual_page_level(b.first);
+            if (level_a != level_b) return level_a > level_b;
+            if (a.second != b.second) return a.second > b.second;
+            return a.first < b.first;
+        });
+        for (const auto& request : requests) {
+            if (m_decoding.size() >= m_settings.max_decodes_in_flight) {
+                break;
+            }
+            start_decode(request.first);
+        }
+
+        m_stats.n_requested = static_cast<u32>(m_requests.size());
+        m_stats.n_decodes_in_flight = static_cast<u32>(m_decoding.size());
+        m_stats.n_resident = static_cast<u32>(m_slots.size() - m_free_slots.size());
+        m_requests.clear();
+        m_frame_stats = m_stats;
+        m_stats.reset();
+        m_frame++;
+    }
+
+    void VirtualTexture::wait_for_decodes()
+    {
+        JobSystem::get_instance()->wait(m_decodes);
+    }
+
+    void VirtualTexture::take_dirty(std::vector<u32>& slots_out, std::vector<u32>& levels_out)
+    {
+        std::sort(m_dirty_slots.begin(), m_dirty_slots.end());
+        m_dirty_slots.erase(std::unique(m_dirty_slots.begin(), m_dirty_slots.end()), m_dirty_slots.end());
+        slots_out.swap(m_dirty_slots);
+        m_dirty_slots.clear();
+        levels_out.clear();
+        for (u32 level = 0; level < m_n_levels; ++level) {
+            if (m_levels[level].dirty) {
+                levels_out.push_back(level);
+                m_levels[level].dirty = false;
+            }
+        }
+    }
+
+    void VirtualTexture::touch(u32 slot)
+    {
+        //The root is never replaced, so it stays out of the list
+        if (get_virtual_page_level(m_slots[slot].page) == m_n_levels - 1) {
+            return;
+        }
+        m_slots[slot].last_used_frame = m_frame;
+        if (m_most_recent == slot) {
+            return;
+        }
+        unlink(slot);
+        m_slots[slot].next = m_most_recent;
+        if (m_most_recent != no_virtual_page) {
+            m_slots[m_most_recent].previous = slot;
+        }
+        m_most_recent = slot;
+        if (m_least_recent == no_virtual_page) {
+            m_least_recent = slot;
+        }
+    }
+
+    void VirtualTexture::unlink(u32 slot)
+    {
+        CacheSlot& cache_slot = m_slots[slot];
+        if (cache_slot.previous != no_virtual_page) {
+            m_slots[cache_slot.previous].next = cache_slot.next;
+        }
+        else if (m_most_recent == slot) {
+            m_most_recent = cache_slot.next;
+        }
+        if (cache_slot.next != no_virtual_page) {
+            m_slots[cache_slot.next].previous = cache_slot.previous;
+        }
+        else if (m_least_recent == slot) {
+            m_least_recent = cache_slot.previous;
+        }
+        cache_slot.previous = no_virtual_page;
+        cache_slot.next = no_virtual_page;
+    }
+
+    void VirtualTexture::place_tile(u32 slot, u32 page, const u8* data)
+    {
+        //Row by row into its place in the cache texture
+        const size_t cache_pitch = get_cache_row_pitch();
+        u8* target = m_cache + static_cast<size_t>(slot / m_settings.cache_tiles_x) * m_tile_rows * cache_pitch + static_cast<size_t>(slot % m_settings.cache_tiles_x) * m_tile_row_bytes;
+        for (u32 row = 0; row < m_tile_rows; ++row) {
+            memcpy(target + row * cache_pitch, data + static_cast<size_t>(row) * m_tile_row_bytes, m_tile_row_bytes);
+        }
+        m_dirty_slots.push_back(slot);
+
+        const u32 level = get_virtual_page_level(page);
+        const u32 x = get_virtual_page_x(page);
+        const u32 y = get_virtual_page_y(page);
+        m_slots[slot].page = page;
+        m_levels[level].slots[static_cast<size_t>(y) * m_levels[level].n_pages_x + x] = slot;
+        touch(slot);
+        update_page_table(level, x, y);
+    }
+
+    void VirtualTexture::update_page_table(u32 level, u32 x, u32 y)
+    {
+        //Only the page and the pages under it in finer levels can change. Going from coarse to fine, every page either
+        //has its own tile, or takes its parent's entry. When a level's size is odd, the last pages of the finer level
+        //fall back to the last page of this one
+        const bool last_x = x + 1 == m_levels[level].n_pages_x;
+        const bool last_y = y + 1 == m_levels[level].n_pages_y;
+        for (u32 finer = level + 1; finer-- > 0;) {
+            VirtualLevel& virtual_level = m_levels[finer];
+            const u32 shift = level - finer;
+            const u32 x_end = last_x ? virtual_level.n_pages_x : std::min((x + 1) << shift, virtual_level.n_pages_x);
+            const u32 y_end = last_y ? virtual_level.n_pages_y : std::min((y + 1) << shift, virtual_level.n_pages_y);
+            for (u32 page_y = y << shift; page_y < y_end; ++page_y) {
+                for (u32 page_x = x << shift; page_x < x_end; ++page_x) {
+                    const size_t index = static_cast<size_t>(page_y) * virtual_level.n_pages_x + page_x;
+                    const u32 slot = virtual_level.slots[index];
+                    if (slot != no_virtual_page) {
+                        virtual_level.page_table[index] = (slot % m_settings.cache_tiles_x) | ((slot / m_settings.cache_tiles_x) << 8) | (finer << 16) | (0xFFu << 24);
+                    }
+                    else if (finer + 1 < m_n_levels) {
+                        const VirtualLevel& parent = m_levels[finer + 1];
+                        virtual_level.page_table[index] = parent.page_table[static_cast<size_t>(std::min(page_y >> 1, parent.n_pages_y - 1)) * parent.n_pages_x + std::min(page_x >> 1, parent.n_pages_x - 1)];
+                    }
+                }
+            }
+            virtual_level.dirty = true;
+        }
+    }
+
+    void VirtualTexture::start_decode(u32 page)
+    {
+        m_decoding[page] = true;
+        m_stats.n_decodes_started++;
+        const size_t tile_bytes = get_tile_bytes();
+        JobSystem::get_instance()->submit([this, page, tile_bytes]() {
+            ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "VirtualTexture - tile";
+            u8* data = static_cast<u8*>(dynamic_allocate(tile_bytes));
+            m_loader(get_virtual_page_level(page), get_virtual_page_x(page), get_virtual_page_y(page), data);
+            std::lock_guard<std::mutex> lock(m_decoded_mutex);
+            m_decoded.push_back({ page, data });
+        }, m_decodes);
+    }
+}
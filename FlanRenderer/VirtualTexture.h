@@ -0,0 +1,184 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "JobSystem.h"
+#include "TextureResource.h"
+
+// Virtual texturing. A texture too big to keep resident is split into tiles, one grid of them per mip level, down to
+// the level that fits in a single tile. Only the tiles something looks at are kept, in a tile cache of a fixed size:
+// one physical texture holding a grid of tiles, so the memory use doesn't depend on the size of the texture.
+//
+// Every tile has a border of texels copied from its neighbours, so filtering near its edge samples the right texels.
+// Tiles are tile_size + 2 * border texels wide in the cache, and block compressed textures need both to be multiples
+// of 4, since tiles are copied in whole blocks.
+//
+// The page table has an entry per tile of every level, pointing at where the tile is in the cache. Tiles that aren't
+// resident point at their closest resident parent instead, so sampling always finds something, only blurrier. The
+// tile of the coarsest level covers the whole texture, and stays resident.
+//
+// What's visible comes from a feedback buffer: a pass that renders the page each pixel samples, at low resolution.
+// Reading it marks the resident tiles as used, and requests the missing ones, along with their missing parents. Tiles
+// are decoded on the job system, coarse levels first, and take the place of the least recently used tile when the
+// cache is full.
+
+namespace Flan {
+    static constexpr u32 no_virtual_page = ~0u;
+    static constexpr u32 max_virtual_page_count = 4096; // Pages per side of level 0, 12 bits in a page id
+
+    // A page as the feedback pass writes it. Levels go up to 255
+    inline u32 pack_virtual_page(u32 level, u32 x, u32 y) { return x | (y << 12) | (level << 24); }
+    inline u32 get_virtual_page_x(u32 page) { return page & 0xFFF; }
+    inline u32 get_virtual_page_y(u32 page) { return (page >> 12) & 0xFFF; }
+    inline u32 get_virtual_page_level(u32 page) { return page >> 24; }
+
+    // Writes the tile at (tile_x, tile_y) of a level, with its border, as rows of get_tile_row_bytes bytes. Runs on the
+    // job system, several at once
+    using VirtualTileLoader = std::function<void(u32 level, u32 tile_x, u32 tile_y, u8* tile_out)>;
+
+    struct VirtualTextureSettings {
+        // Texels per side of a tile, without the border
+        u32 tile_size = 128;
+
+        // Texels copied from the neighbouring tiles on each side. 4 covers trilinear and some anisotropic filtering
+        u32 border = 4;
+
+        // Tiles per side of the cache. Entries of the page table have 8 bits per coordinate, so 256 at most
+        u32 cache_tiles_x = 32;
+        u32 cache_tiles_y = 32;
+
+        // Tiles being decoded at once
+        u32 max_decodes_in_flight = 16;
+    };
+
+    // Counts for the feedback and the update of one frame
+    struct VirtualTextureStats {
+        u64 n_samples = 0; // Feedback entries that sampled the texture
+        u64 n_hits = 0; // Of those, the ones whose tile was resident
+        u32 n_pages = 0; // Different pages in the feedback
+        u32 n_page_hits = 0;
+        u32 n_requested = 0; // Missing pages, including the parents they need
+        u32 n_decodes_started = 0;
+        u32 n_decodes_finished = 0;
+        u32 n_decodes_in_flight = 0;
+        u32 n_evictions = 0;
+        u32 n_dropped = 0; // Decoded tiles with nowhere to go, since every tile in the cache was used this frame
+        u32 n_resident = 0;
+        float get_hit_rate() const { return n_samples > 0 ? static_cast<float>(n_hits) / static_cast<float>(n_samples) : 1.0f; }
+        void reset() { *this = VirtualTextureStats{}; }
+    };
+
+    class VirtualTexture {
+    public:
+        VirtualTexture() {}
+        ~VirtualTexture() { release(); }
+        VirtualTexture(const VirtualTexture&) = delete;
+        VirtualTexture& operator=(const VirtualTexture&) = delete;
+
+        // Tiles come from the levels of a loaded texture, which has to outlive this. It needs its mip chain down to the
+        // level that fits in one tile
+        bool init(const TextureResource* source, const VirtualTextureSettings& settings = VirtualTextureSettings{}, bool silent = false);
+
+        // Tiles come from a loader, e.g. one that decodes them from a tiled file or generates them
+        bool init(u32 width, u32 height, TextureFormat format, const VirtualTileLoader& loader, const VirtualTextureSettings& settings = VirtualTextureSettings{}, bool silent = false);
+        void release();
+
+        // Read this frame's feedback, entries from pack_virtual_page or no_virtual_page. Can be called more than once a
+        // frame, e.g. for several views
+        void add_feedback(const u32* entries, size_t n_entries);
+
+        // Put the tiles that finished decoding in the cache, and start decoding the missing pages that matter most.
+        // Ends the frame: feedback after this counts for the next one
+        void update();
+
+        // Block until every decode in flight is done. The next update picks them up
+        void wait_for_decodes();
+
+        // Layout
+        u32 get_width() const { return m_width; }
+        u32 get_height() const { return m_height; }
+        TextureFormat get_format() const { return m_format; }
+        u32 get_level_count() const { return m_n_levels; }
+        u32 get_page_count_x(u32 level) const { return m_levels[level].n_pages_x; }
+        u32 get_page_count_y(u32 level) const { return m_levels[level].n_pages_y; }
+        u32 get_tile_texels() const { return m_settings.tile_size + 2 * m_settings.border; } // Per side, with the border
+        u32 get_tile_row_bytes() const { return m_tile_row_bytes; }
+        u32 get_tile_row_count() const { return m_tile_rows; }
+        size_t get_tile_bytes() const { return static_cast<size_t>(m_tile_row_bytes) * m_tile_rows; }
+
+        // The cache, as one texture of cache_tiles_x by cache_tiles_y tiles in the texture's format
+        const u8* get_cache_data() const { return m_cache; }
+        u32 get_cache_row_pitch() const { return m_tile_row_bytes * m_settings.cache_tiles_x; }
+        bool is_resident(u32 level, u32 x, u32 y) const { return m_levels[level].slots[static_cast<size_t>(y) * m_levels[level].n_pages_x + x] != no_virtual_page; }
+
+        // Page table of a level, one entry per page: RGBA8 with the cache tile's x and y, the level it's from, and 255.
+        // The shader finds the texel in the tile from the level of the tile, not of the page
+        const u32* get_page_table(u32 level) const { return m_levels[level].page_table.data(); }
+
+        // Cache tiles and page table levels written since the last call, to upload
+        void take_dirty(std::vector<u32>& slots_out, std::vector<u32>& levels_out);
+
+        // Of the last frame, from its feedback and the update that ended it
+        const VirtualTextureStats& get_stats() const { return m_frame_stats; }
+
+    private:
+        struct VirtualLevel {
+            u32 n_pages_x;
+            u32 n_pages_y;
+            std::vector<u32> slots; // Cache slot of each page, or no_virtual_page
+            std::vector<u32> page_table;
+            bool dirty;
+        };
+
+        // One tile of the cache. The ones in use form a list from the most to the least recently used
+        struct CacheSlot {
+            u32 page;
+            u64 last_used_frame;
+            u32 previous;
+            u32 next;
+        };
+
+        struct DecodedTile {
+            u32 page;
+            u8* data;
+        };
+
+        bool init_layout(u32 width, u32 height, TextureFormat format, const VirtualTextureSettings& settings, bool silent);
+        void touch(u32 slot);
+        void unlink(u32 slot);
+        void place_tile(u32 slot, u32 page, const u8* data);
+        void update_page_table(u32 level, u32 x, u32 y);
+        void start_decode(u32 page);
+
+        VirtualTextureSettings m_settings;
+        u32 m_width = 0;
+        u32 m_height = 0;
+        TextureFormat m_format = TextureFormat::RGBA8;
+        u32 m_n_levels = 0;
+        u32 m_tile_row_bytes = 0;
+        u32 m_tile_rows = 0;
+        std::vector<VirtualLevel> m_levels;
+        VirtualTileLoader m_loader;
+        u64 m_frame = 0;
+        VirtualTextureStats m_stats; // Of the frame so far
+        VirtualTextureStats m_frame_stats;
+        std::vector<u32> m_feedback; // Sorted copy of the feedback being read
+
+        u8* m_cache = nullptr;
+        std::vector<CacheSlot> m_slots;
+        std::vector<u32> m_free_slots;
+        u32 m_most_recent = no_virtual_page;
+        u32 m_least_recent = no_virtual_page;
+        std::vector<u32> m_dirty_slots;
+
+        // Missing pages from this frame's feedback, with how many samples wanted them
+        std::unordered_map<u32, u32> m_requests;
+
+        // Decodes run on the job system and hand their tile back here
+        JobCounter m_decodes;
+        std::mutex m_decoded_mutex;
+        std::vector<DecodedTile> m_decoded;
+        std::unordered_map<u32, bool> m_decoding;
+    };
+}